@@ -0,0 +1,25 @@
+; 30M instructions of register arithmetic: 100 * 200 * 250 passes of a
+; 6-instruction loop. Timed on every engine by bench/run.sh (make bench).
+.org 0x2001
+    LOAD_IMM R0, #0
+    LOAD_IMM R1, #1
+    LOAD_IMM R4, #100
+top:
+    LOAD_IMM R7, #0
+    LOAD_IMM R6, #200
+outer:
+    LOAD_IMM R2, #250
+inner:
+    ADD R0, R1
+    ADD R3, R0
+    MLP R5, R1
+    ADD R3, R5
+    SUB R2, R1
+    JNZ inner
+    ADD R7, R1
+    CMP R7, R6
+    JNZ outer
+    SUB R4, R1
+    JNZ top
+    STORE R0, 0x2000
+    HALT
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "log.h"
+#include "mmu.h"
+#include "ram.h"
+
+/*
+ * Cost of one ram_read on flat Ram and through the MMU's TLB:
+ *   flat        16 pages (4 KB) from 0x2000, stride 7
+ *   mmu 16      the same addresses: they fit the 16-entry TLB
+ *   mmu 64 KB   the whole address space, stride 7: a miss per page
+ * Build with optimisation (see make bench).
+ *
+ * usage: ram_bench [accesses]    (default 200000000)
+ */
+
+// Keeps the reads from being optimised away
+static volatile uint32_t sink;
+
+static long long time_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void run(const char *name, Ram *ram, const Mmu *mmu, uint32_t accesses, uint16_t mask)
+{
+    uint64_t misses = mmu ? mmu->tlb_misses : 0;
+    uint32_t sum = 0;
+    uint16_t a = 0x2000;
+    uint8_t value;
+
+    long long start = time_now_ns();
+    for (uint32_t i = 0; i < accesses; i++)
+    {
+        ram_read(ram, a, &value, true);
+        sum += value;
+        a = mask ? (uint16_t)(0x2000 + ((a + 7) & mask)) : (uint16_t)(a + 7);
+    }
+    long long ns = time_now_ns() - start;
+    sink = sum;
+
+    printf("%-10s %6.2f ns/access", name, (double)ns / accesses);
+    if (mmu)
+        printf("   %llu TLB misses (%.1f%%)", (unsigned long long)(mmu->tlb_misses - misses),
+               (mmu->tlb_misses - misses) * 100.0 / accesses);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t accesses = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 200000000u;
+    static Ram ram;
+    static Mmu mmu;
+
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+
+    if (accesses == 0 || !ram_init(&ram) || !mmu_init(&mmu, 4096))
+        return 1;
+
+    run("flat", &ram, NULL, accesses, 0x0FFF);
+
+    ram.mmu = &mmu;
+    run("mmu 16", &ram, &mmu, accesses, 0x0FFF);
+    run("mmu 64 KB", &ram, &mmu, accesses, 0);
+
+    ram.mmu = NULL;
+    mmu_free(&mmu);
+    ram_free(&ram);
+    return 0;
+}
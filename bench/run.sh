@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Time bench/alu_loop.asm (30M instructions) on each engine: best of
+# three wall-clock runs, process start included. The native build and a
+# cpu-emulator built with generic ALU handlers (make bench) are timed too
+# when given.
+#
+# usage: bench/run.sh [cpu-emulator] [alu_loop.native] [cpu-emulator-generic]
+
+EMU=${1:-./cpu-emulator}
+NATIVE=$2
+GENERIC=$3
+DIR=$(cd "$(dirname "$0")" && pwd)
+
+# Runs write out.bin into the working directory
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+EMU=$(cd "$(dirname "$EMU")" && pwd)/$(basename "$EMU")
+[ -n "$NATIVE" ] && NATIVE=$(cd "$(dirname "$NATIVE")" && pwd)/$(basename "$NATIVE")
+[ -n "$GENERIC" ] && GENERIC=$(cd "$(dirname "$GENERIC")" && pwd)/$(basename "$GENERIC")
+cd "$WORK" || exit 1
+
+best()
+{
+    label=$1
+    shift
+    min=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$@" > /dev/null 2>&1 || { echo "$label: failed"; return 1; }
+        ms=$(( ($(date +%s%N) - start) / 1000000 ))
+        [ -z "$min" ] || [ "$ms" -lt "$min" ] && min=$ms
+    done
+    printf '%-22s %6d ms\n' "$label" "$min"
+}
+
+best "interpreter" "$EMU" -q --no-cache "$DIR/alu_loop.asm"
+best "--fast" "$EMU" -q --no-cache --fast "$DIR/alu_loop.asm"
+best "--fast --no-memo" "$EMU" -q --no-cache --fast --no-memo "$DIR/alu_loop.asm"
+[ -n "$GENERIC" ] && best "--fast, generic ALU" "$GENERIC" -q --no-cache --fast "$DIR/alu_loop.asm"
+[ -n "$NATIVE" ] && best "native (cpu-aot)" "$NATIVE" -q
+exit 0
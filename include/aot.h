@@ -0,0 +1,149 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "cpu_exec.h"
+#include "image.h"
+#include "ram.h"
+
+/*
+ * Runtime for guest images translated ahead of time to C by cpu-aot
+ * (tools/cpu_aot.c). The translator emits one labelled stretch of C per
+ * reachable instruction inside a single function, with branches to known
+ * targets as gotos and a switch on cpu->PC to enter at any instruction.
+ * Operands are decoded at translation time; privilege tests remain only for
+ * addresses that are not constant or fall in privileged memory.
+ * System instructions, faults and invalid encodings are handed to the
+ * interpreter exactly like the predecoded engine does.
+ *
+ * The translation covers the image as assembled. A store into translated
+ * code kills the instructions it touches, and from then on they run on the
+ * interpreter. aot_run keeps cpu_run's contract: same instret, batch
+ * boundaries, scheduler events and interrupts.
+ */
+
+typedef struct AotCtx AotCtx;
+
+// Run translated code from cpu->PC until the batch ends, the CPU stops or
+// control leaves live translated code; cpu->PC is exact on return
+typedef void (*AotEntry)(Cpu *cpu, Ram *ram, AotCtx *ctx);
+
+typedef struct
+{
+    uint16_t pc;
+    uint8_t size;
+} AotInsn;
+
+// What a generated file defines, as aot_program
+typedef struct
+{
+    const char *source;           // assembly file it was translated from
+    uint16_t org;                 // entry point
+    uint16_t segment_count;
+    const ImageSegment *segments;
+    const uint8_t *bytes;
+    uint32_t size;
+    const AotInsn *insns;         // translated instructions, by address
+    uint32_t insn_count;
+    AotEntry run;
+} AotProgram;
+
+struct AotCtx
+{
+    const AotProgram *program;
+    uint32_t killed;                  // translated instructions overwritten since loading
+    uint8_t live[RAM_SIZE / 8];       // instruction starts whose translation is valid
+    uint8_t code[RAM_SIZE / 8];       // bytes covered by translated instructions
+    uint8_t size[RAM_SIZE];           // length of the translated instruction starting here
+};
+
+// Result of aot_store
+#define AOT_WRITE_OK 0
+#define AOT_WRITE_FAULT 1
+#define AOT_WRITE_CODE 2    // stored, and translated code was overwritten
+
+extern const AotProgram aot_program;
+
+void aot_init(AotCtx *ctx, const AotProgram *program);
+
+// The program's bytes as an Image, for image_load
+void aot_image(const AotProgram *program, Image *image);
+
+// Same contract as cpu_run, on the translated code
+void aot_run(Cpu *cpu, Ram *ram, bool kernel, AotCtx *ctx);
+
+// Kill translated instructions covering addr; true if any was live
+bool aot_kill(AotCtx *ctx, uint16_t addr);
+
+/* ================= helpers for generated code ================= */
+
+static inline bool aot_live(const AotCtx *ctx, uint16_t pc)
+{
+    return ctx->live[pc >> 3] & (1u << (pc & 7));
+}
+
+static inline bool aot_user_blocked(const Cpu *cpu, uint16_t addr)
+{
+    return addr <= RAM_PRIVILEGED_MODE_END && !cpu->privileged;
+}
+
+// Store with the privilege test already done
+static inline int aot_store(Ram *ram, AotCtx *ctx, uint16_t addr, uint8_t value)
+{
+    if (!ram_store_fast(ram, addr, value) && !ram_write(ram, addr, value, true))
+        return AOT_WRITE_FAULT;
+
+    if ((ctx->code[addr >> 3] & (1u << (addr & 7))) && aot_kill(ctx, addr))
+        return AOT_WRITE_CODE;
+
+    return AOT_WRITE_OK;
+}
+
+// CALL/RET/HALT; false when control must go back through dispatch
+bool aot_call(Cpu *cpu, Ram *ram, AotCtx *ctx, uint16_t pc, uint16_t next, uint16_t target);
+void aot_ret(Cpu *cpu, Ram *ram, uint16_t pc);
+void aot_halt(Cpu *cpu, uint16_t next);
+
+// Start of the instruction at pc: leave at the batch boundary or if it was
+// overwritten, else count it like cpu_step does
+#define AOT_BEGIN(pc, cost) \
+    if (cpu->instret >= cpu->batch_end || (ctx->killed && !aot_live(ctx, (pc)))) \
+    { \
+        cpu->PC = (pc); \
+        return; \
+    } \
+    cpu->instret++; \
+    cpu->cycles += (cost);
+
+// Run the instruction at pc on the interpreter and continue wherever it leaves PC
+#define AOT_INTERP(pc) \
+    do \
+    { \
+        cpu->PC = (pc); \
+        cpu_execute(cpu, ram); \
+        goto dispatch; \
+    } while (0)
+
+// Leave translated code at pc
+#define AOT_EXIT(pc) \
+    do \
+    { \
+        cpu->PC = (pc); \
+        return; \
+    } while (0)
+
+// Store a byte for the instruction at pc; a fault is reported by the interpreter
+#define AOT_STORE(pc, next, addr, value) \
+    do \
+    { \
+        int w_ = aot_store(ram, ctx, (addr), (value)); \
+        if (w_ == AOT_WRITE_FAULT) \
+            AOT_INTERP(pc); \
+        if (w_ == AOT_WRITE_CODE) \
+            AOT_EXIT(next); \
+    } while (0)
+
+#endif
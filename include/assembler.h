@@ -2,10 +2,61 @@
 #define ASSEMBLER_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
+#include "image.h"
+#include "isa.h"
+
+/* Bump whenever the encoding of any instruction changes; keys the image cache */
+#define ASSEMBLER_VERSION "5"
+
 /* ---------- public API ---------- */
 
+/* What one source line assembled to */
+typedef struct
+{
+    uint16_t addr;     // address of its instruction
+    uint8_t size;      // bytes emitted, 0 for blank lines, comments, labels and .org
+    bool layout;       // defines a label or sets the origin
+} AsmLine;
+
+/**
+ * Assemble a program from the given input file into image, recording one
+ * segment per .org. Returns the number of bytes assembled.
+ */
+int assemble_image(FILE *input, Image *image);
+
+/**
+ * Like assemble_image, but an error in the source returns -1 with the
+ * message in error instead of exiting. The assembler keeps global state:
+ * callers on several threads must serialize.
+ */
+int assemble_source(FILE *input, Image *image, char *error, size_t error_size);
+
+/**
+ * Line map of the last successful assembly, indexed by line number - 1;
+ * NULL with *count 0 if there is none.
+ */
+const AsmLine *assembler_lines(size_t *count);
+
+/**
+ * Closest label at or before addr in the last successful assembly, with
+ * its address in *label_addr; NULL if there is none.
+ */
+const char *assembler_label_at(uint16_t addr, uint16_t *label_addr);
+
+/**
+ * Reassemble a single source line at addr against the labels of the last
+ * successful assembly, for patching code in place. Returns its size with
+ * the bytes in out, or -1 with the message in error, including for lines
+ * that define a label or set the origin: those change the layout and need
+ * a full assembly.
+ */
+int assemble_line(const char *text, int line_no, uint16_t addr, uint8_t out[ISA_MAX_SIZE],
+                  char *error, size_t error_size);
+
 /**
  * Assemble a program from the given input file into the given output file.
  * Returns the number of bytes written to output.
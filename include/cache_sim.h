@@ -0,0 +1,84 @@
+#ifndef CACHE_SIM_H
+#define CACHE_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "ram.h"
+
+/*
+ * Memory hierarchy model for estimating how guest code would perform on
+ * cached hardware (--cache-sim). Separate instruction and data caches,
+ * each set-associative with LRU replacement, write-allocate and
+ * write-back, sit in front of a memory that costs miss_penalty cycles per
+ * line fill or dirty writeback. Every instruction also costs its opcode's
+ * entry in the cycle table.
+ *
+ * The model reads the Ram access log, so it sees the interpreter's
+ * accesses (the other engines fall back to the interpreter while it is
+ * attached) and runs a whole log at a time. Instruction bytes of one
+ * instruction that share a line count as one access. Misses are charged
+ * to the instruction that made them; the report lists the worst.
+ */
+
+#define CACHE_SIM_DEFAULT_ICACHE "1024:16:2"
+#define CACHE_SIM_DEFAULT_DCACHE "1024:16:4"
+#define CACHE_SIM_DEFAULT_MISS_PENALTY 20
+#define CACHE_SIM_REPORT_TOP 10
+
+typedef struct
+{
+    uint32_t size;      // bytes
+    uint32_t line;      // bytes per line
+    uint32_t ways;
+} CacheGeometry;
+
+typedef struct
+{
+    CacheGeometry icache;
+    CacheGeometry dcache;
+    uint32_t miss_penalty;      // cycles per line fill or writeback
+    uint32_t cycles[256];       // per opcode
+} CacheSimConfig;
+
+typedef struct
+{
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t writebacks;
+} CacheStats;
+
+typedef struct
+{
+    uint64_t instructions;
+    uint64_t cycles;            // opcode costs plus memory stalls
+    CacheStats icache;
+    CacheStats dcache;
+} CacheSimStats;
+
+typedef struct CacheSim CacheSim;
+
+// Default geometries and penalty, and the cycle costs in isa_table
+void cache_sim_default_config(CacheSimConfig *config);
+
+// Parse "<size>:<line>:<ways>", all powers of two and line * ways <= size
+bool cache_sim_parse_geometry(const char *spec, CacheGeometry *g);
+
+// Override cycle costs from a file of "<MNEMONIC> <cycles>" lines (';' comments)
+bool cache_sim_load_cycles(CacheSimConfig *config, const char *path);
+
+CacheSim *cache_sim_create(const CacheSimConfig *config);
+void cache_sim_destroy(CacheSim *sim);
+
+// Start or stop feeding ram's accesses to the model
+void cache_sim_attach(CacheSim *sim, Ram *ram);
+void cache_sim_detach(CacheSim *sim, Ram *ram);
+
+void cache_sim_stats(CacheSim *sim, CacheSimStats *stats);
+
+// Hit rates, estimated cycles and the instructions with the most misses,
+// named after the closest preceding label of the last assembly
+void cache_sim_report(CacheSim *sim, FILE *out);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef CODE_SHARE_H
+#define CODE_SHARE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu_fast.h"
+#include "ram.h"
+
+/*
+ * Decoded blocks shared by every DecodeCache attached to one CodeShare,
+ * e.g. the daemon's workers, so a program is decoded once per process
+ * rather than once per machine.
+ *
+ * An entry is addressed by its content: the start address, the code bytes
+ * it was decoded from, their verification flags and whether it was decoded
+ * for memoization. A cache that misses looks for an entry at the same
+ * start whose bytes and flags match its own RAM and adopts it: a small
+ * private Block whose instructions and MemoShape point into the share.
+ * Only successor links, memo counters and validity stay private, so shared
+ * entries are never written after publication. Entries are compared
+ * byte for byte rather than by page hash, because code and data share
+ * pages here and a data store would change the hash of every page.
+ *
+ * A machine that stores into its own code drops its private Blocks as
+ * before; the next lookup at that address no longer matches and the block
+ * is decoded privately, then published as another variant (at most
+ * CODE_SHARE_MAX_VARIANTS per address).
+ *
+ * Publication is lock-free: entries come from a bump allocator over one
+ * arena and are pushed onto a per-address list with a compare-and-swap
+ * that releases their contents. Readers never wait. Entries live until the
+ * share is destroyed; once the arena is full nothing more is published.
+ */
+
+#define CODE_SHARE_DEFAULT_SIZE (16u << 20)
+#define CODE_SHARE_MAX_VARIANTS 8
+
+typedef struct SharedBlock
+{
+    struct SharedBlock *next;   // older entry with the same start
+    uint16_t start;
+    uint16_t end;               // last code byte (inclusive)
+    uint16_t count;
+    bool memo_enabled;          // decoded with memoization on
+    bool kernel_only;
+    uint32_t cycles;
+    const MemoShape *memo;      // NULL if not memoizable
+    const uint8_t *bytes;       // code bytes start..end, then their verification flags
+    DecodedInsn insns[];
+} SharedBlock;
+
+typedef struct
+{
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t blocks;            // published
+    size_t bytes;               // arena used
+} CodeShareStats;
+
+typedef struct CodeShare CodeShare;
+
+CodeShare *code_share_create(size_t size);
+
+// Every attached DecodeCache must be destroyed or detached first
+void code_share_destroy(CodeShare *cs);
+
+// Entry decoded from ram's bytes at start with these verification flags, or NULL
+const SharedBlock *code_share_find(CodeShare *cs, const Ram *ram, const uint8_t *verify,
+                                   uint16_t start, bool memo_enabled);
+
+// Publish a block decoded privately from ram; false if the share is full
+// or start already has CODE_SHARE_MAX_VARIANTS entries
+bool code_share_publish(CodeShare *cs, const Ram *ram, const uint8_t *verify, const Block *b,
+                        bool memo_enabled);
+
+void code_share_stats(const CodeShare *cs, CodeShareStats *stats);
+
+#endif
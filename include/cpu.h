@@ -6,15 +6,110 @@
 
 #define REG_COUNT 8
 
+// Register pairs Pn = R(2n):R(2n+1), high byte first
+#define PAIR_COUNT (REG_COUNT / 2)
+
+// Interrupt entry reads the handler address (hi, lo) from privileged memory
+#define CPU_IRQ_VECTOR 0x0000
+#define CPU_IRQ_TIMER 0x01
+
+// Guest counters, as indexed in Cpu.counter_latch
+#define CPU_COUNTER_INSTRET 0
+#define CPU_COUNTER_CYCLES 1
+
+// ALU operation whose operands the lazy flags were recorded from
+typedef enum {
+    FLAGS_NONE = 0,
+    FLAGS_ADD,
+    FLAGS_SUB,     // also CMP
+    FLAGS_MLP,
+    FLAGS_DIV,
+    FLAGS_ADD16,
+    FLAGS_SUB16
+} FlagsOp;
+
+// Lazily evaluated condition flags: ALU ops record their inputs only
+typedef struct {
+    uint8_t op;    // FlagsOp
+    uint16_t a;    // destination value before the operation
+    uint16_t b;    // source value
+} CpuFlags;
+
+struct Scheduler;
+struct Timer;
+
+// Why the CPU stopped when it was not HALT (Cpu.fault)
+typedef enum {
+    CPU_FAULT_NONE,
+    CPU_FAULT_MEMORY,       // access denied: privileged memory in user mode, or the MMU
+    CPU_FAULT_PRIVILEGED,   // privileged instruction in user mode
+    CPU_FAULT_INVALID,      // undefined opcode, register or pair
+    CPU_FAULT_DIV_ZERO,
+    CPU_FAULT_DEVICE,       // MAP/TIMER without the device, or a bad mapping
+} CpuFault;
+
 typedef struct {
     uint16_t PC;
+    uint16_t SP;            // grows down; CALL pushes the return address big-endian
     uint8_t R[REG_COUNT];   // R0..R7
     bool running;
     bool privileged;
+    uint8_t fault;             // CpuFault, set when a fault stops the CPU
+    CpuFlags flags;
+
+    uint64_t instret;          // retired instructions
+    uint64_t batch_end;        // cpu_run re-checks events when instret reaches this
+    uint64_t cycles;           // modelled cycles, isa_table costs of the retired instructions
+
+    // Guest counters (RDINS, RDCYC) count from these; CLRCNT moves them up
+    uint64_t counter_instret_base;
+    uint64_t counter_cycles_base;
+    uint64_t counter_latch[2];  // CPU_COUNTER_*, taken when word 0 is read
+
+    // Interrupts
+    uint8_t irq_pending;       // CPU_IRQ_* bits
+    bool irq_enabled;
+    bool in_irq;
+    bool irq_saved_privileged;
+    uint16_t irq_saved_PC;
+    CpuFlags irq_saved_flags;
+
+    // Optional devices, NULL when not attached
+    struct Scheduler *sched;
+    struct Timer *timer;
 } Cpu;
 
 
 void cpu_init (Cpu *cpu, bool privileged);
 void cpu_print (Cpu *cpu);
 
+static inline void cpu_record_flags(Cpu *cpu, FlagsOp op, uint16_t a, uint16_t b)
+{
+    cpu->flags.op = op;
+    cpu->flags.a = a;
+    cpu->flags.b = b;
+}
+
+// Stop on a fault; the caller has logged it
+static inline void cpu_fault(Cpu *cpu, CpuFault fault)
+{
+    cpu->fault = fault;
+    cpu->running = false;
+}
+
+static inline uint16_t cpu_pair(const Cpu *cpu, uint8_t pair)
+{
+    return (cpu->R[pair * 2] << 8) | cpu->R[pair * 2 + 1];
+}
+
+static inline void cpu_set_pair(Cpu *cpu, uint8_t pair, uint16_t value)
+{
+    cpu->R[pair * 2] = value >> 8;
+    cpu->R[pair * 2 + 1] = value & 0xFF;
+}
+
+// Materialize the lazy flags
+bool cpu_flag_zero (const Cpu *cpu);
+bool cpu_flag_carry (const Cpu *cpu);
+
 #endif
@@ -6,4 +6,20 @@
 
 void cpu_run(Cpu *cpu, Ram *ram, bool kernel);
 
+// Fetch and execute a single instruction at cpu->PC, counting it in
+// cpu->instret and cpu->cycles
+void cpu_step(Cpu *cpu, Ram *ram);
+
+// cpu_step without counting the instruction
+void cpu_execute(Cpu *cpu, Ram *ram);
+
+// Enter the interrupt handler if an interrupt is pending and deliverable
+void cpu_check_interrupts(Cpu *cpu, Ram *ram);
+
+// Fire due scheduler events, then deliver any pending interrupt
+void cpu_service_events(Cpu *cpu, Ram *ram);
+
+// The cpu_run loop without the mode switch and logging
+void cpu_run_until_halt(Cpu *cpu, Ram *ram);
+
 #endif
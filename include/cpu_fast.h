@@ -0,0 +1,147 @@
+#ifndef CPU_FAST_H
+#define CPU_FAST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "ram.h"
+#include "verify.h"
+
+/*
+ * Predecoded execution engine. Straight-line code is decoded once into
+ * blocks of DecodedInsn, each carrying a handler specialised for its
+ * opcode (and, for ALU ops, its register pair). Blocks that end in a
+ * control transfer remember their successors, so hot loops jump from block
+ * to block without a cache lookup.
+ *
+ * The engine reads code bytes straight from Ram and does not log per
+ * instruction. Stores into decoded code invalidate the affected blocks;
+ * anything else that changes code bytes behind the engine's back (image
+ * loading, host patches) must call dcache_invalidate_range or dcache_flush.
+ * With an MMU or a debugger attached, cpu_run_fast uses the interpreter.
+ *
+ * Instructions that passed the load-time verifier (verify.h) are decoded
+ * with unchecked handlers: constant-address loads and stores skip the
+ * privilege check, and DIV skips the zero test when the divisor is known.
+ *
+ * Blocks that are pure functions of a few registers, flags and constant
+ * addresses (no indirect access, CALL/RET or system instructions) carry a
+ * MemoShape: the exact read and write sets, found at decode time. Once such
+ * a block is hot, its results are cached in a bounded table keyed by the
+ * block and its input values, and a hit applies the recorded registers,
+ * flags, stores and next PC instead of running the block. A block whose
+ * hit rate stays low stops memoizing. Entries die with their block, so
+ * code changes need nothing extra.
+ *
+ * Caches attached to a CodeShare (code_share.h) adopt blocks other caches
+ * already decoded from the same bytes instead of decoding them again.
+ *
+ * Each block carries the sum of its isa_table cycle costs, so Cpu.cycles
+ * costs one add per block; only a block left early is costed instruction
+ * by instruction, from its code bytes.
+ */
+
+#define DCACHE_MAX_BLOCK_INSNS 64
+#define DCACHE_COVERAGE_SIZE (1u << 14)   // bytes in a coverage map
+
+#define MEMO_TABLE_SIZE 4096     // cached block results, direct mapped
+#define MEMO_MIN_INSNS 4         // shorter blocks are cheaper to run than to look up
+#define MEMO_MAX_LOADS 8         // distinct input addresses
+#define MEMO_MAX_STORES 8        // distinct output addresses
+#define MEMO_KEY_MAX (1 + REG_COUNT + MEMO_MAX_LOADS)
+#define MEMO_HOT 16              // runs before a block starts memoizing
+#define MEMO_TRIAL 1024          // lookups per hit-rate check
+
+typedef struct DecodeCache DecodeCache;
+struct CodeShare;
+typedef struct DecodedInsn DecodedInsn;
+typedef struct FastCtx FastCtx;
+
+// Returns false to leave the block; the handler has then set cpu->PC
+typedef bool (*FastHandler)(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx);
+
+struct DecodedInsn
+{
+    FastHandler fn;
+    uint16_t pc;      // address of this instruction
+    uint16_t next;    // address of the following instruction
+    uint16_t addr;    // memory operand or branch target
+    uint8_t a;        // first register / immediate operand
+    uint8_t b;        // second register / immediate operand
+};
+
+// Read and write sets of a memoizable block
+typedef struct MemoShape
+{
+    uint8_t in_regs;                    // registers read before the block writes them
+    uint8_t out_regs;                   // registers written
+    bool in_flags;                      // the closing branch reads flags the block did not set
+    bool out_flags;
+    uint8_t load_count;
+    uint8_t store_count;
+    uint8_t key_size;
+    uint16_t loads[MEMO_MAX_LOADS];     // addresses read before the block writes them
+    uint16_t stores[MEMO_MAX_STORES];
+} MemoShape;
+
+typedef struct Block
+{
+    uint32_t size;             // bytes occupied in the arena
+    uint16_t start;            // first code byte
+    uint16_t end;              // last code byte (inclusive)
+    uint16_t count;
+    bool valid;
+    bool kernel_only;          // code in privileged memory or handlers verified for kernel mode
+    uint32_t cycles;           // modelled cost of the whole block
+    struct Block *succ[2];     // chained successors
+    uint16_t succ_pc[2];
+
+    const MemoShape *memo;     // NULL if not memoizable, or memoizing did not pay
+    uint32_t serial;           // tags this block's memo entries
+    uint16_t memo_runs;        // until MEMO_HOT
+    uint16_t memo_lookups;     // in the current trial
+    uint16_t memo_hits;
+    const DecodedInsn *insns;  // right after the Block, or in a CodeShare
+} Block;
+
+struct FastCtx
+{
+    Ram *ram;
+    DecodeCache *dc;
+};
+
+DecodeCache *dcache_create(void);
+void dcache_destroy(DecodeCache *dc);
+void dcache_flush(DecodeCache *dc);
+
+// Drop every block with a code byte in [start, end] and any verification of
+// those bytes; returns how many blocks were dropped
+uint32_t dcache_invalidate_range(DecodeCache *dc, uint16_t start, uint16_t end);
+
+// Use v for instructions decoded from now on; flushes the cache
+void dcache_attach_verification(DecodeCache *dc, const Verification *v);
+
+// Changes whenever blocks are invalidated or flushed
+uint64_t dcache_generation(const DecodeCache *dc);
+
+// True if addr is covered by a live block or by verification: a host store
+// there must be followed by dcache_invalidate_range
+bool dcache_is_code(const DecodeCache *dc, uint16_t addr);
+
+// Count block-to-block edges into map (DCACHE_COVERAGE_SIZE hit counters)
+// from now on, starting a new trace; NULL turns coverage off. Off, it costs
+// one test per block entered.
+void dcache_set_coverage(DecodeCache *dc, uint8_t *map);
+
+// Turn block memoization on or off (on by default)
+void dcache_set_memo(DecodeCache *dc, bool enabled);
+
+// Look blocks up in cs before decoding them and publish the ones decoded
+// here; NULL detaches. Flushes the cache
+void dcache_attach_share(DecodeCache *dc, struct CodeShare *cs);
+
+// Same contract as cpu_run, on the predecoded engine
+void cpu_run_fast(Cpu *cpu, Ram *ram, bool kernel, DecodeCache *dc);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+#include "image_cache.h"
+#include "sweep.h"
+
+/*
+ * Wire protocol of cpu-emulatord (tools/cpu_emulatord.c), a long-running
+ * emulator serving run requests on a Unix stream socket. A client sends any
+ * number of requests on one connection; each gets exactly one response, in
+ * order. All fields are in host byte order: the socket never leaves the
+ * machine.
+ *
+ * Request: a DaemonRequest followed by
+ *   source_len bytes of assembly source    (DAEMON_RUN_SOURCE only)
+ *   select_len bytes of output selection   (same syntax as --select)
+ *   patch_count RAM patches of 3 bytes     (big-endian address, byte)
+ *
+ * Response: a DaemonResponse followed by length bytes: the selected
+ * outputs for DAEMON_OK and DAEMON_TIMEOUT, otherwise an error message.
+ *
+ * Each run starts from the image's loaded state with R0..R7 from the
+ * request and the patches applied, like one record of a sweep. The response
+ * carries the image key; later requests can send DAEMON_RUN_IMAGE with that
+ * key instead of the source.
+ */
+
+#define DAEMON_REQUEST_MAGIC "C8RQ"
+#define DAEMON_RESPONSE_MAGIC "C8RS"
+#define DAEMON_VERSION 1
+#define DAEMON_DEFAULT_SOCKET "/tmp/cpu-emulatord.sock"
+
+#define DAEMON_MAX_SOURCE (1u << 20)
+#define DAEMON_MAX_SELECT 512
+#define DAEMON_MAX_PATCHES 4096
+
+// DaemonRequest.kind
+#define DAEMON_RUN_SOURCE 0   // assemble (or find) the source that follows
+#define DAEMON_RUN_IMAGE 1    // run the image with this key
+
+// DaemonResponse.status
+#define DAEMON_OK 0
+#define DAEMON_TIMEOUT 1      // max_steps reached; outputs are the state at that point
+#define DAEMON_NO_IMAGE 2     // DAEMON_RUN_IMAGE with a key the daemon does not know
+#define DAEMON_ERROR 3        // bad request, assembly error or failed patch
+
+typedef struct
+{
+    char magic[4];                    //  0  DAEMON_REQUEST_MAGIC
+    uint16_t version;                 //  4  DAEMON_VERSION
+    uint8_t kind;                     //  6
+    uint8_t reserved;                 //  7
+    uint32_t source_len;              //  8  0 for DAEMON_RUN_IMAGE
+    uint16_t select_len;              // 12  0 selects SWEEP_DEFAULT_SELECT
+    uint16_t patch_count;             // 14
+    uint64_t max_steps;               // 16  0 means SWEEP_DEFAULT_MAX_STEPS
+    char key[IMAGE_CACHE_KEY_LEN];    // 24  DAEMON_RUN_IMAGE: image key
+    uint8_t regs[SWEEP_REG_BYTES];    // 88  R0..R7
+} DaemonRequest;                      // 96
+
+typedef struct
+{
+    char magic[4];                    //  0  DAEMON_RESPONSE_MAGIC
+    uint16_t version;                 //  4  DAEMON_VERSION
+    uint8_t status;                   //  6
+    uint8_t reserved;                 //  7
+    uint32_t length;                  //  8  bytes that follow
+    uint32_t reserved2;               // 12
+    uint64_t instret;                 // 16  instructions retired by the run
+    char key[IMAGE_CACHE_KEY_LEN];    // 24  key of the image that ran
+} DaemonResponse;                     // 88
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "cpu.h"
+#include "ram.h"
+#include "rewind.h"
+
+#define DEBUG_MAX_WATCHPOINTS 32
+
+typedef enum
+{
+    DEBUG_STOP_HALTED,       // cpu->running went false
+    DEBUG_STOP_BREAKPOINT,   // about to execute an instruction at a breakpoint
+    DEBUG_STOP_WATCHPOINT,   // an instruction touched a watched range
+    DEBUG_STOP_STEP,         // the requested number of instructions retired
+    DEBUG_STOP_START         // reverse execution reached the first checkpoint
+} DebugStop;
+
+typedef struct
+{
+    uint16_t start;
+    uint16_t end;     // inclusive
+    uint8_t access;   // RAM_WATCH_READ | RAM_WATCH_WRITE
+} Watchpoint;
+
+typedef struct
+{
+    Ram *ram;
+
+    uint8_t breakpoints[RAM_SIZE / 8];       // one bit per address
+    uint16_t break_pages[RAM_WATCH_PAGES];   // breakpoints per page (up to 256)
+    uint32_t breakpoint_count;
+
+    Watchpoint watches[DEBUG_MAX_WATCHPOINTS];
+    uint32_t watch_count;
+    uint8_t watch_pages[RAM_WATCH_PAGES];    // RAM_WATCH_* per page, installed into Ram
+
+    uint16_t current_pc;  // PC of the instruction being executed
+    uint8_t current_size; // its encoded length: reads of these bytes are
+                          // fetches and never trigger read watchpoints
+
+    // Details of the last watchpoint hit
+    bool hit;
+    uint16_t hit_pc;      // PC of the instruction that made the access
+    uint16_t hit_addr;
+    uint8_t hit_value;
+    bool hit_write;
+
+    Rewind *rewind;       // NULL unless reverse execution is on
+} Debugger;
+
+void debug_init(Debugger *dbg, Ram *ram);
+void debug_detach(Debugger *dbg);
+
+bool debug_add_breakpoint(Debugger *dbg, uint16_t addr);
+bool debug_remove_breakpoint(Debugger *dbg, uint16_t addr);
+bool debug_add_watchpoint(Debugger *dbg, uint16_t start, uint16_t end, uint8_t access);
+bool debug_remove_watchpoint(Debugger *dbg, uint16_t start);
+
+/**
+ * Run until the CPU halts, a breakpoint or watchpoint triggers, or
+ * max_steps instructions retire (0 = unlimited). With no breakpoints or
+ * watchpoints set this is the plain interpreter loop.
+ */
+DebugStop debug_run(Debugger *dbg, Cpu *cpu, Ram *ram, uint64_t max_steps);
+
+/**
+ * Record checkpoints in rw from now on, starting with the current state, so
+ * the reverse commands below can go back to any later instruction.
+ */
+bool debug_attach_rewind(Debugger *dbg, Rewind *rw, const Cpu *cpu);
+
+/**
+ * Go back n instructions, or to the first checkpoint if the recording does
+ * not reach that far (DEBUG_STOP_START).
+ */
+DebugStop debug_reverse_step(Debugger *dbg, Cpu *cpu, Ram *ram, uint64_t n);
+
+/**
+ * Go back to the latest breakpoint or watchpoint stop before the current
+ * instruction, or to the first checkpoint if there is none.
+ */
+DebugStop debug_reverse_continue(Debugger *dbg, Cpu *cpu, Ram *ram);
+
+// Interactive step/continue/inspect loop reading commands from `in`
+void debug_repl(Debugger *dbg, Cpu *cpu, Ram *ram, FILE *in);
+
+#endif
@@ -2,7 +2,41 @@
 #define DISASSEMBLER_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 
+// Longest line disasm_line can produce, including the trailing newline
+#define DISASM_MAX_LINE 48
+
+/**
+ * Decode the instruction at pc and append its text ("0xPPPP: MNEMONIC ops\n")
+ * to out, which must have room for DISASM_MAX_LINE bytes.
+ * Returns the number of characters written; *length receives the encoded size.
+ */
+size_t disasm_line(const uint8_t *memory, uint16_t pc, char *out, uint8_t *length);
+
+/**
+ * Disassemble [start_addr, end_addr] into buf. Output stops at the last
+ * whole line that fits. Returns the number of bytes written.
+ */
+size_t disassemble_to_buffer(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr,
+                             char *buf, size_t cap);
+
+/**
+ * Disassemble [start_addr, end_addr] to a stream using large buffered writes.
+ * Returns 0 on success, -1 on a write error.
+ */
+int disassemble_to_file(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr, FILE *out);
+
+/**
+ * Same output as disassemble_to_file, but the range is split across up to
+ * `threads` workers. Each worker decodes speculatively from its range start;
+ * ranges are resynchronised with the true instruction stream when spliced.
+ */
+int disassemble_parallel(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr,
+                         FILE *out, int threads);
+
+// Log every instruction in the range at LOG_INFO
 void disassemble_memory(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr);
 
 #endif
@@ -0,0 +1,71 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "ram.h"
+#include "verify.h"
+
+/*
+ * Coverage-guided fuzzing of a loaded program (--fuzz). Each execution
+ * stores an input of 1..input_max bytes at input_addr, puts its length in
+ * R0 and runs the program from its entry point for at most max_steps
+ * instructions on the predecoded engine, which counts block-to-block edges
+ * into a coverage map (dcache_set_coverage).
+ *
+ * Inputs come from mutating the corpus: bit flips, random and boundary
+ * bytes, small additions, splices from other entries and length changes.
+ * A mutant that reaches a new edge, or an edge a new number of times
+ * (bucketed 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+), joins the corpus and
+ * is saved as <dir>/queue/id-NNNNNN. A mutant that stops on a fault is a
+ * crash; the first input for each fault kind and PC is saved as
+ * <dir>/crashes/<kind>-<PC>. Timeouts are counted, not saved.
+ *
+ * Files already in <dir>/queue seed the corpus; with none, a run starts
+ * from input_max zero bytes. Like a sweep, every execution runs on a
+ * copy-on-write view of the loaded RAM that is reset in place afterwards,
+ * so an execution costs no allocation and no system call.
+ */
+
+#define FUZZ_DEFAULT_INPUT "0x3000:64"
+#define FUZZ_DEFAULT_MAX_STEPS 10000
+#define FUZZ_DEFAULT_EXECS 1000000
+#define FUZZ_MAX_INPUT 255      // the length goes in R0
+#define FUZZ_MAX_CORPUS 4096
+
+typedef struct
+{
+    const char *dir;            // queue/ and crashes/ are created under it
+    uint16_t input_addr;
+    uint16_t input_max;         // longest input, bytes
+    uint64_t max_steps;         // per execution
+    uint64_t max_execs;         // stop after this many executions (0: no limit)
+    double max_seconds;         // or after this long (0: no limit)
+    uint64_t seed;              // mutation RNG
+    bool user_mode;             // run unprivileged, so kernel memory accesses fault
+} FuzzConfig;
+
+typedef struct
+{
+    uint64_t execs;
+    uint64_t crashes;           // executions that faulted
+    uint64_t timeouts;
+    uint32_t unique_crashes;    // distinct fault kind and PC
+    uint32_t corpus;
+    uint32_t edges;             // coverage map entries ever hit
+} FuzzStats;
+
+// Parse "<addr>:<length>" into input_addr / input_max
+bool fuzz_parse_input(const char *spec, FuzzConfig *config);
+
+/*
+ * Fuzz the program loaded in (template_cpu, template_ram); v, if not NULL,
+ * is its verification. stats may be NULL. Returns false if the run could
+ * not start or a file could not be written.
+ */
+bool fuzz_run(const FuzzConfig *config, const Cpu *template_cpu, const Ram *template_ram,
+              const Verification *v, FuzzStats *stats);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ram.h"
+
+#define IMAGE_MAX_SEGMENTS 16
+
+// A contiguous run of assembled bytes placed at `addr` by an .org
+typedef struct
+{
+    uint16_t addr;
+    uint32_t length;   // up to RAM_SIZE: a segment never runs past 0xFFFF
+    uint32_t offset;   // position of the first byte in Image.bytes
+} ImageSegment;
+
+// An assembled program: its bytes and where each segment is loaded
+typedef struct
+{
+    uint16_t org;      // entry point (address of the first segment)
+    uint32_t size;     // total bytes across all segments
+    uint16_t segment_count;
+    ImageSegment segments[IMAGE_MAX_SEGMENTS];
+    uint8_t bytes[RAM_SIZE];
+} Image;
+
+void image_init(Image *image);
+bool image_load(const Image *image, Ram *ram, bool privileged);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "image.h"
+
+#define IMAGE_CACHE_KEY_LEN 64 // hex SHA-256
+#define IMAGE_CACHE_DEFAULT_DIR ".cpu-emulator-cache"
+
+/*
+ * Content-addressed cache of assembled images. Entries are keyed by the
+ * SHA-256 of ASSEMBLER_VERSION and the source bytes, so editing the source
+ * or changing the assembler never returns a stale image.
+ */
+
+void image_cache_key(const uint8_t *source, size_t len, char key[IMAGE_CACHE_KEY_LEN + 1]);
+bool image_cache_lookup(const char *dir, const char *key, Image *image);
+bool image_cache_store(const char *dir, const char *key, const Image *image);
+
+#endif
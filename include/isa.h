@@ -1,13 +1,104 @@
 #pragma once
 #include <stdint.h>
 
+/*
+ * The instruction set, defined once. Each row is
+ *
+ *   X(NAME, name, opcode, FORMAT, flags, cycles)
+ *
+ * and expands into the Opcode enum (OP_NAME), isa_table (mnemonic, format,
+ * length, flags, modelled cost in cycles), the interpreter's dispatch table
+ * (op_name in cpu_exec.c) and the assembler's mnemonic lookup. Adding an
+ * instruction means adding a row here and its op_name handler; encoders and
+ * decoders follow FORMAT.
+ */
+#define ISA_INSTRUCTIONS(X) \
+    X(LOAD_IMM,   load_imm,     1, REG_IMM,   0,                           1)   /* reg = immediate value */ \
+    X(SUB,        sub,          2, REG_REG,   0,                           1)   /* dst = dst - src */ \
+    X(ADD,        add,          3, REG_REG,   0,                           1)   /* dst = dst + src */ \
+    X(STORE,      store,        4, REG_ADDR,  0,                           1)   /* memory[addr] = reg */ \
+    X(LOAD_MEM,   load_mem,     5, REG_ADDR,  0,                           1)   /* reg = memory[addr] */ \
+    X(MLP,        mlp,          6, REG_REG,   0,                           4)   /* dst = dst * src */ \
+    X(DIV,        div,          7, REG_REG,   0,                          12)   /* dst = dst / src */ \
+    X(MAP,        map,          8, REG3,      ISA_PRIVILEGED,              1)   /* map page R[page] to frame R[hi]:R[lo] */ \
+    X(TLBFLUSH,   tlbflush,     9, NONE,      ISA_PRIVILEGED,              1)   /* invalidate every TLB entry */ \
+    X(EI,         ei,          10, NONE,      ISA_PRIVILEGED,              1)   /* enable interrupts */ \
+    X(DI,         di,          11, NONE,      ISA_PRIVILEGED,              1)   /* disable interrupts */ \
+    X(IRET,       iret,        12, NONE,      ISA_PRIVILEGED | ISA_BRANCH, 3)   /* return from interrupt handler */ \
+    X(TIMER,      timer,       13, REG_REG,   ISA_PRIVILEGED,              1)   /* timer period = R[hi]:R[lo] instructions, 0 stops */ \
+    X(CMP,        cmp,         14, REG_REG,   0,                           1)   /* set flags from a - b, registers unchanged */ \
+    X(JMP,        jmp,         15, ADDR,      ISA_BRANCH,                  2)   /* PC = addr */ \
+    X(JZ,         jz,          16, ADDR,      ISA_BRANCH,                  2)   /* if Z: PC = addr */ \
+    X(JNZ,        jnz,         17, ADDR,      ISA_BRANCH,                  2)   /* if !Z: PC = addr */ \
+    X(JC,         jc,          18, ADDR,      ISA_BRANCH,                  2)   /* if C: PC = addr */ \
+    X(CALL,       call,        19, ADDR,      ISA_BRANCH,                  3)   /* push PC, PC = addr */ \
+    X(RET,        ret,         20, NONE,      ISA_BRANCH,                  3)   /* pop PC */ \
+    X(LOAD_IMM16, load_imm16,  21, PAIR_IMM,  0,                           1)   /* pair = 16-bit immediate or label */ \
+    X(ADD16,      add16,       22, PAIR_PAIR, 0,                           1)   /* dst pair = dst pair + src pair */ \
+    X(SUB16,      sub16,       23, PAIR_PAIR, 0,                           1)   /* dst pair = dst pair - src pair */ \
+    X(LOAD_IND,   load_ind,    24, REG_IND,   0,                           1)   /* reg = memory[pair], optional pair++ */ \
+    X(STORE_IND,  store_ind,   25, REG_IND,   0,                           1)   /* memory[pair] = reg, optional pair++ */ \
+    X(RDINS,      rdins,       26, PAIR_WORD, 0,                           1)   /* pair = word of the guest instruction counter */ \
+    X(RDCYC,      rdcyc,       27, PAIR_WORD, 0,                           1)   /* pair = word of the guest cycle counter */ \
+    X(CLRCNT,     clrcnt,      28, NONE,      ISA_PRIVILEGED,              1)   /* zero both guest counters */ \
+    X(HALT,       halt,       255, NONE,      ISA_BRANCH,                  1)   /* stop CPU execution */
+
+// Instruction flags
+#define ISA_BRANCH 0x01       // may not continue at the next instruction
+#define ISA_PRIVILEGED 0x02   // faults in user mode
+
 typedef enum {
-    OP_LOAD_IMM = 1,   // reg = immediate value
-    OP_SUB      = 2,   // dst = dst - src
-    OP_ADD      = 3,   // dst = dst + src
-    OP_STORE    = 4,   // memory[addr] = reg
-    OP_LOAD_MEM = 5,   // reg = memory[addr]
-    OP_MLP      = 6,   // dst = dst * src
-    OP_DIV      = 7,   // dst = dst / src
-    OP_HALT     = 255  // stop CPU execution
+#define ISA_ENUM(NAME, name, code, fmt, flags, cycles) OP_##NAME = code,
+    ISA_INSTRUCTIONS(ISA_ENUM)
+#undef ISA_ENUM
 } Opcode;
+
+// Operand encodings, shared by the encoder and the decoders
+typedef enum {
+    FMT_INVALID = 0,   // not a defined opcode
+    FMT_NONE,          // [opcode]
+    FMT_REG_IMM,       // [opcode][reg][imm]
+    FMT_REG_REG,       // [opcode][dst][src]
+    FMT_REG_ADDR,      // [opcode][reg][hi][lo]
+    FMT_REG3,          // [opcode][a][b][c]
+    FMT_ADDR,          // [opcode][hi][lo]
+    FMT_PAIR_IMM,      // [opcode][pair][hi][lo]
+    FMT_PAIR_PAIR,     // [opcode][dst pair][src pair]
+    FMT_REG_IND,       // [opcode][reg][pair | ISA_IND_POST_INC]
+    FMT_PAIR_WORD      // [opcode][pair][word], word 0 is the lowest
+} InstrFormat;
+
+// FMT_REG_IND: increment the pair after the access
+#define ISA_IND_POST_INC 0x80
+#define ISA_IND_PAIR_MASK 0x7F
+
+// FMT_PAIR_WORD: 16-bit words in a 64-bit counter
+#define ISA_COUNTER_WORDS 4
+
+// Encoded length of each format
+#define ISA_SIZE_NONE 1
+#define ISA_SIZE_REG_IMM 3
+#define ISA_SIZE_REG_REG 3
+#define ISA_SIZE_REG_ADDR 4
+#define ISA_SIZE_REG3 4
+#define ISA_SIZE_ADDR 3
+#define ISA_SIZE_PAIR_IMM 4
+#define ISA_SIZE_PAIR_PAIR 3
+#define ISA_SIZE_REG_IND 3
+#define ISA_SIZE_PAIR_WORD 3
+#define ISA_MAX_SIZE 4
+
+typedef struct {
+    const char *mnemonic;
+    uint8_t opcode;
+    uint8_t format;    // InstrFormat
+    uint8_t size;      // encoded length in bytes
+    uint8_t flags;     // ISA_*
+    uint8_t cycles;    // modelled cost, counted by every engine (Cpu.cycles)
+} IsaInstr;
+
+// Indexed by opcode; undefined opcodes are all-zero (FMT_INVALID, size 0)
+extern const IsaInstr isa_table[256];
+
+// Mnemonic to instruction through a perfect hash, NULL if unknown
+const IsaInstr *isa_lookup(const char *mnemonic);
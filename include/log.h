@@ -1,6 +1,8 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdbool.h>
+
 typedef enum
 {
     LOG_INFO,
@@ -13,4 +15,8 @@ typedef enum
 
 void log_write(LogLevel level, const char *fmt, ...);
 
+// Turn one level on or off at runtime
+void log_set_enabled(LogLevel level, bool enabled);
+bool log_is_enabled(LogLevel level);
+
 #endif
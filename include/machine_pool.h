@@ -0,0 +1,53 @@
+#ifndef MACHINE_POOL_H
+#define MACHINE_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+#include "ram.h"
+
+/*
+ * Preallocated Cpu+Ram instances for programs that create many machines.
+ * One arena holds every machine: the 64 KB RAM slots come first, page
+ * aligned and contiguous so the kernel can back them with huge pages, then
+ * the cache-line aligned PoolMachine records. The arena is mapped with
+ * MAP_HUGETLB when huge pages are reserved, otherwise with transparent huge
+ * pages requested (MADV_HUGEPAGE).
+ *
+ * Acquire and release are O(1): each thread keeps its own free list and
+ * only takes the pool lock to move MACHINE_POOL_BATCH machines between its
+ * list and the shared one. A machine may be released by any thread.
+ * A thread that exits hands its cached machines back to the shared list,
+ * and its slot goes to the next thread that uses a pool.
+ *
+ * A released machine's RAM is zeroed in place, so its pages stay resident
+ * and the next user takes no page faults.
+ */
+
+#define MACHINE_POOL_BATCH 16
+#define MACHINE_POOL_MAX_THREADS 64   // live threads beyond this share the locked list
+
+typedef struct
+{
+    Cpu cpu;        // as cpu_init(cpu, false) leaves it
+    Ram ram;        // flat, over the machine's arena slot; zeroed, no MMU or hooks
+    uint32_t index;
+    uint32_t next;  // free list link
+} __attribute__((aligned(64))) PoolMachine;
+
+typedef struct MachinePool MachinePool;
+
+MachinePool *machine_pool_create(uint32_t capacity);
+void machine_pool_destroy(MachinePool *pool);
+
+// NULL when every machine is in use or cached by another live thread (at
+// most 2 * MACHINE_POOL_BATCH per thread); size capacity with that margin
+PoolMachine *machine_pool_acquire(MachinePool *pool);
+void machine_pool_release(MachinePool *pool, PoolMachine *m);
+
+// True if the arena got explicit huge pages (MAP_HUGETLB)
+bool machine_pool_hugetlb(const MachinePool *pool);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef MMU_H
+#define MMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bank-switching MMU: the 16-bit guest address space is split into 256
+ * pages of 256 bytes, each mapped onto a frame of a physical memory of up
+ * to 65536 frames (16 MB). The page table is changed by the privileged
+ * MAP and TLBFLUSH instructions. Translations are cached in a small
+ * direct-mapped TLB of host pointers so the common path is one compare.
+ */
+
+#define MMU_PAGE_SHIFT 8
+#define MMU_PAGE_SIZE (1u << MMU_PAGE_SHIFT)
+#define MMU_PAGE_COUNT 256
+#define MMU_MAX_FRAMES 65536
+#define MMU_TLB_SIZE 16
+
+#define MMU_PTE_PRESENT 0x80000000u
+#define MMU_PTE_FRAME_MASK 0x0000FFFFu
+
+#define MMU_TLB_VALID 0x100u
+
+typedef struct
+{
+    uint32_t tag;      // vpage | MMU_TLB_VALID, 0 when empty
+    uint8_t *host;     // start of the mapped frame
+} MmuTlbEntry;
+
+typedef struct
+{
+    uint8_t *phys;
+    uint32_t frame_count;
+    uint32_t page_table[MMU_PAGE_COUNT];
+    MmuTlbEntry tlb[MMU_TLB_SIZE];
+    uint64_t tlb_misses;
+} Mmu;
+
+/*
+ * Allocate frame_count physical frames and identity-map the first 256 so a
+ * fresh MMU behaves like flat Ram. Returns false on allocation failure.
+ */
+bool mmu_init(Mmu *mmu, uint32_t frame_count);
+void mmu_free(Mmu *mmu);
+
+bool mmu_map(Mmu *mmu, uint8_t vpage, uint32_t frame);
+void mmu_unmap(Mmu *mmu, uint8_t vpage);
+void mmu_flush_tlb(Mmu *mmu);
+
+// Page-table walk and TLB refill. Returns NULL if the page is not present.
+uint8_t *mmu_translate_slow(Mmu *mmu, uint16_t address);
+
+static inline uint8_t *mmu_translate(Mmu *mmu, uint16_t address)
+{
+    uint32_t vpage = address >> MMU_PAGE_SHIFT;
+    MmuTlbEntry *e = &mmu->tlb[vpage & (MMU_TLB_SIZE - 1)];
+
+    if (e->tag == (vpage | MMU_TLB_VALID))
+        return e->host + (address & (MMU_PAGE_SIZE - 1));
+
+    return mmu_translate_slow(mmu, address);
+}
+
+#endif
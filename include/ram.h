@@ -3,20 +3,159 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "mmu.h"
 
 #define RAM_SIZE 65536 // 64KB Ram
 
 #define RAM_PRIVILEGED_MODE_START 0
 #define RAM_PRIVILEGED_MODE_END 8191
 
-// Defining 65536 (64KB) memory cells. Each 1 byte
+// Page directory granularity
+#define RAM_PAGE_SHIFT 12
+#define RAM_PAGE_SIZE (1u << RAM_PAGE_SHIFT)
+#define RAM_PAGE_COUNT (RAM_SIZE >> RAM_PAGE_SHIFT)
+
+// Watchpoint page attribute table: one entry per 256-byte page
+#define RAM_WATCH_PAGE_SHIFT 8
+#define RAM_WATCH_PAGES (RAM_SIZE >> RAM_WATCH_PAGE_SHIFT)
+#define RAM_WATCH_READ 0x01
+#define RAM_WATCH_WRITE 0x02
+
+// Called after a successful access to a page whose attribute bit is set
+typedef void (*RamWatchHook)(void *ctx, uint32_t address, uint8_t value, bool write);
+
+// Access log entries, in program order
+typedef enum
+{
+    RAM_ACCESS_INSN,    // an instruction starts at addr (logged by the interpreter)
+    RAM_ACCESS_FETCH,   // instruction byte
+    RAM_ACCESS_READ,
+    RAM_ACCESS_WRITE
+} RamAccessKind;
+
 typedef struct
 {
-    uint8_t memory_cells[RAM_SIZE];
+    uint16_t addr;
+    uint8_t kind;       // RamAccessKind
+    uint8_t value;
+} RamAccess;
+
+#define RAM_ACCESS_LOG_SIZE 4096
+
+/*
+ * Batched record of every ram_read and ram_write, for models that want the
+ * access stream (cache_sim.h). A read at fetch_next is an instruction byte
+ * and advances it; the interpreter points it at each instruction it starts.
+ * drain runs whenever the log fills and must empty it.
+ */
+typedef struct RamAccessLog
+{
+    RamAccess entries[RAM_ACCESS_LOG_SIZE];
+    uint32_t count;
+    uint16_t fetch_next;
+    void (*drain)(struct RamAccessLog *log);
+} RamAccessLog;
+
+/*
+ * 65536 (64KB) memory cells, each 1 byte, reached through a page directory.
+ *
+ * Flat Ram (ram_init) backs every page with one contiguous memory_cells
+ * block. Sparse Ram (ram_init_sparse) has no memory_cells: every page
+ * starts out pointing at one shared read-only zero page and gets its own
+ * copy on the first ram_write to it. Ram made by ram_init_from works the
+ * same way but shares the pages of a template Ram instead.
+ */
+typedef struct
+{
+    uint8_t *memory_cells;              // contiguous backing, NULL for sparse Ram
+    bool external_cells;                // memory_cells belongs to the caller
+    uint8_t *pages[RAM_PAGE_COUNT];
+    uint32_t shared_pages;              // bit per page still shared (zero page or template)
+
+    // When set, guest addresses are translated through the MMU instead of pages
+    Mmu *mmu;
+
+    // NULL unless a debugger is attached, so unwatched access costs one test
+    const uint8_t *watch_pages;
+    RamWatchHook watch_hook;
+    void *watch_ctx;
+
+    // NULL unless an access model is attached
+    RamAccessLog *access_log;
+
+    // Page hashes for state_hash.h; pages written since are rehashed (hash_dirty)
+    uint32_t hash_dirty;
+    uint64_t page_hash[RAM_PAGE_COUNT];
 } Ram;
 
-void ram_init(Ram *ram);
+bool ram_init(Ram *ram);
+bool ram_init_sparse(Ram *ram);
+
+// Flat Ram over caller-owned, zeroed storage of RAM_SIZE bytes (e.g. shared memory)
+bool ram_init_external(Ram *ram, uint8_t *cells);
+void ram_free(Ram *ram);
+
+// Copy-on-write view of template, which must outlive ram and not change;
+// shares template's page hashes too
+bool ram_init_from(Ram *ram, const Ram *template);
+
+// Restore every page ram owns to template's contents; pages stay owned
+void ram_reset(Ram *ram, const Ram *template);
 bool ram_read(Ram *ram, uint32_t address, uint8_t *output, bool privileged);
 bool ram_write(Ram *ram, uint32_t address, uint8_t value, bool privileged);
 
+// Unchecked read for debuggers and dumps; follows the MMU when one is attached
+uint8_t ram_peek(Ram *ram, uint16_t address);
+
+// Overwrite a whole page (e.g. from a checkpoint), taking ownership if it
+// was shared; not valid with an MMU
+bool ram_load_page(Ram *ram, uint32_t page, const uint8_t *data);
+
+// Call after changing page contents other than through this API (e.g. memset of memory_cells)
+void ram_contents_changed(Ram *ram);
+
+// ram_store_fast leaves page hashes alone to keep the store path short: an
+// engine that used it calls this when it stops, and every page ram owns is
+// hashed again
+void ram_fast_stores_done(Ram *ram);
+
+/*
+ * Direct cell access for execution engines: no privilege checks, hooks or
+ * logging. Only valid without an MMU. ram_store_fast returns false when
+ * the page is still shared and the caller must go through ram_write; see
+ * ram_fast_stores_done.
+ */
+static inline uint8_t ram_load_fast(const Ram *ram, uint16_t address)
+{
+    return ram->pages[address >> RAM_PAGE_SHIFT][address & (RAM_PAGE_SIZE - 1)];
+}
+
+static inline bool ram_store_fast(Ram *ram, uint16_t address, uint8_t value)
+{
+    uint32_t page = address >> RAM_PAGE_SHIFT;
+
+    if (ram->shared_pages & (1u << page))
+        return false;
+
+    ram->pages[page][address & (RAM_PAGE_SIZE - 1)] = value;
+    return true;
+}
+
+static inline void ram_log_access(RamAccessLog *log, uint16_t address, uint8_t kind, uint8_t value)
+{
+    RamAccess *a = &log->entries[log->count++];
+
+    a->addr = address;
+    a->kind = kind;
+    a->value = value;
+
+    if (log->count == RAM_ACCESS_LOG_SIZE)
+        log->drain(log);
+}
+
+// Bytes of page storage owned by this Ram (shared pages are not counted)
+size_t ram_resident_bytes(const Ram *ram);
+
 #endif
@@ -0,0 +1,76 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+#include "ram.h"
+
+/*
+ * Checkpoints for reverse execution in the debugger. Every `interval`
+ * retired instructions a point records the Cpu, the timer and the RAM
+ * pages that changed since the previous point. A page counts as changed
+ * when its state_hash_page hash moved, so clean pages cost nothing. The
+ * first point holds every page.
+ *
+ * Execution is deterministic: the timer is the only scheduled device and
+ * it is part of the point. Any earlier instruction is reached by restoring
+ * the latest point at or before it and running forward. Restoring a page
+ * means copying the newest copy held by that point or an earlier one, and
+ * only pages whose current hash differs are copied.
+ *
+ * Page copies and point records are counted against `budget`. When a new
+ * point goes over it, every other point is dropped, except the first and
+ * the newest, and the interval doubles. A dropped point's pages move to the
+ * next point, so a long run keeps a bounded number of points spread over
+ * all of it. Not available with an MMU.
+ */
+
+#define REWIND_DEFAULT_INTERVAL 100000
+#define REWIND_DEFAULT_BUDGET_MB 64
+
+typedef struct
+{
+    Cpu cpu;
+    uint16_t timer_period;
+    bool timer_queued;
+    uint64_t timer_deadline;
+    uint8_t *pages[RAM_PAGE_COUNT];     // NULL: unchanged since the previous point
+    uint64_t hashes[RAM_PAGE_COUNT];    // of the copies in pages
+} RewindPoint;
+
+typedef struct
+{
+    RewindPoint *points;    // by instret
+    uint32_t count;
+    uint32_t capacity;
+
+    uint64_t interval;
+    uint64_t next;          // instret of the next point to take
+    size_t budget;          // bytes
+    size_t used;
+    uint32_t thinned;       // times the points were halved
+
+    uint64_t saved_hash[RAM_PAGE_COUNT];  // page hashes as of the newest point
+} Rewind;
+
+bool rewind_init(Rewind *rw, uint64_t interval, size_t budget);
+void rewind_free(Rewind *rw);
+
+// Record the current state as a new point; false if out of memory
+bool rewind_checkpoint(Rewind *rw, const Cpu *cpu, Ram *ram);
+
+static inline bool rewind_due(const Rewind *rw, const Cpu *cpu)
+{
+    return cpu->instret >= rw->next;
+}
+
+// Index of the latest point at or before instret, -1 if there is none
+int32_t rewind_find(const Rewind *rw, uint64_t instret);
+
+// Put the machine back into the state of point index
+bool rewind_restore(Rewind *rw, uint32_t index, Cpu *cpu, Ram *ram);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Host-side event queue keyed on retired instruction count. Events hash
+ * into a timing wheel by deadline; the interpreter runs uninterrupted
+ * batches up to sched_next_deadline() and only then calls sched_run_due().
+ */
+
+#define SCHED_WHEEL_SLOTS 256
+#define SCHED_NEVER UINT64_MAX
+
+typedef struct SchedEvent SchedEvent;
+typedef void (*SchedCallback)(SchedEvent *event, uint64_t now);
+
+struct SchedEvent
+{
+    uint64_t deadline;
+    SchedCallback fire;
+    SchedEvent *next;
+    bool queued;
+};
+
+typedef struct Scheduler
+{
+    SchedEvent *slots[SCHED_WHEEL_SLOTS];
+    uint64_t next_deadline;   // SCHED_NEVER when empty
+    uint32_t count;
+} Scheduler;
+
+void sched_init(Scheduler *sched);
+void sched_add(Scheduler *sched, SchedEvent *event, uint64_t deadline);
+void sched_cancel(Scheduler *sched, SchedEvent *event);
+void sched_run_due(Scheduler *sched, uint64_t now);
+
+static inline uint64_t sched_next_deadline(const Scheduler *sched)
+{
+    return sched->next_deadline;
+}
+
+#endif
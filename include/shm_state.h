@@ -0,0 +1,82 @@
+#ifndef SHM_STATE_H
+#define SHM_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "ram.h"
+#include "sched.h"
+
+/*
+ * Machine state in a shared-memory object that other processes can map
+ * read-only (--shm). Guest RAM lives in the object itself: Ram's cells are
+ * the mapping, so readers see every store as it happens. Registers are
+ * published into the header every SHM_PUBLISH_INTERVAL instructions by a
+ * scheduler event, and once more when the CPU stops.
+ *
+ * Layout (host byte order):
+ *
+ *   offset 0                        ShmStateHeader
+ *   offset SHM_STATE_MEMORY_OFFSET  RAM_SIZE bytes of guest memory
+ *
+ * Readers take a consistent register snapshot with the sequence counter:
+ * load seq (acquire), retry while it is odd, copy the fields, then load seq
+ * again and retry if it changed. Memory bytes are not covered by seq.
+ */
+
+#define SHM_STATE_MAGIC "C8SH"
+#define SHM_STATE_VERSION 1
+#define SHM_STATE_MEMORY_OFFSET 4096
+#define SHM_STATE_SIZE (SHM_STATE_MEMORY_OFFSET + RAM_SIZE)
+#define SHM_PUBLISH_INTERVAL 16384
+
+typedef struct
+{
+    char magic[4];              //  0  SHM_STATE_MAGIC
+    uint32_t version;           //  4  SHM_STATE_VERSION
+    uint32_t memory_offset;     //  8  SHM_STATE_MEMORY_OFFSET
+    uint32_t memory_size;       // 12  RAM_SIZE
+    uint64_t seq;               // 16  odd while the emulator is writing
+    uint64_t instret;           // 24
+    uint16_t pc;                // 32
+    uint16_t sp;                // 34
+    uint8_t regs[REG_COUNT];    // 36
+    uint8_t running;            // 44
+    uint8_t privileged;         // 45
+    uint8_t flag_zero;          // 46
+    uint8_t flag_carry;         // 47
+    uint8_t irq_enabled;        // 48
+    uint8_t irq_pending;        // 49
+    uint8_t reserved[6];        // 50
+} ShmStateHeader;
+
+typedef struct
+{
+    SchedEvent event;   // must stay first: the callback casts back to ShmState
+    ShmStateHeader *header;
+    uint8_t *memory;
+    int fd;
+    char name[256];     // shm_open name, empty for memfd
+    Cpu *cpu;
+} ShmState;
+
+/*
+ * name starting with '/' creates a POSIX shared-memory object of that name
+ * (/dev/shm on Linux); "memfd" creates an anonymous memfd that readers open
+ * through /proc/<pid>/fd/<fd>.
+ */
+bool shm_state_open(ShmState *shm, const char *name);
+
+// Back ram with the shared memory; ram_free leaves the mapping alone
+bool shm_state_attach_ram(ShmState *shm, Ram *ram);
+
+// Publish now and every SHM_PUBLISH_INTERVAL instructions on sched
+void shm_state_attach_cpu(ShmState *shm, Cpu *cpu, Scheduler *sched);
+
+void shm_state_publish(ShmState *shm);
+
+// Unmaps and removes the object name; readers keep their mappings
+void shm_state_close(ShmState *shm);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+#include "ram.h"
+
+/*
+ * Store for large numbers of machine states, e.g. the final state of every
+ * sweep run. A snapshot is the architectural Cpu state, the timer, and 16
+ * page references. Pages are stored once per distinct contents, found by
+ * their state_hash_page hash (so clean pages cost a cache lookup to add)
+ * and compared in full on a hash match, since different pages can share a
+ * hash. They are compressed: an all-zero page takes no bytes, others take
+ * the smaller of a byte-run encoding and a small LZ77 variant, or are
+ * stored raw when neither helps. Recently matched pages are kept decoded,
+ * and a page still shared with the unchanging template of a ram_init_from
+ * view is compared once, not on every add.
+ *
+ * Records are appended to segment files seg-NNNNNN in the store directory.
+ * The active segment is buffered in memory and written out when it fills,
+ * on snapshot_store_flush and on close; existing segments are never
+ * modified. Opening a store maps its segments and indexes them, and new
+ * snapshots go to a new segment, numbered after the ones found. A record
+ * cut short (e.g. by a crash) ends its segment.
+ *
+ * Restoring one snapshot costs an index lookup and at most 16 page decodes,
+ * however many snapshots the store holds; pages the target Ram already
+ * holds are not copied. Not available with an MMU.
+ */
+
+#define SNAPSHOT_MAGIC "C8SS"
+#define SNAPSHOT_FORMAT 2
+#define SNAPSHOT_SEGMENT_SIZE (64u << 20)   // bytes before a new segment is started
+
+// How a stored page is encoded
+typedef enum
+{
+    SNAPSHOT_CODEC_ZERO,    // all zero, no payload
+    SNAPSHOT_CODEC_RAW,
+    SNAPSHOT_CODEC_RUNS,    // byte runs and literals
+    SNAPSHOT_CODEC_LZ       // literals and back references
+} SnapshotCodec;
+
+typedef struct
+{
+    uint64_t snapshots;
+    uint64_t pages;         // distinct pages stored
+    uint64_t page_bytes;    // their encoded size
+    uint64_t stored_bytes;  // everything in the segments
+    uint32_t segments;
+} SnapshotStats;
+
+typedef struct SnapshotStore SnapshotStore;
+
+// Open or create the store in dir; a NULL dir keeps everything in memory
+SnapshotStore *snapshot_store_open(const char *dir);
+
+// Flush and free; false if the final flush failed
+bool snapshot_store_close(SnapshotStore *store);
+
+// Write out the buffered part of the active segment
+bool snapshot_store_flush(SnapshotStore *store);
+
+// Add the state of (cpu, ram); returns the new snapshot's number, or -1.
+// stopped: the host stopped the cpu before it halted (e.g. a step limit),
+// so the snapshot restores as running
+int64_t snapshot_store_add(SnapshotStore *store, const Cpu *cpu, Ram *ram, bool stopped);
+
+// Put (cpu, ram) into the state of snapshot id; cpu keeps its devices
+bool snapshot_store_restore(SnapshotStore *store, uint64_t id, Cpu *cpu, Ram *ram);
+
+uint64_t snapshot_store_count(const SnapshotStore *store);
+void snapshot_store_stats(const SnapshotStore *store, SnapshotStats *stats);
+
+/*
+ * Page codecs, exposed for tools. snapshot_encode_page picks the smallest
+ * encoding of a RAM_PAGE_SIZE page into out (RAM_PAGE_SIZE bytes) and
+ * stores its length; snapshot_decode_page checks every length and offset
+ * against the page, so corrupt input fails instead of overrunning.
+ */
+SnapshotCodec snapshot_encode_page(const uint8_t *page, uint8_t *out, uint16_t *length);
+bool snapshot_decode_page(SnapshotCodec codec, const uint8_t *in, uint16_t length, uint8_t *page);
+
+#endif
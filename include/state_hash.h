@@ -0,0 +1,52 @@
+#ifndef STATE_HASH_H
+#define STATE_HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+#include "ram.h"
+
+/*
+ * Machine state digests, for checking runs against golden results and
+ * spotting identical states without comparing 64 KB of RAM.
+ *
+ * Each Ram caches a 64-bit hash per 4 KB page. Stores mark their page
+ * dirty (one OR on the store path) and only dirty pages are hashed again.
+ * A copy-on-write view (ram_init_from) shares its template's hashes, and
+ * ram_reset puts them back, so a sweep run rehashes only the pages it
+ * wrote. With an MMU attached, pages are hashed from the translated view
+ * every time.
+ *
+ * The machine digest covers RAM and the architectural CPU state: PC, SP,
+ * R0-R7, the Z and C flags, the privilege, running and fault state, and the
+ * interrupt state. It leaves out instret, so two runs that reach the same
+ * state by different paths have the same digest. Digests are meant for
+ * comparison, not security.
+ */
+
+// One differing byte, as reported by state_diff_ram
+typedef struct
+{
+    uint16_t addr;
+    uint8_t a;
+    uint8_t b;
+} StateDiff;
+
+uint64_t state_hash_bytes(const void *data, size_t len, uint64_t seed);
+
+// Hash of one RAM_PAGE_SIZE page, from the cache when the page is clean
+uint64_t state_hash_page(Ram *ram, uint32_t page);
+
+uint64_t state_hash_ram(Ram *ram);
+uint64_t state_hash_machine(const Cpu *cpu, Ram *ram);
+
+/*
+ * Compare two RAMs byte by byte, 16 bytes at a time where SIMD is
+ * available; pages shared by both are skipped. Stores the first max
+ * differences in out (which may be NULL) and returns how many bytes differ.
+ */
+size_t state_diff_ram(Ram *a, Ram *b, StateDiff *out, size_t max);
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "ram.h"
+#include "sched.h"
+#include "timer.h"
+#include "verify.h"
+
+/*
+ * Input-vector sweep: run one loaded program once per record of an input
+ * file, writing selected outputs for each run.
+ *
+ * Input file: a SweepHeader followed by fixed-size records. Each record is
+ * R0..R7 (8 bytes) then patch_count RAM patches of 3 bytes: a big-endian
+ * address and the byte to store there. Trailing bytes that do not fill a
+ * whole record are ignored.
+ *
+ * Output file: one record per input record, the selected fields
+ * concatenated in selection order.
+ */
+
+#define SWEEP_MAGIC "C8SW"
+#define SWEEP_FORMAT 1
+#define SWEEP_REG_BYTES 8
+#define SWEEP_PATCH_BYTES 3
+#define SWEEP_MAX_FIELDS 32
+#define SWEEP_DEFAULT_SELECT "0x2000"
+#define SWEEP_DEFAULT_MAX_STEPS 1000000
+
+// Value of the `status` output field
+#define SWEEP_STATUS_HALTED 0    // HALT
+#define SWEEP_STATUS_TIMEOUT 1   // max_steps reached
+#define SWEEP_STATUS_FAULT 2     // stopped by a fault, given by the `fault` field
+
+typedef struct
+{
+    char magic[4];
+    uint16_t format;
+    uint16_t patch_count;
+    uint32_t record_size;   // must equal SWEEP_REG_BYTES + patch_count * SWEEP_PATCH_BYTES
+    uint32_t reserved;
+} SweepHeader;
+
+typedef enum
+{
+    SWEEP_FIELD_REG,      // 1 byte, R[addr]
+    SWEEP_FIELD_PC,       // 2 bytes, big-endian
+    SWEEP_FIELD_SP,       // 2 bytes, big-endian
+    SWEEP_FIELD_STATUS,   // 1 byte, SWEEP_STATUS_*
+    SWEEP_FIELD_FAULT,    // 1 byte, CpuFault
+    SWEEP_FIELD_DIGEST,   // 8 bytes, big-endian state_hash_machine
+    SWEEP_FIELD_RAM       // length bytes from addr
+} SweepFieldKind;
+
+typedef struct
+{
+    SweepFieldKind kind;
+    uint16_t addr;
+    uint16_t length;
+} SweepField;
+
+typedef struct
+{
+    SweepField fields[SWEEP_MAX_FIELDS];
+    uint32_t field_count;
+    uint32_t output_size;   // bytes per output record
+    uint64_t max_steps;     // per run
+    const char *snapshot_dir;   // sweep_run stores every final state there, or NULL
+} SweepConfig;
+
+// Parse a comma-separated selection such as "R0,PC,status,fault,digest,0x2000:16"
+bool sweep_parse_fields(const char *spec, SweepConfig *config);
+
+struct DecodeCache;
+struct SnapshotStore;
+
+/*
+ * One machine for repeated runs of a loaded program: a copy-on-write view
+ * of the template RAM and a decode cache, both kept warm between runs.
+ */
+typedef struct
+{
+    const Cpu *template_cpu;
+    const Ram *template_ram;
+    Ram ram;
+    struct DecodeCache *dc;
+    Scheduler sched;            // devices of the cpu last run, valid until the next run
+    Timer timer;
+
+    // Host stores since the last reset: the run may decode the stored bytes
+    uint16_t *stores;
+    uint32_t store_count;
+    uint32_t store_capacity;
+    bool stores_lost;           // one could not be recorded, so reset flushes the cache
+    uint64_t generation;        // decode cache generation when the run started
+
+    struct SnapshotStore *snapshots;    // receives the final state of each run, or NULL
+} SweepMachine;
+
+// What one sweep_machine_run did
+typedef struct
+{
+    uint64_t instret;   // instructions retired
+    bool timed_out;     // stopped by max_steps
+} SweepRunStats;
+
+bool sweep_machine_init(SweepMachine *m, const Cpu *template_cpu, const Ram *template_ram);
+void sweep_machine_free(SweepMachine *m);
+
+// Store a byte into the machine's RAM before a run, dropping any code decoded from it
+bool sweep_machine_store(SweepMachine *m, uint16_t addr, uint8_t value);
+
+// Run cpu on the machine's RAM for at most max_steps instructions, privileged
+// if kernel; true if it timed out
+bool sweep_machine_exec(SweepMachine *m, Cpu *cpu, bool kernel, uint64_t max_steps);
+
+// Put RAM and the decode cache back to the template state
+void sweep_machine_reset(SweepMachine *m);
+
+/*
+ * Run one input record (registers then patch_count patches, as in the input
+ * file) for at most config->max_steps instructions and write the selected
+ * outputs to out (config->output_size bytes). The machine is back at the
+ * template state afterwards. stats may be NULL. Returns false if a patch
+ * could not be stored or the final state could not be added to the
+ * machine's snapshot store.
+ */
+bool sweep_machine_run(SweepMachine *m, const uint8_t *record, uint16_t patch_count,
+                       const SweepConfig *config, uint8_t *out, SweepRunStats *stats);
+
+/*
+ * Run every record of input_path starting from (template_cpu,
+ * template_ram) and write the outputs to output_path. Each run works on a
+ * copy-on-write view of template_ram that is reset in place afterwards,
+ * and outputs are written in large chunks, so a run costs no allocation
+ * and no system call. With config->snapshot_dir, the final state of run
+ * n becomes snapshot n of the runs added by this sweep. verification, if
+ * not NULL, is the template image's, verified for kernel mode; runs use its
+ * unchecked handlers until a patch changes the code. Returns the number of
+ * records run, or -1.
+ */
+long long sweep_run(const char *input_path, const char *output_path, const SweepConfig *config,
+                    const Cpu *template_cpu, const Ram *template_ram, const Verification *verification);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "sched.h"
+
+/*
+ * Programmable interval timer. TIMER Rhi, Rlo sets the period in retired
+ * instructions (0 stops it); each expiry raises CPU_IRQ_TIMER.
+ */
+typedef struct Timer
+{
+    SchedEvent event;   // must stay first: the callback casts back to Timer
+    Cpu *cpu;
+    Scheduler *sched;
+    uint16_t period;
+} Timer;
+
+void timer_init(Timer *timer, Cpu *cpu, Scheduler *sched);
+void timer_program(Timer *timer, uint16_t period, uint64_t now);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "image.h"
+#include "ram.h"
+
+/*
+ * Load-time static verifier. Walks the code reachable from the image entry
+ * point (and from the interrupt handler, when the image sets the vector),
+ * splits it into basic blocks and checks every instruction:
+ *
+ *   - the opcode is defined and all its bytes come from the image
+ *   - register and pair operands are in range
+ *   - privileged instructions, constant addresses and branch targets are
+ *     legal in the mode the instruction is reached in
+ *   - a DIV whose divisor is a known constant does not divide by zero
+ *
+ * A basic block passes only if all of its instructions do. The predecoded
+ * engine decodes passed instructions with handlers that leave out the
+ * checks decided here (dcache_attach_verification). Code the walk cannot
+ * see (a handler installed at run time) and any instruction whose bytes
+ * are written after loading stay on the fully checked path.
+ *
+ * Checks that follow from the instruction's own bytes and its mode hold
+ * however it is reached. VERIFY_DIVISOR_NONZERO does not: it depends on
+ * register facts collected from the block's leader, so the engine only
+ * uses it when it decodes from that leader without a break. A jump into
+ * the middle of a block, e.g. a RET to an overwritten return address,
+ * gets the checked DIV.
+ *
+ * Register values are tracked within a basic block from LOAD_IMM,
+ * LOAD_IMM16 and ALU results. An interrupt handler may change registers
+ * between any two instructions, so images that can execute EI get no
+ * register facts. The facts depend on every earlier byte of the block, so
+ * a write into a passed block withdraws the rest of the block.
+ */
+
+// Per-byte flags in Verification.flags
+#define VERIFY_OK 0x01                // byte of an instruction in a passed block
+#define VERIFY_KERNEL_ONLY 0x02       // (first byte) only reached in privileged mode
+#define VERIFY_DIVISOR_NONZERO 0x04   // (first byte) DIV whose divisor is not zero when reached from the leader
+#define VERIFY_LEADER 0x08            // first byte of a passed basic block
+#define VERIFY_REACHED 0x10           // first byte of a reachable instruction, passed or not
+
+typedef struct
+{
+    uint8_t flags[RAM_SIZE];
+    bool privileged;          // mode the entry point runs in
+    uint32_t reachable;       // instructions found by the walk
+    uint32_t passed;          // instructions in passed blocks
+    uint32_t blocks;          // basic blocks
+    uint32_t failed_blocks;
+} Verification;
+
+// Verify image as entered at image->org in the given mode; false if any block failed
+bool verify_image(Verification *v, const Image *image, bool privileged);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "assembler.h"
+#include "cpu.h"
+#include "ram.h"
+#include "sched.h"
+
+struct DecodeCache;
+
+/*
+ * Watch mode (--watch): the running guest picks up edits to its source.
+ * A scheduler event polls the file's modification time; when it changes
+ * the source is reassembled and only the bytes that differ from the last
+ * assembly are stored into the live Ram, between two instructions.
+ *
+ * Edited lines that keep their size and define no label are reassembled
+ * alone against the existing label table. Anything else (lines added or
+ * removed, labels, .org, size changes) reassembles the whole file; if code
+ * moved, PC follows the line it was on. Return addresses already on the
+ * stack are not relocated. Bytes the guest wrote itself are only replaced
+ * where the source changed them. A source that fails to assemble is
+ * reported and the running code is kept.
+ */
+
+#define WATCH_CHECK_INTERVAL 65536   // instructions between clock reads
+#define WATCH_POLL_MS 200            // between checks of the file
+
+typedef struct
+{
+    SchedEvent event;           // must stay first: the callback casts back to Watch
+    const char *path;
+    Cpu *cpu;
+    Ram *ram;
+    struct DecodeCache *dc;     // NULL on the interpreter
+    long long last_poll_ms;
+    struct timespec mtime;
+    long long size;
+
+    char *source;               // text the running code was assembled from
+    AsmLine *lines;             // its line map
+    size_t line_count;
+    uint8_t code[RAM_SIZE];     // bytes the source put at each address
+    uint8_t have[RAM_SIZE];     // 1 where it put one
+    uint8_t next[RAM_SIZE];     // the same for the edited source
+    uint8_t next_have[RAM_SIZE];
+
+    uint32_t reloads;
+    uint32_t patched;           // bytes stored by reloads
+} Watch;
+
+// Assemble path as the running program and start polling it on cpu->sched
+bool watch_start(Watch *w, const char *path, Cpu *cpu, Ram *ram, struct DecodeCache *dc);
+void watch_stop(Watch *w);
+
+// Check the file now; true if the running code changed
+bool watch_poll(Watch *w);
+
+#endif
@@ -0,0 +1,184 @@
+#include "aot.h"
+#include "isa.h"
+#include "log.h"
+#include "sched.h"
+
+#include <string.h>
+
+void aot_init(AotCtx *ctx, const AotProgram *program)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->program = program;
+
+    for (uint32_t i = 0; i < program->insn_count; i++)
+    {
+        const AotInsn *insn = &program->insns[i];
+
+        ctx->live[insn->pc >> 3] |= (uint8_t)(1u << (insn->pc & 7));
+        ctx->size[insn->pc] = insn->size;
+
+        for (uint32_t a = insn->pc; a < (uint32_t)insn->pc + insn->size; a++)
+            ctx->code[a >> 3] |= (uint8_t)(1u << (a & 7));
+    }
+}
+
+void aot_image(const AotProgram *program, Image *image)
+{
+    image_init(image);
+    image->org = program->org;
+    image->size = program->size;
+    image->segment_count = program->segment_count;
+    memcpy(image->segments, program->segments, program->segment_count * sizeof(ImageSegment));
+    memcpy(image->bytes, program->bytes, program->size);
+}
+
+bool aot_kill(AotCtx *ctx, uint16_t addr)
+{
+    bool killed = false;
+
+    for (uint32_t back = 0; back < ISA_MAX_SIZE && back <= addr; back++)
+    {
+        uint16_t pc = addr - back;
+
+        if (ctx->size[pc] > back && aot_live(ctx, pc))
+        {
+            ctx->live[pc >> 3] &= (uint8_t)~(1u << (pc & 7));
+            ctx->killed++;
+            killed = true;
+        }
+    }
+
+    if (killed)
+        log_write(LOG_DEBUG, "Translated code at 0x%04X overwritten, interpreting it", addr);
+    return killed;
+}
+
+/* ================= helpers for generated code ================= */
+
+bool aot_call(Cpu *cpu, Ram *ram, AotCtx *ctx, uint16_t pc, uint16_t next, uint16_t target)
+{
+    uint16_t sp = cpu->SP - 2;
+    uint16_t sp_lo = sp + 1;
+
+    if (aot_user_blocked(cpu, sp) || aot_user_blocked(cpu, sp_lo))
+    {
+        cpu->PC = pc;
+        cpu_execute(cpu, ram);
+        return false;
+    }
+
+    int hi = aot_store(ram, ctx, sp, next >> 8);
+    int lo = hi == AOT_WRITE_FAULT ? AOT_WRITE_FAULT : aot_store(ram, ctx, sp_lo, next & 0xFF);
+
+    if (hi == AOT_WRITE_FAULT || lo == AOT_WRITE_FAULT)
+    {
+        log_write(LOG_ERROR, "CALL stack push failed at SP=0x%04X", sp);
+        cpu->PC = next;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return false;
+    }
+
+    cpu->SP = sp;
+    cpu->PC = target;
+    return hi == AOT_WRITE_OK && lo == AOT_WRITE_OK;
+}
+
+void aot_ret(Cpu *cpu, Ram *ram, uint16_t pc)
+{
+    uint16_t sp_lo = cpu->SP + 1;
+
+    if (aot_user_blocked(cpu, cpu->SP) || aot_user_blocked(cpu, sp_lo))
+    {
+        cpu->PC = pc;
+        cpu_execute(cpu, ram);
+        return;
+    }
+
+    cpu->PC = (ram_load_fast(ram, cpu->SP) << 8) | ram_load_fast(ram, sp_lo);
+    cpu->SP += 2;
+}
+
+void aot_halt(Cpu *cpu, uint16_t next)
+{
+    log_write(LOG_INFO, "HALT instruction encountered");
+    cpu->PC = next;
+    cpu->running = false;
+}
+
+/* ================= runner ================= */
+
+// Interpreter step that tells ctx about stores into translated code
+static void step_interpreted(Cpu *cpu, Ram *ram, AotCtx *ctx)
+{
+    uint16_t pc = cpu->PC;
+    uint8_t opcode = ram_load_fast(ram, pc);
+    uint32_t targets[2];
+    int n = 0;
+
+    if (opcode == OP_STORE)
+    {
+        targets[n++] = (ram_load_fast(ram, pc + 2) << 8) | ram_load_fast(ram, pc + 3);
+    }
+    else if (opcode == OP_STORE_IND)
+    {
+        uint8_t pair = ram_load_fast(ram, pc + 2) & ISA_IND_PAIR_MASK;
+        if (pair < PAIR_COUNT)
+            targets[n++] = cpu_pair(cpu, pair);
+    }
+    else if (opcode == OP_CALL)
+    {
+        targets[n++] = (uint16_t)(cpu->SP - 2);
+        targets[n++] = (uint16_t)(cpu->SP - 1);
+    }
+
+    cpu_step(cpu, ram);
+
+    for (int i = 0; i < n; i++)
+    {
+        uint16_t addr = (uint16_t)targets[i];
+
+        if (ctx->code[addr >> 3] & (1u << (addr & 7)))
+            aot_kill(ctx, addr);
+    }
+}
+
+void aot_run(Cpu *cpu, Ram *ram, bool kernel, AotCtx *ctx)
+{
+    if (ram->mmu || ram->watch_pages || ram->access_log)
+    {
+        log_write(LOG_WARN, "MMU, watchpoints or access log active, using the interpreter");
+        cpu_run(cpu, ram, kernel);
+        return;
+    }
+
+    cpu->privileged = kernel;
+
+    log_write(LOG_INFO, "CPU execution started at PC=0x%04X (translated from %s)",
+              cpu->PC, ctx->program->source);
+
+    while (cpu->running)
+    {
+        cpu->batch_end = cpu->sched ? sched_next_deadline(cpu->sched) : SCHED_NEVER;
+
+        while (cpu->running && cpu->instret < cpu->batch_end)
+        {
+            if (aot_live(ctx, cpu->PC))
+            {
+                uint64_t before = cpu->instret;
+
+                ctx->program->run(cpu, ram, ctx);
+                if (cpu->instret != before)
+                    continue;
+            }
+
+            step_interpreted(cpu, ram, ctx);
+        }
+
+        cpu_service_events(cpu, ram);
+    }
+
+    ram_fast_stores_done(ram);
+    if (ctx->killed)
+        log_write(LOG_INFO, "%u translated instruction(s) were overwritten", ctx->killed);
+    log_write(LOG_INFO, "CPU execution stopped");
+}
@@ -7,38 +7,20 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <setjmp.h>
 
 #define MAX_LINE 256
 #define MAX_OUTPUT 65536
 
+#define TO_STRING_(x) #x
+#define TO_STRING(x) TO_STRING_(x)
+
 typedef struct
 {
     char name[64];
     uint16_t addr;
 } Label;
 
-typedef struct
-{
-    const char *mnemonic;
-    uint8_t opcode;
-    uint8_t size;
-} InstrDef;
-
-/* ================= instruction table ================= */
-
-static const InstrDef instr_table[] =
-    {
-        {"LOAD_IMM", OP_LOAD_IMM, 3},
-        {"ADD", OP_ADD, 3},
-        {"SUB", OP_SUB, 3},
-        {"MLP", OP_MLP, 3},
-        {"DIV", OP_DIV, 3},
-        {"STORE", OP_STORE, 4},
-        {"LOAD_MEM", OP_LOAD_MEM, 4},
-        {"HALT", OP_HALT, 1},
-};
-
-#define INSTR_COUNT (sizeof(instr_table) / sizeof(instr_table[0]))
 
 /* ================= state ================= */
 
@@ -49,13 +31,38 @@ static size_t label_cap = 0;
 static uint8_t output_buf[MAX_OUTPUT];
 static size_t out_pos = 0;
 static uint16_t pc = 0;
-static uint16_t org_base = 0;
+
+static ImageSegment segments[IMAGE_MAX_SEGMENTS];
+static uint16_t segment_count = 0;
+
+/* Where each line of the last assembly went; labels_valid once it succeeded */
+static AsmLine *line_map = NULL;
+static size_t line_map_count = 0;
+static size_t line_map_cap = 0;
+static bool labels_valid = false;
+
+/* Set by assemble_source: errors jump back to it instead of exiting */
+static jmp_buf *error_jump = NULL;
+static char *error_out = NULL;
+static size_t error_out_size = 0;
 
 /* ================= utilities ================= */
 
 static void fatal(const char *msg, int line)
 {
-    fprintf(stderr, "Assembler error (line %d): %s\n", line, msg);
+    if (error_jump)
+    {
+        if (line > 0)
+            snprintf(error_out, error_out_size, "line %d: %s", line, msg);
+        else
+            snprintf(error_out, error_out_size, "%s", msg);
+        longjmp(*error_jump, 1);
+    }
+
+    if (line > 0)
+        fprintf(stderr, "Assembler error (line %d): %s\n", line, msg);
+    else
+        fprintf(stderr, "Assembler error: %s\n", msg);
     exit(1);
 }
 
@@ -84,8 +91,8 @@ static void ensure_label_cap(void)
     labels = realloc(labels, label_cap * sizeof(Label));
     if (!labels)
     {
-        fprintf(stderr, "Out of memory\n");
-        exit(1);
+        label_cap = 0;
+        fatal("Out of memory", 0);
     }
 }
 
@@ -105,7 +112,8 @@ static void add_label(const char *name, uint16_t addr, int line)
         fatal("Duplicate label", line);
 
     ensure_label_cap();
-    strncpy(labels[label_count].name, name, sizeof(labels[label_count].name));
+    strncpy(labels[label_count].name, name, sizeof(labels[label_count].name) - 1);
+    labels[label_count].name[sizeof(labels[label_count].name) - 1] = '\0';
     labels[label_count].addr = addr;
     label_count++;
 }
@@ -117,7 +125,7 @@ static uint16_t parse_number(const char *s)
     return (uint16_t)strtol(s, NULL, 10);
 }
 
-static uint8_t reg_num(const char *s)
+static int reg_num(const char *s)
 {
     if (strlen(s) != 2 || s[0] != 'R')
         return -1;
@@ -125,19 +133,42 @@ static uint8_t reg_num(const char *s)
     return (r >= 0 && r < REG_COUNT) ? r : -1;
 }
 
-static const InstrDef *find_instr(const char *mnem)
+static int pair_num(const char *s)
 {
-    for (size_t i = 0; i < INSTR_COUNT; i++)
-    {
-        if (strcmp(instr_table[i].mnemonic, mnem) == 0)
-            return &instr_table[i];
-    }
-    return NULL;
+    if (strlen(s) != 2 || s[0] != 'P')
+        return -1;
+    int p = s[1] - '0';
+    return (p >= 0 && p < PAIR_COUNT) ? p : -1;
 }
 
 static void emit8(uint8_t v)
 {
+    if (out_pos >= MAX_OUTPUT)
+        fatal("program exceeds " TO_STRING(MAX_OUTPUT) " bytes", 0);
+    ImageSegment *seg = &segments[segment_count - 1];
+    if ((uint32_t)seg->addr + seg->length >= RAM_SIZE)
+        fatal("program runs past the end of memory (0xFFFF)", 0);
+
     output_buf[out_pos++] = v;
+    seg->length++;
+}
+
+/* Start a new segment at addr, reusing the current one if nothing was emitted into it */
+static void begin_segment(uint16_t addr, int line)
+{
+    if (segment_count > 0 && segments[segment_count - 1].length == 0)
+    {
+        segments[segment_count - 1].addr = addr;
+        return;
+    }
+
+    if (segment_count >= IMAGE_MAX_SEGMENTS)
+        fatal("Too many .org segments", line);
+
+    segments[segment_count].addr = addr;
+    segments[segment_count].length = 0;
+    segments[segment_count].offset = (uint32_t)out_pos;
+    segment_count++;
 }
 
 static void emit16(uint16_t v)
@@ -230,6 +261,18 @@ static void emit_two_register_instruction(
     emit8((uint8_t)source_register);
 }
 
+static uint16_t resolve_address(const char *token, const char *instruction_name, int line_no)
+{
+    if (isdigit((unsigned char)token[0]))
+        return parse_number(token);
+
+    int label_index = find_label(token);
+    if (label_index < 0)
+        fatal_fmt("[%s] Unknown label", instruction_name, line_no);
+
+    return labels[label_index].addr;
+}
+
 static void emit_reg_addr_instruction(
     uint8_t opcode,
     const char *instruction_name,
@@ -245,24 +288,166 @@ static void emit_reg_addr_instruction(
     if (reg < 0)
         fatal_fmt("[%s] Invalid register", instruction_name, line_no);
 
-    uint16_t address;
+    uint16_t address = resolve_address(address_token, instruction_name, line_no);
 
-    if (isdigit((unsigned char)address_token[0]))
+    emit8(opcode);
+    emit8((uint8_t)reg);
+    emit16(address);
+}
+
+static void emit_addr_instruction(
+    uint8_t opcode,
+    const char *instruction_name,
+    int line_no)
+{
+    char *address_token = next_token();
+
+    if (address_token == NULL)
+        fatal_fmt("[%s] Missing address operand", instruction_name, line_no);
+
+    emit8(opcode);
+    emit16(resolve_address(address_token, instruction_name, line_no));
+}
+
+static void emit_three_register_instruction(
+    uint8_t opcode,
+    const char *instruction_name,
+    int line_number)
+{
+    char *operands[3];
+
+    for (int i = 0; i < 3; i++)
     {
-        address = parse_number(address_token);
+        operands[i] = next_token();
+        if (operands[i] == NULL)
+            fatal_fmt("[%s] missing register operand", instruction_name, line_number);
     }
-    else
-    {
-        int label_index = find_label(address_token);
-        if (label_index < 0)
-            fatal_fmt("[%s] Unknown label", instruction_name, line_no);
 
-        address = labels[label_index].addr;
+    emit8(opcode);
+
+    for (int i = 0; i < 3; i++)
+    {
+        int reg = reg_num(operands[i]);
+        if (reg < 0)
+            fatal_fmt("[%s] Invalid register", instruction_name, line_number);
+        emit8((uint8_t)reg);
     }
+}
+
+static void emit_pair_imm_instruction(
+    uint8_t opcode,
+    const char *instruction_name,
+    int line_no)
+{
+    char *pair_token = next_token();
+    char *value_token = next_token();
+
+    if (pair_token == NULL || value_token == NULL)
+        fatal_fmt("[%s] Missing operands", instruction_name, line_no);
+
+    int pair = pair_num(pair_token);
+    if (pair < 0)
+        fatal_fmt("[%s] Invalid register pair", instruction_name, line_no);
+
+    if (*value_token == '#')
+        value_token++;
+
+    emit8(opcode);
+    emit8((uint8_t)pair);
+    emit16(resolve_address(value_token, instruction_name, line_no));
+}
+
+static void emit_two_pair_instruction(
+    uint8_t opcode,
+    const char *instruction_name,
+    int line_no)
+{
+    char *destination_operand = next_token();
+    char *source_operand = next_token();
+
+    if (destination_operand == NULL || source_operand == NULL)
+        fatal_fmt("[%s] Missing operands", instruction_name, line_no);
+
+    int destination_pair = pair_num(destination_operand);
+    int source_pair = pair_num(source_operand);
+
+    if (destination_pair < 0 || source_pair < 0)
+        fatal_fmt("[%s] Invalid register pair", instruction_name, line_no);
+
+    emit8(opcode);
+    emit8((uint8_t)destination_pair);
+    emit8((uint8_t)source_pair);
+}
+
+static void emit_pair_word_instruction(
+    uint8_t opcode,
+    const char *instruction_name,
+    int line_no)
+{
+    char *pair_token = next_token();
+    char *word_token = next_token();
+
+    if (pair_token == NULL || word_token == NULL)
+        fatal_fmt("[%s] Missing operands", instruction_name, line_no);
+
+    int pair = pair_num(pair_token);
+    if (pair < 0)
+        fatal_fmt("[%s] Invalid register pair", instruction_name, line_no);
+
+    if (*word_token == '#')
+        word_token++;
+
+    uint16_t word = parse_number(word_token);
+    if (word >= ISA_COUNTER_WORDS)
+        fatal_fmt("[%s] Word must be 0 to 3", instruction_name, line_no);
+
+    emit8(opcode);
+    emit8((uint8_t)pair);
+    emit8((uint8_t)word);
+}
+
+/* [Pn] or [Pn+] */
+static void emit_reg_indirect_instruction(
+    uint8_t opcode,
+    const char *instruction_name,
+    int line_no)
+{
+    char *register_token = next_token();
+    char *pointer_token = next_token();
+
+    if (register_token == NULL || pointer_token == NULL)
+        fatal_fmt("[%s] Missing operands", instruction_name, line_no);
+
+    int reg = reg_num(register_token);
+    if (reg < 0)
+        fatal_fmt("[%s] Invalid register", instruction_name, line_no);
+
+    size_t len = strlen(pointer_token);
+    bool post_inc = len == 5 && pointer_token[3] == '+';
+
+    if ((len != 4 && !post_inc) || pointer_token[0] != '[' || pointer_token[len - 1] != ']')
+        fatal_fmt("[%s] Expected [Pn] or [Pn+]", instruction_name, line_no);
+
+    char pair_token[3] = {pointer_token[1], pointer_token[2], '\0'};
+    int pair = pair_num(pair_token);
+    if (pair < 0)
+        fatal_fmt("[%s] Invalid register pair", instruction_name, line_no);
 
     emit8(opcode);
     emit8((uint8_t)reg);
-    emit16(address);
+    emit8((uint8_t)pair | (post_inc ? ISA_IND_POST_INC : 0));
+}
+
+/* LOAD_MEM/STORE with a [pair] operand are the register-indirect forms */
+static const IsaInstr *select_form(const IsaInstr *ins, bool indirect)
+{
+    if (ins == NULL || !indirect)
+        return ins;
+    if (ins->opcode == OP_LOAD_MEM)
+        return &isa_table[OP_LOAD_IND];
+    if (ins->opcode == OP_STORE)
+        return &isa_table[OP_STORE_IND];
+    return ins;
 }
 
 /* ================= pass 1 ================= */
@@ -293,13 +478,13 @@ static void pass1(FILE *f)
 
         if (strncmp(p, ".org", 4) == 0)
         {
-            org_base = parse_number(trim(p + 4));
-            pc = org_base;
+            pc = parse_number(trim(p + 4));
             continue;
         }
 
+        bool indirect = strchr(p, '[') != NULL;
         char *mn = strtok(p, " ,");
-        const InstrDef *ins = find_instr(mn);
+        const IsaInstr *ins = select_form(isa_lookup(mn), indirect);
         if (!ins)
             fatal("Unknown instruction", line_no);
 
@@ -309,11 +494,115 @@ static void pass1(FILE *f)
 
 /* ================= pass 2 ================= */
 
+/* Emit one source line at pc; true if it defines a label or sets the origin */
+static bool emit_line(char *line, int line_no)
+{
+    char *p = trim(line);
+    bool layout = false;
+
+    if (*p == '\0' || *p == ';')
+        return false;
+
+    char *colon = strchr(p, ':');
+    if (colon)
+    {
+        layout = true;
+        p = trim(colon + 1);
+        if (*p == '\0')
+            return true;
+    }
+
+    if (strncmp(p, ".org", 4) == 0)
+    {
+        pc = parse_number(trim(p + 4));
+        begin_segment(pc, line_no);
+        return true;
+    }
+
+    bool indirect = strchr(p, '[') != NULL;
+    char *mn = strtok(p, " ,");
+    const IsaInstr *ins = select_form(isa_lookup(mn), indirect);
+    if (!ins)
+        fatal("Unknown instruction", line_no);
+
+    // Operand syntax follows the encoding format
+    switch (ins->format)
+    {
+    case FMT_NONE:
+        emit8(ins->opcode);
+        break;
+
+    case FMT_REG_IMM:
+        emit_reg_imm_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_REG_REG:
+        emit_two_register_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_REG_ADDR:
+        emit_reg_addr_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_REG3:
+        emit_three_register_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_ADDR:
+        emit_addr_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_PAIR_IMM:
+        emit_pair_imm_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_PAIR_PAIR:
+        emit_two_pair_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_REG_IND:
+        emit_reg_indirect_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    case FMT_PAIR_WORD:
+        emit_pair_word_instruction(ins->opcode, ins->mnemonic, line_no);
+        break;
+
+    default:
+        fatal("Unhandled opcode", line_no);
+    }
+
+    pc += ins->size;
+    return layout;
+}
+
+static void record_line(int line_no, uint16_t addr, uint8_t size, bool layout)
+{
+    if ((size_t)line_no > line_map_cap)
+    {
+        size_t cap = line_map_cap ? line_map_cap * 2 : 256;
+        while (cap < (size_t)line_no)
+            cap *= 2;
+
+        AsmLine *grown = realloc(line_map, cap * sizeof(AsmLine));
+        if (!grown)
+            fatal("Out of memory", line_no);
+        line_map = grown;
+        line_map_cap = cap;
+    }
+
+    line_map[line_no - 1] = (AsmLine){ .addr = addr, .size = size, .layout = layout };
+    line_map_count = (size_t)line_no;
+}
+
 static void pass2(FILE *f)
 {
     rewind(f);
-    pc = org_base;
+    pc = 0;
     out_pos = 0;
+    segment_count = 0;
+    line_map_count = 0;
+    begin_segment(pc, 0);
 
     char line[MAX_LINE];
     int line_no = 0;
@@ -321,83 +610,131 @@ static void pass2(FILE *f)
     while (fgets(line, sizeof(line), f))
     {
         line_no++;
-        char *p = trim(line);
-        if (*p == '\0' || *p == ';')
-            continue;
 
-        char *colon = strchr(p, ':');
-        if (colon)
-        {
-            p = trim(colon + 1);
-            if (*p == '\0')
-                continue;
-        }
+        size_t before = out_pos;
+        bool layout = emit_line(line, line_no);
+        uint8_t size = (uint8_t)(out_pos - before);
 
-        if (strncmp(p, ".org", 4) == 0)
-        {
-            pc = parse_number(trim(p + 4));
-            continue;
-        }
+        record_line(line_no, (uint16_t)(pc - size), size, layout);
+    }
+}
 
-        char *mn = strtok(p, " ,");
-        const InstrDef *ins = find_instr(mn);
-        if (!ins)
-            fatal("Unknown instruction", line_no);
+/* ================= public API ================= */
 
-        switch (ins->opcode)
-        {
+int assemble_image(FILE *input, Image *image)
+{
+    pc = 0;
+    label_count = 0;
+    labels_valid = false;
+
+    pass1(input);
+    pass2(input);
 
-        case OP_LOAD_IMM:
-            emit_reg_imm_instruction(ins->opcode, "LOAD_IMM", line_no);
-            break;
+    image_init(image);
 
-        case OP_ADD:
-            emit_two_register_instruction(ins->opcode, "ADD", line_no);
-            break;
+    for (uint16_t i = 0; i < segment_count; i++)
+    {
+        if (segments[i].length == 0)
+            continue;
+        image->segments[image->segment_count++] = segments[i];
+    }
 
-        case OP_SUB:
-            emit_two_register_instruction(ins->opcode, "SUB", line_no);
-            break;
+    image->org = image->segment_count ? image->segments[0].addr : segments[0].addr;
+    image->size = (uint32_t)out_pos;
+    memcpy(image->bytes, output_buf, out_pos);
+    labels_valid = true;
 
-        case OP_MLP:
-            emit_two_register_instruction(ins->opcode, "MLP", line_no);
-            break;
+    return (int)out_pos;
+}
 
-        case OP_DIV:
-            emit_two_register_instruction(ins->opcode, "DIV", line_no);
-            break;
+int assemble_source(FILE *input, Image *image, char *error, size_t error_size)
+{
+    jmp_buf jump;
+    int size = -1;
 
-        case OP_STORE:
-            emit_reg_addr_instruction(ins->opcode, "STORE", line_no);
-            break;
+    error_out = error;
+    error_out_size = error_size;
+    error_jump = &jump;
 
-        case OP_LOAD_MEM:
-            emit_reg_addr_instruction(ins->opcode, "LOAD_MEM", line_no);
-            break;
+    if (setjmp(jump) == 0)
+        size = assemble_image(input, image);
 
-        case OP_HALT:
-            emit8(OP_HALT);
-            break;
+    error_jump = NULL;
+    return size;
+}
 
-        default:
-            fatal("Unhandled opcode", line_no);
-        }
+int assemble_line(const char *text, int line_no, uint16_t addr, uint8_t out[ISA_MAX_SIZE],
+                  char *error, size_t error_size)
+{
+    char line[MAX_LINE];
+    jmp_buf jump;
+    int size = -1;
 
-        pc += ins->size;
+    if (!labels_valid)
+    {
+        snprintf(error, error_size, "no previous assembly to patch");
+        return -1;
+    }
+
+    snprintf(line, sizeof(line), "%s", text);
+
+    error_out = error;
+    error_out_size = error_size;
+    error_jump = &jump;
+
+    if (setjmp(jump) == 0)
+    {
+        pc = addr;
+        out_pos = 0;
+        segment_count = 0;
+        begin_segment(addr, line_no);
+
+        if (emit_line(line, line_no))
+            snprintf(error, error_size, "line %d: defines a label or .org", line_no);
+        else
+            size = (int)out_pos;
     }
+
+    error_jump = NULL;
+    if (size > 0)
+        memcpy(out, output_buf, (size_t)size);
+    return size;
 }
 
-/* ================= public API ================= */
+const AsmLine *assembler_lines(size_t *count)
+{
+    *count = labels_valid ? line_map_count : 0;
+    return line_map;
+}
+
+const char *assembler_label_at(uint16_t addr, uint16_t *label_addr)
+{
+    const Label *best = NULL;
+
+    if (!labels_valid)
+        return NULL;
+
+    for (size_t i = 0; i < label_count; i++)
+    {
+        if (labels[i].addr <= addr && (!best || labels[i].addr > best->addr))
+            best = &labels[i];
+    }
+
+    if (!best)
+        return NULL;
+
+    *label_addr = best->addr;
+    return best->name;
+}
 
 int assemble(FILE *input, FILE *output, uint16_t *out_org)
 {
-    org_base = 0;
-    pass1(input);
-    pass2(input);
+    static Image image;
+    int size = assemble_image(input, &image);
 
     if (out_org)
-        *out_org = org_base;
+        *out_org = image.org;
 
-    fwrite(output_buf, 1, out_pos, output);
-    return (int)out_pos;
-}
\ No newline at end of file
+    fwrite(image.bytes, 1, image.size, output);
+    return size;
+}
@@ -0,0 +1,358 @@
+#include "cache_sim.h"
+#include "assembler.h"
+#include "isa.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_LINE UINT32_MAX
+
+typedef struct
+{
+    CacheGeometry g;
+    uint32_t line_shift;
+    uint32_t set_mask;
+    uint32_t *tags;         // line number per way, NO_LINE when empty
+    uint64_t *used;         // LRU stamp per way
+    uint8_t *dirty;
+    uint64_t clock;
+    uint32_t last_line;     // most recently used line and its slot, a hit
+    uint32_t last_slot;
+    CacheStats stats;
+} Cache;
+
+struct CacheSim
+{
+    RamAccessLog log;       // first, so drain can cast back
+    CacheSimConfig config;
+    Cache icache;
+    Cache dcache;
+
+    uint64_t instructions;
+    uint64_t base_cycles;
+    uint16_t pc;            // instruction being replayed
+    bool opcode_next;       // its opcode is the next fetch
+    uint32_t fetch_line;    // last line fetched for it
+
+    uint32_t misses[RAM_SIZE];  // by instruction address
+};
+
+/* ================= configuration ================= */
+
+static bool power_of_two(uint32_t n)
+{
+    return n && !(n & (n - 1));
+}
+
+void cache_sim_default_config(CacheSimConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    cache_sim_parse_geometry(CACHE_SIM_DEFAULT_ICACHE, &config->icache);
+    cache_sim_parse_geometry(CACHE_SIM_DEFAULT_DCACHE, &config->dcache);
+    config->miss_penalty = CACHE_SIM_DEFAULT_MISS_PENALTY;
+
+    // The costs the guest's RDCYC counter uses
+    for (uint32_t op = 0; op < 256; op++)
+        config->cycles[op] = isa_table[op].cycles;
+}
+
+bool cache_sim_parse_geometry(const char *spec, CacheGeometry *g)
+{
+    char *end;
+    unsigned long size = strtoul(spec, &end, 0);
+    unsigned long line = *end == ':' ? strtoul(end + 1, &end, 0) : 0;
+    unsigned long ways = *end == ':' ? strtoul(end + 1, &end, 0) : 0;
+
+    if (*end != '\0' || size > RAM_SIZE || !power_of_two((uint32_t)size) ||
+        !power_of_two((uint32_t)line) || !power_of_two((uint32_t)ways) || line * ways > size)
+    {
+        log_write(LOG_ERROR, "Bad cache geometry '%s' (want <size>:<line>:<ways>, powers of two)", spec);
+        return false;
+    }
+
+    g->size = (uint32_t)size;
+    g->line = (uint32_t)line;
+    g->ways = (uint32_t)ways;
+    return true;
+}
+
+bool cache_sim_load_cycles(CacheSimConfig *config, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", path);
+        return false;
+    }
+
+    char line[128];
+    int line_no = 0;
+    bool ok = true;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char mnemonic[32];
+        unsigned cycles;
+
+        line_no++;
+        char *comment = strchr(line, ';');
+        if (comment)
+            *comment = '\0';
+
+        int n = sscanf(line, " %31s %u", mnemonic, &cycles);
+        if (n <= 0)
+            continue;
+
+        const IsaInstr *insn = n == 2 ? isa_lookup(mnemonic) : NULL;
+        if (!insn)
+        {
+            log_write(LOG_ERROR, "%s:%d: want <MNEMONIC> <cycles>", path, line_no);
+            ok = false;
+            break;
+        }
+        config->cycles[insn->opcode] = cycles;
+    }
+
+    fclose(f);
+    return ok;
+}
+
+/* ================= caches ================= */
+
+static bool cache_init(Cache *c, const CacheGeometry *g)
+{
+    uint32_t lines = g->size / g->line;
+
+    memset(c, 0, sizeof(*c));
+    c->g = *g;
+    c->line_shift = (uint32_t)__builtin_ctz(g->line);
+    c->set_mask = lines / g->ways - 1;
+    c->tags = malloc(lines * sizeof(uint32_t));
+    c->used = calloc(lines, sizeof(uint64_t));
+    c->dirty = calloc(lines, 1);
+
+    if (!c->tags || !c->used || !c->dirty)
+        return false;
+
+    for (uint32_t i = 0; i < lines; i++)
+        c->tags[i] = NO_LINE;
+    c->last_line = NO_LINE;
+    return true;
+}
+
+static void cache_free(Cache *c)
+{
+    free(c->tags);
+    free(c->used);
+    free(c->dirty);
+}
+
+// True on a hit; a miss fills the least recently used way of the set
+static bool cache_access(Cache *c, uint32_t line, bool write)
+{
+    c->stats.accesses++;
+
+    // Already the newest in its set, so LRU order stays as it is
+    if (line == c->last_line)
+    {
+        c->dirty[c->last_slot] |= write;
+        return true;
+    }
+
+    uint32_t base = (line & c->set_mask) * c->g.ways;
+    uint32_t *tags = &c->tags[base];
+    uint64_t *used = &c->used[base];
+    uint32_t victim = 0;
+
+    c->clock++;
+    c->last_line = line;
+
+    for (uint32_t w = 0; w < c->g.ways; w++)
+    {
+        if (tags[w] == line)
+        {
+            used[w] = c->clock;
+            c->dirty[base + w] |= write;
+            c->last_slot = base + w;
+            return true;
+        }
+        if (used[w] < used[victim])
+            victim = w;
+    }
+
+    c->stats.misses++;
+    if (c->dirty[base + victim])
+        c->stats.writebacks++;
+
+    tags[victim] = line;
+    used[victim] = c->clock;
+    c->dirty[base + victim] = write;
+    c->last_slot = base + victim;
+    return false;
+}
+
+/* ================= access log ================= */
+
+static void drain(RamAccessLog *log)
+{
+    CacheSim *sim = (CacheSim *)log;
+    Cache *ic = &sim->icache;
+    Cache *dc = &sim->dcache;
+
+    for (uint32_t i = 0; i < log->count; i++)
+    {
+        const RamAccess *a = &log->entries[i];
+
+        switch (a->kind)
+        {
+        case RAM_ACCESS_INSN:
+            sim->pc = a->addr;
+            sim->opcode_next = true;
+            sim->fetch_line = NO_LINE;
+            sim->instructions++;
+            break;
+
+        case RAM_ACCESS_FETCH:
+        {
+            uint32_t line = a->addr >> ic->line_shift;
+
+            if (sim->opcode_next)
+            {
+                sim->base_cycles += sim->config.cycles[a->value];
+                sim->opcode_next = false;
+            }
+            if (line != sim->fetch_line)
+            {
+                sim->fetch_line = line;
+                if (!cache_access(ic, line, false))
+                    sim->misses[sim->pc]++;
+            }
+            break;
+        }
+
+        case RAM_ACCESS_READ:
+        case RAM_ACCESS_WRITE:
+            if (!cache_access(dc, a->addr >> dc->line_shift, a->kind == RAM_ACCESS_WRITE))
+                sim->misses[sim->pc]++;
+            break;
+        }
+    }
+
+    log->count = 0;
+}
+
+CacheSim *cache_sim_create(const CacheSimConfig *config)
+{
+    CacheSim *sim = calloc(1, sizeof(CacheSim));
+    if (!sim)
+        return NULL;
+
+    sim->config = *config;
+    sim->log.drain = drain;
+    sim->fetch_line = NO_LINE;
+
+    if (!cache_init(&sim->icache, &config->icache) || !cache_init(&sim->dcache, &config->dcache))
+    {
+        cache_sim_destroy(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+void cache_sim_destroy(CacheSim *sim)
+{
+    if (!sim)
+        return;
+
+    cache_free(&sim->icache);
+    cache_free(&sim->dcache);
+    free(sim);
+}
+
+void cache_sim_attach(CacheSim *sim, Ram *ram)
+{
+    ram->access_log = &sim->log;
+}
+
+void cache_sim_detach(CacheSim *sim, Ram *ram)
+{
+    drain(&sim->log);
+    ram->access_log = NULL;
+}
+
+/* ================= results ================= */
+
+void cache_sim_stats(CacheSim *sim, CacheSimStats *stats)
+{
+    drain(&sim->log);
+
+    stats->instructions = sim->instructions;
+    stats->icache = sim->icache.stats;
+    stats->dcache = sim->dcache.stats;
+    stats->cycles = sim->base_cycles +
+                    (stats->icache.misses + stats->dcache.misses + stats->dcache.writebacks) *
+                    (uint64_t)sim->config.miss_penalty;
+}
+
+static void report_cache(FILE *out, const char *name, const Cache *c)
+{
+    const CacheStats *s = &c->stats;
+    double hit_rate = s->accesses ? 100.0 * (double)(s->accesses - s->misses) / (double)s->accesses : 0.0;
+
+    fprintf(out, "%s %u bytes, %u-byte lines, %u-way: %llu accesses, %llu misses (%.2f%% hits)",
+            name, c->g.size, c->g.line, c->g.ways, (unsigned long long)s->accesses,
+            (unsigned long long)s->misses, hit_rate);
+    if (s->writebacks)
+        fprintf(out, ", %llu writebacks", (unsigned long long)s->writebacks);
+    fprintf(out, "\n");
+}
+
+void cache_sim_report(CacheSim *sim, FILE *out)
+{
+    CacheSimStats stats;
+    cache_sim_stats(sim, &stats);
+
+    report_cache(out, "I-cache", &sim->icache);
+    report_cache(out, "D-cache", &sim->dcache);
+    fprintf(out, "Estimated cycles: %llu for %llu instructions (CPI %.2f), %llu in memory stalls\n",
+            (unsigned long long)stats.cycles, (unsigned long long)stats.instructions,
+            stats.instructions ? (double)stats.cycles / (double)stats.instructions : 0.0,
+            (unsigned long long)(stats.cycles - sim->base_cycles));
+
+    // Pick the worst instructions by repeated selection; the list is short
+    uint32_t top[CACHE_SIM_REPORT_TOP];
+    uint32_t count = 0;
+
+    for (uint32_t addr = 0; addr < RAM_SIZE; addr++)
+    {
+        uint32_t m = sim->misses[addr];
+        if (!m || (count == CACHE_SIM_REPORT_TOP && m <= sim->misses[top[count - 1]]))
+            continue;
+
+        uint32_t i = count < CACHE_SIM_REPORT_TOP ? count++ : count - 1;
+        while (i > 0 && sim->misses[top[i - 1]] < m)
+        {
+            top[i] = top[i - 1];
+            i--;
+        }
+        top[i] = addr;
+    }
+
+    if (count)
+        fprintf(out, "Most misses:\n");
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint16_t label_addr = 0;
+        const char *label = assembler_label_at((uint16_t)top[i], &label_addr);
+
+        fprintf(out, "  0x%04X", top[i]);
+        if (label && top[i] != label_addr)
+            fprintf(out, " %s+%u", label, top[i] - label_addr);
+        else if (label)
+            fprintf(out, " %s", label);
+        fprintf(out, ": %u miss%s\n", sim->misses[top[i]], sim->misses[top[i]] == 1 ? "" : "es");
+    }
+}
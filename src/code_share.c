@@ -0,0 +1,159 @@
+#include "code_share.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct CodeShare
+{
+    SharedBlock *heads[RAM_SIZE];   // newest entry starting at each address
+    uint8_t *arena;
+    size_t size;
+    size_t used;                    // may run past size once full
+
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t blocks;
+};
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+CodeShare *code_share_create(size_t size)
+{
+    CodeShare *cs = calloc(1, sizeof(CodeShare));
+    if (!cs)
+        return NULL;
+
+    cs->size = size;
+    cs->arena = malloc(size);
+    if (!cs->arena)
+    {
+        free(cs);
+        return NULL;
+    }
+
+    return cs;
+}
+
+void code_share_destroy(CodeShare *cs)
+{
+    if (!cs)
+        return;
+    free(cs->arena);
+    free(cs);
+}
+
+// True if ram and verify still hold what e was decoded from
+static bool matches(const SharedBlock *e, const Ram *ram, const uint8_t *verify, bool memo_enabled)
+{
+    uint32_t len = (uint32_t)e->end - e->start + 1;
+
+    if (e->memo_enabled != memo_enabled || memcmp(e->bytes + len, verify + e->start, len) != 0)
+        return false;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (ram_load_fast(ram, (uint16_t)(e->start + i)) != e->bytes[i])
+            return false;
+    }
+
+    return true;
+}
+
+const SharedBlock *code_share_find(CodeShare *cs, const Ram *ram, const uint8_t *verify,
+                                   uint16_t start, bool memo_enabled)
+{
+    const SharedBlock *e = __atomic_load_n(&cs->heads[start], __ATOMIC_ACQUIRE);
+
+    __atomic_fetch_add(&cs->lookups, 1, __ATOMIC_RELAXED);
+
+    for (; e; e = e->next)
+    {
+        if (matches(e, ram, verify, memo_enabled))
+        {
+            __atomic_fetch_add(&cs->hits, 1, __ATOMIC_RELAXED);
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t count_variants(const SharedBlock *head)
+{
+    uint32_t variants = 0;
+
+    for (const SharedBlock *e = head; e; e = e->next)
+        variants++;
+    return variants;
+}
+
+bool code_share_publish(CodeShare *cs, const Ram *ram, const uint8_t *verify, const Block *b,
+                        bool memo_enabled)
+{
+    SharedBlock *head = __atomic_load_n(&cs->heads[b->start], __ATOMIC_ACQUIRE);
+
+    if (count_variants(head) >= CODE_SHARE_MAX_VARIANTS ||
+        __atomic_load_n(&cs->used, __ATOMIC_RELAXED) >= cs->size)
+        return false;
+
+    uint32_t len = (uint32_t)b->end - b->start + 1;
+    size_t insns_size = align8(b->count * sizeof(DecodedInsn));
+    size_t memo_size = b->memo ? align8(sizeof(MemoShape)) : 0;
+    size_t need = align8(sizeof(SharedBlock)) + insns_size + memo_size + align8(2 * len);
+
+    // Entries that do not fit are lost; the early check above stops later attempts
+    size_t at = __atomic_fetch_add(&cs->used, need, __ATOMIC_RELAXED);
+    if (at + need > cs->size)
+        return false;
+
+    SharedBlock *e = (SharedBlock *)(cs->arena + at);
+    uint8_t *tail = (uint8_t *)e->insns + insns_size;
+
+    e->start = b->start;
+    e->end = b->end;
+    e->count = b->count;
+    e->memo_enabled = memo_enabled;
+    e->kernel_only = b->kernel_only;
+    e->cycles = b->cycles;
+    memcpy(e->insns, b->insns, b->count * sizeof(DecodedInsn));
+
+    e->memo = NULL;
+    if (b->memo)
+    {
+        memcpy(tail, b->memo, sizeof(MemoShape));
+        e->memo = (const MemoShape *)tail;
+        tail += memo_size;
+    }
+
+    for (uint32_t i = 0; i < len; i++)
+        tail[i] = ram_load_fast(ram, (uint16_t)(b->start + i));
+    memcpy(tail + len, verify + b->start, len);
+    e->bytes = tail;
+
+    // Readers see the entry only once it is complete. A failed exchange
+    // means another entry went in first: count again, so racing publishers
+    // cannot exceed the limit (a refused entry stays unused in the arena)
+    do
+    {
+        if (count_variants(head) >= CODE_SHARE_MAX_VARIANTS)
+            return false;
+        e->next = head;
+    } while (!__atomic_compare_exchange_n(&cs->heads[b->start], &head, e, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    __atomic_fetch_add(&cs->blocks, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void code_share_stats(const CodeShare *cs, CodeShareStats *stats)
+{
+    stats->lookups = __atomic_load_n(&cs->lookups, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&cs->hits, __ATOMIC_RELAXED);
+    stats->blocks = __atomic_load_n(&cs->blocks, __ATOMIC_RELAXED);
+
+    size_t used = __atomic_load_n(&cs->used, __ATOMIC_RELAXED);
+    stats->bytes = used < cs->size ? used : cs->size;
+}
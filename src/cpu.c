@@ -1,6 +1,8 @@
 #include "cpu.h"
 #include "log.h"
 
+#include <stddef.h>
+
 void cpu_init(Cpu *cpu, bool privileged)
 {
     log_write(LOG_INFO, "CPU initialization started");
@@ -15,13 +17,37 @@ void cpu_init(Cpu *cpu, bool privileged)
     cpu->PC = 0;
     log_write(LOG_DEBUG, "Program Counter set to 0");
 
+    cpu->SP = 0;
+    cpu->flags.op = FLAGS_NONE;
+    cpu->flags.a = 0;
+    cpu->flags.b = 0;
+    log_write(LOG_DEBUG, "Stack Pointer set to 0 (first push lands at 0xFFFE)");
+
     cpu->running = true;
+    cpu->fault = CPU_FAULT_NONE;
     log_write(LOG_DEBUG, "CPU running flag set to true");
 
     cpu->privileged = privileged;
     log_write(LOG_DEBUG, "CPU privileged mode set to %s",
               privileged ? "true" : "false");
 
+    cpu->instret = 0;
+    cpu->batch_end = 0;
+    cpu->cycles = 0;
+    cpu->counter_instret_base = 0;
+    cpu->counter_cycles_base = 0;
+    cpu->counter_latch[CPU_COUNTER_INSTRET] = 0;
+    cpu->counter_latch[CPU_COUNTER_CYCLES] = 0;
+    cpu->irq_pending = 0;
+    cpu->irq_enabled = false;
+    cpu->in_irq = false;
+    cpu->irq_saved_privileged = false;
+    cpu->irq_saved_PC = 0;
+    cpu->irq_saved_flags = cpu->flags;
+    cpu->sched = NULL;
+    cpu->timer = NULL;
+    log_write(LOG_DEBUG, "Interrupts disabled, no devices attached");
+
     log_write(LOG_INFO, "CPU initialization completed successfully");
 }
 
@@ -52,6 +78,14 @@ void cpu_print(Cpu *cpu)
         cpu->PC
     );
 
+    log_write(
+        LOG_INFO,
+        "Stack Pointer at 0x%04X, flags Z=%d C=%d",
+        cpu->SP,
+        cpu_flag_zero(cpu),
+        cpu_flag_carry(cpu)
+    );
+
     log_write(
         LOG_INFO,
         "CPU state: %s",
@@ -64,3 +98,49 @@ void cpu_print(Cpu *cpu)
         cpu->privileged ? "privileged" : "user"
     );
 }
+
+static uint16_t flags_result(const CpuFlags *f)
+{
+    switch (f->op)
+    {
+    case FLAGS_ADD16:
+        return (uint16_t)(f->a + f->b);
+    case FLAGS_SUB16:
+        return (uint16_t)(f->a - f->b);
+    case FLAGS_ADD:
+        return (uint8_t)(f->a + f->b);
+    case FLAGS_SUB:
+        return (uint8_t)(f->a - f->b);
+    case FLAGS_MLP:
+        return (uint8_t)(f->a * f->b);
+    case FLAGS_DIV:
+        return f->b ? (uint8_t)(f->a / f->b) : 0;
+    default:
+        return 1;
+    }
+}
+
+bool cpu_flag_zero(const Cpu *cpu)
+{
+    return cpu->flags.op != FLAGS_NONE && flags_result(&cpu->flags) == 0;
+}
+
+bool cpu_flag_carry(const Cpu *cpu)
+{
+    const CpuFlags *f = &cpu->flags;
+
+    switch (f->op)
+    {
+    case FLAGS_ADD:
+        return (unsigned)f->a + f->b > 0xFF;
+    case FLAGS_SUB:
+    case FLAGS_SUB16:
+        return f->a < f->b;
+    case FLAGS_ADD16:
+        return (uint32_t)f->a + f->b > 0xFFFF;
+    case FLAGS_MLP:
+        return (unsigned)f->a * f->b > 0xFF;
+    default:
+        return false;
+    }
+}
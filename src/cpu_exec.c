@@ -1,6 +1,8 @@
 #include "cpu_exec.h"
 #include "log.h"
 #include "isa.h"
+#include "sched.h"
+#include "timer.h"
 #include <stdint.h>
 
 /*
@@ -10,6 +12,19 @@
  * ADD/SUB   : [opcode][dst][src]
  * STORE     : [opcode][reg][hi][lo]
  * LOAD_MEM  : [opcode][reg][hi][lo]
+ * MAP       : [opcode][page][hi][lo]   (registers)
+ * TLBFLUSH  : [opcode]
+ * EI/DI     : [opcode]
+ * IRET      : [opcode]
+ * TIMER     : [opcode][hi][lo]          (registers)
+ * CMP       : [opcode][a][b]
+ * JMP/JZ/JNZ/JC/CALL : [opcode][hi][lo]
+ * RET       : [opcode]
+ * LOAD_IMM16: [opcode][pair][hi][lo]
+ * ADD16/SUB16: [opcode][dst pair][src pair]
+ * LOAD_IND/STORE_IND: [opcode][reg][pair | 0x80 post-increment]
+ * RDINS/RDCYC: [opcode][pair][word]
+ * CLRCNT    : [opcode]
  */
 
 static void op_load_imm(Cpu *cpu, Ram *ram)
@@ -19,21 +34,21 @@ static void op_load_imm(Cpu *cpu, Ram *ram)
     if (!ram_read(ram, cpu->PC++, &reg, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (reg) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (!ram_read(ram, cpu->PC++, &imm, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (imm) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (reg >= REG_COUNT)
     {
         log_write(LOG_ERROR, "LOAD_IMM invalid register R%d", reg);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
@@ -49,27 +64,28 @@ static void op_add(Cpu *cpu, Ram *ram)
     if (!ram_read(ram, cpu->PC++, &dst, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (dst) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (!ram_read(ram, cpu->PC++, &src, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (src) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (dst >= REG_COUNT || src >= REG_COUNT)
     {
         log_write(LOG_ERROR, "ADD invalid register dst=R%d src=R%d", dst, src);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
     log_write(LOG_DEBUG, "ADD R%d = R%d (0x%02X) + R%d (0x%02X)",
               dst, dst, cpu->R[dst], src, cpu->R[src]);
 
+    cpu_record_flags(cpu, FLAGS_ADD, cpu->R[dst], cpu->R[src]);
     cpu->R[dst] += cpu->R[src];
 }
 
@@ -80,27 +96,28 @@ static void op_sub(Cpu *cpu, Ram *ram)
     if (!ram_read(ram, cpu->PC++, &dst, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (dst) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (!ram_read(ram, cpu->PC++, &src, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (src) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (dst >= REG_COUNT || src >= REG_COUNT)
     {
         log_write(LOG_ERROR, "SUB invalid register dst=R%d src=R%d", dst, src);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
     log_write(LOG_DEBUG, "SUB R%d = R%d (0x%02X) - R%d (0x%02X)",
               dst, dst, cpu->R[dst], src, cpu->R[src]);
 
+    cpu_record_flags(cpu, FLAGS_SUB, cpu->R[dst], cpu->R[src]);
     cpu->R[dst] -= cpu->R[src];
 }
 
@@ -110,26 +127,27 @@ static void op_mlp(Cpu *cpu, Ram *ram)
     if (!ram_read(ram, cpu->PC++, &dst, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (dst) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (!ram_read(ram, cpu->PC++, &src, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (src) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (dst >= REG_COUNT || src >= REG_COUNT)
     {
         log_write(LOG_ERROR, "MLP invalid register dst=R%d src=R%d", dst, src);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
-    log_write(LOG_DEBUG, "MLP R%d = R%d (0x%02X) + R%d (0x%02X)",
+    log_write(LOG_DEBUG, "MLP R%d = R%d (0x%02X) * R%d (0x%02X)",
               dst, dst, cpu->R[dst], src, cpu->R[src]);
+    cpu_record_flags(cpu, FLAGS_MLP, cpu->R[dst], cpu->R[src]);
     cpu->R[dst] *= cpu->R[src];
 }
 
@@ -139,26 +157,34 @@ static void op_div(Cpu *cpu, Ram *ram)
     if (!ram_read(ram, cpu->PC++, &dst, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (dst) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (!ram_read(ram, cpu->PC++, &src, cpu->privileged))
     {
         log_write(LOG_ERROR, "RAM read failed (src) at PC=0x%04X", cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (dst >= REG_COUNT || src >= REG_COUNT)
     {
         log_write(LOG_ERROR, "DIV invalid register dst=R%d src=R%d", dst, src);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
-    log_write(LOG_DEBUG, "DIV R%d = R%d (0x%02X) + R%d (0x%02X)",
+    if (cpu->R[src] == 0)
+    {
+        log_write(LOG_ERROR, "DIV by zero (R%d) at PC=0x%04X", src, cpu->PC - 3);
+        cpu_fault(cpu, CPU_FAULT_DIV_ZERO);
+        return;
+    }
+
+    log_write(LOG_DEBUG, "DIV R%d = R%d (0x%02X) / R%d (0x%02X)",
               dst, dst, cpu->R[dst], src, cpu->R[src]);
+    cpu_record_flags(cpu, FLAGS_DIV, cpu->R[dst], cpu->R[src]);
     cpu->R[dst] /= cpu->R[src];
 }
 
@@ -171,14 +197,14 @@ static void op_store(Cpu *cpu, Ram *ram)
         !ram_read(ram, cpu->PC++, &lo,  cpu->privileged))
     {
         log_write(LOG_ERROR, "STORE operand fetch failed");
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (reg >= REG_COUNT)
     {
         log_write(LOG_ERROR, "STORE invalid register R%d", reg);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
@@ -187,7 +213,7 @@ static void op_store(Cpu *cpu, Ram *ram)
     if (!ram_write(ram, addr, cpu->R[reg], cpu->privileged))
     {
         log_write(LOG_ERROR, "STORE write failed at 0x%04X", addr);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
@@ -204,7 +230,7 @@ static void op_load_mem(Cpu *cpu, Ram *ram)
     {
         log_write(LOG_ERROR, "RAM read failed (LOAD_MEM reg) at PC=0x%04X",
                   cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
@@ -212,7 +238,7 @@ static void op_load_mem(Cpu *cpu, Ram *ram)
     {
         log_write(LOG_ERROR, "RAM read failed (LOAD_MEM hi) at PC=0x%04X",
                   cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
@@ -220,14 +246,14 @@ static void op_load_mem(Cpu *cpu, Ram *ram)
     {
         log_write(LOG_ERROR, "RAM read failed (LOAD_MEM lo) at PC=0x%04X",
                   cpu->PC - 1);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
     if (reg >= REG_COUNT)
     {
         log_write(LOG_ERROR, "LOAD_MEM invalid register R%d", reg);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_INVALID);
         return;
     }
 
@@ -237,7 +263,7 @@ static void op_load_mem(Cpu *cpu, Ram *ram)
     {
         log_write(LOG_ERROR, "RAM read failed (LOAD_MEM data) at addr=0x%04X",
                   addr);
-        cpu->running = false;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
         return;
     }
 
@@ -245,6 +271,426 @@ static void op_load_mem(Cpu *cpu, Ram *ram)
               reg, addr, cpu->R[reg]);
 }
 
+static void op_cmp(Cpu *cpu, Ram *ram)
+{
+    uint8_t a, b;
+
+    if (!ram_read(ram, cpu->PC++, &a, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &b, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "CMP operand fetch failed");
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (a >= REG_COUNT || b >= REG_COUNT)
+    {
+        log_write(LOG_ERROR, "CMP invalid register R%d, R%d", a, b);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    log_write(LOG_DEBUG, "CMP R%d (0x%02X), R%d (0x%02X)",
+              a, cpu->R[a], b, cpu->R[b]);
+
+    cpu_record_flags(cpu, FLAGS_SUB, cpu->R[a], cpu->R[b]);
+}
+
+static bool fetch_target(Cpu *cpu, Ram *ram, uint16_t *target, const char *name)
+{
+    uint8_t hi, lo;
+
+    if (!ram_read(ram, cpu->PC++, &hi, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &lo, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "%s operand fetch failed", name);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return false;
+    }
+
+    *target = (hi << 8) | lo;
+    return true;
+}
+
+static void op_jmp(Cpu *cpu, Ram *ram)
+{
+    uint16_t target;
+
+    if (!fetch_target(cpu, ram, &target, "JMP"))
+        return;
+
+    log_write(LOG_DEBUG, "JMP 0x%04X", target);
+    cpu->PC = target;
+}
+
+static void branch_if(Cpu *cpu, Ram *ram, bool taken, const char *name)
+{
+    uint16_t target;
+
+    if (!fetch_target(cpu, ram, &target, name))
+        return;
+
+    log_write(LOG_DEBUG, "%s 0x%04X %s", name, target, taken ? "taken" : "not taken");
+
+    if (taken)
+        cpu->PC = target;
+}
+
+static void op_jz(Cpu *cpu, Ram *ram)
+{
+    branch_if(cpu, ram, cpu_flag_zero(cpu), "JZ");
+}
+
+static void op_jnz(Cpu *cpu, Ram *ram)
+{
+    branch_if(cpu, ram, !cpu_flag_zero(cpu), "JNZ");
+}
+
+static void op_jc(Cpu *cpu, Ram *ram)
+{
+    branch_if(cpu, ram, cpu_flag_carry(cpu), "JC");
+}
+
+static void op_call(Cpu *cpu, Ram *ram)
+{
+    uint16_t target;
+
+    if (!fetch_target(cpu, ram, &target, "CALL"))
+        return;
+
+    uint16_t sp = cpu->SP - 2;
+
+    if (!ram_write(ram, sp, cpu->PC >> 8, cpu->privileged) ||
+        !ram_write(ram, (uint16_t)(sp + 1), cpu->PC & 0xFF, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "CALL stack push failed at SP=0x%04X", sp);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    log_write(LOG_DEBUG, "CALL 0x%04X (return 0x%04X, SP=0x%04X)", target, cpu->PC, sp);
+
+    cpu->SP = sp;
+    cpu->PC = target;
+}
+
+static void op_ret(Cpu *cpu, Ram *ram)
+{
+    uint8_t hi, lo;
+
+    if (!ram_read(ram, cpu->SP, &hi, cpu->privileged) ||
+        !ram_read(ram, (uint16_t)(cpu->SP + 1), &lo, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "RET stack pop failed at SP=0x%04X", cpu->SP);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    cpu->SP += 2;
+    cpu->PC = (hi << 8) | lo;
+
+    log_write(LOG_DEBUG, "RET -> 0x%04X (SP=0x%04X)", cpu->PC, cpu->SP);
+}
+
+/* ================= register pairs ================= */
+
+static void op_load_imm16(Cpu *cpu, Ram *ram)
+{
+    uint8_t pair, hi, lo;
+
+    if (!ram_read(ram, cpu->PC++, &pair, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &hi, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &lo, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "LOAD_IMM16 operand fetch failed");
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (pair >= PAIR_COUNT)
+    {
+        log_write(LOG_ERROR, "LOAD_IMM16 invalid pair P%d", pair);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    cpu_set_pair(cpu, pair, (hi << 8) | lo);
+
+    log_write(LOG_DEBUG, "LOAD_IMM16 P%d <- 0x%04X", pair, cpu_pair(cpu, pair));
+}
+
+static void pair_arith(Cpu *cpu, Ram *ram, const char *name, FlagsOp op)
+{
+    uint8_t dst, src;
+
+    if (!ram_read(ram, cpu->PC++, &dst, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &src, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "%s operand fetch failed", name);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (dst >= PAIR_COUNT || src >= PAIR_COUNT)
+    {
+        log_write(LOG_ERROR, "%s invalid pair dst=P%d src=P%d", name, dst, src);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    uint16_t a = cpu_pair(cpu, dst);
+    uint16_t b = cpu_pair(cpu, src);
+
+    cpu_record_flags(cpu, op, a, b);
+    cpu_set_pair(cpu, dst, op == FLAGS_ADD16 ? a + b : a - b);
+
+    log_write(LOG_DEBUG, "%s P%d = 0x%04X %c P%d (0x%04X)",
+              name, dst, a, op == FLAGS_ADD16 ? '+' : '-', src, b);
+}
+
+static void op_add16(Cpu *cpu, Ram *ram)
+{
+    pair_arith(cpu, ram, "ADD16", FLAGS_ADD16);
+}
+
+static void op_sub16(Cpu *cpu, Ram *ram)
+{
+    pair_arith(cpu, ram, "SUB16", FLAGS_SUB16);
+}
+
+// Operands of LOAD_IND/STORE_IND; on success *addr is the pair's value
+static bool fetch_indirect(Cpu *cpu, Ram *ram, const char *name,
+                           uint8_t *reg, uint8_t *pair, bool *post_inc, uint16_t *addr)
+{
+    uint8_t operand;
+
+    if (!ram_read(ram, cpu->PC++, reg, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &operand, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "%s operand fetch failed", name);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return false;
+    }
+
+    *pair = operand & ISA_IND_PAIR_MASK;
+    *post_inc = operand & ISA_IND_POST_INC;
+
+    if (*reg >= REG_COUNT || *pair >= PAIR_COUNT)
+    {
+        log_write(LOG_ERROR, "%s invalid operands R%d, P%d", name, *reg, *pair);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return false;
+    }
+
+    *addr = cpu_pair(cpu, *pair);
+    return true;
+}
+
+static void op_load_ind(Cpu *cpu, Ram *ram)
+{
+    uint8_t reg, pair, value;
+    bool post_inc;
+    uint16_t addr;
+
+    if (!fetch_indirect(cpu, ram, "LOAD_IND", &reg, &pair, &post_inc, &addr))
+        return;
+
+    if (!ram_read(ram, addr, &value, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "LOAD_IND read failed at 0x%04X", addr);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    // The increment is applied last, so it wins if reg is half of the pair
+    cpu->R[reg] = value;
+    if (post_inc)
+        cpu_set_pair(cpu, pair, addr + 1);
+
+    log_write(LOG_DEBUG, "LOAD_IND R%d <- RAM[0x%04X] (0x%02X)%s",
+              reg, addr, value, post_inc ? ", P++" : "");
+}
+
+static void op_store_ind(Cpu *cpu, Ram *ram)
+{
+    uint8_t reg, pair;
+    bool post_inc;
+    uint16_t addr;
+
+    if (!fetch_indirect(cpu, ram, "STORE_IND", &reg, &pair, &post_inc, &addr))
+        return;
+
+    uint8_t value = cpu->R[reg];
+
+    if (!ram_write(ram, addr, value, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "STORE_IND write failed at 0x%04X", addr);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (post_inc)
+        cpu_set_pair(cpu, pair, addr + 1);
+
+    log_write(LOG_DEBUG, "STORE_IND RAM[0x%04X] <- R%d (0x%02X)%s",
+              addr, reg, value, post_inc ? ", P++" : "");
+}
+
+static bool require_privileged(Cpu *cpu, const char *name)
+{
+    if (!cpu->privileged)
+    {
+        log_write(LOG_UNAUTHORIZED, "%s requires privileged mode (PC=0x%04X)",
+                  name, cpu->PC - 1);
+        cpu_fault(cpu, CPU_FAULT_PRIVILEGED);
+        return false;
+    }
+
+    return true;
+}
+
+static bool require_mmu(Cpu *cpu, Ram *ram, const char *name)
+{
+    if (!require_privileged(cpu, name))
+        return false;
+
+    if (!ram->mmu)
+    {
+        log_write(LOG_ERROR, "%s executed without an MMU attached", name);
+        cpu_fault(cpu, CPU_FAULT_DEVICE);
+        return false;
+    }
+
+    return true;
+}
+
+static void op_map(Cpu *cpu, Ram *ram)
+{
+    uint8_t page, hi, lo;
+
+    if (!ram_read(ram, cpu->PC++, &page, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &hi,   cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &lo,   cpu->privileged))
+    {
+        log_write(LOG_ERROR, "MAP operand fetch failed");
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (page >= REG_COUNT || hi >= REG_COUNT || lo >= REG_COUNT)
+    {
+        log_write(LOG_ERROR, "MAP invalid register R%d, R%d, R%d", page, hi, lo);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    if (!require_mmu(cpu, ram, "MAP"))
+        return;
+
+    uint16_t frame = (cpu->R[hi] << 8) | cpu->R[lo];
+
+    log_write(LOG_DEBUG, "MAP page 0x%02X -> frame 0x%04X", cpu->R[page], frame);
+
+    if (!mmu_map(ram->mmu, cpu->R[page], frame))
+        cpu_fault(cpu, CPU_FAULT_DEVICE);
+}
+
+static void op_tlbflush(Cpu *cpu, Ram *ram)
+{
+    if (!require_mmu(cpu, ram, "TLBFLUSH"))
+        return;
+
+    log_write(LOG_DEBUG, "TLBFLUSH");
+    mmu_flush_tlb(ram->mmu);
+}
+
+static void op_ei(Cpu *cpu, Ram *ram)
+{
+    (void)ram;
+
+    if (!require_privileged(cpu, "EI"))
+        return;
+
+    log_write(LOG_DEBUG, "EI");
+    cpu->irq_enabled = true;
+
+    // Deliver anything already pending right after this instruction
+    if (cpu->irq_pending)
+        cpu->batch_end = cpu->instret;
+}
+
+static void op_di(Cpu *cpu, Ram *ram)
+{
+    (void)ram;
+
+    if (!require_privileged(cpu, "DI"))
+        return;
+
+    log_write(LOG_DEBUG, "DI");
+    cpu->irq_enabled = false;
+}
+
+static void op_iret(Cpu *cpu, Ram *ram)
+{
+    (void)ram;
+
+    if (!require_privileged(cpu, "IRET"))
+        return;
+
+    if (!cpu->in_irq)
+    {
+        log_write(LOG_ERROR, "IRET outside of an interrupt handler at PC=0x%04X", cpu->PC - 1);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    log_write(LOG_DEBUG, "IRET -> PC=0x%04X", cpu->irq_saved_PC);
+
+    cpu->PC = cpu->irq_saved_PC;
+    cpu->privileged = cpu->irq_saved_privileged;
+    cpu->flags = cpu->irq_saved_flags;
+    cpu->in_irq = false;
+
+    if (cpu->irq_pending)
+        cpu->batch_end = cpu->instret;
+}
+
+static void op_timer(Cpu *cpu, Ram *ram)
+{
+    uint8_t hi, lo;
+
+    if (!ram_read(ram, cpu->PC++, &hi, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &lo, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "TIMER operand fetch failed");
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (hi >= REG_COUNT || lo >= REG_COUNT)
+    {
+        log_write(LOG_ERROR, "TIMER invalid register R%d, R%d", hi, lo);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    if (!require_privileged(cpu, "TIMER"))
+        return;
+
+    if (!cpu->timer)
+    {
+        log_write(LOG_ERROR, "TIMER executed without a timer attached");
+        cpu_fault(cpu, CPU_FAULT_DEVICE);
+        return;
+    }
+
+    timer_program(cpu->timer, (cpu->R[hi] << 8) | cpu->R[lo], cpu->instret);
+
+    // The deadline may now be earlier than the current batch end
+    if (sched_next_deadline(cpu->sched) < cpu->batch_end)
+        cpu->batch_end = sched_next_deadline(cpu->sched);
+}
+
 static void op_halt(Cpu *cpu, Ram *ram)
 {
     (void)ram;
@@ -261,53 +707,185 @@ static void op_invalid(Cpu *cpu, Ram *ram, uint8_t opcode)
               "Invalid opcode 0x%02X at PC=0x%04X",
               opcode, cpu->PC - 1);
 
-    cpu->running = false;
+    cpu_fault(cpu, CPU_FAULT_INVALID);
+}
+
+/* ================= guest counters ================= */
+
+// Word 0 latches the whole counter, so the words read after it belong together
+static void read_counter(Cpu *cpu, Ram *ram, const char *name, uint8_t counter, uint64_t value)
+{
+    uint8_t pair, word;
+
+    if (!ram_read(ram, cpu->PC++, &pair, cpu->privileged) ||
+        !ram_read(ram, cpu->PC++, &word, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "%s operand fetch failed", name);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    if (pair >= PAIR_COUNT || word >= ISA_COUNTER_WORDS)
+    {
+        log_write(LOG_ERROR, "%s invalid pair P%d or word %d", name, pair, word);
+        cpu_fault(cpu, CPU_FAULT_INVALID);
+        return;
+    }
+
+    if (word == 0)
+        cpu->counter_latch[counter] = value;
+
+    cpu_set_pair(cpu, pair, (uint16_t)(cpu->counter_latch[counter] >> (16 * word)));
+
+    log_write(LOG_DEBUG, "%s P%d <- word %d (0x%04X)", name, pair, word, cpu_pair(cpu, pair));
+}
+
+static void op_rdins(Cpu *cpu, Ram *ram)
+{
+    read_counter(cpu, ram, "RDINS", CPU_COUNTER_INSTRET, cpu->instret - cpu->counter_instret_base);
+}
+
+static void op_rdcyc(Cpu *cpu, Ram *ram)
+{
+    read_counter(cpu, ram, "RDCYC", CPU_COUNTER_CYCLES, cpu->cycles - cpu->counter_cycles_base);
+}
+
+static void op_clrcnt(Cpu *cpu, Ram *ram)
+{
+    (void)ram;
+
+    if (!require_privileged(cpu, "CLRCNT"))
+        return;
+
+    // instret and cycles keep running: the scheduler's deadlines are in instret
+    log_write(LOG_DEBUG, "CLRCNT");
+    cpu->counter_instret_base = cpu->instret;
+    cpu->counter_cycles_base = cpu->cycles;
 }
 
 typedef void (*OpcodeHandler)(Cpu *, Ram *);
 
 static OpcodeHandler handlers[256] =
 {
-    [OP_LOAD_IMM] = op_load_imm,
-    [OP_ADD]      = op_add,
-    [OP_SUB]      = op_sub,
-    [OP_MLP]      = op_mlp,
-    [OP_DIV]      = op_div,
-    [OP_STORE]    = op_store,
-    [OP_LOAD_MEM] = op_load_mem,
-    [OP_HALT]     = op_halt,
+#define ISA_HANDLER(NAME, name, code, fmt, flags, cycles) [OP_##NAME] = op_##name,
+    ISA_INSTRUCTIONS(ISA_HANDLER)
+#undef ISA_HANDLER
 };
 
-void cpu_run(Cpu *cpu, Ram *ram, bool kernel)
+static bool fetch_opcode(Cpu *cpu, Ram *ram, uint8_t *opcode)
 {
-    cpu->privileged = kernel;
+    if (ram->access_log)
+    {
+        ram->access_log->fetch_next = cpu->PC;
+        ram_log_access(ram->access_log, cpu->PC, RAM_ACCESS_INSN, 0);
+    }
 
-    log_write(LOG_INFO, "CPU execution started at PC=0x%04X", cpu->PC);
+    if (!ram_read(ram, cpu->PC++, opcode, cpu->privileged))
+    {
+        log_write(LOG_ERROR, "Failed to fetch opcode at PC=0x%04X",
+                  cpu->PC - 1);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return false;
+    }
 
-    while (cpu->running)
+    log_write(LOG_TRACE, "Fetched opcode 0x%02X", *opcode);
+    return true;
+}
+
+static void dispatch(Cpu *cpu, Ram *ram, uint8_t opcode)
+{
+    OpcodeHandler handler = handlers[opcode];
+    if (handler)
+    {
+        handler(cpu, ram);
+    }
+    else
     {
-        uint8_t opcode;
+        op_invalid(cpu, ram, opcode);
+    }
+}
 
-        if (!ram_read(ram, cpu->PC++, &opcode, cpu->privileged))
-        {
-            log_write(LOG_ERROR, "Failed to fetch opcode at PC=0x%04X",
-                      cpu->PC - 1);
-            cpu->running = false;
-            return;
-        }
+// Both counters include the instruction being executed, as in the other engines
+void cpu_step(Cpu *cpu, Ram *ram)
+{
+    uint8_t opcode;
 
-        log_write(LOG_TRACE, "Fetched opcode 0x%02X", opcode);
+    cpu->instret++;
 
-        OpcodeHandler handler = handlers[opcode];
-        if (handler)
-        {
-            handler(cpu, ram);
-        }
-        else
+    if (fetch_opcode(cpu, ram, &opcode))
+    {
+        cpu->cycles += isa_table[opcode].cycles;
+        dispatch(cpu, ram, opcode);
+    }
+}
+
+void cpu_execute(Cpu *cpu, Ram *ram)
+{
+    uint8_t opcode;
+
+    if (fetch_opcode(cpu, ram, &opcode))
+        dispatch(cpu, ram, opcode);
+}
+
+void cpu_check_interrupts(Cpu *cpu, Ram *ram)
+{
+    if (!cpu->irq_pending || !cpu->irq_enabled || cpu->in_irq || !cpu->running)
+        return;
+
+    uint8_t hi, lo;
+
+    if (!ram_read(ram, CPU_IRQ_VECTOR, &hi, true) ||
+        !ram_read(ram, CPU_IRQ_VECTOR + 1, &lo, true))
+    {
+        log_write(LOG_ERROR, "Failed to read interrupt vector at 0x%04X", CPU_IRQ_VECTOR);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return;
+    }
+
+    cpu->irq_saved_PC = cpu->PC;
+    cpu->irq_saved_privileged = cpu->privileged;
+    cpu->irq_saved_flags = cpu->flags;
+    cpu->privileged = true;
+    cpu->in_irq = true;
+    cpu->irq_pending = 0;
+    cpu->PC = (hi << 8) | lo;
+
+    log_write(LOG_DEBUG, "Interrupt taken, PC 0x%04X -> 0x%04X",
+              cpu->irq_saved_PC, cpu->PC);
+}
+
+void cpu_service_events(Cpu *cpu, Ram *ram)
+{
+    if (cpu->sched)
+        sched_run_due(cpu->sched, cpu->instret);
+
+    cpu_check_interrupts(cpu, ram);
+}
+
+void cpu_run_until_halt(Cpu *cpu, Ram *ram)
+{
+    while (cpu->running)
+    {
+        // Run uninterrupted up to the next scheduled event; handlers that
+        // make an interrupt deliverable (EI, IRET) pull batch_end in
+        cpu->batch_end = cpu->sched ? sched_next_deadline(cpu->sched) : SCHED_NEVER;
+
+        while (cpu->running && cpu->instret < cpu->batch_end)
         {
-            op_invalid(cpu, ram, opcode);
+            cpu_step(cpu, ram);
         }
+
+        cpu_service_events(cpu, ram);
     }
+}
+
+void cpu_run(Cpu *cpu, Ram *ram, bool kernel)
+{
+    cpu->privileged = kernel;
+
+    log_write(LOG_INFO, "CPU execution started at PC=0x%04X", cpu->PC);
+
+    cpu_run_until_halt(cpu, ram);
 
     log_write(LOG_INFO, "CPU execution stopped");
 }
@@ -0,0 +1,1157 @@
+#include "cpu_fast.h"
+#include "code_share.h"
+#include "cpu_exec.h"
+#include "isa.h"
+#include "log.h"
+#include "sched.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_SIZE (4u << 20)
+#define BLOCK_BYTES_MAX (sizeof(Block) + DCACHE_MAX_BLOCK_INSNS * sizeof(DecodedInsn) + sizeof(MemoShape) + 8)
+
+// Longest span of code one block can cover
+#define DCACHE_MAX_BLOCK_BYTES (DCACHE_MAX_BLOCK_INSNS * ISA_MAX_SIZE)
+
+// One cached block result: outputs for the inputs in key
+typedef struct
+{
+    uint32_t serial;                    // Block.serial, 0 when empty
+    uint16_t next_pc;
+    uint8_t key[MEMO_KEY_MAX];
+    uint8_t regs[REG_COUNT];            // registers in the block's out_regs
+    CpuFlags flags;
+    uint8_t stores[MEMO_MAX_STORES];    // values for MemoShape.stores
+} MemoEntry;
+
+struct DecodeCache
+{
+    Block *blocks[RAM_SIZE];            // live block starting at each address
+    uint8_t code_bits[RAM_SIZE / 8];    // bytes covered by a live block
+    uint8_t *arena;                     // blocks, laid out back to back
+    size_t arena_used;
+    uint32_t epoch;                     // bumped on flush; stale Block pointers die with it
+    uint64_t generation;                // bumped whenever blocks are dropped
+    uint8_t verify[RAM_SIZE];           // Verification flags, cleared where code changes
+    uint8_t *coverage;                  // edge hit counts, or NULL
+    uint16_t coverage_prev;             // previous block's location, shifted
+    CodeShare *share;                   // blocks decoded elsewhere, or NULL
+
+    MemoEntry memo[MEMO_TABLE_SIZE];
+    bool memo_enabled;
+    uint32_t next_serial;               // never reused, so entries of dropped blocks never match
+    uint64_t memo_lookups;
+    uint64_t memo_hits;
+};
+
+typedef enum
+{
+    WRITE_OK,
+    WRITE_FAULT,
+    WRITE_HIT_CODE
+} WriteResult;
+
+/* ================= helpers ================= */
+
+static inline bool code_bit(const DecodeCache *dc, uint16_t addr)
+{
+    return dc->code_bits[addr >> 3] & (1u << (addr & 7));
+}
+
+static void set_code_bits(DecodeCache *dc, uint32_t start, uint32_t end)
+{
+    for (uint32_t a = start; a <= end; a++)
+        dc->code_bits[a >> 3] |= (uint8_t)(1u << (a & 7));
+}
+
+static inline bool user_blocked(const Cpu *cpu, uint16_t addr)
+{
+    return addr <= RAM_PRIVILEGED_MODE_END && !cpu->privileged;
+}
+
+static WriteResult write_byte(FastCtx *ctx, uint16_t addr, uint8_t value)
+{
+    if (!ram_store_fast(ctx->ram, addr, value) &&
+        !ram_write(ctx->ram, addr, value, true))
+        return WRITE_FAULT;
+
+    // Verified bytes are no longer what the verifier saw
+    if ((code_bit(ctx->dc, addr) || ctx->dc->verify[addr]) &&
+        dcache_invalidate_range(ctx->dc, addr, addr))
+        return WRITE_HIT_CODE;
+
+    return WRITE_OK;
+}
+
+/* ================= generic handlers ================= */
+
+// Anything unusual runs through the interpreter and ends the block
+static bool fast_interp(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    cpu->PC = in->pc;
+    cpu_execute(cpu, ctx->ram);
+    return false;
+}
+
+static bool fast_load_imm(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu->R[in->a] = in->b;
+    return true;
+}
+
+static bool fast_cmp(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu_record_flags(cpu, FLAGS_SUB, cpu->R[in->a], cpu->R[in->b]);
+    return true;
+}
+
+static bool fast_store(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    if (user_blocked(cpu, in->addr))
+        return fast_interp(cpu, in, ctx);
+
+    switch (write_byte(ctx, in->addr, cpu->R[in->a]))
+    {
+    case WRITE_OK:
+        return true;
+    case WRITE_FAULT:
+        log_write(LOG_ERROR, "STORE write failed at 0x%04X", in->addr);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        break;
+    case WRITE_HIT_CODE:
+        break;
+    }
+
+    cpu->PC = in->next;
+    return false;
+}
+
+static bool fast_load_mem(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    if (user_blocked(cpu, in->addr))
+        return fast_interp(cpu, in, ctx);
+
+    cpu->R[in->a] = ram_load_fast(ctx->ram, in->addr);
+    return true;
+}
+
+static bool fast_load_imm16(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu_set_pair(cpu, in->a, in->addr);
+    return true;
+}
+
+static bool fast_add16(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    uint16_t a = cpu_pair(cpu, in->a);
+    uint16_t b = cpu_pair(cpu, in->b);
+
+    cpu_record_flags(cpu, FLAGS_ADD16, a, b);
+    cpu_set_pair(cpu, in->a, a + b);
+    return true;
+}
+
+static bool fast_sub16(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    uint16_t a = cpu_pair(cpu, in->a);
+    uint16_t b = cpu_pair(cpu, in->b);
+
+    cpu_record_flags(cpu, FLAGS_SUB16, a, b);
+    cpu_set_pair(cpu, in->a, a - b);
+    return true;
+}
+
+// in->b is the pair, in->addr non-zero for post-increment
+static bool fast_load_ind(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    uint16_t addr = cpu_pair(cpu, in->b);
+
+    if (user_blocked(cpu, addr))
+        return fast_interp(cpu, in, ctx);
+
+    cpu->R[in->a] = ram_load_fast(ctx->ram, addr);
+    if (in->addr)
+        cpu_set_pair(cpu, in->b, addr + 1);
+    return true;
+}
+
+static bool fast_store_ind(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    uint16_t addr = cpu_pair(cpu, in->b);
+
+    if (user_blocked(cpu, addr))
+        return fast_interp(cpu, in, ctx);
+
+    WriteResult result = write_byte(ctx, addr, cpu->R[in->a]);
+    if (result == WRITE_FAULT)
+    {
+        log_write(LOG_ERROR, "STORE_IND write failed at 0x%04X", addr);
+        cpu->PC = in->next;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return false;
+    }
+
+    if (in->addr)
+        cpu_set_pair(cpu, in->b, addr + 1);
+    if (result == WRITE_OK)
+        return true;
+
+    cpu->PC = in->next;
+    return false;
+}
+
+/* ================= unchecked handlers ================= */
+
+// Verified: the constant address is legal in every mode this code runs in
+static bool fast_load_mem_unchecked(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    cpu->R[in->a] = ram_load_fast(ctx->ram, in->addr);
+    return true;
+}
+
+static bool fast_store_unchecked(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    switch (write_byte(ctx, in->addr, cpu->R[in->a]))
+    {
+    case WRITE_OK:
+        return true;
+    case WRITE_FAULT:
+        log_write(LOG_ERROR, "STORE write failed at 0x%04X", in->addr);
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        break;
+    case WRITE_HIT_CODE:
+        break;
+    }
+
+    cpu->PC = in->next;
+    return false;
+}
+
+static bool fast_jmp(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu->PC = in->addr;
+    return false;
+}
+
+static bool fast_jz(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu->PC = cpu_flag_zero(cpu) ? in->addr : in->next;
+    return false;
+}
+
+static bool fast_jnz(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu->PC = cpu_flag_zero(cpu) ? in->next : in->addr;
+    return false;
+}
+
+static bool fast_jc(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    cpu->PC = cpu_flag_carry(cpu) ? in->addr : in->next;
+    return false;
+}
+
+static bool fast_call(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    uint16_t sp = cpu->SP - 2;
+    uint16_t sp_lo = sp + 1;
+
+    if (user_blocked(cpu, sp) || user_blocked(cpu, sp_lo))
+        return fast_interp(cpu, in, ctx);
+
+    if (write_byte(ctx, sp, in->next >> 8) == WRITE_FAULT ||
+        write_byte(ctx, sp_lo, in->next & 0xFF) == WRITE_FAULT)
+    {
+        log_write(LOG_ERROR, "CALL stack push failed at SP=0x%04X", sp);
+        cpu->PC = in->next;
+        cpu_fault(cpu, CPU_FAULT_MEMORY);
+        return false;
+    }
+
+    cpu->SP = sp;
+    cpu->PC = in->addr;
+    return false;
+}
+
+static bool fast_ret(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    uint16_t sp_lo = cpu->SP + 1;
+
+    if (user_blocked(cpu, cpu->SP) || user_blocked(cpu, sp_lo))
+        return fast_interp(cpu, in, ctx);
+
+    cpu->PC = (ram_load_fast(ctx->ram, cpu->SP) << 8) | ram_load_fast(ctx->ram, sp_lo);
+    cpu->SP += 2;
+    return false;
+}
+
+static bool fast_halt(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx)
+{
+    (void)ctx;
+    log_write(LOG_INFO, "HALT instruction encountered");
+    cpu->PC = in->next;
+    cpu->running = false;
+    return false;
+}
+
+/* ================= register-specialised ALU handlers ================= */
+
+/*
+ * One handler per (opcode, dst, src): the register indices are constants,
+ * so each body is a couple of loads and a store with no operand decoding
+ * or range checks. FOR_EACH_DST/FOR_EACH_SRC expand the 8x8 grid.
+ */
+
+#if REG_COUNT != 8
+#error "FOR_EACH_DST/FOR_EACH_SRC assume 8 registers"
+#endif
+
+#define FOR_EACH_DST(M, OP) \
+    M(OP, 0) M(OP, 1) M(OP, 2) M(OP, 3) M(OP, 4) M(OP, 5) M(OP, 6) M(OP, 7)
+
+#define FOR_EACH_SRC(M, OP, D) \
+    M(OP, D, 0) M(OP, D, 1) M(OP, D, 2) M(OP, D, 3) \
+    M(OP, D, 4) M(OP, D, 5) M(OP, D, 6) M(OP, D, 7)
+
+#define ALU_ADD(D, S) \
+    cpu_record_flags(cpu, FLAGS_ADD, cpu->R[D], cpu->R[S]); \
+    cpu->R[D] += cpu->R[S];
+
+#define ALU_SUB(D, S) \
+    cpu_record_flags(cpu, FLAGS_SUB, cpu->R[D], cpu->R[S]); \
+    cpu->R[D] -= cpu->R[S];
+
+#define ALU_MLP(D, S) \
+    cpu_record_flags(cpu, FLAGS_MLP, cpu->R[D], cpu->R[S]); \
+    cpu->R[D] *= cpu->R[S];
+
+// The interpreter reports the divide-by-zero fault
+#define ALU_DIV(D, S) \
+    if (cpu->R[S] == 0) \
+        return fast_interp(cpu, in, ctx); \
+    cpu_record_flags(cpu, FLAGS_DIV, cpu->R[D], cpu->R[S]); \
+    cpu->R[D] /= cpu->R[S];
+
+// Verified: the divisor is a non-zero constant
+#define ALU_DIVNZ(D, S) \
+    cpu_record_flags(cpu, FLAGS_DIV, cpu->R[D], cpu->R[S]); \
+    cpu->R[D] /= cpu->R[S];
+
+#ifdef FAST_GENERIC_ALU
+
+/*
+ * Benchmark build (make bench): one handler per opcode that reads its
+ * registers from the operands, behind the same tables.
+ */
+#define DEFINE_ALU_OP(OP) \
+    static bool fast_##OP(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx) \
+    { \
+        (void)ctx; \
+        ALU_##OP(in->a, in->b) \
+        return true; \
+    }
+
+DEFINE_ALU_OP(ADD)
+DEFINE_ALU_OP(SUB)
+DEFINE_ALU_OP(MLP)
+DEFINE_ALU_OP(DIV)
+DEFINE_ALU_OP(DIVNZ)
+
+#define ALU_ENTRY(OP, D, S) fast_##OP,
+
+#else
+
+#define DEFINE_ALU(OP, D, S) \
+    static bool fast_##OP##_##D##_##S(Cpu *cpu, const DecodedInsn *in, FastCtx *ctx) \
+    { \
+        (void)in; \
+        (void)ctx; \
+        ALU_##OP(D, S) \
+        return true; \
+    }
+
+#define DEFINE_ALU_ROW(OP, D) FOR_EACH_SRC(DEFINE_ALU, OP, D)
+
+FOR_EACH_DST(DEFINE_ALU_ROW, ADD)
+FOR_EACH_DST(DEFINE_ALU_ROW, SUB)
+FOR_EACH_DST(DEFINE_ALU_ROW, MLP)
+FOR_EACH_DST(DEFINE_ALU_ROW, DIV)
+FOR_EACH_DST(DEFINE_ALU_ROW, DIVNZ)
+
+#define ALU_ENTRY(OP, D, S) fast_##OP##_##D##_##S,
+
+#endif
+
+#define ALU_ROW(OP, D) { FOR_EACH_SRC(ALU_ENTRY, OP, D) },
+
+static const FastHandler alu_add[REG_COUNT][REG_COUNT] = { FOR_EACH_DST(ALU_ROW, ADD) };
+static const FastHandler alu_sub[REG_COUNT][REG_COUNT] = { FOR_EACH_DST(ALU_ROW, SUB) };
+static const FastHandler alu_mlp[REG_COUNT][REG_COUNT] = { FOR_EACH_DST(ALU_ROW, MLP) };
+static const FastHandler alu_div[REG_COUNT][REG_COUNT] = { FOR_EACH_DST(ALU_ROW, DIV) };
+static const FastHandler alu_divnz[REG_COUNT][REG_COUNT] = { FOR_EACH_DST(ALU_ROW, DIVNZ) };
+
+/* ================= decoder ================= */
+
+/*
+ * Fill in the handler and operands; false if only the interpreter can run
+ * it. verified holds the instruction's Verification flags, 0 when it did
+ * not pass.
+ */
+static bool decode_insn(DecodedInsn *in, uint8_t opcode, uint8_t o1, uint8_t o2, uint8_t o3,
+                        uint8_t verified)
+{
+    in->a = o1;
+    in->b = o2;
+    in->addr = 0;
+
+    switch (opcode)
+    {
+    case OP_LOAD_IMM:
+        if (o1 >= REG_COUNT)
+            break;
+        in->fn = fast_load_imm;
+        return true;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MLP:
+    case OP_DIV:
+        if (o1 >= REG_COUNT || o2 >= REG_COUNT)
+            break;
+        in->fn = opcode == OP_ADD ? alu_add[o1][o2] :
+                 opcode == OP_SUB ? alu_sub[o1][o2] :
+                 opcode == OP_MLP ? alu_mlp[o1][o2] :
+                 (verified & VERIFY_DIVISOR_NONZERO) ? alu_divnz[o1][o2] : alu_div[o1][o2];
+        return true;
+
+    case OP_CMP:
+        if (o1 >= REG_COUNT || o2 >= REG_COUNT)
+            break;
+        in->fn = fast_cmp;
+        return true;
+
+    case OP_STORE:
+    case OP_LOAD_MEM:
+        if (o1 >= REG_COUNT)
+            break;
+        in->addr = (o2 << 8) | o3;
+        if (verified)
+            in->fn = opcode == OP_STORE ? fast_store_unchecked : fast_load_mem_unchecked;
+        else
+            in->fn = opcode == OP_STORE ? fast_store : fast_load_mem;
+        return true;
+
+    case OP_LOAD_IMM16:
+        if (o1 >= PAIR_COUNT)
+            break;
+        in->addr = (o2 << 8) | o3;
+        in->fn = fast_load_imm16;
+        return true;
+
+    case OP_ADD16:
+    case OP_SUB16:
+        if (o1 >= PAIR_COUNT || o2 >= PAIR_COUNT)
+            break;
+        in->fn = opcode == OP_ADD16 ? fast_add16 : fast_sub16;
+        return true;
+
+    case OP_LOAD_IND:
+    case OP_STORE_IND:
+        if (o1 >= REG_COUNT || (o2 & ISA_IND_PAIR_MASK) >= PAIR_COUNT)
+            break;
+        in->b = o2 & ISA_IND_PAIR_MASK;
+        in->addr = o2 & ISA_IND_POST_INC;
+        in->fn = opcode == OP_LOAD_IND ? fast_load_ind : fast_store_ind;
+        return true;
+
+    case OP_JMP:
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+    case OP_CALL:
+        in->addr = (o1 << 8) | o2;
+        in->fn = opcode == OP_JMP ? fast_jmp :
+                 opcode == OP_JZ  ? fast_jz :
+                 opcode == OP_JNZ ? fast_jnz :
+                 opcode == OP_JC  ? fast_jc : fast_call;
+        return true;
+
+    case OP_RET:
+        in->fn = fast_ret;
+        return true;
+
+    case OP_HALT:
+        in->fn = fast_halt;
+        return true;
+
+    default:
+        // System instructions and invalid opcodes
+        return false;
+    }
+
+    // Bad register operands
+    return false;
+}
+
+// Flags of the instruction at pc if all of its bytes passed verification, else 0
+static uint8_t verified_flags(const DecodeCache *dc, uint32_t pc, uint32_t size)
+{
+    for (uint32_t a = pc; a < pc + size; a++)
+    {
+        if (!(dc->verify[a] & VERIFY_OK))
+            return 0;
+    }
+
+    return dc->verify[pc];
+}
+
+/* ================= memoization shape ================= */
+
+static void shape_read(MemoShape *s, uint8_t written, uint8_t reg)
+{
+    if (!(written & (1u << reg)))
+        s->in_regs |= (uint8_t)(1u << reg);
+}
+
+static bool shape_has(const uint16_t *addrs, uint8_t count, uint16_t addr)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (addrs[i] == addr)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Add one decoded instruction to the block's read and write sets; false if
+ * its effect is not a function of registers, flags and constant addresses.
+ */
+static bool shape_insn(MemoShape *s, uint8_t *written, uint8_t opcode, const DecodedInsn *in)
+{
+    switch (opcode)
+    {
+    case OP_LOAD_IMM:
+        *written |= (uint8_t)(1u << in->a);
+        break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MLP:
+    case OP_DIV:
+        shape_read(s, *written, in->a);
+        shape_read(s, *written, in->b);
+        *written |= (uint8_t)(1u << in->a);
+        s->out_flags = true;
+        break;
+
+    case OP_CMP:
+        shape_read(s, *written, in->a);
+        shape_read(s, *written, in->b);
+        s->out_flags = true;
+        break;
+
+    case OP_LOAD_MEM:
+        // A byte the block stored itself is not an input
+        if (!shape_has(s->stores, s->store_count, in->addr) &&
+            !shape_has(s->loads, s->load_count, in->addr))
+        {
+            if (s->load_count == MEMO_MAX_LOADS)
+                return false;
+            s->loads[s->load_count++] = in->addr;
+        }
+        *written |= (uint8_t)(1u << in->a);
+        break;
+
+    case OP_STORE:
+        shape_read(s, *written, in->a);
+        if (!shape_has(s->stores, s->store_count, in->addr))
+        {
+            if (s->store_count == MEMO_MAX_STORES)
+                return false;
+            s->stores[s->store_count++] = in->addr;
+        }
+        break;
+
+    case OP_LOAD_IMM16:
+        *written |= (uint8_t)(3u << (in->a * 2));
+        break;
+
+    case OP_ADD16:
+    case OP_SUB16:
+        for (uint8_t r = 0; r < 2; r++)
+        {
+            shape_read(s, *written, (uint8_t)(in->a * 2 + r));
+            shape_read(s, *written, (uint8_t)(in->b * 2 + r));
+        }
+        *written |= (uint8_t)(3u << (in->a * 2));
+        s->out_flags = true;
+        break;
+
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+        if (!s->out_flags)
+            s->in_flags = true;
+        break;
+
+    case OP_JMP:
+        break;
+
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+// Fill in the private part of a block and make it live
+static void install_block(DecodeCache *dc, Block *b, uint16_t start, uint16_t end, uint16_t count,
+                          bool kernel_only, uint32_t cycles)
+{
+    b->start = start;
+    b->end = end;
+    b->count = count;
+    b->valid = true;
+    b->kernel_only = kernel_only;
+    b->cycles = cycles;
+    b->succ[0] = b->succ[1] = NULL;
+    b->succ_pc[0] = b->succ_pc[1] = 0;
+    b->serial = dc->next_serial++;
+    b->memo_runs = b->memo_lookups = b->memo_hits = 0;
+
+    dc->arena_used += b->size;
+    dc->blocks[start] = b;
+    set_code_bits(dc, start, end);
+}
+
+static Block *decode_block(DecodeCache *dc, Ram *ram, uint16_t start)
+{
+    if (ARENA_SIZE - dc->arena_used < BLOCK_BYTES_MAX)
+    {
+        log_write(LOG_DEBUG, "Decode cache full, flushing");
+        dcache_flush(dc);
+    }
+
+    Block *b = (Block *)(dc->arena + dc->arena_used);
+    const SharedBlock *sb = dc->share ? code_share_find(dc->share, ram, dc->verify, start, dc->memo_enabled) : NULL;
+
+    // Decoded elsewhere from the same bytes: only the header is private
+    if (sb)
+    {
+        b->size = sizeof(Block);
+        b->insns = sb->insns;
+        b->memo = sb->memo;
+        install_block(dc, b, start, sb->end, sb->count, sb->kernel_only, sb->cycles);
+        return b;
+    }
+
+    DecodedInsn *insns = (DecodedInsn *)(b + 1);
+    uint32_t pc = start;
+    uint16_t count = 0;
+    uint32_t cycles = 0;
+    bool kernel_only = start <= RAM_PRIVILEGED_MODE_END;
+    MemoShape shape = { 0 };
+    uint8_t written = 0;
+    bool pure = dc->memo_enabled;
+    bool from_leader = false;   // reached from a verified leader without a break
+
+    while (count < DCACHE_MAX_BLOCK_INSNS)
+    {
+        DecodedInsn *in = &insns[count++];
+        uint8_t opcode = ram_load_fast(ram, (uint16_t)pc);
+        uint32_t size = isa_table[opcode].size ? isa_table[opcode].size : 1;
+        bool ends;
+
+        cycles += isa_table[opcode].cycles;
+
+        in->pc = (uint16_t)pc;
+        in->next = (uint16_t)(pc + size);
+
+        if (pc + size > RAM_SIZE)
+        {
+            in->fn = fast_interp;
+            ends = true;
+        }
+        else
+        {
+            uint8_t o1 = size > 1 ? ram_load_fast(ram, (uint16_t)(pc + 1)) : 0;
+            uint8_t o2 = size > 2 ? ram_load_fast(ram, (uint16_t)(pc + 2)) : 0;
+            uint8_t o3 = size > 3 ? ram_load_fast(ram, (uint16_t)(pc + 3)) : 0;
+
+            uint8_t verified = verified_flags(dc, pc, size);
+
+            // Register facts only hold on the path the verifier followed from
+            // the leader; a block entered mid-way (e.g. by a RET to an
+            // overwritten return address) keeps the checked DIV
+            if (verified & VERIFY_LEADER)
+                from_leader = true;
+            else if (!verified)
+                from_leader = false;
+            if (!from_leader)
+                verified &= (uint8_t)~VERIFY_DIVISOR_NONZERO;
+
+            if (verified & VERIFY_KERNEL_ONLY)
+                kernel_only = true;
+
+            if (decode_insn(in, opcode, o1, o2, o3, verified))
+            {
+                ends = isa_table[opcode].flags & ISA_BRANCH;
+                pure = pure && shape_insn(&shape, &written, opcode, in);
+            }
+            else
+            {
+                in->fn = fast_interp;
+                ends = true;
+                pure = false;
+            }
+        }
+
+        pc += size;
+        if (ends)
+            break;
+    }
+
+    uint32_t end = (pc > RAM_SIZE ? RAM_SIZE : pc) - 1;
+
+    b->size = (uint32_t)((sizeof(Block) + count * sizeof(DecodedInsn) + 7) & ~(size_t)7);
+    b->insns = insns;
+    b->memo = NULL;
+
+    // The shape lives in the arena right after the instructions
+    if (pure && count >= MEMO_MIN_INSNS)
+    {
+        MemoShape *memo = (MemoShape *)((uint8_t *)b + b->size);
+
+        shape.out_regs = written;
+        shape.key_size = (uint8_t)(1 + __builtin_popcount(shape.in_regs) + shape.load_count);
+        *memo = shape;
+        b->memo = memo;
+        b->size += (uint32_t)((sizeof(MemoShape) + 7) & ~(size_t)7);
+    }
+
+    install_block(dc, b, start, (uint16_t)end, count, kernel_only, cycles);
+
+    if (dc->share)
+        code_share_publish(dc->share, ram, dc->verify, b, dc->memo_enabled);
+
+    return b;
+}
+
+/* ================= cache management ================= */
+
+DecodeCache *dcache_create(void)
+{
+    DecodeCache *dc = calloc(1, sizeof(DecodeCache));
+    if (!dc)
+        return NULL;
+
+    dc->memo_enabled = true;
+    dc->next_serial = 1;
+
+    dc->arena = malloc(ARENA_SIZE);
+    if (!dc->arena)
+    {
+        free(dc);
+        return NULL;
+    }
+
+    return dc;
+}
+
+void dcache_destroy(DecodeCache *dc)
+{
+    if (!dc)
+        return;
+    free(dc->arena);
+    free(dc);
+}
+
+void dcache_flush(DecodeCache *dc)
+{
+    memset(dc->blocks, 0, sizeof(dc->blocks));
+    memset(dc->code_bits, 0, sizeof(dc->code_bits));
+    dc->arena_used = 0;
+    dc->epoch++;
+    dc->generation++;
+}
+
+void dcache_attach_verification(DecodeCache *dc, const Verification *v)
+{
+    memcpy(dc->verify, v->flags, sizeof(dc->verify));
+    dcache_flush(dc);
+}
+
+uint64_t dcache_generation(const DecodeCache *dc)
+{
+    return dc->generation;
+}
+
+bool dcache_is_code(const DecodeCache *dc, uint16_t addr)
+{
+    return code_bit(dc, addr) || dc->verify[addr];
+}
+
+void dcache_set_memo(DecodeCache *dc, bool enabled)
+{
+    dc->memo_enabled = enabled;
+    dcache_flush(dc);
+}
+
+void dcache_attach_share(DecodeCache *dc, CodeShare *cs)
+{
+    dc->share = cs;
+    dcache_flush(dc);
+}
+
+void dcache_set_coverage(DecodeCache *dc, uint8_t *map)
+{
+    dc->coverage = map;
+    dc->coverage_prev = 0;
+}
+
+// First address whose block could still reach addr
+static inline uint32_t scan_from(uint32_t addr)
+{
+    return addr >= DCACHE_MAX_BLOCK_BYTES ? addr - DCACHE_MAX_BLOCK_BYTES + 1 : 0;
+}
+
+uint32_t dcache_invalidate_range(DecodeCache *dc, uint16_t start, uint16_t end)
+{
+    uint32_t dropped = 0;
+
+    // Register facts flow forward through a verified block: the rest of it loses them too
+    if (dc->verify[end])
+    {
+        uint32_t last = end;
+
+        while (last + 1 < RAM_SIZE && (dc->verify[last + 1] & VERIFY_OK) &&
+               !(dc->verify[last + 1] & VERIFY_LEADER))
+            last++;
+        end = (uint16_t)last;
+    }
+    memset(dc->verify + start, 0, (size_t)end - start + 1);
+
+    uint32_t lo = end, hi = start;
+
+    // Only blocks starting within DCACHE_MAX_BLOCK_BYTES before start can overlap
+    for (uint32_t a = scan_from(start); a <= end; a++)
+    {
+        Block *b = dc->blocks[a];
+
+        if (!b || b->end < start)
+            continue;
+
+        b->valid = false;
+        dc->blocks[a] = NULL;
+
+        if (b->start < lo)
+            lo = b->start;
+        if (b->end > hi)
+            hi = b->end;
+        dropped++;
+    }
+
+    if (!dropped)
+        return 0;
+
+    dc->generation++;
+
+    // Clear the dropped ranges, then restore bits of survivors that overlap them
+    for (uint32_t a = lo; a <= hi; a++)
+        dc->code_bits[a >> 3] &= (uint8_t)~(1u << (a & 7));
+
+    for (uint32_t a = scan_from(lo); a <= hi; a++)
+    {
+        Block *b = dc->blocks[a];
+
+        if (b && b->end >= lo)
+            set_code_bits(dc, b->start, b->end);
+    }
+
+    log_write(LOG_DEBUG, "Invalidated %u decoded block(s) covering 0x%04X-0x%04X",
+              dropped, start, end);
+    return dropped;
+}
+
+/* ================= engine ================= */
+
+static void link_block(Block *from, uint16_t pc, Block *to)
+{
+    int slot = (from->succ[0] == NULL || from->succ_pc[0] == pc) ? 0 : 1;
+
+    from->succ[slot] = to;
+    from->succ_pc[slot] = pc;
+}
+
+// AFL-style edge: the previous location is shifted so A->B and B->A differ
+static inline void record_edge(DecodeCache *dc, uint16_t pc)
+{
+    uint16_t loc = (uint16_t)(pc * 40503u);
+
+    dc->coverage[(loc ^ dc->coverage_prev) & (DCACHE_COVERAGE_SIZE - 1)]++;
+    dc->coverage_prev = loc >> 1;
+}
+
+/* ================= memoization ================= */
+
+// Input values of b in shape order, after a byte of privilege and flag bits
+static void memo_key(const Cpu *cpu, const Ram *ram, const MemoShape *s, uint8_t *key)
+{
+    uint32_t n = 0;
+
+    key[n++] = (uint8_t)(cpu->privileged |
+                         (s->in_flags ? (cpu_flag_zero(cpu) << 1) | (cpu_flag_carry(cpu) << 2) : 0));
+
+    for (uint8_t r = 0; r < REG_COUNT; r++)
+    {
+        if (s->in_regs & (1u << r))
+            key[n++] = cpu->R[r];
+    }
+
+    for (uint8_t i = 0; i < s->load_count; i++)
+        key[n++] = ram_load_fast(ram, s->loads[i]);
+}
+
+static MemoEntry *memo_slot(DecodeCache *dc, uint32_t serial, const uint8_t *key, uint8_t size)
+{
+    uint32_t h = 2166136261u ^ serial;
+
+    for (uint8_t i = 0; i < size; i++)
+        h = (h ^ key[i]) * 16777619u;
+
+    return &dc->memo[(h ^ (h >> 15)) & (MEMO_TABLE_SIZE - 1)];
+}
+
+/*
+ * Look b up for the current inputs. On a hit the recorded outputs are
+ * applied and true returned. On a miss *record is set to the slot the run
+ * should fill, or NULL if this run is not to be recorded.
+ */
+static bool memo_replay(Cpu *cpu, FastCtx *ctx, Block *b, uint8_t *key, MemoEntry **record)
+{
+    DecodeCache *dc = ctx->dc;
+    const MemoShape *s = b->memo;
+
+    *record = NULL;
+
+    if (b->memo_runs < MEMO_HOT)
+    {
+        b->memo_runs++;
+        return false;
+    }
+
+    // Stores into code must go through the handlers, which end the block
+    for (uint8_t i = 0; i < s->store_count; i++)
+    {
+        if (dcache_is_code(dc, s->stores[i]))
+            return false;
+    }
+
+    memo_key(cpu, ctx->ram, s, key);
+
+    MemoEntry *e = memo_slot(dc, b->serial, key, s->key_size);
+
+    dc->memo_lookups++;
+    if (++b->memo_lookups == MEMO_TRIAL)
+    {
+        // Not paying for the lookups: run this block normally from now on
+        if (b->memo_hits < MEMO_TRIAL / 4)
+        {
+            b->memo = NULL;
+            return false;
+        }
+        b->memo_lookups = b->memo_hits = 0;
+    }
+
+    if (e->serial != b->serial || memcmp(e->key, key, s->key_size) != 0)
+    {
+        *record = e;
+        return false;
+    }
+
+    for (uint8_t i = 0; i < s->store_count; i++)
+    {
+        if (write_byte(ctx, s->stores[i], e->stores[i]) == WRITE_FAULT)
+        {
+            log_write(LOG_ERROR, "STORE write failed at 0x%04X", s->stores[i]);
+            cpu_fault(cpu, CPU_FAULT_MEMORY);
+            return true;
+        }
+    }
+
+    for (uint8_t r = 0; r < REG_COUNT; r++)
+    {
+        if (s->out_regs & (1u << r))
+            cpu->R[r] = e->regs[r];
+    }
+
+    if (s->out_flags)
+        cpu->flags = e->flags;
+
+    cpu->PC = e->next_pc;
+    cpu->instret += b->count;
+    cpu->cycles += b->cycles;
+    b->memo_hits++;
+    dc->memo_hits++;
+    return true;
+}
+
+static void memo_record(const Cpu *cpu, const Ram *ram, const Block *b, const uint8_t *key, MemoEntry *e)
+{
+    const MemoShape *s = b->memo;
+
+    e->serial = b->serial;
+    e->next_pc = cpu->PC;
+    memcpy(e->key, key, s->key_size);
+    memcpy(e->regs, cpu->R, REG_COUNT);
+    e->flags = cpu->flags;
+
+    for (uint8_t i = 0; i < s->store_count; i++)
+        e->stores[i] = ram_load_fast(ram, s->stores[i]);
+}
+
+// Cost of the first n instructions of a block left early
+static uint32_t prefix_cycles(const Ram *ram, const DecodedInsn *in, uint32_t n)
+{
+    uint32_t cycles = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        cycles += isa_table[ram_load_fast(ram, in[i].pc)].cycles;
+
+    return cycles;
+}
+
+static void run_batch(Cpu *cpu, FastCtx *ctx)
+{
+    DecodeCache *dc = ctx->dc;
+    Block *prev = NULL;
+
+    while (cpu->running && cpu->instret < cpu->batch_end)
+    {
+        uint16_t pc = cpu->PC;
+        Block *b = NULL;
+
+        // Chained successor first, then the cache, then decode
+        if (prev && prev->valid)
+        {
+            if (prev->succ_pc[0] == pc && prev->succ[0] && prev->succ[0]->valid)
+                b = prev->succ[0];
+            else if (prev->succ_pc[1] == pc && prev->succ[1] && prev->succ[1]->valid)
+                b = prev->succ[1];
+        }
+
+        if (!b)
+        {
+            b = dc->blocks[pc];
+
+            if (!b)
+            {
+                uint32_t epoch = dc->epoch;
+                b = decode_block(dc, ctx->ram, pc);
+                if (dc->epoch != epoch)
+                    prev = NULL;
+            }
+
+            if (prev && prev->valid)
+                link_block(prev, pc, b);
+        }
+
+        if (dc->coverage)
+            record_edge(dc, pc);
+
+        // User mode may not fetch from privileged memory or run kernel-verified
+        // handlers: let the interpreter check (and fault)
+        if (b->kernel_only && !cpu->privileged)
+        {
+            cpu_step(cpu, ctx->ram);
+            prev = NULL;
+            continue;
+        }
+
+        uint64_t budget = cpu->batch_end - cpu->instret;
+        MemoEntry *record = NULL;
+        uint8_t key[MEMO_KEY_MAX];
+
+        if (b->memo && budget >= b->count && memo_replay(cpu, ctx, b, key, &record))
+        {
+            prev = b;
+            continue;
+        }
+
+        uint32_t n = b->count < budget ? b->count : (uint32_t)budget;
+        uint64_t base = cpu->instret;
+        uint64_t base_cycles = cpu->cycles;
+        const DecodedInsn *in = b->insns;
+        uint32_t i = 0;
+
+        // Counted up front so system instructions run by the interpreter see
+        // an exact instret and cycle count
+        cpu->instret = base + n;
+        cpu->cycles = base_cycles + (n == b->count ? b->cycles : prefix_cycles(ctx->ram, in, n));
+
+        for (; i < n; i++)
+        {
+            if (!in[i].fn(cpu, &in[i], ctx))
+            {
+                i++;
+                goto exited;
+            }
+        }
+
+        cpu->PC = in[n - 1].next;
+
+    exited:
+        cpu->instret = base + i;
+        if (i != n)
+            cpu->cycles = base_cycles + prefix_cycles(ctx->ram, in, i);
+        prev = b;
+
+        // A clean run of the whole block, with its code untouched
+        if (record && i == b->count && cpu->running && b->valid)
+            memo_record(cpu, ctx->ram, b, key, record);
+    }
+}
+
+void cpu_run_fast(Cpu *cpu, Ram *ram, bool kernel, DecodeCache *dc)
+{
+    if (ram->mmu || ram->watch_pages || ram->access_log)
+    {
+        log_write(LOG_WARN, "MMU, watchpoints or access log active, using the interpreter");
+        cpu_run(cpu, ram, kernel);
+        return;
+    }
+
+    cpu->privileged = kernel;
+
+    log_write(LOG_INFO, "CPU execution started at PC=0x%04X (predecoded)", cpu->PC);
+
+    FastCtx ctx = { ram, dc };
+    uint64_t lookups = dc->memo_lookups;
+    uint64_t hits = dc->memo_hits;
+
+    while (cpu->running)
+    {
+        cpu->batch_end = cpu->sched ? sched_next_deadline(cpu->sched) : SCHED_NEVER;
+        run_batch(cpu, &ctx);
+        cpu_service_events(cpu, ram);
+    }
+
+    ram_fast_stores_done(ram);
+    log_write(LOG_INFO, "CPU execution stopped");
+
+    if (dc->memo_lookups != lookups)
+        log_write(LOG_INFO, "Memoized blocks: %llu of %llu lookups hit",
+                  (unsigned long long)(dc->memo_hits - hits),
+                  (unsigned long long)(dc->memo_lookups - lookups));
+}
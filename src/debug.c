@@ -0,0 +1,453 @@
+#include "debug.h"
+#include "cpu_exec.h"
+#include "isa.h"
+#include "sched.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_COMMAND 128
+
+static void rebuild_watch_pages(Debugger *dbg)
+{
+    memset(dbg->watch_pages, 0, sizeof(dbg->watch_pages));
+
+    for (uint32_t i = 0; i < dbg->watch_count; i++)
+    {
+        const Watchpoint *w = &dbg->watches[i];
+        for (uint32_t page = w->start >> RAM_WATCH_PAGE_SHIFT;
+             page <= (uint32_t)(w->end >> RAM_WATCH_PAGE_SHIFT); page++)
+            dbg->watch_pages[page] |= w->access;
+    }
+
+    // Only install the page table while something is watched
+    dbg->ram->watch_pages = dbg->watch_count ? dbg->watch_pages : NULL;
+}
+
+static void on_watch(void *ctx, uint32_t address, uint8_t value, bool write)
+{
+    Debugger *dbg = ctx;
+    uint8_t access = write ? RAM_WATCH_WRITE : RAM_WATCH_READ;
+
+    if (dbg->hit)
+        return;
+
+    // Instruction fetch, not a data read
+    if (!write && (uint16_t)(address - dbg->current_pc) < dbg->current_size)
+        return;
+
+    for (uint32_t i = 0; i < dbg->watch_count; i++)
+    {
+        const Watchpoint *w = &dbg->watches[i];
+
+        if ((w->access & access) && address >= w->start && address <= w->end)
+        {
+            dbg->hit = true;
+            dbg->hit_pc = dbg->current_pc;
+            dbg->hit_addr = (uint16_t)address;
+            dbg->hit_value = value;
+            dbg->hit_write = write;
+            return;
+        }
+    }
+}
+
+void debug_init(Debugger *dbg, Ram *ram)
+{
+    memset(dbg, 0, sizeof(*dbg));
+    dbg->ram = ram;
+
+    ram->watch_pages = NULL;
+    ram->watch_hook = on_watch;
+    ram->watch_ctx = dbg;
+}
+
+void debug_detach(Debugger *dbg)
+{
+    dbg->ram->watch_pages = NULL;
+    dbg->ram->watch_hook = NULL;
+    dbg->ram->watch_ctx = NULL;
+}
+
+static bool is_breakpoint(const Debugger *dbg, uint16_t addr)
+{
+    return dbg->break_pages[addr >> RAM_WATCH_PAGE_SHIFT] &&
+           (dbg->breakpoints[addr >> 3] & (1u << (addr & 7)));
+}
+
+bool debug_add_breakpoint(Debugger *dbg, uint16_t addr)
+{
+    if (is_breakpoint(dbg, addr))
+        return false;
+
+    dbg->breakpoints[addr >> 3] |= (uint8_t)(1u << (addr & 7));
+    dbg->break_pages[addr >> RAM_WATCH_PAGE_SHIFT]++;
+    dbg->breakpoint_count++;
+    return true;
+}
+
+bool debug_remove_breakpoint(Debugger *dbg, uint16_t addr)
+{
+    if (!is_breakpoint(dbg, addr))
+        return false;
+
+    dbg->breakpoints[addr >> 3] &= (uint8_t)~(1u << (addr & 7));
+    dbg->break_pages[addr >> RAM_WATCH_PAGE_SHIFT]--;
+    dbg->breakpoint_count--;
+    return true;
+}
+
+bool debug_add_watchpoint(Debugger *dbg, uint16_t start, uint16_t end, uint8_t access)
+{
+    if (dbg->watch_count >= DEBUG_MAX_WATCHPOINTS || end < start ||
+        !(access & (RAM_WATCH_READ | RAM_WATCH_WRITE)))
+        return false;
+
+    Watchpoint *w = &dbg->watches[dbg->watch_count++];
+    w->start = start;
+    w->end = end;
+    w->access = access;
+
+    rebuild_watch_pages(dbg);
+    return true;
+}
+
+bool debug_remove_watchpoint(Debugger *dbg, uint16_t start)
+{
+    for (uint32_t i = 0; i < dbg->watch_count; i++)
+    {
+        if (dbg->watches[i].start == start)
+        {
+            dbg->watches[i] = dbg->watches[--dbg->watch_count];
+            rebuild_watch_pages(dbg);
+            return true;
+        }
+    }
+    return false;
+}
+
+DebugStop debug_run(Debugger *dbg, Cpu *cpu, Ram *ram, uint64_t max_steps)
+{
+    dbg->hit = false;
+
+    // Nothing to check: run the plain interpreter loop at full speed
+    if (max_steps == 0 && dbg->breakpoint_count == 0 && dbg->watch_count == 0 && !dbg->rewind)
+    {
+        cpu_run_until_halt(cpu, ram);
+        return DEBUG_STOP_HALTED;
+    }
+
+    uint64_t steps = 0;
+
+    while (cpu->running)
+    {
+        // The instruction we are resuming from never re-triggers its own breakpoint
+        if (steps > 0 && is_breakpoint(dbg, cpu->PC))
+            return DEBUG_STOP_BREAKPOINT;
+
+        if (dbg->rewind && rewind_due(dbg->rewind, cpu) && !rewind_checkpoint(dbg->rewind, cpu, ram))
+            dbg->rewind = NULL;
+
+        dbg->current_pc = cpu->PC;
+        if (dbg->watch_count)
+        {
+            uint8_t size = isa_table[ram_peek(ram, cpu->PC)].size;
+            dbg->current_size = size ? size : 1;
+        }
+        cpu_step(cpu, ram);
+        steps++;
+
+        if (cpu->sched && cpu->instret >= sched_next_deadline(cpu->sched))
+            cpu_service_events(cpu, ram);
+        else if (cpu->irq_pending)
+            cpu_check_interrupts(cpu, ram);
+
+        if (dbg->hit)
+            return DEBUG_STOP_WATCHPOINT;
+
+        if (max_steps && steps >= max_steps && cpu->running)
+            return DEBUG_STOP_STEP;
+    }
+
+    return DEBUG_STOP_HALTED;
+}
+
+/* ================= reverse execution ================= */
+
+static const LogLevel quiet_levels[] = { LOG_INFO, LOG_DEBUG, LOG_TRACE };
+
+// Replayed instructions were logged the first time round
+static void quiet_logging(bool saved[], bool quiet)
+{
+    for (uint32_t i = 0; i < sizeof(quiet_levels) / sizeof(quiet_levels[0]); i++)
+    {
+        if (quiet)
+        {
+            saved[i] = log_is_enabled(quiet_levels[i]);
+            log_set_enabled(quiet_levels[i], false);
+        }
+        else
+        {
+            log_set_enabled(quiet_levels[i], saved[i]);
+        }
+    }
+}
+
+bool debug_attach_rewind(Debugger *dbg, Rewind *rw, const Cpu *cpu)
+{
+    if (dbg->ram->mmu || !rewind_checkpoint(rw, cpu, dbg->ram))
+        return false;
+
+    dbg->rewind = rw;
+    return true;
+}
+
+// Run forward to instret target, through any breakpoints and watchpoints
+static DebugStop run_to(Debugger *dbg, Cpu *cpu, Ram *ram, uint64_t target)
+{
+    DebugStop stop = DEBUG_STOP_STEP;
+
+    while (cpu->running && cpu->instret < target)
+        stop = debug_run(dbg, cpu, ram, target - cpu->instret);
+
+    if (stop == DEBUG_STOP_STEP && is_breakpoint(dbg, cpu->PC))
+        stop = DEBUG_STOP_BREAKPOINT;
+    return stop;
+}
+
+// Restore the latest checkpoint at or before target and replay up to it
+static DebugStop go_to(Debugger *dbg, Cpu *cpu, Ram *ram, uint64_t target)
+{
+    Rewind *rw = dbg->rewind;
+    int32_t index = rewind_find(rw, target);
+
+    if (index < 0)
+    {
+        index = 0;
+        target = rw->points[0].cpu.instret;
+    }
+
+    if (!rewind_restore(rw, (uint32_t)index, cpu, ram))
+        return DEBUG_STOP_STEP;
+
+    dbg->hit = false;
+    DebugStop stop = run_to(dbg, cpu, ram, target);
+
+    return cpu->instret == rw->points[0].cpu.instret && stop == DEBUG_STOP_STEP ? DEBUG_STOP_START : stop;
+}
+
+DebugStop debug_reverse_step(Debugger *dbg, Cpu *cpu, Ram *ram, uint64_t n)
+{
+    bool saved[3];
+    uint64_t target = cpu->instret > n ? cpu->instret - n : 0;
+
+    quiet_logging(saved, true);
+    DebugStop stop = go_to(dbg, cpu, ram, target);
+    quiet_logging(saved, false);
+
+    return stop == DEBUG_STOP_START ? stop : DEBUG_STOP_STEP;
+}
+
+/*
+ * Replay each checkpoint interval, newest first, up to where the previous
+ * scan started, and remember the last stop in it. The first interval with
+ * a stop holds the answer.
+ */
+DebugStop debug_reverse_continue(Debugger *dbg, Cpu *cpu, Ram *ram)
+{
+    Rewind *rw = dbg->rewind;
+    uint64_t limit = cpu->instret;
+    uint64_t found = UINT64_MAX;
+    bool saved[3];
+
+    quiet_logging(saved, true);
+
+    for (int32_t k = limit ? rewind_find(rw, limit - 1) : -1;
+         k >= 0 && found == UINT64_MAX && (dbg->breakpoint_count || dbg->watch_count); k--)
+    {
+        if (!rewind_restore(rw, (uint32_t)k, cpu, ram))
+            break;
+
+        if (is_breakpoint(dbg, cpu->PC))
+            found = cpu->instret;
+
+        while (cpu->running && cpu->instret < limit)
+        {
+            DebugStop stop = debug_run(dbg, cpu, ram, limit - cpu->instret);
+
+            if ((stop == DEBUG_STOP_BREAKPOINT || stop == DEBUG_STOP_WATCHPOINT) && cpu->instret < limit)
+                found = cpu->instret;
+        }
+
+        limit = rw->points[k].cpu.instret;
+    }
+
+    DebugStop stop = go_to(dbg, cpu, ram, found == UINT64_MAX ? 0 : found);
+    quiet_logging(saved, false);
+
+    return stop;
+}
+
+/* ================= interactive mode ================= */
+
+static void dump_memory(Ram *ram, uint32_t addr, uint32_t len)
+{
+    for (uint32_t row = 0; row < len; row += 16)
+    {
+        printf("0x%04X:", (addr + row) & 0xFFFF);
+        for (uint32_t i = row; i < row + 16 && i < len; i++)
+            printf(" %02X", ram_peek(ram, (uint16_t)(addr + i)));
+        printf("\n");
+    }
+}
+
+static void report_stop(const Debugger *dbg, const Cpu *cpu, DebugStop stop)
+{
+    switch (stop)
+    {
+    case DEBUG_STOP_HALTED:
+        printf("CPU halted at PC=0x%04X\n", cpu->PC);
+        break;
+    case DEBUG_STOP_BREAKPOINT:
+        printf("Breakpoint at PC=0x%04X\n", cpu->PC);
+        break;
+    case DEBUG_STOP_WATCHPOINT:
+        printf("Watchpoint: instruction at 0x%04X %s 0x%04X (value 0x%02X), PC=0x%04X\n",
+               dbg->hit_pc, dbg->hit_write ? "wrote" : "read",
+               dbg->hit_addr, dbg->hit_value, cpu->PC);
+        break;
+    case DEBUG_STOP_STEP:
+        printf("PC=0x%04X\n", cpu->PC);
+        break;
+    case DEBUG_STOP_START:
+        printf("Start of the recording, PC=0x%04X\n", cpu->PC);
+        break;
+    }
+}
+
+static void repl_help(void)
+{
+    printf("Commands:\n"
+           "  s [n]                 step n instructions (default 1)\n"
+           "  c                     continue\n"
+           "  S [n]                 step n instructions backwards (default 1)\n"
+           "  C                     continue backwards to the previous stop\n"
+           "  b <addr>              set breakpoint\n"
+           "  d <addr>              delete breakpoint\n"
+           "  w <addr> [len] [r|w]  watch a range for reads and/or writes (default rw)\n"
+           "  u <addr>              remove the watchpoint starting at addr\n"
+           "  r                     print registers\n"
+           "  x <addr> [len]        dump memory\n"
+           "  q                     quit\n");
+}
+
+void debug_repl(Debugger *dbg, Cpu *cpu, Ram *ram, FILE *in)
+{
+    char line[MAX_COMMAND];
+
+    printf("Debugging at PC=0x%04X, type 'h' for help\n", cpu->PC);
+
+    while (printf("(dbg) "), fflush(stdout), fgets(line, sizeof(line), in))
+    {
+        char cmd = 0;
+        char mode[4] = "rw";
+        char arg1[32] = "", arg2[32] = "";
+        int n = sscanf(line, " %c %31s %31s %3s", &cmd, arg1, arg2, mode);
+        uint32_t a = (uint32_t)strtoul(arg1, NULL, 0);
+        uint32_t b = (uint32_t)strtoul(arg2, NULL, 0);
+
+        if (n <= 0)
+            continue;
+
+        switch (cmd)
+        {
+        case 's':
+            if (!cpu->running)
+            {
+                printf("CPU is halted\n");
+                break;
+            }
+            report_stop(dbg, cpu, debug_run(dbg, cpu, ram, n >= 2 && a ? a : 1));
+            break;
+
+        case 'c':
+            if (!cpu->running)
+            {
+                printf("CPU is halted\n");
+                break;
+            }
+            report_stop(dbg, cpu, debug_run(dbg, cpu, ram, 0));
+            break;
+
+        case 'S':
+        case 'C':
+            if (!dbg->rewind)
+            {
+                printf("Reverse execution is off\n");
+                break;
+            }
+            report_stop(dbg, cpu, cmd == 'S' ? debug_reverse_step(dbg, cpu, ram, n >= 2 && a ? a : 1)
+                                             : debug_reverse_continue(dbg, cpu, ram));
+            printf("instret=%llu\n", (unsigned long long)cpu->instret);
+            break;
+
+        case 'b':
+            if (n < 2 || !debug_add_breakpoint(dbg, (uint16_t)a))
+                printf("Cannot set breakpoint\n");
+            break;
+
+        case 'd':
+            if (n < 2 || !debug_remove_breakpoint(dbg, (uint16_t)a))
+                printf("No breakpoint at that address\n");
+            break;
+
+        case 'w':
+        {
+            uint32_t len = n >= 3 && b ? b : 1;
+            uint8_t access = 0;
+            const char *kind = mode;
+
+            if (n >= 3 && (arg2[0] == 'r' || arg2[0] == 'w'))
+            {
+                len = 1;
+                kind = arg2;
+            }
+            if (strchr(kind, 'r'))
+                access |= RAM_WATCH_READ;
+            if (strchr(kind, 'w'))
+                access |= RAM_WATCH_WRITE;
+
+            if (n < 2 || a + len - 1 > 0xFFFF ||
+                !debug_add_watchpoint(dbg, (uint16_t)a, (uint16_t)(a + len - 1), access))
+                printf("Cannot set watchpoint\n");
+            break;
+        }
+
+        case 'u':
+            if (n < 2 || !debug_remove_watchpoint(dbg, (uint16_t)a))
+                printf("No watchpoint at that address\n");
+            break;
+
+        case 'r':
+            cpu_print(cpu);
+            break;
+
+        case 'x':
+            if (n < 2)
+            {
+                printf("Usage: x <addr> [len]\n");
+                break;
+            }
+            dump_memory(ram, a, n >= 3 && b ? b : 64);
+            break;
+
+        case 'q':
+            return;
+
+        default:
+            repl_help();
+            break;
+        }
+    }
+}
@@ -2,6 +2,16 @@
 #include "isa.h"
 #include "log.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define STREAM_CHUNK (64 * 1024)
+#define MAX_THREADS 64
+#define MIN_RANGE_PER_THREAD 4096
+
+static const char hex_digits[] = "0123456789ABCDEF";
 
 static uint8_t read8(const uint8_t *memory, uint16_t addr)
 {
@@ -11,95 +21,392 @@ static uint8_t read8(const uint8_t *memory, uint16_t addr)
 static uint16_t read16(const uint8_t *memory, uint16_t addr)
 {
     uint16_t hi = read8(memory, addr);
-    uint16_t lo = read8(memory, addr + 1);
+    uint16_t lo = read8(memory, (uint16_t)(addr + 1));
     return (hi << 8) | lo;
 }
 
-static void disasm_load_imm(const uint8_t *memory, uint16_t pc, uint16_t *next_pc)
+/* ================= formatting ================= */
+
+static char *put_str(char *p, const char *s)
+{
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+static char *put_hex8(char *p, uint8_t v)
+{
+    *p++ = hex_digits[v >> 4];
+    *p++ = hex_digits[v & 0xF];
+    return p;
+}
+
+static char *put_hex16(char *p, uint16_t v)
 {
-    uint8_t reg = read8(memory, pc + 1);
-    uint8_t imm = read8(memory, pc + 2);
-    log_write(LOG_INFO, "[DISASSEMBLER] 0x%04X: LOAD_IMM R%u, #%u", pc, reg, imm);
-    *next_pc = pc + 3;
+    *p++ = '0';
+    *p++ = 'x';
+    p = put_hex8(p, v >> 8);
+    return put_hex8(p, v & 0xFF);
 }
 
-static void disasm_two_reg(const uint8_t *memory, uint16_t pc, uint16_t *next_pc, const char *name)
+static char *put_dec(char *p, uint8_t v)
 {
-    uint8_t dst = read8(memory, pc + 1);
-    uint8_t src = read8(memory, pc + 2);
-    log_write(LOG_INFO, "[DISASSEMBLER] 0x%04X: %s R%u, R%u", pc, name, dst, src);
-    *next_pc = pc + 3;
+    if (v >= 100)
+        *p++ = '0' + v / 100;
+    if (v >= 10)
+        *p++ = '0' + (v / 10) % 10;
+    *p++ = '0' + v % 10;
+    return p;
 }
 
-static void disasm_mem_op(const uint8_t *memory, uint16_t pc, uint16_t *next_pc, const char *name)
+static char *put_reg(char *p, uint8_t reg)
 {
-    uint8_t reg = read8(memory, pc + 1);
-    uint16_t addr = read16(memory, pc + 2);
-    log_write(LOG_INFO, "[DISASSEMBLER] 0x%04X: %s R%u, 0x%04X", pc, name, reg, addr);
-    *next_pc = pc + 4;
+    *p++ = 'R';
+    return put_dec(p, reg);
 }
 
-static void disasm_halt(uint16_t pc, uint16_t *next_pc)
+static char *put_pair(char *p, uint8_t pair)
 {
-    log_write(LOG_INFO, "[DISASSEMBLER] 0x%04X: HALT", pc);
-    *next_pc = pc + 1;
+    *p++ = 'P';
+    return put_dec(p, pair);
 }
 
-static void disasm_unknown(const uint8_t *memory, uint16_t pc, uint16_t *next_pc)
+/* ================= decoder ================= */
+
+size_t disasm_line(const uint8_t *memory, uint16_t pc, char *out, uint8_t *length)
 {
     uint8_t opcode = read8(memory, pc);
-    log_write(LOG_INFO, "[DISASSEMBLER] 0x%04X: DB 0x%02X", pc, opcode);
-    *next_pc = pc + 1;
+    const IsaInstr *ins = &isa_table[opcode];
+    char *p = out;
+
+    p = put_hex16(p, pc);
+    *p++ = ':';
+    *p++ = ' ';
+
+    switch (ins->format)
+    {
+    case FMT_NONE:
+        p = put_str(p, ins->mnemonic);
+        break;
+
+    case FMT_REG_IMM:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_reg(p, read8(memory, pc + 1));
+        p = put_str(p, ", #");
+        p = put_dec(p, read8(memory, pc + 2));
+        break;
+
+    case FMT_REG_REG:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_reg(p, read8(memory, pc + 1));
+        p = put_str(p, ", ");
+        p = put_reg(p, read8(memory, pc + 2));
+        break;
+
+    case FMT_REG_ADDR:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_reg(p, read8(memory, pc + 1));
+        p = put_str(p, ", ");
+        p = put_hex16(p, read16(memory, pc + 2));
+        break;
+
+    case FMT_ADDR:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_hex16(p, read16(memory, pc + 1));
+        break;
+
+    case FMT_REG3:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_reg(p, read8(memory, pc + 1));
+        p = put_str(p, ", ");
+        p = put_reg(p, read8(memory, pc + 2));
+        p = put_str(p, ", ");
+        p = put_reg(p, read8(memory, pc + 3));
+        break;
+
+    case FMT_PAIR_IMM:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_pair(p, read8(memory, pc + 1));
+        p = put_str(p, ", ");
+        p = put_hex16(p, read16(memory, pc + 2));
+        break;
+
+    case FMT_PAIR_PAIR:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_pair(p, read8(memory, pc + 1));
+        p = put_str(p, ", ");
+        p = put_pair(p, read8(memory, pc + 2));
+        break;
+
+    case FMT_REG_IND:
+    {
+        uint8_t operand = read8(memory, pc + 2);
+
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_reg(p, read8(memory, pc + 1));
+        p = put_str(p, ", [");
+        p = put_pair(p, operand & ISA_IND_PAIR_MASK);
+        if (operand & ISA_IND_POST_INC)
+            *p++ = '+';
+        *p++ = ']';
+        break;
+    }
+
+    case FMT_PAIR_WORD:
+        p = put_str(p, ins->mnemonic);
+        *p++ = ' ';
+        p = put_pair(p, read8(memory, pc + 1));
+        p = put_str(p, ", #");
+        p = put_dec(p, read8(memory, pc + 2));
+        break;
+
+    default:
+        p = put_str(p, "DB 0x");
+        p = put_hex8(p, opcode);
+        break;
+    }
+
+    *p++ = '\n';
+    *length = ins->size ? ins->size : 1;
+
+    return (size_t)(p - out);
 }
 
-void disassemble_memory(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr)
+/* ================= sequential output ================= */
+
+size_t disassemble_to_buffer(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr,
+                             char *buf, size_t cap)
 {
-    uint16_t pc = start_addr;
+    char line[DISASM_MAX_LINE];
+    size_t used = 0;
+    uint32_t pc = start_addr;
 
     while (pc <= end_addr)
     {
-        uint8_t opcode = read8(memory, pc);
-        uint16_t next_pc = pc;
+        uint8_t length;
 
-        switch (opcode)
+        if (cap - used >= DISASM_MAX_LINE)
         {
-        case OP_LOAD_IMM:
-            disasm_load_imm(memory, pc, &next_pc);
-            break;
+            used += disasm_line(memory, (uint16_t)pc, buf + used, &length);
+        }
+        else
+        {
+            size_t n = disasm_line(memory, (uint16_t)pc, line, &length);
+            if (n > cap - used)
+                break;
+            memcpy(buf + used, line, n);
+            used += n;
+        }
 
-        case OP_ADD:
-            disasm_two_reg(memory, pc, &next_pc, "ADD");
-            break;
+        pc += length;
+    }
 
-        case OP_SUB:
-            disasm_two_reg(memory, pc, &next_pc, "SUB");
-            break;
+    return used;
+}
 
-        case OP_MLP:
-            disasm_two_reg(memory, pc, &next_pc, "MLP");
-            break;
+int disassemble_to_file(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr, FILE *out)
+{
+    char *buf = malloc(STREAM_CHUNK);
+    if (!buf)
+    {
+        log_write(LOG_ERROR, "Out of memory allocating disassembly buffer");
+        return -1;
+    }
 
-        case OP_DIV:
-            disasm_two_reg(memory, pc, &next_pc, "DIV");
-            break;
+    size_t used = 0;
+    uint32_t pc = start_addr;
+    int rc = 0;
 
-        case OP_STORE:
-            disasm_mem_op(memory, pc, &next_pc, "STORE");
-            break;
+    while (pc <= end_addr)
+    {
+        if (STREAM_CHUNK - used < DISASM_MAX_LINE)
+        {
+            if (fwrite(buf, 1, used, out) != used)
+            {
+                rc = -1;
+                break;
+            }
+            used = 0;
+        }
 
-        case OP_LOAD_MEM:
-            disasm_mem_op(memory, pc, &next_pc, "LOAD_MEM");
-            break;
+        uint8_t length;
+        used += disasm_line(memory, (uint16_t)pc, buf + used, &length);
+        pc += length;
+    }
 
-        case OP_HALT:
-            disasm_halt(pc, &next_pc);
-            break;
+    if (rc == 0 && used && fwrite(buf, 1, used, out) != used)
+        rc = -1;
+
+    free(buf);
+    return rc;
+}
+
+/* ================= parallel output ================= */
 
-        default:
-            disasm_unknown(memory, pc, &next_pc);
+typedef struct
+{
+    const uint8_t *memory;
+    uint32_t start;        // first address this worker owns
+    uint32_t end;          // last address this worker owns (inclusive)
+    uint32_t next_pc;      // address following the last decoded instruction
+    uint32_t *offsets;     // text offset per owned address, UINT32_MAX if not a boundary
+    char *text;
+    size_t text_len;
+    bool failed;
+} DisasmRange;
+
+static void *disasm_worker(void *arg)
+{
+    DisasmRange *r = arg;
+    uint32_t span = r->end - r->start + 1;
+
+    r->offsets = malloc(span * sizeof(uint32_t));
+    r->text = malloc((size_t)span * DISASM_MAX_LINE);
+    if (!r->offsets || !r->text)
+    {
+        r->failed = true;
+        return NULL;
+    }
+
+    memset(r->offsets, 0xFF, span * sizeof(uint32_t));
+
+    uint32_t pc = r->start;
+    size_t used = 0;
+
+    while (pc <= r->end)
+    {
+        uint8_t length;
+        r->offsets[pc - r->start] = (uint32_t)used;
+        used += disasm_line(r->memory, (uint16_t)pc, r->text + used, &length);
+        pc += length;
+    }
+
+    r->text_len = used;
+    r->next_pc = pc;
+    return NULL;
+}
+
+int disassemble_parallel(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr,
+                         FILE *out, int threads)
+{
+    if (end_addr < start_addr)
+        return 0;
+
+    uint32_t total = (uint32_t)end_addr - start_addr + 1;
+    uint32_t max_threads = total / MIN_RANGE_PER_THREAD;
+
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if ((uint32_t)threads > max_threads)
+        threads = (int)max_threads;
+    if (threads <= 1)
+        return disassemble_to_file(memory, start_addr, end_addr, out);
+
+    DisasmRange ranges[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    uint32_t per = total / threads;
+    int started = 0;
+    int rc = 0;
+
+    memset(ranges, 0, sizeof(ranges));
+
+    for (int i = 0; i < threads; i++)
+    {
+        ranges[i].memory = memory;
+        ranges[i].start = start_addr + per * i;
+        ranges[i].end = (i == threads - 1) ? end_addr : ranges[i].start + per - 1;
+
+        if (pthread_create(&tids[i], NULL, disasm_worker, &ranges[i]) != 0)
+        {
+            rc = -1;
             break;
         }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < started; i++)
+    {
+        if (ranges[i].failed)
+            rc = -1;
+    }
+
+    if (rc != 0)
+    {
+        log_write(LOG_WARN, "Parallel disassembly unavailable, falling back to a single thread");
+        for (int i = 0; i < started; i++)
+        {
+            free(ranges[i].offsets);
+            free(ranges[i].text);
+        }
+        return disassemble_to_file(memory, start_addr, end_addr, out);
+    }
+
+    /*
+     * Splice: the real stream enters each range at `pc`, which may sit in
+     * the middle of an instruction the worker decoded speculatively. Decode
+     * sequentially from there until the two streams meet on a common
+     * instruction boundary; from that point on they are identical.
+     */
+    uint32_t pc = start_addr;
+    char line[DISASM_MAX_LINE];
+
+    for (int i = 0; i < started; i++)
+    {
+        DisasmRange *r = &ranges[i];
+
+        while (pc <= r->end && r->offsets[pc - r->start] == UINT32_MAX)
+        {
+            uint8_t length;
+            size_t n = disasm_line(memory, (uint16_t)pc, line, &length);
+            if (fwrite(line, 1, n, out) != n)
+                rc = -1;
+            pc += length;
+        }
+
+        if (pc > r->end)
+            continue;
+
+        uint32_t offset = r->offsets[pc - r->start];
+        size_t n = r->text_len - offset;
+        if (fwrite(r->text + offset, 1, n, out) != n)
+            rc = -1;
 
-        pc = next_pc;
+        pc = r->next_pc;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        free(ranges[i].offsets);
+        free(ranges[i].text);
+    }
+
+    return rc;
+}
+
+/* ================= logging ================= */
+
+void disassemble_memory(const uint8_t *memory, uint16_t start_addr, uint16_t end_addr)
+{
+    char line[DISASM_MAX_LINE];
+    uint32_t pc = start_addr;
+
+    while (pc <= end_addr)
+    {
+        uint8_t length;
+        size_t n = disasm_line(memory, (uint16_t)pc, line, &length);
+        line[n - 1] = '\0';
+        log_write(LOG_INFO, "[DISASSEMBLER] %s", line);
+        pc += length;
     }
 }
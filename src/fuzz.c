@@ -0,0 +1,482 @@
+#include "fuzz.h"
+#include "cpu_fast.h"
+#include "log.h"
+#include "sweep.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define LOG_LEVELS (LOG_UNAUTHORIZED + 1)
+#define FAULT_KINDS (CPU_FAULT_DEVICE + 1)
+#define CLOCK_CHECK_EXECS 1024   // executions between clock reads
+#define STATUS_SECONDS 2.0
+
+static const char *const fault_names[FAULT_KINDS] = {
+    "none", "memory", "privileged", "invalid", "div_zero", "device"
+};
+
+// Boundary values for the byte mutator
+static const uint8_t interesting[] = { 0x00, 0x01, 0x02, 0x10, 0x20, 0x40, 0x64, 0x7F, 0x80, 0x81, 0xFE, 0xFF };
+
+typedef struct
+{
+    const FuzzConfig *config;
+    SweepMachine machine;
+    uint8_t *trace;             // edge hit counts of the current execution
+    uint8_t *seen;              // hit-count buckets ever reached, per map entry
+    uint8_t *crash_seen;        // one bit per fault kind and PC
+    uint8_t *corpus;            // FUZZ_MAX_CORPUS entries of input_max bytes
+    uint16_t *corpus_len;
+    uint32_t next_id;           // queue file number
+    uint64_t rng;
+    uint8_t count_class[256];   // hit count -> bucket bit
+    bool log_saved[LOG_LEVELS];
+    FuzzStats stats;
+} Fuzzer;
+
+/* ================= helpers ================= */
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Executions fault on purpose: silence the engine, errors included
+static void quiet(Fuzzer *f)
+{
+    for (int l = 0; l < LOG_LEVELS; l++)
+    {
+        f->log_saved[l] = log_is_enabled((LogLevel)l);
+        log_set_enabled((LogLevel)l, false);
+    }
+}
+
+static void loud(const Fuzzer *f)
+{
+    for (int l = 0; l < LOG_LEVELS; l++)
+        log_set_enabled((LogLevel)l, f->log_saved[l]);
+}
+
+static bool make_dir(const char *path)
+{
+    if (mkdir(path, 0755) == 0 || errno == EEXIST)
+        return true;
+
+    log_write(LOG_ERROR, "Error while creating %s", path);
+    return false;
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t len)
+{
+    FILE *out = fopen(path, "wb");
+    bool ok = out && fwrite(data, 1, len, out) == len;
+
+    if (out && fclose(out) != 0)
+        ok = false;
+    if (!ok)
+        log_write(LOG_ERROR, "Error while writing %s", path);
+    return ok;
+}
+
+// xorshift64*
+static uint64_t next_rand(Fuzzer *f)
+{
+    f->rng ^= f->rng >> 12;
+    f->rng ^= f->rng << 25;
+    f->rng ^= f->rng >> 27;
+    return f->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t below(Fuzzer *f, uint32_t n)
+{
+    return (uint32_t)(next_rand(f) % n);
+}
+
+bool fuzz_parse_input(const char *spec, FuzzConfig *config)
+{
+    char *end;
+    unsigned long addr = strtoul(spec, &end, 0);
+    unsigned long len = *end == ':' ? strtoul(end + 1, &end, 0) : 0;
+
+    if (*end != '\0' || len == 0 || len > FUZZ_MAX_INPUT || addr + len > RAM_SIZE)
+    {
+        log_write(LOG_ERROR, "Bad fuzz input region '%s' (want <addr>:<1..%d> inside RAM)", spec,
+                  FUZZ_MAX_INPUT);
+        return false;
+    }
+
+    config->input_addr = (uint16_t)addr;
+    config->input_max = (uint16_t)len;
+    return true;
+}
+
+/* ================= execution ================= */
+
+// Run one input; returns the CpuFault it stopped on
+static uint8_t execute(Fuzzer *f, const uint8_t *input, uint16_t len, bool *timed_out, uint16_t *pc)
+{
+    SweepMachine *m = &f->machine;
+    Cpu cpu = *m->template_cpu;
+
+    for (uint16_t i = 0; i < len; i++)
+        sweep_machine_store(m, (uint16_t)(f->config->input_addr + i), input[i]);
+    cpu.R[0] = (uint8_t)len;
+
+    // new_coverage leaves the trace cleared
+    dcache_set_coverage(m->dc, f->trace);
+
+    *timed_out = sweep_machine_exec(m, &cpu, !f->config->user_mode, f->config->max_steps);
+    *pc = cpu.PC;
+
+    sweep_machine_reset(m);
+    return cpu.fault;
+}
+
+// Record the trace's buckets and clear it for the next execution; true if
+// one was never reached before
+static bool new_coverage(Fuzzer *f)
+{
+    uint64_t *words = (uint64_t *)f->trace;
+    bool found = false;
+
+    // Most of the map is untouched: skip it a cache line at a time
+    for (uint32_t w = 0; w < DCACHE_COVERAGE_SIZE / 8; w += 8)
+    {
+        if (!(words[w] | words[w + 1] | words[w + 2] | words[w + 3] |
+              words[w + 4] | words[w + 5] | words[w + 6] | words[w + 7]))
+            continue;
+
+        for (uint32_t i = w * 8; i < w * 8 + 64; i++)
+        {
+            uint8_t bucket = f->count_class[f->trace[i]];
+
+            if (bucket & ~f->seen[i])
+            {
+                if (!f->seen[i])
+                    f->stats.edges++;
+                f->seen[i] |= bucket;
+                found = true;
+            }
+        }
+        memset(words + w, 0, 64);
+    }
+
+    return found;
+}
+
+static bool add_to_corpus(Fuzzer *f, const uint8_t *input, uint16_t len, bool save)
+{
+    if (f->stats.corpus == FUZZ_MAX_CORPUS)
+        return true;
+
+    memcpy(f->corpus + (size_t)f->stats.corpus * f->config->input_max, input, len);
+    f->corpus_len[f->stats.corpus++] = len;
+
+    if (!save)
+        return true;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/queue/id-%06u", f->config->dir, f->next_id++);
+    return write_file(path, input, len);
+}
+
+// Save the first input to reach each fault kind and PC
+static bool save_crash(Fuzzer *f, uint8_t fault, uint16_t pc, const uint8_t *input, uint16_t len)
+{
+    uint32_t key = (uint32_t)fault * RAM_SIZE + pc;
+
+    if (f->crash_seen[key >> 3] & (1u << (key & 7)))
+        return true;
+    f->crash_seen[key >> 3] |= (uint8_t)(1u << (key & 7));
+    f->stats.unique_crashes++;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/crashes/%s-%04X", f->config->dir, fault_names[fault], pc);
+
+    loud(f);
+    log_write(LOG_INFO, "Fuzz: %s fault at PC=0x%04X after %llu execs -> %s", fault_names[fault], pc,
+              (unsigned long long)f->stats.execs, path);
+    bool ok = write_file(path, input, len);
+    quiet(f);
+    return ok;
+}
+
+// Run input and act on the result: crash, timeout or new coverage
+static bool try_input(Fuzzer *f, const uint8_t *input, uint16_t len, bool seed)
+{
+    bool timed_out;
+    uint16_t pc;
+    uint8_t fault = execute(f, input, len, &timed_out, &pc);
+
+    f->stats.execs++;
+
+    if (timed_out || (fault != CPU_FAULT_NONE && fault < FAULT_KINDS))
+    {
+        memset(f->trace, 0, DCACHE_COVERAGE_SIZE);
+
+        if (timed_out)
+        {
+            f->stats.timeouts++;
+            return true;
+        }
+
+        f->stats.crashes++;
+        return save_crash(f, fault, pc, input, len);
+    }
+
+    if (new_coverage(f) || seed)
+        return add_to_corpus(f, input, len, !seed);
+    return true;
+}
+
+/* ================= mutation ================= */
+
+// Stacked random edits of buf (input_max bytes, len in use); returns the new length
+static uint16_t mutate(Fuzzer *f, uint8_t *buf, uint16_t len)
+{
+    uint16_t max = f->config->input_max;
+    uint32_t rounds = 1u << (1 + below(f, 4));
+
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        switch (below(f, 8))
+        {
+        case 0:
+            buf[below(f, len)] ^= (uint8_t)(1u << below(f, 8));
+            break;
+        case 1:
+            buf[below(f, len)] = (uint8_t)next_rand(f);
+            break;
+        case 2:
+            buf[below(f, len)] = interesting[below(f, sizeof(interesting))];
+            break;
+        case 3:
+            buf[below(f, len)] += (uint8_t)(1 + below(f, 16));
+            break;
+        case 4:
+            buf[below(f, len)] -= (uint8_t)(1 + below(f, 16));
+            break;
+        case 5:
+        {
+            // Splice in a piece of another corpus entry
+            uint32_t e = below(f, f->stats.corpus);
+            const uint8_t *other = f->corpus + (size_t)e * max;
+            uint16_t other_len = f->corpus_len[e];
+            uint16_t from = (uint16_t)below(f, other_len);
+            uint16_t to = (uint16_t)below(f, len);
+            uint16_t room = (uint16_t)(other_len - from < len - to ? other_len - from : len - to);
+
+            memcpy(buf + to, other + from, 1 + below(f, room));
+            break;
+        }
+        case 6:
+        {
+            uint16_t new_len = (uint16_t)(1 + below(f, max));
+
+            for (uint16_t i = len; i < new_len; i++)
+                buf[i] = (uint8_t)next_rand(f);
+            len = new_len;
+            break;
+        }
+        default:
+        {
+            // Copy a piece of the input over another part of it
+            uint16_t from = (uint16_t)below(f, len);
+            uint16_t to = (uint16_t)below(f, len);
+            uint16_t room = (uint16_t)(len - (from > to ? from : to));
+
+            memmove(buf + to, buf + from, 1 + below(f, room));
+            break;
+        }
+        }
+    }
+
+    return len;
+}
+
+/* ================= entry ================= */
+
+// Corpus entries left in <dir>/queue by an earlier run
+static bool load_queue(Fuzzer *f, const char *queue_dir, uint8_t *buf)
+{
+    DIR *d = opendir(queue_dir);
+    struct dirent *ent;
+    bool ok = true;
+
+    if (!d)
+        return true;
+
+    while (ok && (ent = readdir(d)) && f->stats.corpus < FUZZ_MAX_CORPUS)
+    {
+        char path[4096];
+        unsigned id;
+
+        if (ent->d_name[0] == '.')
+            continue;
+        if (sscanf(ent->d_name, "id-%u", &id) == 1 && id >= f->next_id)
+            f->next_id = id + 1;
+
+        if (snprintf(path, sizeof(path), "%s/%s", queue_dir, ent->d_name) >= (int)sizeof(path))
+            continue;
+        FILE *in = fopen(path, "rb");
+        if (!in)
+            continue;
+
+        size_t len = fread(buf, 1, f->config->input_max, in);
+        fclose(in);
+        if (len)
+            ok = try_input(f, buf, (uint16_t)len, true);
+    }
+
+    closedir(d);
+    return ok;
+}
+
+static void report(Fuzzer *f, double elapsed)
+{
+    loud(f);
+    log_write(LOG_INFO, "Fuzz: %llu execs (%.0f/s), corpus %u, edges %u, crashes %u unique (%llu), timeouts %llu",
+              (unsigned long long)f->stats.execs, elapsed > 0 ? f->stats.execs / elapsed : 0.0,
+              f->stats.corpus, f->stats.edges, f->stats.unique_crashes,
+              (unsigned long long)f->stats.crashes, (unsigned long long)f->stats.timeouts);
+    quiet(f);
+}
+
+static bool fuzz_loop(Fuzzer *f, uint8_t *buf)
+{
+    const FuzzConfig *config = f->config;
+    char path[4096];
+    struct timespec start;
+    double last_report = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    snprintf(path, sizeof(path), "%s/queue", config->dir);
+    if (!load_queue(f, path, buf))
+        return false;
+
+    if (f->stats.corpus == 0)
+    {
+        memset(buf, 0, config->input_max);
+        if (!try_input(f, buf, config->input_max, true))
+            return false;
+    }
+
+    if (f->stats.corpus == 0)
+    {
+        loud(f);
+        log_write(LOG_ERROR, "Fuzz: every seed input crashes or times out");
+        quiet(f);
+        return false;
+    }
+
+    while (!config->max_execs || f->stats.execs < config->max_execs)
+    {
+        uint32_t e = below(f, f->stats.corpus);
+        uint16_t len = f->corpus_len[e];
+
+        memcpy(buf, f->corpus + (size_t)e * config->input_max, len);
+        len = mutate(f, buf, len);
+
+        if (!try_input(f, buf, len, false))
+            return false;
+
+        if (f->stats.execs % CLOCK_CHECK_EXECS == 0)
+        {
+            double elapsed = seconds_since(&start);
+
+            if (config->max_seconds && elapsed >= config->max_seconds)
+                break;
+            if (elapsed - last_report >= STATUS_SECONDS)
+            {
+                report(f, elapsed);
+                last_report = elapsed;
+            }
+        }
+    }
+
+    report(f, seconds_since(&start));
+    return true;
+}
+
+bool fuzz_run(const FuzzConfig *config, const Cpu *template_cpu, const Ram *template_ram,
+              const Verification *v, FuzzStats *stats)
+{
+    if (template_ram->mmu)
+    {
+        log_write(LOG_ERROR, "Fuzz mode does not support an MMU");
+        return false;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/queue", config->dir);
+    if (!make_dir(config->dir) || !make_dir(path))
+        return false;
+    snprintf(path, sizeof(path), "%s/crashes", config->dir);
+    if (!make_dir(path))
+        return false;
+
+    Fuzzer *f = calloc(1, sizeof(Fuzzer));
+    uint8_t *buf = malloc(config->input_max);
+
+    if (f)
+    {
+        f->config = config;
+        f->rng = config->seed ? config->seed : 0x9E3779B97F4A7C15ULL;
+        f->trace = calloc(1, DCACHE_COVERAGE_SIZE);
+        f->seen = calloc(1, DCACHE_COVERAGE_SIZE);
+        f->crash_seen = calloc(1, (size_t)FAULT_KINDS * RAM_SIZE / 8);
+        f->corpus = malloc((size_t)FUZZ_MAX_CORPUS * config->input_max);
+        f->corpus_len = malloc(FUZZ_MAX_CORPUS * sizeof(uint16_t));
+    }
+
+    bool ok = f && buf && f->trace && f->seen && f->crash_seen && f->corpus && f->corpus_len &&
+              sweep_machine_init(&f->machine, template_cpu, template_ram);
+
+    if (!ok)
+    {
+        log_write(LOG_ERROR, "Out of memory preparing the fuzzer");
+    }
+    else
+    {
+        if (v)
+            dcache_attach_verification(f->machine.dc, v);
+
+        for (int c = 0; c < 256; c++)
+        {
+            f->count_class[c] = c == 0 ? 0 : c == 1 ? 1 : c == 2 ? 2 : c == 3 ? 4 : c < 8 ? 8
+                              : c < 16 ? 16 : c < 32 ? 32 : c < 128 ? 64 : 128;
+        }
+
+        log_write(LOG_INFO, "Fuzzing %u byte(s) at 0x%04X, %llu steps per execution -> %s",
+                  config->input_max, config->input_addr, (unsigned long long)config->max_steps, config->dir);
+
+        quiet(f);
+        ok = fuzz_loop(f, buf);
+        loud(f);
+
+        dcache_set_coverage(f->machine.dc, NULL);
+        sweep_machine_free(&f->machine);
+        if (stats)
+            *stats = f->stats;
+    }
+
+    if (f)
+    {
+        free(f->trace);
+        free(f->seen);
+        free(f->crash_seen);
+        free(f->corpus);
+        free(f->corpus_len);
+    }
+    free(f);
+    free(buf);
+    return ok;
+}
@@ -0,0 +1,33 @@
+#include "image.h"
+#include "log.h"
+
+#include <string.h>
+
+void image_init(Image *image)
+{
+    image->org = 0;
+    image->size = 0;
+    image->segment_count = 0;
+    memset(image->segments, 0, sizeof(image->segments));
+}
+
+bool image_load(const Image *image, Ram *ram, bool privileged)
+{
+    for (uint16_t s = 0; s < image->segment_count; s++)
+    {
+        const ImageSegment *seg = &image->segments[s];
+
+        for (uint32_t i = 0; i < seg->length; i++)
+        {
+            uint32_t addr = (uint32_t)seg->addr + i;
+
+            if (!ram_write(ram, addr, image->bytes[seg->offset + i], privileged))
+            {
+                log_write(LOG_ERROR, "Failed to write program to RAM at 0x%04X", addr);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,144 @@
+#include "image_cache.h"
+#include "assembler.h"
+#include "sha256.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "C8IM"
+#define CACHE_FORMAT 2     // 2: 32-bit ImageSegment.length
+
+typedef struct
+{
+    char magic[4];
+    uint16_t format;
+    uint16_t org;
+    uint16_t segment_count;
+    uint16_t reserved;
+    uint32_t size;
+} CacheHeader;
+
+static void entry_path(char *out, size_t cap, const char *dir, const char *key)
+{
+    snprintf(out, cap, "%s/%s.img", dir, key);
+}
+
+void image_cache_key(const uint8_t *source, size_t len, char key[IMAGE_CACHE_KEY_LEN + 1])
+{
+    static const char hex[] = "0123456789abcdef";
+    static const char tag[] = "cpu-emulator assembler " ASSEMBLER_VERSION;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    Sha256 ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, tag, sizeof(tag)); // includes the NUL as a separator
+    sha256_update(&ctx, source, len);
+    sha256_final(&ctx, digest);
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        key[i * 2] = hex[digest[i] >> 4];
+        key[i * 2 + 1] = hex[digest[i] & 0xF];
+    }
+    key[IMAGE_CACHE_KEY_LEN] = '\0';
+}
+
+bool image_cache_lookup(const char *dir, const char *key, Image *image)
+{
+    char path[4096];
+    entry_path(path, sizeof(path), dir, key);
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    CacheHeader hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+              memcmp(hdr.magic, CACHE_MAGIC, 4) == 0;
+
+    // Written by another version: a miss, replaced by the next store
+    if (ok && hdr.format != CACHE_FORMAT)
+    {
+        fclose(f);
+        return false;
+    }
+
+    ok = ok && hdr.segment_count <= IMAGE_MAX_SEGMENTS &&
+         hdr.size <= RAM_SIZE;
+
+    if (ok)
+    {
+        image_init(image);
+        image->org = hdr.org;
+        image->size = hdr.size;
+        image->segment_count = hdr.segment_count;
+
+        ok = fread(image->segments, sizeof(ImageSegment), hdr.segment_count, f) == hdr.segment_count &&
+             fread(image->bytes, 1, hdr.size, f) == hdr.size;
+    }
+
+    for (uint16_t i = 0; ok && i < image->segment_count; i++)
+    {
+        const ImageSegment *seg = &image->segments[i];
+        if ((uint64_t)seg->offset + seg->length > image->size ||
+            (uint32_t)seg->addr + seg->length > RAM_SIZE)
+            ok = false;
+    }
+
+    fclose(f);
+
+    if (!ok)
+        log_write(LOG_WARN, "Ignoring corrupt image cache entry %s", path);
+
+    return ok;
+}
+
+bool image_cache_store(const char *dir, const char *key, const Image *image)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        log_write(LOG_WARN, "Cannot create image cache directory %s", dir);
+        return false;
+    }
+
+    char path[4096];
+    char tmp[4200];
+    entry_path(path, sizeof(path), dir, key);
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+    {
+        log_write(LOG_WARN, "Cannot write image cache entry %s", tmp);
+        return false;
+    }
+
+    CacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, 4);
+    hdr.format = CACHE_FORMAT;
+    hdr.org = image->org;
+    hdr.segment_count = image->segment_count;
+    hdr.size = image->size;
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(image->segments, sizeof(ImageSegment), image->segment_count, f) == image->segment_count &&
+              fwrite(image->bytes, 1, image->size, f) == image->size;
+
+    if (fclose(f) != 0)
+        ok = false;
+
+    // Publish atomically so concurrent runs never read a partial entry
+    if (!ok || rename(tmp, path) != 0)
+    {
+        log_write(LOG_WARN, "Failed to store image cache entry %s", path);
+        unlink(tmp);
+        return false;
+    }
+
+    return true;
+}
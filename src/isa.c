@@ -0,0 +1,83 @@
+#include "isa.h"
+
+#include <string.h>
+#include <pthread.h>
+
+const IsaInstr isa_table[256] =
+{
+#define ISA_ENTRY(NAME, name, code, fmt, flags, cycles) \
+    [OP_##NAME] = {#NAME, OP_##NAME, FMT_##fmt, ISA_SIZE_##fmt, flags, cycles},
+    ISA_INSTRUCTIONS(ISA_ENTRY)
+#undef ISA_ENTRY
+};
+
+/* ================= mnemonic lookup ================= */
+
+/*
+ * Perfect hash over the mnemonics: FNV-1a with the first seed that sends
+ * every mnemonic to its own slot. The seed is found once, on first use, so
+ * new rows in ISA_INSTRUCTIONS never need a hand-tuned hash.
+ */
+
+#define HASH_SLOTS 64
+#define HASH_MASK (HASH_SLOTS - 1)
+
+#define ISA_COUNT_ONE(NAME, name, code, fmt, flags, cycles) +1
+_Static_assert(0 ISA_INSTRUCTIONS(ISA_COUNT_ONE) <= HASH_SLOTS / 2, "grow HASH_SLOTS");
+#undef ISA_COUNT_ONE
+
+static uint8_t hash_slots[HASH_SLOTS];   // opcode per slot, 0 when empty
+static uint32_t hash_seed;
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t hash_mnemonic(uint32_t seed, const char *s)
+{
+    uint32_t h = 2166136261u ^ seed;
+
+    while (*s)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+
+    return h & HASH_MASK;
+}
+
+static void build_hash(void)
+{
+    static const uint8_t opcodes[] =
+    {
+#define ISA_OPCODE(NAME, name, code, fmt, flags, cycles) OP_##NAME,
+        ISA_INSTRUCTIONS(ISA_OPCODE)
+#undef ISA_OPCODE
+    };
+
+    for (uint32_t seed = 0;; seed++)
+    {
+        size_t i;
+
+        memset(hash_slots, 0, sizeof(hash_slots));
+
+        for (i = 0; i < sizeof(opcodes); i++)
+        {
+            uint32_t slot = hash_mnemonic(seed, isa_table[opcodes[i]].mnemonic);
+            if (hash_slots[slot])
+                break;
+            hash_slots[slot] = opcodes[i];
+        }
+
+        if (i == sizeof(opcodes))
+        {
+            hash_seed = seed;
+            return;
+        }
+    }
+}
+
+const IsaInstr *isa_lookup(const char *mnemonic)
+{
+    pthread_once(&hash_once, build_hash);
+
+    uint8_t opcode = hash_slots[hash_mnemonic(hash_seed, mnemonic)];
+    if (opcode && strcmp(isa_table[opcode].mnemonic, mnemonic) == 0)
+        return &isa_table[opcode];
+
+    return NULL;
+}
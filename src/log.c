@@ -84,6 +84,36 @@ static bool should_show(LogLevel level)
     }
 }
 
+void log_set_enabled(LogLevel level, bool enabled)
+{
+    switch (level)
+    {
+    case LOG_INFO:
+        LOG_INFO_SHOW = enabled;
+        break;
+    case LOG_DEBUG:
+        LOG_DEBUG_SHOW = enabled;
+        break;
+    case LOG_WARN:
+        LOG_WARN_SHOW = enabled;
+        break;
+    case LOG_TRACE:
+        LOG_TRACE_SHOW = enabled;
+        break;
+    case LOG_ERROR:
+        LOG_ERROR_SHOW = enabled;
+        break;
+    case LOG_UNAUTHORIZED:
+        LOG_UNAUTHORIZED_SHOW = enabled;
+        break;
+    }
+}
+
+bool log_is_enabled(LogLevel level)
+{
+    return should_show(level);
+}
+
 void log_write(LogLevel level, const char *fmt, ...)
 {
     if (!should_show(level))
@@ -0,0 +1,306 @@
+#include "machine_pool.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define NO_MACHINE UINT32_MAX
+#define HUGE_PAGE_SIZE (2u << 20)
+#define NO_SLOT UINT32_MAX                  // thread not numbered yet
+#define SHARED_ONLY (UINT32_MAX - 1)        // every slot was taken: use the shared list
+
+typedef struct
+{
+    uint32_t head;
+    uint32_t count;
+} __attribute__((aligned(64))) FreeList;
+
+struct MachinePool
+{
+    FreeList local[MACHINE_POOL_MAX_THREADS];   // one per thread slot, no locking
+    FreeList shared;                            // under lock
+    pthread_mutex_t lock;
+
+    uint8_t *arena;
+    size_t arena_size;
+    uint8_t *cells;             // capacity * RAM_SIZE
+    PoolMachine *machines;
+    uint32_t capacity;
+    bool hugetlb;
+    Cpu cpu_template;
+    MachinePool *next_pool;     // in pools
+};
+
+/*
+ * Thread slots are shared by every pool. A thread takes one on first use;
+ * when it exits, slot_key's destructor hands the machines it cached in
+ * each live pool to that pool's shared list and frees the slot for the
+ * next thread.
+ */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static MachinePool *pools;              // live pools
+static uint32_t free_slots[MACHINE_POOL_MAX_THREADS];
+static uint32_t free_slot_count;
+static uint32_t next_thread_slot;       // slots below this have been handed out
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static __thread uint32_t thread_slot = NO_SLOT;
+
+static size_t round_up(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+static void push(FreeList *list, PoolMachine *m)
+{
+    m->next = list->head;
+    list->head = m->index;
+    list->count++;
+}
+
+static PoolMachine *pop(MachinePool *pool, FreeList *list)
+{
+    if (list->head == NO_MACHINE)
+        return NULL;
+
+    PoolMachine *m = &pool->machines[list->head];
+    list->head = m->next;
+    list->count--;
+    return m;
+}
+
+// Caller holds the lock
+static void move(MachinePool *pool, FreeList *from, FreeList *to, uint32_t count)
+{
+    PoolMachine *m;
+
+    while (count-- && (m = pop(pool, from)))
+        push(to, m);
+}
+
+/* ================= thread slots ================= */
+
+// slot_key destructor; value is the slot + 1
+static void release_slot(void *value)
+{
+    uint32_t slot = (uint32_t)(uintptr_t)value - 1;
+
+    pthread_mutex_lock(&registry_lock);
+    for (MachinePool *pool = pools; pool; pool = pool->next_pool)
+    {
+        FreeList *list = &pool->local[slot];
+
+        pthread_mutex_lock(&pool->lock);
+        move(pool, list, &pool->shared, list->count);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free_slots[free_slot_count++] = slot;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void create_slot_key(void)
+{
+    if (pthread_key_create(&slot_key, release_slot) != 0)
+        next_thread_slot = MACHINE_POOL_MAX_THREADS;    // no way to give slots back
+}
+
+static uint32_t take_slot(void)
+{
+    uint32_t slot = SHARED_ONLY;
+
+    pthread_once(&slot_key_once, create_slot_key);
+
+    pthread_mutex_lock(&registry_lock);
+    if (free_slot_count)
+        slot = free_slots[--free_slot_count];
+    else if (next_thread_slot < MACHINE_POOL_MAX_THREADS)
+        slot = next_thread_slot++;
+    pthread_mutex_unlock(&registry_lock);
+
+    if (slot != SHARED_ONLY && pthread_setspecific(slot_key, (void *)(uintptr_t)(slot + 1)) != 0)
+    {
+        release_slot((void *)(uintptr_t)(slot + 1));
+        slot = SHARED_ONLY;
+    }
+    return slot;
+}
+
+static FreeList *local_list(MachinePool *pool)
+{
+    if (thread_slot == NO_SLOT)
+        thread_slot = take_slot();
+
+    return thread_slot < MACHINE_POOL_MAX_THREADS ? &pool->local[thread_slot] : NULL;
+}
+
+/* ================= arena ================= */
+
+// Huge-page aligned anonymous memory: reserved huge pages if any, else THP
+static uint8_t *map_arena(size_t size, bool *hugetlb)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+    {
+        *hugetlb = true;
+        return p;
+    }
+
+    *hugetlb = false;
+
+    // Over-map by one huge page and trim, so the slots start on a huge page boundary
+    uint8_t *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    uint8_t *base = (uint8_t *)round_up((uintptr_t)raw, HUGE_PAGE_SIZE);
+    if (base > raw)
+        munmap(raw, (size_t)(base - raw));
+    munmap(base + size, (size_t)(raw + HUGE_PAGE_SIZE - base));
+
+    madvise(base, size, MADV_HUGEPAGE);
+    return base;
+}
+
+MachinePool *machine_pool_create(uint32_t capacity)
+{
+    MachinePool *pool = aligned_alloc(64, round_up(sizeof(MachinePool), 64));
+    if (!pool || capacity == 0)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+
+    size_t cells_size = (size_t)capacity * RAM_SIZE;
+    size_t machines_size = round_up((size_t)capacity * sizeof(PoolMachine), RAM_PAGE_SIZE);
+
+    pool->capacity = capacity;
+    pool->arena_size = round_up(cells_size + machines_size, HUGE_PAGE_SIZE);
+    pool->arena = map_arena(pool->arena_size, &pool->hugetlb);
+    if (!pool->arena)
+    {
+        log_write(LOG_ERROR, "Out of memory allocating a pool of %u machines", capacity);
+        free(pool);
+        return NULL;
+    }
+
+    pool->cells = pool->arena;
+    pool->machines = (PoolMachine *)(pool->arena + cells_size);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    // Per-machine setup logs; keep it to one line for the pool
+    bool show_info = log_is_enabled(LOG_INFO);
+    bool show_debug = log_is_enabled(LOG_DEBUG);
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+
+    cpu_init(&pool->cpu_template, false);
+
+    for (uint32_t i = 0; i < MACHINE_POOL_MAX_THREADS; i++)
+        pool->local[i].head = NO_MACHINE;
+    pool->shared.head = NO_MACHINE;
+
+    // Pushed in reverse so machines are handed out in arena order
+    for (uint32_t i = capacity; i-- > 0;)
+    {
+        PoolMachine *m = &pool->machines[i];
+
+        m->index = i;
+        ram_init_external(&m->ram, pool->cells + (size_t)i * RAM_SIZE);
+        push(&pool->shared, m);
+    }
+
+    log_set_enabled(LOG_INFO, show_info);
+    log_set_enabled(LOG_DEBUG, show_debug);
+
+    pthread_mutex_lock(&registry_lock);
+    pool->next_pool = pools;
+    pools = pool;
+    pthread_mutex_unlock(&registry_lock);
+
+    log_write(LOG_INFO, "Machine pool: %u machines in %zu MB (%s)", capacity, pool->arena_size >> 20,
+              pool->hugetlb ? "huge pages" : "transparent huge pages requested");
+    return pool;
+}
+
+void machine_pool_destroy(MachinePool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&registry_lock);
+    MachinePool **link = &pools;
+    while (*link != pool)
+        link = &(*link)->next_pool;
+    *link = pool->next_pool;
+    pthread_mutex_unlock(&registry_lock);
+
+    munmap(pool->arena, pool->arena_size);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+bool machine_pool_hugetlb(const MachinePool *pool)
+{
+    return pool->hugetlb;
+}
+
+/* ================= acquire / release ================= */
+
+PoolMachine *machine_pool_acquire(MachinePool *pool)
+{
+    FreeList *list = local_list(pool);
+    PoolMachine *m;
+
+    if (list && list->count)
+    {
+        m = pop(pool, list);
+    }
+    else
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (list)
+            move(pool, &pool->shared, list, MACHINE_POOL_BATCH);
+        m = pop(pool, list ? list : &pool->shared);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (m)
+        m->cpu = pool->cpu_template;
+    return m;
+}
+
+void machine_pool_release(MachinePool *pool, PoolMachine *m)
+{
+    uint8_t *cells = pool->cells + (size_t)m->index * RAM_SIZE;
+
+    memset(cells, 0, RAM_SIZE);
+    if (m->ram.mmu || m->ram.watch_pages || m->ram.access_log || m->ram.memory_cells != cells)
+        ram_init_external(&m->ram, cells);
+    else
+        ram_contents_changed(&m->ram);
+
+    FreeList *list = local_list(pool);
+
+    if (list && list->count < 2 * MACHINE_POOL_BATCH)
+    {
+        push(list, m);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (list)
+    {
+        push(list, m);
+        move(pool, list, &pool->shared, MACHINE_POOL_BATCH);
+    }
+    else
+    {
+        push(&pool->shared, m);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -8,9 +8,24 @@
 #include "ram.h"
 #include "cpu.h"
 #include "cpu_exec.h"
+#include "cpu_fast.h"
 #include "log.h"
 #include "assembler.h"
 #include "disassembler.h"
+#include "cache_sim.h"
+#include "debug.h"
+#include "rewind.h"
+#include "sched.h"
+#include "timer.h"
+#include "image.h"
+#include "image_cache.h"
+#include "fuzz.h"
+#include "sweep.h"
+#include "shm_state.h"
+#include "snapshot.h"
+#include "state_hash.h"
+#include "verify.h"
+#include "watch.h"
 
 static long long time_now_ms(void)
 {
@@ -21,100 +36,573 @@ static long long time_now_ms(void)
 
 static void usage(const char *prog)
 {
-    printf("Usage: %s [-d] <asm_file>\n", prog);
-    printf("  -d    disassemble only\n");
+    printf("Usage: %s [options] <asm_file>\n", prog);
+    printf("  -d                 disassemble only\n");
+    printf("  -j <threads>       worker threads for disassembly (default 1)\n");
+    printf("  --cache-dir <dir>  assembled image cache (default %s)\n", IMAGE_CACHE_DEFAULT_DIR);
+    printf("  --no-cache         always assemble, bypassing the image cache\n");
+    printf("  --sparse           allocate RAM pages on first write\n");
+    printf("  --mmu <frames>     bank-switched memory with <frames> 256-byte physical frames\n");
+    printf("  --debug            interactive debugger (breakpoints, watchpoints, stepping)\n");
+    printf("  --rewind-interval <n> debugger checkpoint interval in instructions, 0 for none (default %d)\n",
+           REWIND_DEFAULT_INTERVAL);
+    printf("  --rewind-budget <MB> memory for debugger checkpoints (default %d)\n", REWIND_DEFAULT_BUDGET_MB);
+    printf("  --fast             run on the predecoded engine\n");
+    printf("  --no-memo          predecoded engine: never replay memoized blocks\n");
+    printf("  --no-verify        skip the load-time verifier (the engine keeps every check)\n");
+    printf("  --watch            patch edits to <asm_file> into the running guest, see watch.h\n");
+    printf("  -q                 quiet: only warnings and errors\n");
+    printf("  --shm <name>       share RAM and registers as /name or memfd, see shm_state.h\n");
+    printf("  --cache-sim        model instruction and data caches and report, see cache_sim.h\n");
+    printf("  --icache <s:l:w>   I-cache size:line:ways in bytes (default %s)\n", CACHE_SIM_DEFAULT_ICACHE);
+    printf("  --dcache <s:l:w>   D-cache size:line:ways in bytes (default %s)\n", CACHE_SIM_DEFAULT_DCACHE);
+    printf("  --miss-penalty <n> cycles per line fill or writeback (default %d)\n", CACHE_SIM_DEFAULT_MISS_PENALTY);
+    printf("  --cycles <file>    per-opcode cycle costs, \"<MNEMONIC> <cycles>\" lines\n");
+    printf("  --expect-digest <hex> exit with 1 unless the final state has this digest, see state_hash.h\n");
+    printf("  --sweep <inputs>   run once per record of <inputs>, see sweep.h\n");
+    printf("  --sweep-out <file> sweep output (default sweep.out)\n");
+    printf("  --select <fields>  sweep outputs, e.g. R0,PC,status,0x2000:4 (default %s)\n",
+           SWEEP_DEFAULT_SELECT);
+    printf("  --snapshots <dir>  sweep: keep every final state in a snapshot store, see snapshot.h\n");
+    printf("  --resume <dir>:<n> start from snapshot <n> of the store in <dir>\n");
+    printf("  --max-steps <n>    sweep per-run instruction limit (default %d, fuzzing %d)\n",
+           SWEEP_DEFAULT_MAX_STEPS, FUZZ_DEFAULT_MAX_STEPS);
+    printf("  --fuzz <dir>       coverage-guided fuzzing, corpus and crashes in <dir>, see fuzz.h\n");
+    printf("  --fuzz-input <a:n> guest input region, length in R0 (default %s)\n", FUZZ_DEFAULT_INPUT);
+    printf("  --fuzz-execs <n>   stop after <n> executions, 0 for no limit (default %d)\n",
+           FUZZ_DEFAULT_EXECS);
+    printf("  --fuzz-time <s>    stop after <s> seconds\n");
+    printf("  --fuzz-seed <n>    mutation RNG seed\n");
+    printf("  --fuzz-user        run the target unprivileged\n");
 }
 
-int main(int argc, char *argv[])
+static uint8_t *read_file(const char *path, size_t *len)
 {
-    bool disasm_only = false;
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
 
-    if (argc < 2 || argc > 3)
+    size_t cap = 4096;
+    size_t used = 0;
+    uint8_t *data = malloc(cap);
+
+    while (data)
     {
-        usage(argv[0]);
-        return 1;
+        used += fread(data + used, 1, cap - used, f);
+        if (used < cap)
+            break;
+
+        cap *= 2;
+        uint8_t *grown = realloc(data, cap);
+        if (!grown)
+            free(data);
+        data = grown;
+    }
+
+    fclose(f);
+    *len = used;
+    return data;
+}
+
+static bool write_binary(const char *bin_path, const Image *image)
+{
+    FILE *out = fopen(bin_path, "wb");
+    if (!out)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", bin_path);
+        return false;
+    }
+    fwrite(image->bytes, 1, image->size, out);
+    fclose(out);
+    return true;
+}
+
+/*
+ * Produce the image for asm_path, from the cache when the source is
+ * unchanged, otherwise by assembling it. Either way out.bin gets the
+ * assembled bytes, as before the cache. cache_dir == NULL disables the cache.
+ */
+static bool load_program(const char *asm_path, const char *cache_dir, Image *image)
+{
+    const char *bin_path = "out.bin";
+    size_t source_len = 0;
+    uint8_t *source = read_file(asm_path, &source_len);
+
+    if (!source)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", asm_path);
+        return false;
+    }
+
+    char key[IMAGE_CACHE_KEY_LEN + 1];
+    image_cache_key(source, source_len, key);
+
+    if (cache_dir && image_cache_lookup(cache_dir, key, image))
+    {
+        log_write(LOG_INFO, "Image cache hit %s (%u bytes at 0x%04X)", key, image->size, image->org);
+        free(source);
+        return write_binary(bin_path, image);
     }
 
-    int arg_index = 1;
+    FILE *in = fmemopen(source, source_len ? source_len : 1, "r");
+    if (!in)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", asm_path);
+        free(source);
+        return false;
+    }
+
+    int size = assemble_image(in, image);
+    fclose(in);
+    free(source);
+
+    if (!write_binary(bin_path, image))
+        return false;
+
+    log_write(LOG_INFO, "Assembled %d bytes -> %s", size, bin_path);
+
+    if (cache_dir)
+        image_cache_store(cache_dir, key, image);
+
+    return true;
+}
+
+// Put the machine into snapshot n of the store named by "<dir>:<n>"
+static bool resume_snapshot(const char *spec, Cpu *cpu, Ram *ram)
+{
+    const char *colon = strrchr(spec, ':');
+    char *end = NULL;
+    unsigned long long id = colon ? strtoull(colon + 1, &end, 0) : 0;
+
+    if (!colon || colon == spec || end == colon + 1 || *end != '\0')
+    {
+        log_write(LOG_ERROR, "Bad snapshot '%s' (want <dir>:<n>)", spec);
+        return false;
+    }
+
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(colon - spec), spec);
+
+    SnapshotStore *store = snapshot_store_open(dir);
+    if (!store)
+        return false;
+
+    bool ok = snapshot_store_restore(store, id, cpu, ram);
+    if (ok)
+        log_write(LOG_INFO, "Resumed snapshot %llu of %s at PC 0x%04X", id, dir, cpu->PC);
+    else
+        log_write(LOG_ERROR, "%s has no snapshot %llu (%llu stored)", dir, id,
+                  (unsigned long long)snapshot_store_count(store));
+
+    snapshot_store_close(store);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    bool disasm_only = false;
+    int disasm_threads = 1;
+    bool use_cache = true;
+    bool debug_mode = false;
+    uint64_t rewind_interval = REWIND_DEFAULT_INTERVAL;
+    uint64_t rewind_budget_mb = REWIND_DEFAULT_BUDGET_MB;
+    uint32_t mmu_frames = 0;
+    bool sparse_ram = false;
+    bool fast = false;
+    bool verify = true;
+    bool memo = true;
+    bool watch_mode = false;
+    const char *sweep_path = NULL;
+    const char *sweep_out = "sweep.out";
+    const char *sweep_select = SWEEP_DEFAULT_SELECT;
+    const char *snapshot_dir = NULL;
+    const char *resume = NULL;
+    uint64_t max_steps = 0;
+    const char *fuzz_input = FUZZ_DEFAULT_INPUT;
+    FuzzConfig fuzz = { .max_execs = FUZZ_DEFAULT_EXECS };
+    const char *shm_name = NULL;
+    const char *expect_digest = NULL;
+    bool cache_sim = false;
+    const char *icache_spec = CACHE_SIM_DEFAULT_ICACHE;
+    const char *dcache_spec = CACHE_SIM_DEFAULT_DCACHE;
+    const char *cycles_path = NULL;
+    uint32_t miss_penalty = CACHE_SIM_DEFAULT_MISS_PENALTY;
+    const char *cache_dir = getenv("CPU_EMULATOR_CACHE");
+    const char *asm_path = NULL;
+
+    if (cache_dir == NULL)
+        cache_dir = IMAGE_CACHE_DEFAULT_DIR;
 
-    if (argc == 3)
+    for (int i = 1; i < argc; i++)
     {
-        if (strcmp(argv[1], "-d") != 0)
+        if (strcmp(argv[i], "-d") == 0)
+        {
+            disasm_only = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            disasm_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc)
+        {
+            cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0)
+        {
+            use_cache = false;
+        }
+        else if (strcmp(argv[i], "--sparse") == 0)
+        {
+            sparse_ram = true;
+        }
+        else if (strcmp(argv[i], "--mmu") == 0 && i + 1 < argc)
+        {
+            mmu_frames = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--debug") == 0)
+        {
+            debug_mode = true;
+        }
+        else if (strcmp(argv[i], "--rewind-interval") == 0 && i + 1 < argc)
+        {
+            rewind_interval = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--rewind-budget") == 0 && i + 1 < argc)
+        {
+            rewind_budget_mb = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--fast") == 0)
+        {
+            fast = true;
+        }
+        else if (strcmp(argv[i], "--no-memo") == 0)
+        {
+            memo = false;
+        }
+        else if (strcmp(argv[i], "--no-verify") == 0)
+        {
+            verify = false;
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            watch_mode = true;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            log_set_enabled(LOG_INFO, false);
+            log_set_enabled(LOG_DEBUG, false);
+            log_set_enabled(LOG_TRACE, false);
+        }
+        else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc)
+        {
+            shm_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--expect-digest") == 0 && i + 1 < argc)
+        {
+            expect_digest = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-sim") == 0)
+        {
+            cache_sim = true;
+        }
+        else if (strcmp(argv[i], "--icache") == 0 && i + 1 < argc)
+        {
+            icache_spec = argv[++i];
+            cache_sim = true;
+        }
+        else if (strcmp(argv[i], "--dcache") == 0 && i + 1 < argc)
+        {
+            dcache_spec = argv[++i];
+            cache_sim = true;
+        }
+        else if (strcmp(argv[i], "--miss-penalty") == 0 && i + 1 < argc)
+        {
+            miss_penalty = (uint32_t)strtoul(argv[++i], NULL, 0);
+            cache_sim = true;
+        }
+        else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            cycles_path = argv[++i];
+            cache_sim = true;
+        }
+        else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+        {
+            sweep_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sweep-out") == 0 && i + 1 < argc)
+        {
+            sweep_out = argv[++i];
+        }
+        else if (strcmp(argv[i], "--select") == 0 && i + 1 < argc)
+        {
+            sweep_select = argv[++i];
+        }
+        else if (strcmp(argv[i], "--snapshots") == 0 && i + 1 < argc)
+        {
+            snapshot_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+        {
+            resume = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc)
+        {
+            max_steps = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc)
+        {
+            fuzz.dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--fuzz-input") == 0 && i + 1 < argc)
+        {
+            fuzz_input = argv[++i];
+        }
+        else if (strcmp(argv[i], "--fuzz-execs") == 0 && i + 1 < argc)
+        {
+            fuzz.max_execs = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-time") == 0 && i + 1 < argc)
+        {
+            fuzz.max_seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fuzz-seed") == 0 && i + 1 < argc)
+        {
+            fuzz.seed = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-user") == 0)
+        {
+            fuzz.user_mode = true;
+        }
+        else if (argv[i][0] != '-' && asm_path == NULL)
+        {
+            asm_path = argv[i];
+        }
+        else
         {
             usage(argv[0]);
             return 1;
         }
-        disasm_only = true;
-        arg_index = 2;
     }
 
-    const char *asm_path = argv[arg_index];
-    const char *bin_path = "out.bin";
+    if (asm_path == NULL)
+    {
+        usage(argv[0]);
+        return 1;
+    }
 
-    long long start = time_now_ms();
+    if (watch_mode && (debug_mode || sweep_path || disasm_only))
+    {
+        log_write(LOG_ERROR, "--watch cannot be combined with --debug, --sweep or -d");
+        return 1;
+    }
 
-    FILE *in = fopen(asm_path, "r");
-    if (!in)
+    if (fuzz.dir && (debug_mode || sweep_path || watch_mode || shm_name))
     {
-        log_write(LOG_ERROR, "Error while opening %s", asm_path);
+        log_write(LOG_ERROR, "--fuzz cannot be combined with --debug, --sweep, --watch or --shm");
         return 1;
     }
+    if (fuzz.dir && !fuzz_parse_input(fuzz_input, &fuzz))
+        return 1;
 
-    FILE *out = fopen(bin_path, "wb");
-    if (!out)
+    if (cache_sim && (debug_mode || sweep_path || watch_mode || fuzz.dir))
     {
-        log_write(LOG_ERROR, "Error while opening %s", bin_path);
-        fclose(in);
+        log_write(LOG_ERROR, "--cache-sim cannot be combined with --debug, --sweep, --watch or --fuzz");
         return 1;
     }
 
-    uint16_t org = 0;
-    int size = assemble(in, out, &org);
-    fclose(in);
-    fclose(out);
+    // Sweep runs happen on private views of RAM with their own CPUs
+    if (sweep_path && shm_name)
+    {
+        log_write(LOG_ERROR, "--shm cannot be combined with --sweep");
+        return 1;
+    }
 
-    log_write(LOG_INFO, "Assembled %d bytes -> %s", size, bin_path);
+    if (snapshot_dir && !sweep_path)
+    {
+        log_write(LOG_ERROR, "--snapshots needs --sweep");
+        return 1;
+    }
+    if (resume && (sweep_path || fuzz.dir || mmu_frames))
+    {
+        log_write(LOG_ERROR, "--resume cannot be combined with --sweep, --fuzz or --mmu");
+        return 1;
+    }
+
+    CacheSimConfig cache_config;
+    cache_sim_default_config(&cache_config);
+    cache_config.miss_penalty = miss_penalty;
+    if (cache_sim && (!cache_sim_parse_geometry(icache_spec, &cache_config.icache) ||
+                      !cache_sim_parse_geometry(dcache_spec, &cache_config.dcache) ||
+                      (cycles_path && !cache_sim_load_cycles(&cache_config, cycles_path))))
+        return 1;
+
+    long long start = time_now_ms();
+
+    static Image image;
+    // The cache report names labels, which only an assembly provides
+    if (!load_program(asm_path, use_cache && !cache_sim ? cache_dir : NULL, &image))
+        return 1;
 
     Cpu cpu;
     Ram ram;
 
     bool privileged = false;
     cpu_init(&cpu, privileged);
-    ram_init(&ram);
+    static ShmState shm;
+    bool ram_ok;
 
-    FILE *bin = fopen(bin_path, "rb");
-    if (!bin)
+    if (shm_name && !disasm_only)
     {
-        log_write(LOG_ERROR, "Error while opening %s", bin_path);
+        if (sparse_ram || mmu_frames)
+        {
+            log_write(LOG_ERROR, "--shm cannot be combined with --sparse or --mmu");
+            return 1;
+        }
+        ram_ok = shm_state_open(&shm, shm_name) && shm_state_attach_ram(&shm, &ram);
+    }
+    else
+    {
+        ram_ok = (sparse_ram && !disasm_only) ? ram_init_sparse(&ram) : ram_init(&ram);
+    }
+    if (!ram_ok)
+        return 1;
+
+    static Mmu mmu;
+    if (mmu_frames && !disasm_only)
+    {
+        if (!mmu_init(&mmu, mmu_frames))
+            return 1;
+        ram.mmu = &mmu;
+    }
+
+    if (!image_load(&image, &ram, privileged))
+        return 1;
+
+    if (disasm_only)
+    {
+        fflush(stdout);
+        for (uint16_t i = 0; i < image.segment_count; i++)
+        {
+            const ImageSegment *seg = &image.segments[i];
+            disassemble_parallel(ram.memory_cells, seg->addr, seg->addr + seg->length - 1,
+                                 stdout, disasm_threads);
+        }
+        return 0;
+    }
+
+    // main runs every program privileged (kernel below). The verification
+    // describes the image entered at org: a resumed snapshot brings its own
+    // RAM and mode, so it runs on the checked handlers.
+    static Verification verification;
+    if (resume)
+        verify = false;
+    if (verify)
+        verify_image(&verification, &image, true);
+
+    uint16_t org = image.org;
+
+    static Scheduler sched;
+    static Timer timer;
+    sched_init(&sched);
+    timer_init(&timer, &cpu, &sched);
+    cpu.PC = org;
+    cpu.running = true;
+
+    if (resume && !resume_snapshot(resume, &cpu, &ram))
         return 1;
+    bool kernel = resume ? cpu.privileged : true;
+
+    if (sweep_path)
+    {
+        SweepConfig config;
+
+        config.max_steps = max_steps ? max_steps : SWEEP_DEFAULT_MAX_STEPS;
+        config.snapshot_dir = snapshot_dir;
+        if (!sweep_parse_fields(sweep_select, &config))
+            return 1;
+
+        long long runs = sweep_run(sweep_path, sweep_out, &config, &cpu, &ram, verify ? &verification : NULL);
+        ram_free(&ram);
+        return runs < 0 ? 1 : 0;
     }
 
-    uint8_t buffer[RAM_SIZE];
-    size_t read = fread(buffer, 1, sizeof(buffer), bin);
-    fclose(bin);
+    if (fuzz.dir)
+    {
+        fuzz.max_steps = max_steps ? max_steps : FUZZ_DEFAULT_MAX_STEPS;
 
-    uint16_t load_addr = org;
+        // The verification assumed kernel mode
+        bool ok = fuzz_run(&fuzz, &cpu, &ram, verify && !fuzz.user_mode ? &verification : NULL, NULL);
+        ram_free(&ram);
+        return ok ? 0 : 1;
+    }
 
-    for (size_t i = 0; i < read; i++)
+    if (shm.header)
+        shm_state_attach_cpu(&shm, &cpu, &sched);
+
+    DecodeCache *dc = NULL;
+    if (fast && !debug_mode)
     {
-        if (!ram_write(&ram, load_addr + i, buffer[i], privileged))
+        dc = dcache_create();
+        if (!dc)
         {
-            log_write(LOG_ERROR, "Failed to write program to RAM at 0x%04X", load_addr + i);
+            log_write(LOG_ERROR, "Out of memory allocating the decode cache");
             return 1;
         }
+        if (verify)
+            dcache_attach_verification(dc, &verification);
+        if (!memo)
+            dcache_set_memo(dc, false);
     }
 
-    disassemble_memory(ram.memory_cells, load_addr, load_addr + size - 1);
+    static Watch watch;
+    if (watch_mode && !watch_start(&watch, asm_path, &cpu, &ram, dc))
+        return 1;
 
-    if (disasm_only)
+    if (debug_mode)
     {
-        return 0;
+        static Debugger dbg;
+
+        static Rewind rewind;
+
+        cpu.privileged = kernel;
+        debug_init(&dbg, &ram);
+        if (rewind_interval && !ram.mmu)
+        {
+            if (!rewind_init(&rewind, rewind_interval, (size_t)rewind_budget_mb << 20) ||
+                !debug_attach_rewind(&dbg, &rewind, &cpu))
+                log_write(LOG_WARN, "Reverse execution unavailable");
+        }
+        debug_repl(&dbg, &cpu, &ram, stdin);
+        debug_detach(&dbg);
+        rewind_free(&rewind);
     }
+    else if (cache_sim)
+    {
+        CacheSim *sim = cache_sim_create(&cache_config);
+        if (!sim)
+        {
+            log_write(LOG_ERROR, "Out of memory allocating the cache model");
+            return 1;
+        }
 
-    cpu.PC = org;
-    cpu.running = true;
+        cache_sim_attach(sim, &ram);
+        cpu_run(&cpu, &ram, kernel);
+        cache_sim_detach(sim, &ram);
+        cache_sim_report(sim, stdout);
+        cache_sim_destroy(sim);
+    }
+    else if (dc)
+    {
+        cpu_run_fast(&cpu, &ram, kernel, dc);
+    }
+    else
+    {
+        cpu_run(&cpu, &ram, kernel);
+    }
 
-    cpu_run(&cpu, &ram, true);
+    if (watch_mode)
+        watch_stop(&watch);
+    dcache_destroy(dc);
 
     uint8_t result = 0;
     ram_read(&ram, 0x2000, &result, privileged);
@@ -123,8 +611,34 @@ int main(int argc, char *argv[])
 
     cpu_print(&cpu);
 
+    uint64_t digest = state_hash_machine(&cpu, &ram);
+    int status = 0;
+
+    log_write(LOG_INFO, "State digest: %016llx", (unsigned long long)digest);
+    if (expect_digest && strtoull(expect_digest, NULL, 16) != digest)
+    {
+        log_write(LOG_ERROR, "State digest %016llx does not match the expected %s",
+                  (unsigned long long)digest, expect_digest);
+        status = 1;
+    }
+
+    if (ram.mmu)
+    {
+        log_write(LOG_INFO, "MMU TLB misses: %llu", (unsigned long long)mmu.tlb_misses);
+        mmu_free(&mmu);
+    }
+
+    log_write(LOG_INFO, "RAM resident: %zu bytes", ram_resident_bytes(&ram));
+    ram_free(&ram);
+
+    if (shm.header)
+    {
+        shm_state_publish(&shm);
+        shm_state_close(&shm);
+    }
+
     long long end = time_now_ms();
     log_write(LOG_INFO, "Elapsed time: %lld ms (%.3f s)", end - start, (end - start) / 1000.0);
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,87 @@
+#include "mmu.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool mmu_init(Mmu *mmu, uint32_t frame_count)
+{
+    memset(mmu, 0, sizeof(*mmu));
+
+    if (frame_count < MMU_PAGE_COUNT || frame_count > MMU_MAX_FRAMES)
+    {
+        log_write(LOG_ERROR, "MMU frame count %u out of range [%u, %u]",
+                  frame_count, MMU_PAGE_COUNT, MMU_MAX_FRAMES);
+        return false;
+    }
+
+    mmu->phys = calloc(frame_count, MMU_PAGE_SIZE);
+    if (!mmu->phys)
+    {
+        log_write(LOG_ERROR, "Out of memory allocating %u MMU frames", frame_count);
+        return false;
+    }
+
+    mmu->frame_count = frame_count;
+
+    for (uint32_t page = 0; page < MMU_PAGE_COUNT; page++)
+        mmu->page_table[page] = MMU_PTE_PRESENT | page;
+
+    log_write(LOG_INFO, "MMU initialized with %u frames (%u KB physical)",
+              frame_count, frame_count * MMU_PAGE_SIZE / 1024);
+    return true;
+}
+
+void mmu_free(Mmu *mmu)
+{
+    free(mmu->phys);
+    mmu->phys = NULL;
+    mmu->frame_count = 0;
+}
+
+bool mmu_map(Mmu *mmu, uint8_t vpage, uint32_t frame)
+{
+    if (frame >= mmu->frame_count)
+    {
+        log_write(LOG_ERROR, "MMU frame %u out of range (frames=%u)", frame, mmu->frame_count);
+        return false;
+    }
+
+    mmu->page_table[vpage] = MMU_PTE_PRESENT | frame;
+    mmu->tlb[vpage & (MMU_TLB_SIZE - 1)].tag = 0;
+
+    log_write(LOG_DEBUG, "MMU map page 0x%02X -> frame 0x%04X", vpage, frame);
+    return true;
+}
+
+void mmu_unmap(Mmu *mmu, uint8_t vpage)
+{
+    mmu->page_table[vpage] = 0;
+    mmu->tlb[vpage & (MMU_TLB_SIZE - 1)].tag = 0;
+}
+
+void mmu_flush_tlb(Mmu *mmu)
+{
+    for (int i = 0; i < MMU_TLB_SIZE; i++)
+        mmu->tlb[i].tag = 0;
+}
+
+uint8_t *mmu_translate_slow(Mmu *mmu, uint16_t address)
+{
+    uint32_t vpage = address >> MMU_PAGE_SHIFT;
+    uint32_t pte = mmu->page_table[vpage];
+
+    if (!(pte & MMU_PTE_PRESENT))
+    {
+        log_write(LOG_ERROR, "MMU page fault at 0x%04X (page 0x%02X not present)",
+                  address, vpage);
+        return NULL;
+    }
+
+    MmuTlbEntry *e = &mmu->tlb[vpage & (MMU_TLB_SIZE - 1)];
+    e->tag = vpage | MMU_TLB_VALID;
+    e->host = mmu->phys + (size_t)(pte & MMU_PTE_FRAME_MASK) * MMU_PAGE_SIZE;
+    mmu->tlb_misses++;
+
+    return e->host + (address & (MMU_PAGE_SIZE - 1));
+}
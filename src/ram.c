@@ -2,14 +2,191 @@
 #include "log.h"
 #include "inttypes.h"
 #include "string.h"
+#include "stdlib.h"
+
+// Backs every unwritten page of sparse Ram; never written through
+static const uint8_t zero_page[RAM_PAGE_SIZE] __attribute__((aligned(RAM_PAGE_SIZE)));
 
 static bool is_address_valid(uint32_t address, bool privileged);
 
-void ram_init(Ram *ram)
+#define ALL_PAGES ((1u << RAM_PAGE_COUNT) - 1)
+
+static inline bool is_shared(const Ram *ram, uint32_t page)
+{
+    return ram->shared_pages & (1u << page);
+}
+
+static uint8_t *materialize_page(Ram *ram, uint32_t page)
+{
+    uint8_t *copy = malloc(RAM_PAGE_SIZE);
+    if (!copy)
+    {
+        log_write(LOG_ERROR, "Out of memory allocating RAM page %" PRIu32, page);
+        return NULL;
+    }
+
+    memcpy(copy, ram->pages[page], RAM_PAGE_SIZE);
+    ram->pages[page] = copy;
+    ram->shared_pages &= ~(1u << page);
+    log_write(LOG_DEBUG, "RAM page %" PRIu32 " allocated on first write", page);
+    return copy;
+}
+
+static inline const uint8_t *read_cell(Ram *ram, uint32_t address)
+{
+    if (ram->mmu)
+        return mmu_translate(ram->mmu, (uint16_t)address);
+    return &ram->pages[address >> RAM_PAGE_SHIFT][address & (RAM_PAGE_SIZE - 1)];
+}
+
+static inline uint8_t *write_cell(Ram *ram, uint32_t address)
+{
+    if (ram->mmu)
+        return mmu_translate(ram->mmu, (uint16_t)address);
+
+    uint32_t page = address >> RAM_PAGE_SHIFT;
+    uint8_t *base = ram->pages[page];
+
+    if (is_shared(ram, page))
+    {
+        base = materialize_page(ram, page);
+        if (!base)
+            return NULL;
+    }
+
+    ram->hash_dirty |= 1u << page;
+    return &base[address & (RAM_PAGE_SIZE - 1)];
+}
+
+static void reset_hooks(Ram *ram)
+{
+    ram->mmu = NULL;
+    ram->watch_pages = NULL;
+    ram->watch_hook = NULL;
+    ram->watch_ctx = NULL;
+    ram->access_log = NULL;
+    ram->hash_dirty = ALL_PAGES;
+}
+
+bool ram_init(Ram *ram)
 {
     log_write(LOG_INFO, "Setting all memory cells to 0");
-    memset(ram->memory_cells, 0, RAM_SIZE);
+
+    // calloc hands back zeroed pages without touching them
+    ram->memory_cells = calloc(1, RAM_SIZE);
+    if (!ram->memory_cells)
+    {
+        log_write(LOG_ERROR, "Out of memory allocating RAM");
+        return false;
+    }
+
+    ram->external_cells = false;
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        ram->pages[i] = ram->memory_cells + i * RAM_PAGE_SIZE;
+    ram->shared_pages = 0;
+
+    reset_hooks(ram);
     log_write(LOG_INFO, "RAM initialized correctly");
+    return true;
+}
+
+bool ram_init_external(Ram *ram, uint8_t *cells)
+{
+    ram->memory_cells = cells;
+    ram->external_cells = true;
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        ram->pages[i] = cells + i * RAM_PAGE_SIZE;
+    ram->shared_pages = 0;
+
+    reset_hooks(ram);
+    log_write(LOG_INFO, "RAM initialized on external storage");
+    return true;
+}
+
+bool ram_init_sparse(Ram *ram)
+{
+    ram->memory_cells = NULL;
+    ram->external_cells = false;
+
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        ram->pages[i] = (uint8_t *)zero_page;
+    ram->shared_pages = ALL_PAGES;
+
+    reset_hooks(ram);
+    log_write(LOG_INFO, "Sparse RAM initialized (%u pages of %u bytes)",
+              RAM_PAGE_COUNT, RAM_PAGE_SIZE);
+    return true;
+}
+
+bool ram_init_from(Ram *ram, const Ram *template)
+{
+    ram->memory_cells = NULL;
+    ram->external_cells = false;
+
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        ram->pages[i] = template->pages[i];
+    ram->shared_pages = ALL_PAGES;
+
+    reset_hooks(ram);
+    memcpy(ram->page_hash, template->page_hash, sizeof(ram->page_hash));
+    ram->hash_dirty = template->hash_dirty;
+    return true;
+}
+
+void ram_reset(Ram *ram, const Ram *template)
+{
+    uint32_t owned = ~ram->shared_pages & ALL_PAGES;
+
+    while (owned)
+    {
+        uint32_t i = (uint32_t)__builtin_ctz(owned);
+        uint32_t bit = 1u << i;
+
+        memcpy(ram->pages[i], template->pages[i], RAM_PAGE_SIZE);
+
+        // The page matches the template again, and so does its hash
+        ram->page_hash[i] = template->page_hash[i];
+        ram->hash_dirty = (ram->hash_dirty & ~bit) | (template->hash_dirty & bit);
+        owned &= owned - 1;
+    }
+}
+
+void ram_free(Ram *ram)
+{
+    if (ram->memory_cells)
+    {
+        if (!ram->external_cells)
+            free(ram->memory_cells);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        {
+            if (!is_shared(ram, i))
+                free(ram->pages[i]);
+        }
+    }
+
+    ram->memory_cells = NULL;
+    ram->external_cells = false;
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        ram->pages[i] = (uint8_t *)zero_page;
+    ram->shared_pages = ALL_PAGES;
+    ram->hash_dirty = ALL_PAGES;
+}
+
+size_t ram_resident_bytes(const Ram *ram)
+{
+    if (ram->memory_cells)
+        return RAM_SIZE;
+
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+    {
+        if (!is_shared(ram, i))
+            bytes += RAM_PAGE_SIZE;
+    }
+    return bytes;
 }
 
 bool ram_read(Ram *ram, uint32_t address, uint8_t *output, bool privileged)
@@ -17,7 +194,24 @@ bool ram_read(Ram *ram, uint32_t address, uint8_t *output, bool privileged)
     if (!is_address_valid(address, privileged))
         return false;
 
-    *output = ram->memory_cells[address];
+    const uint8_t *c = read_cell(ram, address);
+    if (!c)
+        return false;
+
+    *output = *c;
+
+    if (ram->watch_pages &&
+        (ram->watch_pages[address >> RAM_WATCH_PAGE_SHIFT] & RAM_WATCH_READ))
+        ram->watch_hook(ram->watch_ctx, address, *output, false);
+
+    if (ram->access_log)
+    {
+        RamAccessLog *log = ram->access_log;
+        bool fetch = address == log->fetch_next;
+
+        log->fetch_next += fetch;
+        ram_log_access(log, (uint16_t)address, fetch ? RAM_ACCESS_FETCH : RAM_ACCESS_READ, *output);
+    }
 
     log_write(LOG_DEBUG,
               "RAM READ  address=0x%04" PRIX32 " value=0x%02X",
@@ -31,7 +225,18 @@ bool ram_write(Ram *ram, uint32_t address, uint8_t value, bool privileged)
     if (!is_address_valid(address, privileged))
         return false;
 
-    ram->memory_cells[address] = value;
+    uint8_t *c = write_cell(ram, address);
+    if (!c)
+        return false;
+
+    *c = value;
+
+    if (ram->watch_pages &&
+        (ram->watch_pages[address >> RAM_WATCH_PAGE_SHIFT] & RAM_WATCH_WRITE))
+        ram->watch_hook(ram->watch_ctx, address, value, true);
+
+    if (ram->access_log)
+        ram_log_access(ram->access_log, (uint16_t)address, RAM_ACCESS_WRITE, value);
 
     log_write(LOG_DEBUG,
               "RAM WRITE addr=0x%04" PRIX32 " value=0x%02X",
@@ -40,6 +245,38 @@ bool ram_write(Ram *ram, uint32_t address, uint8_t value, bool privileged)
     return true;
 }
 
+uint8_t ram_peek(Ram *ram, uint16_t address)
+{
+    const uint8_t *c = read_cell(ram, address);
+    return c ? *c : 0;
+}
+
+bool ram_load_page(Ram *ram, uint32_t page, const uint8_t *data)
+{
+    uint8_t *base = ram->pages[page];
+
+    if (is_shared(ram, page))
+    {
+        base = materialize_page(ram, page);
+        if (!base)
+            return false;
+    }
+
+    memcpy(base, data, RAM_PAGE_SIZE);
+    ram->hash_dirty |= 1u << page;
+    return true;
+}
+
+void ram_contents_changed(Ram *ram)
+{
+    ram->hash_dirty = ALL_PAGES;
+}
+
+void ram_fast_stores_done(Ram *ram)
+{
+    ram->hash_dirty |= ~ram->shared_pages & ALL_PAGES;
+}
+
 static bool is_address_valid(uint32_t address, bool privileged)
 {
     if (address >= RAM_SIZE)
@@ -0,0 +1,205 @@
+#include "rewind.h"
+#include "state_hash.h"
+#include "timer.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool rewind_init(Rewind *rw, uint64_t interval, size_t budget)
+{
+    memset(rw, 0, sizeof(*rw));
+
+    if (interval == 0)
+        return false;
+
+    rw->interval = interval;
+    rw->budget = budget;
+    return true;
+}
+
+static void free_point(Rewind *rw, RewindPoint *p)
+{
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+    {
+        if (p->pages[i])
+        {
+            free(p->pages[i]);
+            p->pages[i] = NULL;
+            rw->used -= RAM_PAGE_SIZE;
+        }
+    }
+}
+
+void rewind_free(Rewind *rw)
+{
+    for (uint32_t i = 0; i < rw->count; i++)
+        free_point(rw, &rw->points[i]);
+
+    free(rw->points);
+    memset(rw, 0, sizeof(*rw));
+}
+
+/*
+ * Drop every other point between the first and the newest. The pages of a
+ * dropped point that the next point does not have are still current there,
+ * so they move; the rest are freed.
+ */
+static void thin(Rewind *rw)
+{
+    uint32_t kept = 1;
+
+    for (uint32_t i = 1; i < rw->count; i++)
+    {
+        RewindPoint *p = &rw->points[i];
+
+        if (i % 2 == 1 && i + 1 < rw->count)
+        {
+            RewindPoint *next = &rw->points[i + 1];
+
+            for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+            {
+                if (p->pages[page] && !next->pages[page])
+                {
+                    next->pages[page] = p->pages[page];
+                    next->hashes[page] = p->hashes[page];
+                    p->pages[page] = NULL;
+                }
+            }
+            free_point(rw, p);
+            rw->used -= sizeof(RewindPoint);
+            continue;
+        }
+
+        rw->points[kept++] = *p;
+    }
+
+    rw->count = kept;
+    rw->interval *= 2;
+    rw->thinned++;
+}
+
+bool rewind_checkpoint(Rewind *rw, const Cpu *cpu, Ram *ram)
+{
+    if (ram->mmu)
+        return false;
+
+    if (rw->count == rw->capacity)
+    {
+        uint32_t capacity = rw->capacity ? rw->capacity * 2 : 64;
+        RewindPoint *points = realloc(rw->points, capacity * sizeof(RewindPoint));
+
+        if (!points)
+        {
+            log_write(LOG_ERROR, "Out of memory recording a checkpoint");
+            return false;
+        }
+        rw->points = points;
+        rw->capacity = capacity;
+    }
+
+    RewindPoint *p = &rw->points[rw->count];
+    memset(p, 0, sizeof(*p));
+    p->cpu = *cpu;
+
+    if (cpu->timer)
+    {
+        p->timer_period = cpu->timer->period;
+        p->timer_queued = cpu->timer->event.queued;
+        p->timer_deadline = cpu->timer->event.deadline;
+    }
+
+    for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        uint64_t hash = state_hash_page(ram, page);
+
+        if (rw->count > 0 && hash == rw->saved_hash[page])
+            continue;
+
+        p->pages[page] = malloc(RAM_PAGE_SIZE);
+        if (!p->pages[page])
+        {
+            log_write(LOG_ERROR, "Out of memory recording a checkpoint");
+            free_point(rw, p);
+            return false;
+        }
+
+        memcpy(p->pages[page], ram->pages[page], RAM_PAGE_SIZE);
+        p->hashes[page] = hash;
+        rw->used += RAM_PAGE_SIZE;
+    }
+
+    for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        if (p->pages[page])
+            rw->saved_hash[page] = p->hashes[page];
+    }
+
+    rw->count++;
+    rw->used += sizeof(RewindPoint);
+    rw->next = cpu->instret + rw->interval;
+
+    while (rw->used > rw->budget && rw->count > 2)
+    {
+        thin(rw);
+        rw->next = cpu->instret + rw->interval;
+    }
+
+    return true;
+}
+
+int32_t rewind_find(const Rewind *rw, uint64_t instret)
+{
+    uint32_t lo = 0;
+    uint32_t hi = rw->count;
+
+    // First point after instret
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (rw->points[mid].cpu.instret <= instret)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (int32_t)lo - 1;
+}
+
+bool rewind_restore(Rewind *rw, uint32_t index, Cpu *cpu, Ram *ram)
+{
+    if (ram->mmu || index >= rw->count)
+        return false;
+
+    const RewindPoint *p = &rw->points[index];
+
+    for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        // The newest copy at or before the point; the first point has them all
+        uint32_t i = index;
+        while (!rw->points[i].pages[page])
+            i--;
+
+        const RewindPoint *src = &rw->points[i];
+
+        if (state_hash_page(ram, page) != src->hashes[page] &&
+            !ram_load_page(ram, page, src->pages[page]))
+            return false;
+    }
+
+    Timer *timer = cpu->timer;
+
+    *cpu = p->cpu;
+
+    if (timer)
+    {
+        timer->period = p->timer_period;
+        if (p->timer_queued)
+            sched_add(timer->sched, &timer->event, p->timer_deadline);
+        else
+            sched_cancel(timer->sched, &timer->event);
+    }
+
+    return true;
+}
@@ -0,0 +1,124 @@
+#include "sched.h"
+
+#include <string.h>
+
+#define SLOT_MASK (SCHED_WHEEL_SLOTS - 1)
+
+// Earliest deadline at or after `from`, searching the wheel one slot at a time
+static uint64_t find_next_deadline(const Scheduler *sched, uint64_t from)
+{
+    uint64_t best = SCHED_NEVER;
+
+    if (sched->count == 0)
+        return best;
+
+    for (uint32_t i = 0; i < SCHED_WHEEL_SLOTS; i++)
+    {
+        const SchedEvent *e = sched->slots[(from + i) & SLOT_MASK];
+
+        for (; e; e = e->next)
+        {
+            if (e->deadline < best)
+                best = e->deadline;
+        }
+
+        // Anything due within this revolution beats later slots
+        if (best < from + SCHED_WHEEL_SLOTS && best <= from + i)
+            return best;
+    }
+
+    return best;
+}
+
+void sched_init(Scheduler *sched)
+{
+    memset(sched->slots, 0, sizeof(sched->slots));
+    sched->next_deadline = SCHED_NEVER;
+    sched->count = 0;
+}
+
+void sched_add(Scheduler *sched, SchedEvent *event, uint64_t deadline)
+{
+    if (event->queued)
+        sched_cancel(sched, event);
+
+    SchedEvent **slot = &sched->slots[deadline & SLOT_MASK];
+
+    event->deadline = deadline;
+    event->next = *slot;
+    event->queued = true;
+    *slot = event;
+    sched->count++;
+
+    if (deadline < sched->next_deadline)
+        sched->next_deadline = deadline;
+}
+
+void sched_cancel(Scheduler *sched, SchedEvent *event)
+{
+    if (!event->queued)
+        return;
+
+    SchedEvent **link = &sched->slots[event->deadline & SLOT_MASK];
+
+    while (*link && *link != event)
+        link = &(*link)->next;
+
+    if (*link)
+    {
+        *link = event->next;
+        sched->count--;
+    }
+
+    event->queued = false;
+    event->next = NULL;
+
+    if (event->deadline == sched->next_deadline)
+        sched->next_deadline = find_next_deadline(sched, event->deadline);
+}
+
+void sched_run_due(Scheduler *sched, uint64_t now)
+{
+    if (now < sched->next_deadline)
+        return;
+
+    // Slots between the earliest deadline and now, at most one revolution
+    uint64_t from = sched->next_deadline;
+    uint64_t span = now - from + 1;
+    if (span > SCHED_WHEEL_SLOTS)
+        span = SCHED_WHEEL_SLOTS;
+
+    for (uint64_t i = 0; i < span; i++)
+    {
+        SchedEvent **link = &sched->slots[(from + i) & SLOT_MASK];
+        SchedEvent *due = NULL;
+
+        // Unlink due events first: callbacks may re-arm themselves
+        while (*link)
+        {
+            SchedEvent *e = *link;
+            if (e->deadline <= now)
+            {
+                *link = e->next;
+                e->queued = false;
+                e->next = due;
+                due = e;
+                sched->count--;
+            }
+            else
+            {
+                link = &e->next;
+            }
+        }
+
+        while (due)
+        {
+            SchedEvent *e = due;
+            due = e->next;
+            e->next = NULL;
+            e->fire(e, now);
+        }
+    }
+
+    sched->next_deadline = find_next_deadline(sched, now + 1);
+}
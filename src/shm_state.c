@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include "shm_state.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void publish_fire(SchedEvent *event, uint64_t now)
+{
+    ShmState *shm = (ShmState *)event;
+
+    shm_state_publish(shm);
+    sched_add(shm->cpu->sched, &shm->event, now + SHM_PUBLISH_INTERVAL);
+}
+
+bool shm_state_open(ShmState *shm, const char *name)
+{
+    memset(shm, 0, sizeof(*shm));
+    shm->fd = -1;
+
+    if (strcmp(name, "memfd") == 0)
+    {
+        shm->fd = memfd_create("cpu-emulator", MFD_CLOEXEC);
+    }
+    else if (name[0] == '/')
+    {
+        snprintf(shm->name, sizeof(shm->name), "%s", name);
+        shm->fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    }
+    else
+    {
+        log_write(LOG_ERROR, "Shared memory name must start with '/' or be 'memfd': %s", name);
+        return false;
+    }
+
+    if (shm->fd < 0 || ftruncate(shm->fd, SHM_STATE_SIZE) != 0)
+    {
+        log_write(LOG_ERROR, "Error while creating shared memory %s", name);
+        shm_state_close(shm);
+        return false;
+    }
+
+    void *map = mmap(NULL, SHM_STATE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        log_write(LOG_ERROR, "Error while mapping shared memory %s", name);
+        shm_state_close(shm);
+        return false;
+    }
+
+    shm->header = map;
+    shm->memory = (uint8_t *)map + SHM_STATE_MEMORY_OFFSET;
+
+    // ftruncate zero-filled the object; only the identification fields need setting
+    shm->header->version = SHM_STATE_VERSION;
+    shm->header->memory_offset = SHM_STATE_MEMORY_OFFSET;
+    shm->header->memory_size = RAM_SIZE;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shm->header->magic, SHM_STATE_MAGIC, 4);
+
+    if (shm->name[0])
+        log_write(LOG_INFO, "Machine state shared as %s (%u bytes)", shm->name, SHM_STATE_SIZE);
+    else
+        log_write(LOG_INFO, "Machine state shared as /proc/%d/fd/%d (%u bytes)",
+                  (int)getpid(), shm->fd, SHM_STATE_SIZE);
+
+    return true;
+}
+
+bool shm_state_attach_ram(ShmState *shm, Ram *ram)
+{
+    return ram_init_external(ram, shm->memory);
+}
+
+void shm_state_attach_cpu(ShmState *shm, Cpu *cpu, Scheduler *sched)
+{
+    shm->cpu = cpu;
+    shm->event.fire = publish_fire;
+    shm->event.next = NULL;
+    shm->event.queued = false;
+
+    shm_state_publish(shm);
+    sched_add(sched, &shm->event, cpu->instret + SHM_PUBLISH_INTERVAL);
+}
+
+void shm_state_publish(ShmState *shm)
+{
+    ShmStateHeader *h = shm->header;
+    const Cpu *cpu = shm->cpu;
+    uint64_t seq = h->seq;
+
+    // Seqlock write side: odd while the fields are inconsistent
+    __atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    h->instret = cpu->instret;
+    h->pc = cpu->PC;
+    h->sp = cpu->SP;
+    memcpy(h->regs, cpu->R, REG_COUNT);
+    h->running = cpu->running;
+    h->privileged = cpu->privileged;
+    h->flag_zero = cpu_flag_zero(cpu);
+    h->flag_carry = cpu_flag_carry(cpu);
+    h->irq_enabled = cpu->irq_enabled;
+    h->irq_pending = cpu->irq_pending;
+
+    __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void shm_state_close(ShmState *shm)
+{
+    if (shm->header)
+        munmap(shm->header, SHM_STATE_SIZE);
+    if (shm->fd >= 0)
+        close(shm->fd);
+    if (shm->name[0])
+        shm_unlink(shm->name);
+
+    shm->header = NULL;
+    shm->memory = NULL;
+    shm->fd = -1;
+    shm->name[0] = '\0';
+}
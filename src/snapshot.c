@@ -0,0 +1,1086 @@
+#include "snapshot.h"
+#include "state_hash.h"
+#include "timer.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORD_PAGE 'P'
+#define RECORD_STATE 'S'
+
+// Byte-run codec: a control byte below 0x80 is followed by that many plus
+// one literal bytes, one from 0x80 up by one byte repeated (c - 0x80 + RUN_MIN) times
+#define RUN_MIN 3
+#define RUN_MAX (0x7F + RUN_MIN)
+#define LITERAL_MAX 0x80
+
+// LZ codec: a token holds the literal count (high nibble) and the match
+// length minus LZ_MIN_MATCH (low nibble), 15 meaning more length bytes
+// follow; then the literals, a 16-bit little-endian offset and the match.
+// The last token has no match and ends the page.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_NIBBLE_MAX 15
+
+// Decoded stored pages kept to check hash matches, direct-mapped by page number
+#define DECODED_PAGES 64
+
+typedef struct
+{
+    char magic[4];
+    uint16_t format;
+    uint16_t reserved;
+    uint32_t number;        // matches the file name
+    uint32_t reserved2;
+} SegmentHeader;
+
+// Followed by length payload bytes, padded to 8
+typedef struct
+{
+    uint8_t kind;           // RECORD_PAGE
+    uint8_t codec;          // SnapshotCodec
+    uint16_t length;
+    uint32_t reserved;
+    uint64_t hash;          // state_hash_page of the contents
+} PageRecord;
+
+typedef struct
+{
+    uint8_t kind;           // RECORD_STATE
+    uint8_t running;
+    uint8_t privileged;
+    uint8_t fault;
+    uint8_t irq_pending;
+    uint8_t irq_enabled;
+    uint8_t in_irq;
+    uint8_t irq_saved_privileged;
+    uint16_t PC;
+    uint16_t SP;
+    uint8_t R[REG_COUNT];
+    uint16_t irq_saved_PC;
+    uint16_t timer_period;
+    uint8_t flags_op;
+    uint8_t irq_saved_flags_op;
+    uint8_t timer_queued;
+    uint8_t stopped;        // running until the host stopped it
+    uint16_t flags_a;
+    uint16_t flags_b;
+    uint16_t irq_saved_flags_a;
+    uint16_t irq_saved_flags_b;
+    uint32_t reserved2;
+    uint64_t instret;
+    uint64_t timer_deadline;
+    uint64_t cycles;
+    uint64_t counter_instret_base;
+    uint64_t counter_cycles_base;
+    uint64_t counter_latch[2];
+    uint32_t pages[RAM_PAGE_COUNT];     // page numbers in the store
+} StateRecord;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;            // bytes of valid records, header included
+    size_t written;         // bytes already in the file
+    bool mapped;            // data is a read-only mapping of the file
+} Segment;
+
+typedef struct
+{
+    uint64_t hash;
+    uint32_t segment;
+    uint32_t offset;        // of the payload
+    uint16_t length;
+    uint8_t codec;
+} PageEntry;
+
+typedef struct
+{
+    uint32_t segment;
+    uint32_t offset;        // of the StateRecord
+} StateEntry;
+
+struct SnapshotStore
+{
+    char *dir;              // NULL: in memory
+    int fd;                 // file of the active segment, -1 if none
+
+    Segment *segments;      // the last one is active unless mapped
+    uint32_t segment_count;
+    uint32_t segment_capacity;
+
+    PageEntry *pages;
+    uint32_t page_count;
+    uint32_t page_capacity;
+    uint64_t page_bytes;
+
+    uint32_t *table;        // page number + 1 by hash, 0 when empty
+    uint32_t table_mask;
+
+    uint8_t decoded[DECODED_PAGES][RAM_PAGE_SIZE];
+    uint32_t decoded_page[DECODED_PAGES];   // page number + 1, 0 when empty
+
+    // Per Ram page: a page shared with an unchanging template (ram_init_from)
+    // and the stored page it was found equal to, so it is compared once
+    const uint8_t *shared_source[RAM_PAGE_COUNT];
+    uint32_t shared_id[RAM_PAGE_COUNT];
+
+    StateEntry *states;
+    uint64_t state_count;
+    uint64_t state_capacity;
+
+    uint8_t scratch[RAM_PAGE_SIZE];
+};
+
+/* ================= page codecs ================= */
+
+static uint32_t run_length(const uint8_t *page, uint32_t i)
+{
+    uint32_t n = 1;
+    while (i + n < RAM_PAGE_SIZE && n < RUN_MAX && page[i + n] == page[i])
+        n++;
+    return n;
+}
+
+static bool put_literals(uint8_t *out, uint32_t *o, const uint8_t *lit, uint32_t count)
+{
+    if (count == 0)
+        return true;
+    if (*o + 1 + count >= RAM_PAGE_SIZE)
+        return false;
+
+    out[(*o)++] = (uint8_t)(count - 1);
+    memcpy(out + *o, lit, count);
+    *o += count;
+    return true;
+}
+
+// Length of the encoding, 0 if it would not be smaller than the page
+static uint32_t encode_runs(const uint8_t *page, uint8_t *out)
+{
+    uint32_t i = 0;
+    uint32_t o = 0;
+    uint32_t literal = 0;
+
+    while (i < RAM_PAGE_SIZE)
+    {
+        uint32_t n = run_length(page, i);
+
+        if (n < RUN_MIN)
+        {
+            i++;
+            if (i - literal == LITERAL_MAX)
+            {
+                if (!put_literals(out, &o, page + literal, i - literal))
+                    return 0;
+                literal = i;
+            }
+            continue;
+        }
+
+        if (!put_literals(out, &o, page + literal, i - literal) || o + 2 >= RAM_PAGE_SIZE)
+            return 0;
+
+        out[o++] = (uint8_t)(0x80 | (n - RUN_MIN));
+        out[o++] = page[i];
+        i += n;
+        literal = i;
+    }
+
+    return put_literals(out, &o, page + literal, i - literal) ? o : 0;
+}
+
+static bool decode_runs(const uint8_t *in, uint32_t length, uint8_t *page)
+{
+    uint32_t i = 0;
+    uint32_t o = 0;
+
+    while (i < length)
+    {
+        uint8_t c = in[i++];
+
+        if (c & 0x80)
+        {
+            uint32_t n = (c & 0x7F) + RUN_MIN;
+            if (i >= length || o + n > RAM_PAGE_SIZE)
+                return false;
+            memset(page + o, in[i++], n);
+            o += n;
+        }
+        else
+        {
+            uint32_t n = c + 1u;
+            if (i + n > length || o + n > RAM_PAGE_SIZE)
+                return false;
+            memcpy(page + o, in + i, n);
+            i += n;
+            o += n;
+        }
+    }
+
+    return o == RAM_PAGE_SIZE;
+}
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static bool put_extra_length(uint8_t *out, uint32_t *o, uint32_t n)
+{
+    for (n -= LZ_NIBBLE_MAX;; n -= 255)
+    {
+        if (*o >= RAM_PAGE_SIZE - 1)
+            return false;
+        out[(*o)++] = (uint8_t)(n < 255 ? n : 255);
+        if (n < 255)
+            return true;
+    }
+}
+
+// One token; match_length 0 for the last, which has no match
+static bool put_sequence(uint8_t *out, uint32_t *o, const uint8_t *lit, uint32_t lit_count,
+                         uint32_t offset, uint32_t match_length)
+{
+    uint32_t m = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+    if (*o >= RAM_PAGE_SIZE - 1)
+        return false;
+    out[(*o)++] = (uint8_t)(((lit_count < LZ_NIBBLE_MAX ? lit_count : LZ_NIBBLE_MAX) << 4) |
+                            (m < LZ_NIBBLE_MAX ? m : LZ_NIBBLE_MAX));
+
+    if (lit_count >= LZ_NIBBLE_MAX && !put_extra_length(out, o, lit_count))
+        return false;
+    if (*o + lit_count >= RAM_PAGE_SIZE)
+        return false;
+    memcpy(out + *o, lit, lit_count);
+    *o += lit_count;
+
+    if (match_length == 0)
+        return true;
+    if (*o + 2 >= RAM_PAGE_SIZE)
+        return false;
+    out[(*o)++] = (uint8_t)(offset & 0xFF);
+    out[(*o)++] = (uint8_t)(offset >> 8);
+
+    return m < LZ_NIBBLE_MAX || put_extra_length(out, o, m);
+}
+
+// Greedy, one candidate per hash; 0 if the result would not be smaller
+static uint32_t encode_lz(const uint8_t *page, uint8_t *out)
+{
+    uint16_t table[1 << LZ_HASH_BITS];     // position + 1
+    uint32_t i = 0;
+    uint32_t o = 0;
+    uint32_t literal = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (i + LZ_MIN_MATCH <= RAM_PAGE_SIZE)
+    {
+        uint32_t h = lz_hash(page + i);
+        uint32_t candidate = table[h];
+        table[h] = (uint16_t)(i + 1);
+
+        if (!candidate || memcmp(page + candidate - 1, page + i, LZ_MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        uint32_t ref = candidate - 1;
+        uint32_t n = LZ_MIN_MATCH;
+        while (i + n < RAM_PAGE_SIZE && page[ref + n] == page[i + n])
+            n++;
+
+        if (!put_sequence(out, &o, page + literal, i - literal, i - ref, n))
+            return 0;
+        i += n;
+        literal = i;
+    }
+
+    return put_sequence(out, &o, page + literal, RAM_PAGE_SIZE - literal, 0, 0) ? o : 0;
+}
+
+static bool get_extra_length(const uint8_t *in, uint32_t *i, uint32_t length, uint32_t *n)
+{
+    uint8_t b;
+    do
+    {
+        if (*i >= length)
+            return false;
+        b = in[(*i)++];
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+static bool decode_lz(const uint8_t *in, uint32_t length, uint8_t *page)
+{
+    uint32_t i = 0;
+    uint32_t o = 0;
+
+    while (i < length)
+    {
+        uint8_t token = in[i++];
+        uint32_t lit = token >> 4;
+        uint32_t n = token & LZ_NIBBLE_MAX;
+
+        if (lit == LZ_NIBBLE_MAX && !get_extra_length(in, &i, length, &lit))
+            return false;
+        if (i + lit > length || o + lit > RAM_PAGE_SIZE)
+            return false;
+        memcpy(page + o, in + i, lit);
+        i += lit;
+        o += lit;
+
+        if (o == RAM_PAGE_SIZE)
+            return i == length && n == 0;
+
+        if (i + 2 > length)
+            return false;
+        uint32_t offset = in[i] | (in[i + 1] << 8);
+        i += 2;
+
+        if (n == LZ_NIBBLE_MAX && !get_extra_length(in, &i, length, &n))
+            return false;
+        n += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || o + n > RAM_PAGE_SIZE)
+            return false;
+
+        // The match may overlap what it produces. What it produces repeats
+        // with period offset, so copy from its start in pieces that double
+        uint32_t from = o - offset;
+        while (n)
+        {
+            uint32_t piece = n < o - from ? n : o - from;
+            memcpy(page + o, page + from, piece);
+            o += piece;
+            n -= piece;
+        }
+    }
+
+    return false;
+}
+
+SnapshotCodec snapshot_encode_page(const uint8_t *page, uint8_t *out, uint16_t *length)
+{
+    uint32_t i = 0;
+    while (i < RAM_PAGE_SIZE && page[i] == 0)
+        i++;
+
+    if (i == RAM_PAGE_SIZE)
+    {
+        *length = 0;
+        return SNAPSHOT_CODEC_ZERO;
+    }
+
+    uint8_t lz[RAM_PAGE_SIZE];
+    uint32_t runs_length = encode_runs(page, out);
+    uint32_t lz_length = encode_lz(page, lz);
+
+    if (lz_length && (!runs_length || lz_length < runs_length))
+    {
+        memcpy(out, lz, lz_length);
+        *length = (uint16_t)lz_length;
+        return SNAPSHOT_CODEC_LZ;
+    }
+
+    if (runs_length)
+    {
+        *length = (uint16_t)runs_length;
+        return SNAPSHOT_CODEC_RUNS;
+    }
+
+    memcpy(out, page, RAM_PAGE_SIZE);
+    *length = RAM_PAGE_SIZE;
+    return SNAPSHOT_CODEC_RAW;
+}
+
+bool snapshot_decode_page(SnapshotCodec codec, const uint8_t *in, uint16_t length, uint8_t *page)
+{
+    switch (codec)
+    {
+    case SNAPSHOT_CODEC_ZERO:
+        memset(page, 0, RAM_PAGE_SIZE);
+        return length == 0;
+
+    case SNAPSHOT_CODEC_RAW:
+        if (length != RAM_PAGE_SIZE)
+            return false;
+        memcpy(page, in, RAM_PAGE_SIZE);
+        return true;
+
+    case SNAPSHOT_CODEC_RUNS:
+        return decode_runs(in, length, page);
+
+    case SNAPSHOT_CODEC_LZ:
+        return decode_lz(in, length, page);
+    }
+
+    return false;
+}
+
+/* ================= index ================= */
+
+static uint32_t table_start(const SnapshotStore *store, uint64_t hash)
+{
+    return (uint32_t)(hash ^ (hash >> 32)) & store->table_mask;
+}
+
+// The empty slot that ends the probe sequence of hash; pages that share a
+// hash each get a slot, in the order they were indexed
+static uint32_t *free_slot(SnapshotStore *store, uint64_t hash)
+{
+    uint32_t i = table_start(store, hash);
+
+    while (store->table[i])
+        i = (i + 1) & store->table_mask;
+
+    return &store->table[i];
+}
+
+// Contents of stored page id; NULL if its payload does not decode
+static const uint8_t *stored_page(SnapshotStore *store, uint32_t id)
+{
+    uint32_t slot = id & (DECODED_PAGES - 1);
+
+    if (store->decoded_page[slot] != id + 1)
+    {
+        const PageEntry *e = &store->pages[id];
+        const uint8_t *payload = store->segments[e->segment].data + e->offset;
+
+        store->decoded_page[slot] = 0;
+        if (!snapshot_decode_page(e->codec, payload, e->length, store->decoded[slot]))
+        {
+            log_write(LOG_ERROR, "Snapshot page %u does not decode", id);
+            return NULL;
+        }
+        store->decoded_page[slot] = id + 1;
+    }
+
+    return store->decoded[slot];
+}
+
+// Room for one more page, keeping the table at most half full
+static bool reserve_page(SnapshotStore *store)
+{
+    if (store->page_count == store->page_capacity)
+    {
+        uint32_t capacity = store->page_capacity ? store->page_capacity * 2 : 256;
+        PageEntry *pages = realloc(store->pages, capacity * sizeof(PageEntry));
+
+        if (!pages)
+            return false;
+        store->pages = pages;
+        store->page_capacity = capacity;
+    }
+
+    uint32_t size = store->table_mask + 1;
+    if (store->table && (store->page_count + 1) * 2 <= size)
+        return true;
+
+    uint32_t *old = store->table;
+    uint32_t new_size = store->table ? size * 2 : 512;
+
+    store->table = calloc(new_size, sizeof(uint32_t));
+    if (!store->table)
+    {
+        store->table = old;
+        return false;
+    }
+    store->table_mask = new_size - 1;
+
+    for (uint32_t id = 0; id < store->page_count; id++)
+        *free_slot(store, store->pages[id].hash) = id + 1;
+
+    free(old);
+    return true;
+}
+
+// Index a page record after any others with the same hash
+static bool index_page(SnapshotStore *store, const PageRecord *rec, uint32_t segment, uint32_t offset)
+{
+    if (!reserve_page(store))
+        return false;
+
+    uint32_t *slot = free_slot(store, rec->hash);
+    uint32_t id = store->page_count++;
+    PageEntry *e = &store->pages[id];
+
+    e->hash = rec->hash;
+    e->segment = segment;
+    e->offset = offset;
+    e->length = rec->length;
+    e->codec = rec->codec;
+    store->page_bytes += rec->length;
+
+    *slot = id + 1;
+    return true;
+}
+
+static bool index_state(SnapshotStore *store, uint32_t segment, uint32_t offset)
+{
+    if (store->state_count == store->state_capacity)
+    {
+        uint64_t capacity = store->state_capacity ? store->state_capacity * 2 : 1024;
+        StateEntry *states = realloc(store->states, capacity * sizeof(StateEntry));
+
+        if (!states)
+            return false;
+        store->states = states;
+        store->state_capacity = capacity;
+    }
+
+    store->states[store->state_count].segment = segment;
+    store->states[store->state_count].offset = offset;
+    store->state_count++;
+    return true;
+}
+
+static size_t padded(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+static bool valid_page_record(const PageRecord *rec)
+{
+    switch (rec->codec)
+    {
+    case SNAPSHOT_CODEC_ZERO:
+        return rec->length == 0;
+    case SNAPSHOT_CODEC_RAW:
+        return rec->length == RAM_PAGE_SIZE;
+    case SNAPSHOT_CODEC_RUNS:
+    case SNAPSHOT_CODEC_LZ:
+        return rec->length > 0 && rec->length < RAM_PAGE_SIZE;
+    }
+    return false;
+}
+
+// Index the records of a mapped segment; its size ends at the first bad one
+static bool scan_segment(SnapshotStore *store, uint32_t number, const char *path)
+{
+    Segment *seg = &store->segments[number];
+    size_t pos = sizeof(SegmentHeader);
+
+    while (pos < seg->size)
+    {
+        uint8_t kind = seg->data[pos];
+        bool ok = false;
+        size_t next = pos;
+
+        if (kind == RECORD_PAGE && pos + sizeof(PageRecord) <= seg->size)
+        {
+            PageRecord rec;
+            memcpy(&rec, seg->data + pos, sizeof(rec));
+            next = pos + sizeof(rec) + padded(rec.length);
+            ok = valid_page_record(&rec) && next <= seg->size;
+
+            if (ok && !index_page(store, &rec, number, (uint32_t)(pos + sizeof(rec))))
+                return false;
+        }
+        else if (kind == RECORD_STATE && pos + sizeof(StateRecord) <= seg->size)
+        {
+            StateRecord rec;
+            memcpy(&rec, seg->data + pos, sizeof(rec));
+            next = pos + sizeof(rec);
+            ok = true;
+
+            for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+            {
+                if (rec.pages[page] >= store->page_count)
+                    ok = false;
+            }
+
+            if (ok && !index_state(store, number, (uint32_t)pos))
+                return false;
+        }
+
+        if (!ok)
+        {
+            log_write(LOG_WARN, "%s: ignoring %zu bytes after a bad or partial record",
+                      path, seg->size - pos);
+            seg->size = pos;
+            break;
+        }
+        pos = next;
+    }
+
+    return true;
+}
+
+/* ================= segments ================= */
+
+static void segment_path(char *path, size_t size, const char *dir, uint32_t number)
+{
+    snprintf(path, size, "%s/seg-%06u", dir, number);
+}
+
+static bool reserve_segment(SnapshotStore *store)
+{
+    if (store->segment_count < store->segment_capacity)
+        return true;
+
+    uint32_t capacity = store->segment_capacity ? store->segment_capacity * 2 : 8;
+    Segment *segments = realloc(store->segments, capacity * sizeof(Segment));
+
+    if (!segments)
+        return false;
+    store->segments = segments;
+    store->segment_capacity = capacity;
+    return true;
+}
+
+// Map segment file number read-only; false when it does not exist or is bad
+static bool map_segment(SnapshotStore *store, uint32_t number, size_t size, bool *missing)
+{
+    char path[4096];
+    segment_path(path, sizeof(path), store->dir, number);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        *missing = errno == ENOENT;
+        if (!*missing)
+            log_write(LOG_ERROR, "Error while opening %s", path);
+        return false;
+    }
+
+    struct stat st;
+    SegmentHeader hdr;
+    bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(hdr) &&
+              (size == 0 || (size_t)st.st_size >= size);
+    void *map = ok ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (map != MAP_FAILED)
+        memcpy(&hdr, map, sizeof(hdr));
+
+    if (map == MAP_FAILED || memcmp(hdr.magic, SNAPSHOT_MAGIC, 4) != 0 ||
+        hdr.format != SNAPSHOT_FORMAT || hdr.number != number || !reserve_segment(store))
+    {
+        log_write(LOG_ERROR, "%s is not a snapshot segment (format %u)", path, SNAPSHOT_FORMAT);
+        if (map != MAP_FAILED)
+            munmap(map, (size_t)st.st_size);
+        return false;
+    }
+
+    Segment *seg = &store->segments[number];
+    seg->data = map;
+    seg->size = size ? size : (size_t)st.st_size;
+    seg->written = (size_t)st.st_size;
+    seg->mapped = true;
+
+    if (number == store->segment_count)
+        store->segment_count++;
+
+    return size || scan_segment(store, number, path);
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static Segment *active_segment(SnapshotStore *store)
+{
+    if (store->segment_count == 0)
+        return NULL;
+
+    Segment *seg = &store->segments[store->segment_count - 1];
+    return seg->mapped ? NULL : seg;
+}
+
+bool snapshot_store_flush(SnapshotStore *store)
+{
+    Segment *seg = active_segment(store);
+    if (!seg || store->fd < 0)
+        return true;
+
+    if (!write_all(store->fd, seg->data + seg->written, seg->size - seg->written))
+    {
+        log_write(LOG_ERROR, "Error while writing snapshot segment %u", store->segment_count - 1);
+        return false;
+    }
+
+    seg->written = seg->size;
+    return true;
+}
+
+// Write out the active segment and replace its buffer with a mapping of the file
+static bool seal_segment(SnapshotStore *store)
+{
+    Segment *seg = active_segment(store);
+    if (!seg)
+        return true;
+
+    // In memory, give back the unused tail of the buffer
+    if (!store->dir)
+    {
+        uint8_t *data = realloc(seg->data, seg->size);
+        if (data)
+            seg->data = data;
+        return true;
+    }
+
+    if (!snapshot_store_flush(store))
+        return false;
+
+    uint32_t number = store->segment_count - 1;
+    uint8_t *buffer = seg->data;
+    bool missing = false;
+
+    close(store->fd);
+    store->fd = -1;
+
+    if (!map_segment(store, number, seg->size, &missing))
+        return false;
+
+    free(buffer);
+    return true;
+}
+
+static bool start_segment(SnapshotStore *store)
+{
+    if (!seal_segment(store) || !reserve_segment(store))
+        return false;
+
+    uint32_t number = store->segment_count;
+    Segment *seg = &store->segments[number];
+
+    memset(seg, 0, sizeof(*seg));
+    seg->data = malloc(SNAPSHOT_SEGMENT_SIZE);
+    if (!seg->data)
+        return false;
+
+    if (store->dir)
+    {
+        char path[4096];
+        segment_path(path, sizeof(path), store->dir, number);
+
+        store->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+        if (store->fd < 0)
+        {
+            log_write(LOG_ERROR, "Cannot create snapshot segment %s", path);
+            free(seg->data);
+            return false;
+        }
+    }
+
+    SegmentHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, 4);
+    hdr.format = SNAPSHOT_FORMAT;
+    hdr.number = number;
+
+    memcpy(seg->data, &hdr, sizeof(hdr));
+    seg->size = sizeof(hdr);
+    store->segment_count++;
+    return true;
+}
+
+// Space for len bytes in the active segment, starting a new one if needed;
+// stores the segment and offset of the space
+static uint8_t *append(SnapshotStore *store, size_t len, uint32_t *segment, uint32_t *offset)
+{
+    Segment *seg = active_segment(store);
+
+    if (!seg || seg->size + len > SNAPSHOT_SEGMENT_SIZE)
+    {
+        if (!start_segment(store))
+            return NULL;
+        seg = active_segment(store);
+    }
+
+    uint8_t *p = seg->data + seg->size;
+    memset(p, 0, len);
+
+    *segment = store->segment_count - 1;
+    *offset = (uint32_t)seg->size;
+    seg->size += len;
+    return p;
+}
+
+/* ================= store ================= */
+
+SnapshotStore *snapshot_store_open(const char *dir)
+{
+    SnapshotStore *store = calloc(1, sizeof(SnapshotStore));
+    if (!store)
+        return NULL;
+
+    store->fd = -1;
+
+    if (dir)
+    {
+        store->dir = strdup(dir);
+        if (!store->dir || (mkdir(dir, 0755) != 0 && errno != EEXIST))
+        {
+            log_write(LOG_ERROR, "Cannot create snapshot directory %s", dir);
+            snapshot_store_close(store);
+            return NULL;
+        }
+
+        bool missing = false;
+        while (map_segment(store, store->segment_count, 0, &missing))
+            ;
+
+        if (!missing)
+        {
+            snapshot_store_close(store);
+            return NULL;
+        }
+    }
+
+    return store;
+}
+
+bool snapshot_store_close(SnapshotStore *store)
+{
+    if (!store)
+        return true;
+
+    bool ok = snapshot_store_flush(store);
+
+    if (store->fd >= 0)
+        close(store->fd);
+
+    for (uint32_t i = 0; i < store->segment_count; i++)
+    {
+        Segment *seg = &store->segments[i];
+
+        if (seg->mapped)
+            munmap(seg->data, seg->written);
+        else
+            free(seg->data);
+    }
+
+    free(store->segments);
+    free(store->pages);
+    free(store->table);
+    free(store->states);
+    free(store->dir);
+    free(store);
+    return ok;
+}
+
+// Number of the stored page with ram's page contents, adding it if new
+static int64_t add_page(SnapshotStore *store, Ram *ram, uint32_t page)
+{
+    uint64_t hash = state_hash_page(ram, page);
+    const uint8_t *source = (ram->shared_pages & (1u << page)) ? ram->pages[page] : NULL;
+
+    if (source && store->shared_source[page] == source && store->pages[store->shared_id[page]].hash == hash)
+        return store->shared_id[page];
+    if (!reserve_page(store))
+        return -1;
+
+    // A hash match is only a candidate: different pages can share a hash
+    for (uint32_t i = table_start(store, hash); store->table[i]; i = (i + 1) & store->table_mask)
+    {
+        uint32_t id = store->table[i] - 1;
+        const uint8_t *stored;
+
+        if (store->pages[id].hash != hash)
+            continue;
+        stored = stored_page(store, id);
+        if (!stored)
+            return -1;
+        if (memcmp(stored, ram->pages[page], RAM_PAGE_SIZE) == 0)
+        {
+            store->shared_source[page] = source;
+            store->shared_id[page] = id;
+            return id;
+        }
+    }
+
+    PageRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = RECORD_PAGE;
+    rec.codec = (uint8_t)snapshot_encode_page(ram->pages[page], store->scratch, &rec.length);
+    rec.hash = hash;
+
+    uint32_t segment;
+    uint32_t offset;
+    uint8_t *p = append(store, sizeof(rec) + padded(rec.length), &segment, &offset);
+    if (!p)
+        return -1;
+
+    memcpy(p, &rec, sizeof(rec));
+    memcpy(p + sizeof(rec), store->scratch, rec.length);
+
+    if (!index_page(store, &rec, segment, offset + (uint32_t)sizeof(rec)))
+        return -1;
+
+    store->shared_source[page] = source;
+    store->shared_id[page] = store->page_count - 1;
+    return store->page_count - 1;
+}
+
+int64_t snapshot_store_add(SnapshotStore *store, const Cpu *cpu, Ram *ram, bool stopped)
+{
+    if (ram->mmu)
+    {
+        log_write(LOG_ERROR, "Snapshots do not support an MMU");
+        return -1;
+    }
+
+    StateRecord rec;
+    memset(&rec, 0, sizeof(rec));
+
+    for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        int64_t id = add_page(store, ram, page);
+        if (id < 0)
+        {
+            log_write(LOG_ERROR, "Error while storing a snapshot page");
+            return -1;
+        }
+        rec.pages[page] = (uint32_t)id;
+    }
+
+    rec.kind = RECORD_STATE;
+    rec.running = cpu->running;
+    rec.stopped = stopped;
+    rec.privileged = cpu->privileged;
+    rec.fault = cpu->fault;
+    rec.irq_pending = cpu->irq_pending;
+    rec.irq_enabled = cpu->irq_enabled;
+    rec.in_irq = cpu->in_irq;
+    rec.irq_saved_privileged = cpu->irq_saved_privileged;
+    rec.PC = cpu->PC;
+    rec.SP = cpu->SP;
+    memcpy(rec.R, cpu->R, REG_COUNT);
+    rec.irq_saved_PC = cpu->irq_saved_PC;
+    rec.flags_op = cpu->flags.op;
+    rec.flags_a = cpu->flags.a;
+    rec.flags_b = cpu->flags.b;
+    rec.irq_saved_flags_op = cpu->irq_saved_flags.op;
+    rec.irq_saved_flags_a = cpu->irq_saved_flags.a;
+    rec.irq_saved_flags_b = cpu->irq_saved_flags.b;
+    rec.instret = cpu->instret;
+    rec.cycles = cpu->cycles;
+    rec.counter_instret_base = cpu->counter_instret_base;
+    rec.counter_cycles_base = cpu->counter_cycles_base;
+    memcpy(rec.counter_latch, cpu->counter_latch, sizeof(rec.counter_latch));
+
+    if (cpu->timer)
+    {
+        rec.timer_period = cpu->timer->period;
+        rec.timer_queued = cpu->timer->event.queued;
+        rec.timer_deadline = cpu->timer->event.deadline;
+    }
+
+    uint32_t segment;
+    uint32_t offset;
+    uint8_t *p = append(store, sizeof(rec), &segment, &offset);
+
+    if (!p || !index_state(store, segment, offset))
+    {
+        log_write(LOG_ERROR, "Error while storing a snapshot");
+        return -1;
+    }
+
+    memcpy(p, &rec, sizeof(rec));
+    return (int64_t)store->state_count - 1;
+}
+
+bool snapshot_store_restore(SnapshotStore *store, uint64_t id, Cpu *cpu, Ram *ram)
+{
+    if (ram->mmu || id >= store->state_count)
+        return false;
+
+    const StateEntry *entry = &store->states[id];
+    StateRecord rec;
+    memcpy(&rec, store->segments[entry->segment].data + entry->offset, sizeof(rec));
+
+    for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        const PageEntry *e = &store->pages[rec.pages[page]];
+        const uint8_t *stored = stored_page(store, rec.pages[page]);
+
+        if (!stored)
+            return false;
+        if (state_hash_page(ram, page) == e->hash && memcmp(ram->pages[page], stored, RAM_PAGE_SIZE) == 0)
+            continue;
+        if (!ram_load_page(ram, page, stored))
+            return false;
+
+        // Known already, so the page need not be hashed again
+        ram->page_hash[page] = e->hash;
+        ram->hash_dirty &= ~(1u << page);
+    }
+
+    cpu->running = rec.running || rec.stopped;
+    cpu->privileged = rec.privileged;
+    cpu->fault = rec.fault;
+    cpu->irq_pending = rec.irq_pending;
+    cpu->irq_enabled = rec.irq_enabled;
+    cpu->in_irq = rec.in_irq;
+    cpu->irq_saved_privileged = rec.irq_saved_privileged;
+    cpu->PC = rec.PC;
+    cpu->SP = rec.SP;
+    memcpy(cpu->R, rec.R, REG_COUNT);
+    cpu->irq_saved_PC = rec.irq_saved_PC;
+    cpu->flags.op = rec.flags_op;
+    cpu->flags.a = rec.flags_a;
+    cpu->flags.b = rec.flags_b;
+    cpu->irq_saved_flags.op = rec.irq_saved_flags_op;
+    cpu->irq_saved_flags.a = rec.irq_saved_flags_a;
+    cpu->irq_saved_flags.b = rec.irq_saved_flags_b;
+    cpu->instret = rec.instret;
+    cpu->cycles = rec.cycles;
+    cpu->counter_instret_base = rec.counter_instret_base;
+    cpu->counter_cycles_base = rec.counter_cycles_base;
+    memcpy(cpu->counter_latch, rec.counter_latch, sizeof(cpu->counter_latch));
+    cpu->batch_end = 0;
+
+    Timer *timer = cpu->timer;
+    if (timer)
+    {
+        timer->period = rec.timer_period;
+        if (rec.timer_queued)
+            sched_add(timer->sched, &timer->event, rec.timer_deadline);
+        else
+            sched_cancel(timer->sched, &timer->event);
+    }
+
+    return true;
+}
+
+uint64_t snapshot_store_count(const SnapshotStore *store)
+{
+    return store->state_count;
+}
+
+void snapshot_store_stats(const SnapshotStore *store, SnapshotStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->snapshots = store->state_count;
+    stats->pages = store->page_count;
+    stats->page_bytes = store->page_bytes;
+    stats->segments = store->segment_count;
+
+    for (uint32_t i = 0; i < store->segment_count; i++)
+        stats->stored_bytes += store->segments[i].size;
+}
@@ -0,0 +1,210 @@
+#include "state_hash.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// xxHash64 primes; the rounds below follow its structure
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+    return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t state_hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+
+    // Four independent lanes keep the multipliers busy
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+
+    for (; end - p >= 32; p += 32)
+    {
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+    }
+
+    uint64_t h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18) + (uint64_t)len;
+
+    for (; end - p >= 8; p += 8)
+        h = rotl(h ^ round64(0, read64(p)), 27) * PRIME1 + PRIME4;
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * PRIME3), 11) * PRIME1;
+
+    return avalanche(h);
+}
+
+/* ================= RAM ================= */
+
+uint64_t state_hash_page(Ram *ram, uint32_t page)
+{
+    uint32_t bit = 1u << page;
+
+    if (ram->mmu)
+    {
+        uint8_t copy[RAM_PAGE_SIZE];
+
+        for (uint32_t i = 0; i < RAM_PAGE_SIZE; i++)
+            copy[i] = ram_peek(ram, (uint16_t)(page * RAM_PAGE_SIZE + i));
+        return state_hash_bytes(copy, RAM_PAGE_SIZE, page);
+    }
+
+    if (ram->hash_dirty & bit)
+    {
+        ram->page_hash[page] = state_hash_bytes(ram->pages[page], RAM_PAGE_SIZE, page);
+        ram->hash_dirty &= ~bit;
+    }
+
+    return ram->page_hash[page];
+}
+
+uint64_t state_hash_ram(Ram *ram)
+{
+    uint64_t hashes[RAM_PAGE_COUNT];
+
+    for (uint32_t i = 0; i < RAM_PAGE_COUNT; i++)
+        hashes[i] = state_hash_page(ram, i);
+
+    return state_hash_bytes(hashes, sizeof(hashes), 0);
+}
+
+uint64_t state_hash_machine(const Cpu *cpu, Ram *ram)
+{
+    // Fixed layout, so padding and host-only fields stay out of the digest
+    uint8_t s[32] = { 0 };
+    size_t n = 0;
+
+    s[n++] = cpu->PC >> 8;
+    s[n++] = cpu->PC & 0xFF;
+    s[n++] = cpu->SP >> 8;
+    s[n++] = cpu->SP & 0xFF;
+    memcpy(s + n, cpu->R, REG_COUNT);
+    n += REG_COUNT;
+    s[n++] = cpu_flag_zero(cpu);
+    s[n++] = cpu_flag_carry(cpu);
+    s[n++] = cpu->running;
+    s[n++] = cpu->privileged;
+    s[n++] = cpu->fault;
+    s[n++] = cpu->irq_pending;
+    s[n++] = cpu->irq_enabled;
+    s[n++] = cpu->in_irq;
+    if (cpu->in_irq)
+    {
+        s[n++] = cpu->irq_saved_privileged;
+        s[n++] = cpu->irq_saved_PC >> 8;
+        s[n++] = cpu->irq_saved_PC & 0xFF;
+    }
+
+    return state_hash_bytes(s, n, state_hash_ram(ram));
+}
+
+/* ================= diff ================= */
+
+static const uint8_t *page_bytes(Ram *ram, uint32_t page, uint8_t *copy)
+{
+    if (!ram->mmu)
+        return ram->pages[page];
+
+    for (uint32_t i = 0; i < RAM_PAGE_SIZE; i++)
+        copy[i] = ram_peek(ram, (uint16_t)(page * RAM_PAGE_SIZE + i));
+    return copy;
+}
+
+// Record the bytes of a 16-byte chunk selected by mask (bit i: byte i differs)
+static size_t report(const uint8_t *a, const uint8_t *b, uint32_t base, uint32_t mask,
+                     StateDiff *out, size_t found, size_t max)
+{
+    while (mask)
+    {
+        uint32_t i = (uint32_t)__builtin_ctz(mask);
+
+        if (out && found < max)
+        {
+            out[found].addr = (uint16_t)(base + i);
+            out[found].a = a[i];
+            out[found].b = b[i];
+        }
+        found++;
+        mask &= mask - 1;
+    }
+
+    return found;
+}
+
+// Bit i set where a[i] != b[i], for 16 bytes
+static inline uint32_t differing(const uint8_t *a, const uint8_t *b)
+{
+#if defined(__SSE2__)
+    __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    return ~(uint32_t)_mm_movemask_epi8(eq) & 0xFFFF;
+#else
+    if (read64(a) == read64(b) && read64(a + 8) == read64(b + 8))
+        return 0;
+
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < 16; i++)
+        mask |= (uint32_t)(a[i] != b[i]) << i;
+    return mask;
+#endif
+}
+
+size_t state_diff_ram(Ram *a, Ram *b, StateDiff *out, size_t max)
+{
+    static __thread uint8_t copy_a[RAM_PAGE_SIZE];
+    static __thread uint8_t copy_b[RAM_PAGE_SIZE];
+    size_t found = 0;
+
+    for (uint32_t page = 0; page < RAM_PAGE_COUNT; page++)
+    {
+        const uint8_t *pa = page_bytes(a, page, copy_a);
+        const uint8_t *pb = page_bytes(b, page, copy_b);
+
+        // Same storage, e.g. both still sharing one template page
+        if (pa == pb)
+            continue;
+
+        for (uint32_t off = 0; off < RAM_PAGE_SIZE; off += 16)
+        {
+            uint32_t mask = differing(pa + off, pb + off);
+
+            if (mask)
+                found = report(pa + off, pb + off, page * RAM_PAGE_SIZE + off, mask, out, found, max);
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,494 @@
+#include "sweep.h"
+#include "cpu_fast.h"
+#include "log.h"
+#include "sched.h"
+#include "snapshot.h"
+#include "state_hash.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define OUTPUT_CHUNK (1u << 20)
+
+// Stops a run that exceeds max_steps
+typedef struct
+{
+    SchedEvent event;   // must stay first: the callback casts back to Watchdog
+    Cpu *cpu;
+    bool fired;
+} Watchdog;
+
+static void watchdog_fire(SchedEvent *event, uint64_t now)
+{
+    Watchdog *wd = (Watchdog *)event;
+
+    (void)now;
+    wd->cpu->running = false;
+    wd->fired = true;
+}
+
+/* ================= output selection ================= */
+
+static bool parse_field(const char *tok, SweepField *f)
+{
+    if ((tok[0] == 'R' || tok[0] == 'r') && tok[1] >= '0' && tok[1] < '0' + REG_COUNT && tok[2] == '\0')
+    {
+        f->kind = SWEEP_FIELD_REG;
+        f->addr = (uint16_t)(tok[1] - '0');
+        f->length = 1;
+        return true;
+    }
+
+    if (strcasecmp(tok, "PC") == 0 || strcasecmp(tok, "SP") == 0)
+    {
+        f->kind = (tok[0] == 'P' || tok[0] == 'p') ? SWEEP_FIELD_PC : SWEEP_FIELD_SP;
+        f->addr = 0;
+        f->length = 2;
+        return true;
+    }
+
+    if (strcasecmp(tok, "status") == 0)
+    {
+        f->kind = SWEEP_FIELD_STATUS;
+        f->addr = 0;
+        f->length = 1;
+        return true;
+    }
+
+    if (strcasecmp(tok, "fault") == 0)
+    {
+        f->kind = SWEEP_FIELD_FAULT;
+        f->addr = 0;
+        f->length = 1;
+        return true;
+    }
+
+    if (strcasecmp(tok, "digest") == 0)
+    {
+        f->kind = SWEEP_FIELD_DIGEST;
+        f->addr = 0;
+        f->length = 8;
+        return true;
+    }
+
+    char *end;
+    unsigned long addr = strtoul(tok, &end, 0);
+    unsigned long length = 1;
+
+    if (end == tok)
+        return false;
+    if (*end == ':')
+        length = strtoul(end + 1, &end, 0);
+    if (*end != '\0' || length == 0 || addr >= RAM_SIZE || addr + length > RAM_SIZE)
+        return false;
+
+    f->kind = SWEEP_FIELD_RAM;
+    f->addr = (uint16_t)addr;
+    f->length = (uint16_t)length;
+    return true;
+}
+
+bool sweep_parse_fields(const char *spec, SweepConfig *config)
+{
+    const char *p = spec;
+
+    config->field_count = 0;
+    config->output_size = 0;
+
+    while (*p)
+    {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        char tok[32];
+
+        if (config->field_count == SWEEP_MAX_FIELDS || len == 0 || len >= sizeof(tok))
+        {
+            log_write(LOG_ERROR, "Invalid output selection '%s'", spec);
+            return false;
+        }
+
+        memcpy(tok, p, len);
+        tok[len] = '\0';
+
+        SweepField *f = &config->fields[config->field_count];
+        if (!parse_field(tok, f))
+        {
+            log_write(LOG_ERROR, "Invalid output field '%s'", tok);
+            return false;
+        }
+
+        config->field_count++;
+        config->output_size += f->length;
+        p += len + (comma ? 1 : 0);
+    }
+
+    return config->field_count > 0;
+}
+
+static uint8_t *emit_fields(uint8_t *out, const SweepConfig *config, const Cpu *cpu,
+                            Ram *ram, bool timed_out)
+{
+    for (uint32_t i = 0; i < config->field_count; i++)
+    {
+        const SweepField *f = &config->fields[i];
+
+        switch (f->kind)
+        {
+        case SWEEP_FIELD_REG:
+            *out++ = cpu->R[f->addr];
+            break;
+        case SWEEP_FIELD_PC:
+            *out++ = cpu->PC >> 8;
+            *out++ = cpu->PC & 0xFF;
+            break;
+        case SWEEP_FIELD_SP:
+            *out++ = cpu->SP >> 8;
+            *out++ = cpu->SP & 0xFF;
+            break;
+        case SWEEP_FIELD_STATUS:
+            *out++ = timed_out ? SWEEP_STATUS_TIMEOUT : cpu->fault ? SWEEP_STATUS_FAULT : SWEEP_STATUS_HALTED;
+            break;
+        case SWEEP_FIELD_FAULT:
+            *out++ = cpu->fault;
+            break;
+        case SWEEP_FIELD_DIGEST:
+        {
+            uint64_t digest = state_hash_machine(cpu, ram);
+
+            for (int shift = 56; shift >= 0; shift -= 8)
+                *out++ = (uint8_t)(digest >> shift);
+            break;
+        }
+        case SWEEP_FIELD_RAM:
+            for (uint32_t a = f->addr; a < (uint32_t)f->addr + f->length; a++)
+                *out++ = ram_load_fast(ram, (uint16_t)a);
+            break;
+        }
+    }
+
+    return out;
+}
+
+/* ================= input ================= */
+
+static const uint8_t *map_input(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SweepHeader))
+    {
+        log_write(LOG_ERROR, "%s is not a sweep input file", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        log_write(LOG_ERROR, "Error while mapping %s", path);
+        return NULL;
+    }
+
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *size = (size_t)st.st_size;
+    return map;
+}
+
+static bool check_header(const SweepHeader *hdr, const char *path)
+{
+    if (memcmp(hdr->magic, SWEEP_MAGIC, 4) != 0 || hdr->format != SWEEP_FORMAT)
+    {
+        log_write(LOG_ERROR, "%s is not a sweep input file (format %u)", path, SWEEP_FORMAT);
+        return false;
+    }
+
+    if (hdr->record_size != SWEEP_REG_BYTES + (uint32_t)hdr->patch_count * SWEEP_PATCH_BYTES)
+    {
+        log_write(LOG_ERROR, "%s: record size %u does not match %u patches",
+                  path, hdr->record_size, hdr->patch_count);
+        return false;
+    }
+
+    return true;
+}
+
+/* ================= runner ================= */
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+bool sweep_machine_init(SweepMachine *m, const Cpu *template_cpu, const Ram *template_ram)
+{
+    memset(m, 0, sizeof(*m));
+    m->template_cpu = template_cpu;
+    m->template_ram = template_ram;
+    m->dc = dcache_create();
+
+    if (!m->dc || !ram_init_from(&m->ram, template_ram))
+    {
+        dcache_destroy(m->dc);
+        m->dc = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void sweep_machine_free(SweepMachine *m)
+{
+    free(m->stores);
+    m->stores = NULL;
+    ram_free(&m->ram);
+    dcache_destroy(m->dc);
+    m->dc = NULL;
+}
+
+bool sweep_machine_store(SweepMachine *m, uint16_t addr, uint8_t value)
+{
+    if (!ram_store_fast(&m->ram, addr, value) && !ram_write(&m->ram, addr, value, true))
+        return false;
+
+    if (dcache_is_code(m->dc, addr))
+        dcache_invalidate_range(m->dc, addr, addr);
+
+    // Not code yet, the byte may still be decoded during the run
+    if (m->store_count == m->store_capacity)
+    {
+        uint32_t capacity = m->store_capacity ? m->store_capacity * 2 : 64;
+        uint16_t *stores = realloc(m->stores, capacity * sizeof(uint16_t));
+
+        if (!stores)
+        {
+            m->stores_lost = true;
+            return true;
+        }
+        m->stores = stores;
+        m->store_capacity = capacity;
+    }
+    m->stores[m->store_count++] = addr;
+
+    return true;
+}
+
+bool sweep_machine_exec(SweepMachine *m, Cpu *cpu, bool kernel, uint64_t max_steps)
+{
+    Watchdog wd = { .event = { .fire = watchdog_fire }, .cpu = cpu };
+
+    // The devices outlive the run, so the final state can be snapshotted
+    sched_init(&m->sched);
+    timer_init(&m->timer, cpu, &m->sched);
+    sched_add(&m->sched, &wd.event, cpu->instret + max_steps);
+
+    m->generation = dcache_generation(m->dc);
+    cpu_run_fast(cpu, &m->ram, kernel, m->dc);
+    sched_cancel(&m->sched, &wd.event);
+    return wd.fired;
+}
+
+void sweep_machine_reset(SweepMachine *m)
+{
+    ram_reset(&m->ram, m->template_ram);
+
+    // A program that rewrote its own code leaves blocks that no longer match the template
+    if (dcache_generation(m->dc) != m->generation || m->stores_lost)
+    {
+        dcache_flush(m->dc);
+    }
+    else
+    {
+        // Blocks decoded from the stored bytes during the run
+        for (uint32_t i = 0; i < m->store_count; i++)
+        {
+            if (dcache_is_code(m->dc, m->stores[i]))
+                dcache_invalidate_range(m->dc, m->stores[i], m->stores[i]);
+        }
+    }
+
+    m->store_count = 0;
+    m->stores_lost = false;
+    m->generation = dcache_generation(m->dc);
+}
+
+bool sweep_machine_run(SweepMachine *m, const uint8_t *record, uint16_t patch_count,
+                       const SweepConfig *config, uint8_t *out, SweepRunStats *stats)
+{
+    Cpu cpu = *m->template_cpu;
+    const uint8_t *patch = record + SWEEP_REG_BYTES;
+
+    memcpy(cpu.R, record, SWEEP_REG_BYTES);
+    for (uint16_t i = 0; i < patch_count; i++, patch += SWEEP_PATCH_BYTES)
+    {
+        if (!sweep_machine_store(m, (uint16_t)((patch[0] << 8) | patch[1]), patch[2]))
+        {
+            sweep_machine_reset(m);
+            return false;
+        }
+    }
+
+    bool timed_out = sweep_machine_exec(m, &cpu, true, config->max_steps);
+
+    emit_fields(out, config, &cpu, &m->ram, timed_out);
+    bool stored = !m->snapshots || snapshot_store_add(m->snapshots, &cpu, &m->ram, timed_out) >= 0;
+
+    if (stats)
+    {
+        stats->instret = cpu.instret - m->template_cpu->instret;
+        stats->timed_out = timed_out;
+    }
+
+    sweep_machine_reset(m);
+    return stored;
+}
+
+long long sweep_run(const char *input_path, const char *output_path, const SweepConfig *config,
+                    const Cpu *template_cpu, const Ram *template_ram, const Verification *verification)
+{
+    if (template_ram->mmu)
+    {
+        log_write(LOG_ERROR, "Sweep mode does not support an MMU");
+        return -1;
+    }
+
+    size_t map_size = 0;
+    const uint8_t *map = map_input(input_path, &map_size);
+    if (!map)
+        return -1;
+
+    SweepHeader hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+    if (!check_header(&hdr, input_path))
+    {
+        munmap((void *)map, map_size);
+        return -1;
+    }
+
+    size_t records = (map_size - sizeof(hdr)) / hdr.record_size;
+    if ((map_size - sizeof(hdr)) % hdr.record_size)
+        log_write(LOG_WARN, "%s: ignoring a trailing partial record", input_path);
+
+    SnapshotStore *snapshots = NULL;
+    if (config->snapshot_dir)
+    {
+        snapshots = snapshot_store_open(config->snapshot_dir);
+        if (!snapshots)
+        {
+            munmap((void *)map, map_size);
+            return -1;
+        }
+    }
+
+    FILE *out = fopen(output_path, "wb");
+    size_t cap = config->output_size > OUTPUT_CHUNK ? config->output_size : OUTPUT_CHUNK;
+    uint8_t *buf = malloc(cap);
+    SweepMachine machine;
+
+    if (!out || !buf || !sweep_machine_init(&machine, template_cpu, template_ram))
+    {
+        log_write(LOG_ERROR, "Error while preparing sweep output %s", output_path);
+        if (out)
+            fclose(out);
+        free(buf);
+        snapshot_store_close(snapshots);
+        munmap((void *)map, map_size);
+        return -1;
+    }
+    machine.snapshots = snapshots;
+    if (verification)
+        dcache_attach_verification(machine.dc, verification);
+    uint64_t first_snapshot = snapshots ? snapshot_store_count(snapshots) : 0;
+
+    // Per-run logging would cost a write per run; keep only warnings and errors
+    bool show_info = log_is_enabled(LOG_INFO);
+    bool show_debug = log_is_enabled(LOG_DEBUG);
+    bool show_trace = log_is_enabled(LOG_TRACE);
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    struct timespec start;
+    size_t used = 0;
+    long long done = 0;
+    bool ok = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t r = 0; r < records && ok; r++)
+    {
+        const uint8_t *rec = map + sizeof(hdr) + r * hdr.record_size;
+
+        if (cap - used < config->output_size)
+        {
+            ok = fwrite(buf, 1, used, out) == used;
+            used = 0;
+        }
+
+        if (!ok || !sweep_machine_run(&machine, rec, hdr.patch_count, config, buf + used, NULL))
+        {
+            ok = false;
+            break;
+        }
+
+        used += config->output_size;
+        done++;
+    }
+
+    if (ok && used)
+        ok = fwrite(buf, 1, used, out) == used;
+    if (fclose(out) != 0)
+        ok = false;
+
+    double elapsed = seconds_since(&start);
+
+    log_set_enabled(LOG_INFO, show_info);
+    log_set_enabled(LOG_DEBUG, show_debug);
+    log_set_enabled(LOG_TRACE, show_trace);
+
+    sweep_machine_free(&machine);
+    free(buf);
+    munmap((void *)map, map_size);
+
+    if (snapshots)
+    {
+        SnapshotStats st;
+        snapshot_store_stats(snapshots, &st);
+        if (!snapshot_store_close(snapshots))
+            ok = false;
+
+        if (done)
+            log_write(LOG_INFO, "Snapshots %llu-%llu in %s: %llu states, %llu distinct pages, "
+                      "%.1f KB stored for %.1f MB of RAM",
+                      (unsigned long long)first_snapshot, (unsigned long long)(first_snapshot + done - 1),
+                      config->snapshot_dir, (unsigned long long)st.snapshots, (unsigned long long)st.pages,
+                      st.stored_bytes / 1024.0, st.snapshots * (double)RAM_SIZE / (1 << 20));
+    }
+
+    if (!ok)
+    {
+        log_write(LOG_ERROR, "Sweep failed after %lld runs", done);
+        return -1;
+    }
+
+    log_write(LOG_INFO, "Sweep: %lld runs in %.3f s (%.0f runs/s) -> %s",
+              done, elapsed, elapsed > 0 ? done / elapsed : 0.0, output_path);
+    return done;
+}
@@ -0,0 +1,40 @@
+#include "timer.h"
+#include "log.h"
+
+#include <stddef.h>
+
+static void timer_fire(SchedEvent *event, uint64_t now)
+{
+    Timer *timer = (Timer *)event;
+
+    timer->cpu->irq_pending |= CPU_IRQ_TIMER;
+    log_write(LOG_TRACE, "Timer expired at instruction %llu", (unsigned long long)now);
+
+    if (timer->period)
+        sched_add(timer->sched, &timer->event, now + timer->period);
+}
+
+void timer_init(Timer *timer, Cpu *cpu, Scheduler *sched)
+{
+    timer->event.fire = timer_fire;
+    timer->event.next = NULL;
+    timer->event.queued = false;
+    timer->cpu = cpu;
+    timer->sched = sched;
+    timer->period = 0;
+
+    cpu->timer = timer;
+    cpu->sched = sched;
+}
+
+void timer_program(Timer *timer, uint16_t period, uint64_t now)
+{
+    timer->period = period;
+
+    if (period)
+        sched_add(timer->sched, &timer->event, now + period);
+    else
+        sched_cancel(timer->sched, &timer->event);
+
+    log_write(LOG_DEBUG, "Timer period set to %u instructions", period);
+}
@@ -0,0 +1,385 @@
+#include "verify.h"
+#include "cpu.h"
+#include "isa.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Walk state per address
+#define SEEN_USER 0x01
+#define SEEN_KERNEL 0x02
+#define QUEUED_USER 0x04
+#define QUEUED_KERNEL 0x08
+#define LEADER 0x10      // first instruction of a basic block
+#define LOADED 0x20      // byte comes from the image
+
+typedef struct
+{
+    uint8_t code[RAM_SIZE];     // image bytes at their load addresses
+    uint8_t state[RAM_SIZE];
+    uint32_t stack[2 * RAM_SIZE];   // pc | kernel << 16, each queued once per mode
+    uint32_t depth;
+    bool enables_interrupts;
+} Walk;
+
+// Register values known at some point of a basic block
+typedef struct
+{
+    bool known[REG_COUNT];
+    uint8_t value[REG_COUNT];
+} RegFacts;
+
+/* ================= reachability ================= */
+
+static bool loaded(const Walk *w, uint32_t pc, uint32_t size)
+{
+    if (pc + size > RAM_SIZE)
+        return false;
+
+    for (uint32_t a = pc; a < pc + size; a++)
+    {
+        if (!(w->state[a] & LOADED))
+            return false;
+    }
+
+    return true;
+}
+
+static void enqueue(Walk *w, uint16_t pc, bool kernel)
+{
+    uint8_t queued = kernel ? QUEUED_KERNEL : QUEUED_USER;
+
+    w->state[pc] |= LEADER;
+    if (w->state[pc] & queued)
+        return;
+
+    w->state[pc] |= queued;
+    w->stack[w->depth++] = pc | (uint32_t)kernel << 16;
+}
+
+// Follow straight-line code from pc, queueing every other successor
+static void walk_from(Walk *w, uint32_t pc, bool kernel)
+{
+    uint8_t seen = kernel ? SEEN_KERNEL : SEEN_USER;
+
+    while (pc < RAM_SIZE && !(w->state[pc] & seen))
+    {
+        w->state[pc] |= seen;
+
+        uint8_t opcode = w->code[pc];
+        const IsaInstr *ins = &isa_table[opcode];
+
+        // Rejected in the block pass
+        if (ins->format == FMT_INVALID || !loaded(w, pc, ins->size))
+            return;
+
+        uint32_t next = pc + ins->size;
+
+        if (opcode == OP_EI)
+            w->enables_interrupts = true;
+
+        if (ins->format == FMT_ADDR)
+            enqueue(w, (w->code[pc + 1] << 8) | w->code[pc + 2], kernel);
+
+        if (!(ins->flags & ISA_BRANCH))
+        {
+            pc = next;
+            continue;
+        }
+
+        // Conditional branches fall through; CALL comes back to the next instruction
+        if ((opcode == OP_JZ || opcode == OP_JNZ || opcode == OP_JC || opcode == OP_CALL) &&
+            next < RAM_SIZE)
+            enqueue(w, (uint16_t)next, kernel);
+
+        return;
+    }
+}
+
+static void walk(Walk *w)
+{
+    while (w->depth)
+    {
+        uint32_t item = w->stack[--w->depth];
+        walk_from(w, item & 0xFFFF, item >> 16);
+    }
+}
+
+/* ================= register facts ================= */
+
+static void fact_set(RegFacts *f, uint8_t reg, uint8_t value)
+{
+    f->known[reg] = true;
+    f->value[reg] = value;
+}
+
+static bool pair_known(const RegFacts *f, uint8_t pair)
+{
+    return f->known[pair * 2] && f->known[pair * 2 + 1];
+}
+
+static uint16_t pair_value(const RegFacts *f, uint8_t pair)
+{
+    return (f->value[pair * 2] << 8) | f->value[pair * 2 + 1];
+}
+
+static void pair_set(RegFacts *f, uint8_t pair, bool known, uint16_t value)
+{
+    f->known[pair * 2] = f->known[pair * 2 + 1] = known;
+    f->value[pair * 2] = value >> 8;
+    f->value[pair * 2 + 1] = value & 0xFF;
+}
+
+// Registers after an instruction that passed its checks
+static void fact_update(RegFacts *f, uint8_t opcode, uint8_t o1, uint8_t o2, uint8_t o3)
+{
+    switch (opcode)
+    {
+    case OP_LOAD_IMM:
+        fact_set(f, o1, o2);
+        break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MLP:
+    case OP_DIV:
+        if (!f->known[o1] || !f->known[o2] || (opcode == OP_DIV && f->value[o2] == 0))
+        {
+            f->known[o1] = false;
+            break;
+        }
+        fact_set(f, o1, opcode == OP_ADD ? f->value[o1] + f->value[o2] :
+                        opcode == OP_SUB ? f->value[o1] - f->value[o2] :
+                        opcode == OP_MLP ? f->value[o1] * f->value[o2] :
+                                           f->value[o1] / f->value[o2]);
+        break;
+
+    case OP_LOAD_MEM:
+        f->known[o1] = false;
+        break;
+
+    case OP_LOAD_IMM16:
+        pair_set(f, o1, true, (o2 << 8) | o3);
+        break;
+
+    case OP_ADD16:
+    case OP_SUB16:
+        pair_set(f, o1, pair_known(f, o1) && pair_known(f, o2),
+                 opcode == OP_ADD16 ? pair_value(f, o1) + pair_value(f, o2)
+                                    : pair_value(f, o1) - pair_value(f, o2));
+        break;
+
+    case OP_LOAD_IND:
+    case OP_STORE_IND:
+    {
+        uint8_t pair = o2 & ISA_IND_PAIR_MASK;
+
+        if (opcode == OP_LOAD_IND)
+            f->known[o1] = false;
+        if (o2 & ISA_IND_POST_INC)
+            pair_set(f, pair, pair_known(f, pair), pair_value(f, pair) + 1);
+        break;
+    }
+
+    case OP_RDINS:
+    case OP_RDCYC:
+        pair_set(f, o1, false, 0);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* ================= block checks ================= */
+
+static bool reject(bool report, uint32_t pc, const char *mnemonic, const char *why)
+{
+    if (report)
+        log_write(LOG_WARN, "Verifier: 0x%04X %s: %s", pc, mnemonic, why);
+    return false;
+}
+
+static bool check_insn(const Walk *w, uint32_t pc, bool kernel, const RegFacts *facts, bool report)
+{
+    uint8_t opcode = w->code[pc];
+    const IsaInstr *ins = &isa_table[opcode];
+
+    if (ins->format == FMT_INVALID)
+        return reject(report, pc, "?", "undefined opcode");
+    if (!loaded(w, pc, ins->size))
+    {
+        log_write(LOG_DEBUG, "Verifier: 0x%04X is outside the image", pc);
+        return false;
+    }
+    if (!kernel && pc + ins->size - 1 <= RAM_PRIVILEGED_MODE_END)
+        return reject(report, pc, ins->mnemonic, "code in privileged memory reached in user mode");
+    if (!kernel && (ins->flags & ISA_PRIVILEGED))
+        return reject(report, pc, ins->mnemonic, "privileged instruction reached in user mode");
+
+    uint8_t o1 = ins->size > 1 ? w->code[pc + 1] : 0;
+    uint8_t o2 = ins->size > 2 ? w->code[pc + 2] : 0;
+    uint8_t o3 = ins->size > 3 ? w->code[pc + 3] : 0;
+    uint16_t addr;
+
+    switch (ins->format)
+    {
+    case FMT_REG_IMM:
+        if (o1 >= REG_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register");
+        break;
+
+    case FMT_REG_REG:
+        if (o1 >= REG_COUNT || o2 >= REG_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register");
+        if (opcode == OP_DIV && facts->known[o2] && facts->value[o2] == 0)
+            return reject(report, pc, ins->mnemonic, "divisor is always zero");
+        break;
+
+    case FMT_REG_ADDR:
+        addr = (o2 << 8) | o3;
+        if (o1 >= REG_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register");
+        if (!kernel && addr <= RAM_PRIVILEGED_MODE_END)
+            return reject(report, pc, ins->mnemonic, "privileged address in user mode");
+        break;
+
+    case FMT_REG3:
+        if (o1 >= REG_COUNT || o2 >= REG_COUNT || o3 >= REG_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register");
+        break;
+
+    case FMT_ADDR:
+        addr = (o1 << 8) | o2;
+        if (!kernel && addr <= RAM_PRIVILEGED_MODE_END)
+            return reject(report, pc, ins->mnemonic, "branch into privileged memory in user mode");
+        break;
+
+    case FMT_PAIR_IMM:
+        if (o1 >= PAIR_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register pair");
+        break;
+
+    case FMT_PAIR_PAIR:
+        if (o1 >= PAIR_COUNT || o2 >= PAIR_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register pair");
+        break;
+
+    case FMT_REG_IND:
+        if (o1 >= REG_COUNT || (o2 & ISA_IND_PAIR_MASK) >= PAIR_COUNT)
+            return reject(report, pc, ins->mnemonic, "invalid register or pair");
+        break;
+
+    case FMT_PAIR_WORD:
+        if (o1 >= PAIR_COUNT || o2 >= ISA_COUNTER_WORDS)
+            return reject(report, pc, ins->mnemonic, "invalid register pair or word");
+        break;
+
+    default:
+        break;
+    }
+
+    return true;
+}
+
+/*
+ * Check the basic block starting at leader, or with mark set, record the
+ * flags of a block that passed. Returns false on the first failure.
+ */
+static bool scan_block(const Walk *w, Verification *v, uint32_t leader, bool mark)
+{
+    RegFacts facts;
+    uint32_t pc = leader;
+
+    memset(&facts, 0, sizeof(facts));
+
+    for (;;)
+    {
+        bool kernel = !(w->state[pc] & SEEN_USER);
+
+        if (!check_insn(w, pc, kernel, &facts, !mark))
+            return false;
+
+        uint8_t opcode = w->code[pc];
+        const IsaInstr *ins = &isa_table[opcode];
+        uint8_t o1 = ins->size > 1 ? w->code[pc + 1] : 0;
+        uint8_t o2 = ins->size > 2 ? w->code[pc + 2] : 0;
+        uint8_t o3 = ins->size > 3 ? w->code[pc + 3] : 0;
+
+        if (mark)
+        {
+            for (uint32_t a = pc; a < pc + ins->size; a++)
+                v->flags[a] |= VERIFY_OK;
+            if (pc == leader)
+                v->flags[pc] |= VERIFY_LEADER;
+            if (kernel)
+                v->flags[pc] |= VERIFY_KERNEL_ONLY;
+            if (opcode == OP_DIV && facts.known[o2])
+                v->flags[pc] |= VERIFY_DIVISOR_NONZERO;
+            v->passed++;
+        }
+
+        if (!w->enables_interrupts)
+            fact_update(&facts, opcode, o1, o2, o3);
+
+        pc += ins->size;
+        if ((ins->flags & ISA_BRANCH) || pc >= RAM_SIZE || (w->state[pc] & LEADER))
+            return true;
+    }
+}
+
+/* ================= entry ================= */
+
+bool verify_image(Verification *v, const Image *image, bool privileged)
+{
+    memset(v, 0, sizeof(*v));
+    v->privileged = privileged;
+
+    Walk *w = calloc(1, sizeof(Walk));
+    if (!w)
+    {
+        log_write(LOG_ERROR, "Out of memory verifying the image");
+        return false;
+    }
+
+    for (uint16_t i = 0; i < image->segment_count; i++)
+    {
+        const ImageSegment *seg = &image->segments[i];
+
+        memcpy(w->code + seg->addr, image->bytes + seg->offset, seg->length);
+        memset(w->state + seg->addr, LOADED, seg->length);
+    }
+
+    enqueue(w, image->org, privileged);
+
+    // The interrupt handler runs privileged; follow it if the image sets the vector
+    if (loaded(w, CPU_IRQ_VECTOR, 2))
+        enqueue(w, (w->code[CPU_IRQ_VECTOR] << 8) | w->code[CPU_IRQ_VECTOR + 1], true);
+
+    walk(w);
+
+    for (uint32_t pc = 0; pc < RAM_SIZE; pc++)
+    {
+        if (w->state[pc] & (SEEN_USER | SEEN_KERNEL))
+        {
+            v->flags[pc] |= VERIFY_REACHED;
+            v->reachable++;
+        }
+        if (!(w->state[pc] & LEADER) || !(w->state[pc] & (SEEN_USER | SEEN_KERNEL)))
+            continue;
+
+        v->blocks++;
+        if (scan_block(w, v, pc, false))
+            scan_block(w, v, pc, true);
+        else
+            v->failed_blocks++;
+    }
+
+    log_write(LOG_INFO, "Verified %u of %u reachable instructions (%u of %u basic blocks)%s",
+              v->passed, v->reachable, v->blocks - v->failed_blocks, v->blocks,
+              w->enables_interrupts ? ", no register facts: interrupts enabled" : "");
+
+    free(w);
+    return v->failed_blocks == 0;
+}
@@ -0,0 +1,397 @@
+#include "watch.h"
+#include "cpu_fast.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+static void watch_fire(SchedEvent *event, uint64_t now)
+{
+    Watch *w = (Watch *)event;
+    long long t = now_ms();
+
+    if (t - w->last_poll_ms >= WATCH_POLL_MS)
+    {
+        w->last_poll_ms = t;
+        watch_poll(w);
+    }
+
+    sched_add(w->cpu->sched, &w->event, now + WATCH_CHECK_INTERVAL);
+}
+
+/* ================= source ================= */
+
+// True if the file looks different from the last check
+static bool file_changed(Watch *w)
+{
+    struct stat st;
+
+    if (stat(w->path, &st) != 0)
+        return false;
+
+    bool changed = st.st_mtim.tv_sec != w->mtime.tv_sec ||
+                   st.st_mtim.tv_nsec != w->mtime.tv_nsec || st.st_size != w->size;
+
+    w->mtime = st.st_mtim;
+    w->size = st.st_size;
+    return changed;
+}
+
+// Whole file as a NUL-terminated string
+static char *read_source(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    struct stat st;
+    char *text = NULL;
+
+    if (fstat(fileno(f), &st) == 0 && (text = malloc((size_t)st.st_size + 1)))
+        text[fread(text, 1, (size_t)st.st_size, f)] = '\0';
+
+    fclose(f);
+    return text;
+}
+
+// Split a copy of text into lines numbered like the assembler's fgets loop
+static char **split_lines(const char *text, char **copy, size_t *count)
+{
+    size_t n = 0;
+    size_t len = strlen(text);
+
+    for (size_t i = 0; i < len; i++)
+        n += text[i] == '\n';
+    if (len && text[len - 1] != '\n')
+        n++;
+
+    *copy = strdup(text);
+    char **lines = malloc((n ? n : 1) * sizeof(char *));
+    if (!*copy || !lines)
+    {
+        free(*copy);
+        free(lines);
+        return NULL;
+    }
+
+    char *p = *copy;
+    for (size_t i = 0; i < n; i++)
+    {
+        char *nl = strchr(p, '\n');
+
+        lines[i] = p;
+        if (nl)
+            *nl = '\0';
+        p = nl ? nl + 1 : p + strlen(p);
+    }
+
+    *count = n;
+    return lines;
+}
+
+static bool assemble_text(const char *path, const char *text, Image *image)
+{
+    char error[256];
+    size_t len = strlen(text);
+    FILE *in = fmemopen((void *)text, len ? len : 1, "r");
+
+    if (!in)
+        return false;
+
+    int size = assemble_source(in, image, error, sizeof(error));
+    fclose(in);
+
+    if (size < 0)
+        log_write(LOG_ERROR, "Watch: %s %s, keeping the running code", path, error);
+    return size >= 0;
+}
+
+static void image_bytes(const Image *image, uint8_t *code, uint8_t *have)
+{
+    memset(have, 0, RAM_SIZE);
+
+    for (uint16_t i = 0; i < image->segment_count; i++)
+    {
+        const ImageSegment *seg = &image->segments[i];
+
+        memcpy(code + seg->addr, image->bytes + seg->offset, seg->length);
+        memset(have + seg->addr, 1, seg->length);
+    }
+}
+
+static bool keep_line_map(Watch *w)
+{
+    size_t count;
+    const AsmLine *lines = assembler_lines(&count);
+    AsmLine *copy = malloc((count ? count : 1) * sizeof(AsmLine));
+
+    if (!copy)
+        return false;
+
+    memcpy(copy, lines, count * sizeof(AsmLine));
+    free(w->lines);
+    w->lines = copy;
+    w->line_count = count;
+    return true;
+}
+
+/* ================= reload ================= */
+
+/*
+ * Reassemble just the edited lines into next. False if the edit changes
+ * the layout, or a line does not assemble on its own.
+ */
+static bool patch_lines(Watch *w, char **old_lines, size_t old_count, char **new_lines, size_t new_count,
+                        uint32_t *edited)
+{
+    if (old_count != new_count || old_count != w->line_count)
+        return false;
+
+    memcpy(w->next, w->code, RAM_SIZE);
+    memcpy(w->next_have, w->have, RAM_SIZE);
+    *edited = 0;
+
+    for (size_t i = 0; i < new_count; i++)
+    {
+        const AsmLine *line = &w->lines[i];
+        uint8_t bytes[ISA_MAX_SIZE];
+        char error[256];
+
+        if (strcmp(old_lines[i], new_lines[i]) == 0)
+            continue;
+        if (line->layout)
+            return false;
+
+        int size = assemble_line(new_lines[i], (int)i + 1, line->addr, bytes, error, sizeof(error));
+        if (size != line->size)
+            return false;
+
+        memcpy(w->next + line->addr, bytes, (size_t)size);
+        (*edited)++;
+    }
+
+    return true;
+}
+
+// Index of the line whose instruction starts at addr, or -1
+static long find_line(const AsmLine *lines, size_t count, uint16_t addr)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (lines[i].size && lines[i].addr == addr)
+            return (long)i;
+    }
+    return -1;
+}
+
+/*
+ * After a full reassembly: move PC to where its line went. Lines in the
+ * unchanged head and tail of the file keep their identity; a PC inside the
+ * edited region goes to the first instruction of the new text there.
+ */
+static void relocate_pc(Watch *w, char **old_lines, size_t old_count, char **new_lines, size_t new_count)
+{
+    size_t new_map_count;
+    const AsmLine *new_map = assembler_lines(&new_map_count);
+    size_t head = 0;
+    size_t tail = 0;
+    bool moved = false;
+
+    while (head < old_count && head < new_count && strcmp(old_lines[head], new_lines[head]) == 0)
+        head++;
+    while (tail < old_count - head && tail < new_count - head &&
+           strcmp(old_lines[old_count - 1 - tail], new_lines[new_count - 1 - tail]) == 0)
+        tail++;
+
+    if (old_count != w->line_count || new_count != new_map_count)
+        return;
+
+    for (size_t i = 0; i < old_count && !moved; i++)
+    {
+        size_t j = i < head ? i : i >= old_count - tail ? i + new_count - old_count : SIZE_MAX;
+
+        if (j != SIZE_MAX && w->lines[i].size && w->lines[i].addr != new_map[j].addr)
+            moved = true;
+    }
+
+    if (!moved)
+        return;
+
+    long i = find_line(w->lines, old_count, w->cpu->PC);
+    if (i >= 0)
+    {
+        size_t j = (size_t)i < head ? (size_t)i
+                 : (size_t)i >= old_count - tail ? (size_t)i + new_count - old_count
+                                                 : head;
+
+        while (j < new_count && new_map[j].size == 0)
+            j++;
+
+        if (j < new_count && new_map[j].addr != w->cpu->PC)
+        {
+            log_write(LOG_INFO, "Watch: code moved, PC 0x%04X -> 0x%04X (line %zu)",
+                      w->cpu->PC, new_map[j].addr, j + 1);
+            w->cpu->PC = new_map[j].addr;
+        }
+    }
+
+    if (w->cpu->SP != 0)
+        log_write(LOG_WARN, "Watch: code moved; return addresses on the stack were not relocated");
+}
+
+// Store the bytes of next that differ from the running code
+static uint32_t apply(Watch *w)
+{
+    uint32_t stored = 0;
+    uint32_t start = RAM_SIZE;
+
+    for (uint32_t addr = 0; addr <= RAM_SIZE; addr++)
+    {
+        bool differs = addr < RAM_SIZE && w->next_have[addr] &&
+                       (!w->have[addr] || w->code[addr] != w->next[addr]);
+
+        if (differs)
+        {
+            if (!ram_write(w->ram, addr, w->next[addr], true))
+                log_write(LOG_WARN, "Watch: cannot store at 0x%04X", addr);
+            stored++;
+            if (start == RAM_SIZE)
+                start = addr;
+            continue;
+        }
+
+        if (start != RAM_SIZE)
+        {
+            if (w->dc)
+                dcache_invalidate_range(w->dc, (uint16_t)start, (uint16_t)(addr - 1));
+            start = RAM_SIZE;
+        }
+    }
+
+    memcpy(w->code, w->next, RAM_SIZE);
+    memcpy(w->have, w->next_have, RAM_SIZE);
+    return stored;
+}
+
+bool watch_poll(Watch *w)
+{
+    if (!file_changed(w))
+        return false;
+
+    char *text = read_source(w->path);
+    if (!text || strcmp(text, w->source) == 0)
+    {
+        free(text);
+        return false;
+    }
+
+    char *old_copy = NULL;
+    char *new_copy = NULL;
+    size_t old_count = 0;
+    size_t new_count = 0;
+    char **old_lines = split_lines(w->source, &old_copy, &old_count);
+    char **new_lines = split_lines(text, &new_copy, &new_count);
+    uint32_t edited = 0;
+    bool changed = false;
+
+    if (old_lines && new_lines && patch_lines(w, old_lines, old_count, new_lines, new_count, &edited))
+    {
+        uint32_t stored = apply(w);
+
+        log_write(LOG_INFO, "Watch: %s: %u line(s) reassembled in place, %u byte(s) patched",
+                  w->path, edited, stored);
+        w->patched += stored;
+        changed = true;
+    }
+    else if (old_lines && new_lines)
+    {
+        static Image image;
+
+        if (assemble_text(w->path, text, &image))
+        {
+            image_bytes(&image, w->next, w->next_have);
+            relocate_pc(w, old_lines, old_count, new_lines, new_count);
+
+            uint32_t stored = apply(w);
+
+            log_write(LOG_INFO, "Watch: %s reassembled, %u byte(s) patched", w->path, stored);
+            w->patched += stored;
+            changed = keep_line_map(w);
+        }
+    }
+
+    free(old_lines);
+    free(new_lines);
+    free(old_copy);
+    free(new_copy);
+
+    if (!changed)
+    {
+        free(text);
+        return false;
+    }
+
+    free(w->source);
+    w->source = text;
+    w->reloads++;
+    return true;
+}
+
+/* ================= entry ================= */
+
+bool watch_start(Watch *w, const char *path, Cpu *cpu, Ram *ram, struct DecodeCache *dc)
+{
+    static Image image;
+
+    memset(w, 0, sizeof(*w));
+    w->path = path;
+    w->cpu = cpu;
+    w->ram = ram;
+    w->dc = dc;
+    w->event.fire = watch_fire;
+
+    file_changed(w);
+    w->source = read_source(path);
+    if (!w->source)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", path);
+        return false;
+    }
+
+    // The running image may have come from the image cache: rebuild the labels and line map
+    if (!assemble_text(path, w->source, &image) || !keep_line_map(w))
+    {
+        watch_stop(w);
+        return false;
+    }
+
+    image_bytes(&image, w->code, w->have);
+    w->last_poll_ms = now_ms();
+    sched_add(cpu->sched, &w->event, cpu->instret + WATCH_CHECK_INTERVAL);
+
+    log_write(LOG_INFO, "Watching %s for edits", path);
+    return true;
+}
+
+void watch_stop(Watch *w)
+{
+    if (w->event.queued)
+        sched_cancel(w->cpu->sched, &w->event);
+
+    if (w->reloads)
+        log_write(LOG_INFO, "Watch: %u reload(s), %u byte(s) patched", w->reloads, w->patched);
+
+    free(w->source);
+    free(w->lines);
+    w->source = NULL;
+    w->lines = NULL;
+}
@@ -0,0 +1,12 @@
+; expect: 8
+;
+; Straight-line arithmetic, a store and a load.
+.org 0x2001
+
+start:
+    LOAD_IMM R0, #5
+    LOAD_IMM R1, #3
+    ADD      R0, R1
+    STORE    R0, 0x2000
+    LOAD_MEM R2, 0x2000
+    HALT
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cache_sim.h"
+#include "cpu.h"
+#include "cpu_exec.h"
+#include "isa.h"
+#include "log.h"
+
+#define TEST_AREA "cache_sim"
+#include "test.h"
+
+/*
+ * --cache-sim on a program small enough to count by hand: conflict misses
+ * and dirty writebacks in a direct-mapped data cache that a 2-way cache
+ * avoids, instruction fetches split across lines, and the cycle estimate.
+ */
+
+// 0x3000 and 0x3040 map to the same set of a 64-byte, 16-byte-line cache
+static const char program[] =
+    ".org 0x2001\n"
+    "    STORE R0, 0x3000\n"       // 0x2001-0x2004
+    "    STORE R0, 0x3040\n"       // 0x2005-0x2008
+    "    LOAD_MEM R1, 0x3000\n"    // 0x2009-0x200C
+    "    LOAD_MEM R1, 0x3001\n"    // 0x200D-0x2010: spans two lines
+    "    HALT\n";                  // 0x2011
+
+static Image image;
+
+static CacheSimStats run(const char *dcache)
+{
+    CacheSimConfig config;
+    CacheSimStats stats;
+    Cpu cpu;
+    Ram ram;
+
+    memset(&stats, 0, sizeof(stats));
+    cache_sim_default_config(&config);
+    config.miss_penalty = 20;
+    if (!cache_sim_parse_geometry("64:16:1", &config.icache) ||
+        !cache_sim_parse_geometry(dcache, &config.dcache))
+    {
+        failures++;
+        return stats;
+    }
+
+    CacheSim *sim = cache_sim_create(&config);
+    cpu_init(&cpu, true);
+    ram_init(&ram);
+    image_load(&image, &ram, true);
+    cpu.PC = image.org;
+
+    cache_sim_attach(sim, &ram);
+    cpu_run(&cpu, &ram, true);
+    cache_sim_detach(sim, &ram);
+    cache_sim_stats(sim, &stats);
+
+    cache_sim_destroy(sim);
+    ram_free(&ram);
+    return stats;
+}
+
+int main(void)
+{
+    char error[256];
+    CacheGeometry g;
+
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+    log_set_enabled(LOG_ERROR, false);
+
+    FILE *in = fmemopen((void *)program, sizeof(program) - 1, "r");
+    image_init(&image);
+    if (!in || assemble_source(in, &image, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "cache_sim_test: cannot assemble: %s\n", error);
+        return 1;
+    }
+    fclose(in);
+
+    check(cache_sim_parse_geometry("1024:16:4", &g) && g.size == 1024 && g.line == 16 && g.ways == 4,
+          "parse a geometry");
+    check(!cache_sim_parse_geometry("96:16:2", &g), "size not a power of two refused");
+    check(!cache_sim_parse_geometry("16:16:2", &g), "line * ways over size refused");
+
+    CacheSimStats direct = run("64:16:1");
+    check(direct.instructions == 5, "instructions counted");
+    check(direct.icache.accesses == 6 && direct.icache.misses == 2,
+          "I-cache: one access per line an instruction touches");
+    check(direct.dcache.accesses == 4 && direct.dcache.misses == 3 && direct.dcache.writebacks == 2,
+          "direct-mapped D-cache: conflict misses write back dirty lines");
+
+    uint64_t base = isa_table[OP_STORE].cycles * 2 + isa_table[OP_LOAD_MEM].cycles * 2 +
+                    isa_table[OP_HALT].cycles;
+    check(direct.cycles == base + 20 * (2 + 3 + 2), "cycles: opcode costs plus 20 per fill or writeback");
+
+    CacheSimStats two_way = run("128:16:2");
+    check(two_way.dcache.accesses == 4 && two_way.dcache.misses == 2 && two_way.dcache.writebacks == 0,
+          "2-way D-cache holds both lines");
+
+    printf("cache_sim_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+; expect: 11
+;
+; A counted loop calling a subroutine, then a carry test.
+.org 0x2001
+start:
+    LOAD_IMM R0, #0
+    LOAD_IMM R1, #1
+    LOAD_IMM R2, #10
+    LOAD_IMM R3, #0
+loop:
+    CALL addr0
+    SUB R2, R1
+    JNZ loop
+    LOAD_IMM R4, #200
+    LOAD_IMM R5, #100
+    ADD R4, R5
+    JC carry
+    HALT
+carry:
+    ADD R0, R1
+    STORE R0, 0x2000
+    HALT
+addr0:
+    ADD R0, R1
+    RET
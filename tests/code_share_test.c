@@ -0,0 +1,142 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "code_share.h"
+#include "log.h"
+
+#define TEST_AREA "code_share"
+#include "test.h"
+
+/*
+ * CodeShare publication and lookup: entries are found only by machines
+ * whose bytes and verification flags match, and threads publishing at
+ * the same addresses at once never exceed CODE_SHARE_MAX_VARIANTS.
+ */
+
+#define THREADS 16
+#define ADDRESSES 2048
+#define FIRST 0x2000
+
+static uint8_t verify[RAM_SIZE];
+static CodeShare *share;
+static pthread_barrier_t barrier;
+
+// A one-byte block at start
+static void one_byte_block(Block *b, DecodedInsn *insn, uint16_t start)
+{
+    memset(b, 0, sizeof(*b));
+    memset(insn, 0, sizeof(*insn));
+    b->start = b->end = start;
+    b->count = 1;
+    b->valid = true;
+    insn->pc = start;
+    insn->next = (uint16_t)(start + 1);
+    b->insns = insn;
+}
+
+static void test_variants(void)
+{
+    CodeShare *cs = code_share_create(CODE_SHARE_DEFAULT_SIZE);
+    Ram ram;
+    Block b;
+    DecodedInsn insn;
+
+    ram_init(&ram);
+    one_byte_block(&b, &insn, FIRST);
+
+    for (uint8_t v = 0; v < CODE_SHARE_MAX_VARIANTS; v++)
+    {
+        ram_write(&ram, FIRST, v, true);
+        check(code_share_publish(cs, &ram, verify, &b, false), "publish a variant");
+    }
+    ram_write(&ram, FIRST, 0xAA, true);
+    check(!code_share_publish(cs, &ram, verify, &b, false), "variant beyond the limit refused");
+    check(!code_share_find(cs, &ram, verify, FIRST, false), "refused variant not found");
+
+    ram_write(&ram, FIRST, 3, true);
+    const SharedBlock *e = code_share_find(cs, &ram, verify, FIRST, false);
+    check(e && e->bytes[0] == 3 && e->count == 1, "find the matching variant");
+    check(!code_share_find(cs, &ram, verify, FIRST, true), "memo flag must match");
+
+    uint8_t other[RAM_SIZE] = { 0 };
+    other[FIRST] = 0x01;
+    check(!code_share_find(cs, &ram, other, FIRST, false), "verification flags must match");
+
+    ram_free(&ram);
+    code_share_destroy(cs);
+}
+
+// Each thread publishes its own variant at every address, all at once
+static void *publisher(void *arg)
+{
+    uint8_t id = (uint8_t)(uintptr_t)arg;
+    Ram ram;
+    Block b;
+    DecodedInsn insn;
+
+    ram_init(&ram);
+    for (uint32_t i = 0; i < ADDRESSES; i++)
+        ram_write(&ram, FIRST + i, id, true);
+
+    pthread_barrier_wait(&barrier);
+    for (uint32_t i = 0; i < ADDRESSES; i++)
+    {
+        one_byte_block(&b, &insn, (uint16_t)(FIRST + i));
+        code_share_publish(share, &ram, verify, &b, false);
+    }
+
+    ram_free(&ram);
+    return NULL;
+}
+
+static void test_racing_publishers(void)
+{
+    pthread_t threads[THREADS];
+
+    share = code_share_create(CODE_SHARE_DEFAULT_SIZE);
+    pthread_barrier_init(&barrier, NULL, THREADS);
+    for (uintptr_t t = 0; t < THREADS; t++)
+        pthread_create(&threads[t], NULL, publisher, (void *)t);
+    for (int t = 0; t < THREADS; t++)
+        pthread_join(threads[t], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    // Exactly the limit per address: as many variants as threads were offered
+    uint32_t over = 0, under = 0;
+    Ram ram;
+    ram_init(&ram);
+    for (uint32_t i = 0; i < ADDRESSES; i++)
+    {
+        uint32_t found = 0;
+        for (uint8_t id = 0; id < THREADS; id++)
+        {
+            ram_write(&ram, FIRST + i, id, true);
+            if (code_share_find(share, &ram, verify, (uint16_t)(FIRST + i), false))
+                found++;
+        }
+        over += found > CODE_SHARE_MAX_VARIANTS;
+        under += found < CODE_SHARE_MAX_VARIANTS;
+    }
+    ram_free(&ram);
+
+    CodeShareStats st;
+    code_share_stats(share, &st);
+    check(over == 0, "racing publishers exceeded the variant limit");
+    check(under == 0, "an address got fewer variants than offered");
+    check(st.blocks == (uint64_t)ADDRESSES * CODE_SHARE_MAX_VARIANTS, "published block count");
+
+    code_share_destroy(share);
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+
+    test_variants();
+    test_racing_publishers();
+
+    printf("code_share_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+; expect: 63
+;
+; Each branch outcome adds a distinct bit to R0: CMP equal, less and
+; greater with JZ, JNZ and JC, then the carry of MLP and the borrow of
+; SUB, whose flags are derived only when the branch asks.
+.org 0x2001
+    LOAD_IMM R0, #0
+    LOAD_IMM R1, #5
+    LOAD_IMM R2, #5
+    LOAD_IMM R3, #9
+    CMP      R1, R2
+    JZ       equal
+    HALT
+equal:
+    LOAD_IMM R7, #1
+    ADD      R0, R7
+    CMP      R1, R3
+    JC       less
+    HALT
+less:
+    LOAD_IMM R7, #2
+    ADD      R0, R7
+    CMP      R3, R1
+    JC       fail
+    JZ       fail
+    JNZ      greater
+    HALT
+greater:
+    LOAD_IMM R7, #4
+    ADD      R0, R7
+    LOAD_IMM R4, #32
+    LOAD_IMM R5, #8
+    MLP      R4, R5
+    JC       product
+    HALT
+product:
+    LOAD_IMM R7, #8
+    ADD      R0, R7
+    LOAD_IMM R4, #3
+    SUB      R4, R3
+    JC       borrow
+    HALT
+borrow:
+    LOAD_IMM R7, #16
+    ADD      R0, R7
+    SUB      R1, R2
+    JNZ      fail
+    JC       fail
+    LOAD_IMM R7, #32
+    ADD      R0, R7
+fail:
+    STORE    R0, 0x2000
+    HALT
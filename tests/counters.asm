@@ -0,0 +1,19 @@
+; expect: 151
+;
+; Cycles minus instructions over a timed loop, read with RDCYC and RDINS
+; after CLRCNT. Ten passes of MLP (4), DIV (12), SUB (1) and JNZ (2),
+; two LOAD_IMMs and the reads themselves: 43 instructions, 194 cycles.
+.org 0x2001
+    CLRCNT
+    LOAD_IMM R0, #10
+    LOAD_IMM R1, #1
+loop:
+    MLP      R2, R1
+    DIV      R2, R1
+    SUB      R0, R1
+    JNZ      loop
+    RDINS    P2, #0
+    RDCYC    P3, #0
+    SUB      R7, R5
+    STORE    R7, 0x2000
+    HALT
@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "daemon.h"
+
+#define TEST_AREA "daemon"
+#include "test.h"
+
+/*
+ * Starts ./cpu-emulatord with two workers and checks that
+ *   - clients holding idle connections do not starve the workers;
+ *   - tests/div_mid_block.asm, sent as DAEMON_RUN_SOURCE with the
+ *     verifier on, is answered instead of killing the daemon.
+ * Run from the repository root (make check does).
+ */
+
+#define WORKERS "2"
+#define IDLE_CLIENTS 6
+#define ANSWER_TIMEOUT_S 10
+
+static char *read_file(const char *path, uint32_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    static char buf[1 << 16];
+    *len = (uint32_t)fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    return buf;
+}
+
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    // The daemon may still be starting
+    for (int tries = 0; tries < 500; tries++)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            // Fail instead of hanging if the daemon never answers
+            struct timeval timeout = { ANSWER_TIMEOUT_S, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static bool send_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void *data, size_t len)
+{
+    char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Run the source and return the byte at 0x2000, or -1
+static int run_source(int fd, const char *source, uint32_t source_len)
+{
+    static const char select[] = "0x2000";
+    DaemonRequest req;
+
+    memset(&req, 0, sizeof(req));
+    memcpy(req.magic, DAEMON_REQUEST_MAGIC, 4);
+    req.version = DAEMON_VERSION;
+    req.kind = DAEMON_RUN_SOURCE;
+    req.source_len = source_len;
+    req.select_len = sizeof(select) - 1;
+
+    if (!send_all(fd, &req, sizeof(req)) || !send_all(fd, source, source_len) ||
+        !send_all(fd, select, sizeof(select) - 1))
+        return -1;
+
+    DaemonResponse rsp;
+    uint8_t body[256];
+    if (!recv_all(fd, &rsp, sizeof(rsp)) || rsp.length > sizeof(body) ||
+        !recv_all(fd, body, rsp.length))
+        return -1;
+
+    if (rsp.status != DAEMON_OK || rsp.length != 1)
+        return -1;
+    return body[0];
+}
+
+int main(void)
+{
+    static const char idle_source[] = ".org 0x2001\nLOAD_IMM R0, #3\nSTORE R0, 0x2000\nHALT\n";
+    uint32_t source_len;
+    char *source = read_file("tests/div_mid_block.asm", &source_len);
+    if (!source)
+    {
+        fprintf(stderr, "daemon_test: cannot read tests/div_mid_block.asm\n");
+        return 1;
+    }
+
+    char dir[] = "/tmp/cpu-emulatord-test.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "%s/sock", dir);
+
+    pid_t daemon = fork();
+    if (daemon == 0)
+    {
+        execl("./cpu-emulatord", "cpu-emulatord", "-s", socket_path, "-j", WORKERS,
+              "--no-cache", (char *)NULL);
+        _exit(127);
+    }
+
+    // More clients than workers, each answered once and then left idle
+    int idle[IDLE_CLIENTS];
+    for (int i = 0; i < IDLE_CLIENTS; i++)
+    {
+        idle[i] = connect_to(socket_path);
+        check(idle[i] >= 0, "connect");
+        check(run_source(idle[i], idle_source, sizeof(idle_source) - 1) == 3,
+              "request on an idle client's connection");
+    }
+
+    // A new client is still served, and the unverifiable DIV gets the checked path
+    int fd = connect_to(socket_path);
+    check(fd >= 0, "connect with idle clients open");
+    check(run_source(fd, source, source_len) == 7, "div_mid_block as DAEMON_RUN_SOURCE");
+    check(run_source(fd, source, source_len) == 7, "same connection after div_mid_block");
+
+    int status;
+    check(waitpid(daemon, &status, WNOHANG) == 0, "daemon still running");
+
+    // Idle clients can come back
+    check(run_source(idle[0], idle_source, sizeof(idle_source) - 1) == 3,
+          "idle client's second request");
+
+    close(fd);
+    for (int i = 0; i < IDLE_CLIENTS; i++)
+        close(idle[i]);
+
+    kill(daemon, SIGTERM);
+    waitpid(daemon, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "clean shutdown");
+
+    unlink(socket_path);
+    rmdir(dir);
+
+    printf("daemon_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cpu.h"
+#include "debug.h"
+#include "log.h"
+#include "sched.h"
+#include "state_hash.h"
+#include "timer.h"
+
+#define TEST_AREA "debug"
+#include "test.h"
+
+/*
+ * Debugger stops: breakpoints when a page holds 256 of them, and read
+ * watchpoints, which data reads trigger but instruction fetches do not.
+ * Reverse execution: every state reached by stepping back matches the one
+ * recorded on the way forward, timer interrupts included, also after the
+ * checkpoints were thinned to fit their budget.
+ */
+
+#define DATA 0x2100
+
+static const char program[] =
+    ".org 0x2001\n"
+    "    LOAD_IMM R1, #5\n"
+    "    STORE R1, 0x2100\n"
+    "    LOAD_IMM R0, #7\n"
+    "    LOAD_MEM R1, 0x2100\n"
+    "    ADD R0, R1\n"
+    "    STORE R0, 0x2000\n"
+    "    HALT\n";
+
+static Image image;
+
+// Fresh machine at the program's entry point
+static void load(Cpu *cpu, Ram *ram)
+{
+    cpu_init(cpu, true);
+    ram_init(ram);
+    image_load(&image, ram, true);
+    cpu->PC = image.org;
+}
+
+static void test_full_page_of_breakpoints(void)
+{
+    static Debugger dbg;
+    uint16_t halt = (uint16_t)(image.org + image.size - 1);
+    Cpu cpu;
+    Ram ram;
+
+    load(&cpu, &ram);
+    debug_init(&dbg, &ram);
+
+    bool added = true;
+    for (uint32_t addr = 0x2000; addr < 0x2100; addr++)
+        added &= debug_add_breakpoint(&dbg, (uint16_t)addr);
+    check(added, "add 256 breakpoints on one page");
+
+    debug_run(&dbg, &cpu, &ram, 1);
+    check(debug_run(&dbg, &cpu, &ram, 0) == DEBUG_STOP_BREAKPOINT,
+          "stop at the next instruction with 256 breakpoints on its page");
+
+    // All but the one at HALT
+    for (uint32_t addr = 0x2000; addr < 0x2100; addr++)
+        if (addr != halt)
+            debug_remove_breakpoint(&dbg, (uint16_t)addr);
+    check(dbg.breakpoint_count == 1, "one breakpoint left");
+    check(debug_run(&dbg, &cpu, &ram, 0) == DEBUG_STOP_BREAKPOINT && cpu.PC == halt,
+          "stop at the breakpoint left on the page");
+
+    debug_detach(&dbg);
+    ram_free(&ram);
+}
+
+static DebugStop run_watching(uint16_t start, uint16_t end, Debugger *dbg)
+{
+    Cpu cpu;
+    Ram ram;
+
+    load(&cpu, &ram);
+    debug_init(dbg, &ram);
+    debug_add_watchpoint(dbg, start, end, RAM_WATCH_READ);
+
+    DebugStop stop = debug_run(dbg, &cpu, &ram, 0);
+
+    debug_detach(dbg);
+    ram_free(&ram);
+    return stop;
+}
+
+static void test_read_watchpoints(void)
+{
+    static Debugger dbg;
+    uint16_t code_end = (uint16_t)(image.org + image.size - 1);
+
+    // The code is fetched, never read as data
+    check(run_watching(image.org, code_end, &dbg) == DEBUG_STOP_HALTED,
+          "read watchpoint on code ignores instruction fetches");
+
+    check(run_watching(DATA, DATA, &dbg) == DEBUG_STOP_WATCHPOINT &&
+          dbg.hit_addr == DATA && dbg.hit_value == 5 && !dbg.hit_write,
+          "read watchpoint on data stops at LOAD_MEM");
+
+    // A range covering code and data: only the LOAD_MEM counts
+    check(run_watching(image.org, DATA, &dbg) == DEBUG_STOP_WATCHPOINT && dbg.hit_addr == DATA,
+          "read watchpoint on code and data stops at the data read");
+}
+
+// A loop storing across a page boundary while a timer interrupts it
+static const char interrupted[] =
+    ".org 0x2001\n"
+    "    LOAD_IMM R0, #0x30\n"
+    "    LOAD_IMM R1, #0x00\n"
+    "    STORE R0, 0x0000\n"
+    "    STORE R1, 0x0001\n"
+    "    LOAD_IMM R6, #1\n"
+    "    LOAD_IMM R0, #0\n"
+    "    LOAD_IMM R1, #7\n"
+    "    TIMER R0, R1\n"
+    "    EI\n"
+    "    LOAD_IMM16 P1, 0x4FA0\n"
+    "    LOAD_IMM R5, #200\n"
+    "loop:\n"
+    "    LOAD_IMM R4, #0x11\n"
+    "    ADD R4, R7\n"
+    "    STORE R4, [P1+]\n"
+    "    SUB R5, R6\n"
+    "    JNZ loop\n"
+    "    STORE R7, 0x2000\n"
+    "    HALT\n"
+    ".org 0x3000\n"
+    "    ADD R7, R6\n"
+    "    IRET\n";
+
+#define LOOP 0x2023
+#define MAX_STEPS 4096
+
+static void test_reverse(void)
+{
+    static Image rimage;
+    static Debugger dbg;
+    static Rewind rw;
+    static Scheduler sched;
+    static Timer timer;
+    static uint64_t digest[MAX_STEPS];
+    static uint16_t pc[MAX_STEPS];
+    char error[256];
+    Cpu cpu;
+    Ram ram;
+
+    FILE *in = fmemopen((void *)interrupted, sizeof(interrupted) - 1, "r");
+    image_init(&rimage);
+    if (!in || assemble_source(in, &rimage, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "debug_test: cannot assemble: %s\n", error);
+        failures++;
+        return;
+    }
+    fclose(in);
+
+    cpu_init(&cpu, true);
+    ram_init(&ram);
+    sched_init(&sched);
+    timer_init(&timer, &cpu, &sched);
+    image_load(&rimage, &ram, true);
+    cpu.PC = rimage.org;
+
+    // Small interval and budget: the run outgrows it and gets thinned
+    debug_init(&dbg, &ram);
+    check(rewind_init(&rw, 16, 160 * 1024) && debug_attach_rewind(&dbg, &rw, &cpu), "attach rewind");
+
+    uint64_t end = 0;
+    digest[0] = state_hash_machine(&cpu, &ram);
+    pc[0] = cpu.PC;
+    while (cpu.running && end + 1 < MAX_STEPS)
+    {
+        debug_run(&dbg, &cpu, &ram, 1);
+        end = cpu.instret;
+        digest[end] = state_hash_machine(&cpu, &ram);
+        pc[end] = cpu.PC;
+    }
+    check(!cpu.running && cpu.fault == CPU_FAULT_NONE && ram_peek(&ram, 0x2000) > 0,
+          "interrupted loop halts");
+    check(rw.thinned > 0, "checkpoints thinned to fit the budget");
+
+    static const uint64_t back[] = { 1, 5, 17, 100, 333, 1 };
+    bool same = true;
+    uint64_t at = end;
+    for (size_t i = 0; i < sizeof(back) / sizeof(back[0]); i++)
+    {
+        debug_reverse_step(&dbg, &cpu, &ram, back[i]);
+        at -= back[i];
+        same &= cpu.instret == at && state_hash_machine(&cpu, &ram) == digest[at];
+    }
+    check(same, "reverse steps reach the recorded states");
+
+    // Back to the previous time PC was at the loop head
+    debug_add_breakpoint(&dbg, LOOP);
+    uint64_t previous = at - 1;
+    while (pc[previous] != LOOP)
+        previous--;
+    check(debug_reverse_continue(&dbg, &cpu, &ram) == DEBUG_STOP_BREAKPOINT &&
+          cpu.instret == previous && state_hash_machine(&cpu, &ram) == digest[previous],
+          "reverse continue stops at the previous breakpoint hit");
+    debug_remove_breakpoint(&dbg, LOOP);
+
+    check(debug_reverse_step(&dbg, &cpu, &ram, end) == DEBUG_STOP_START &&
+          cpu.instret == 0 && state_hash_machine(&cpu, &ram) == digest[0],
+          "reverse past the start stops at the first checkpoint");
+
+    // And forward again to the same end
+    debug_run(&dbg, &cpu, &ram, 0);
+    check(cpu.instret == end && state_hash_machine(&cpu, &ram) == digest[end], "replay to the end");
+
+    debug_detach(&dbg);
+    rewind_free(&rw);
+    ram_free(&ram);
+}
+
+int main(void)
+{
+    char error[256];
+
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    FILE *in = fmemopen((void *)program, sizeof(program) - 1, "r");
+    image_init(&image);
+    if (!in || assemble_source(in, &image, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "debug_test: cannot assemble: %s\n", error);
+        return 1;
+    }
+    fclose(in);
+
+    test_full_page_of_breakpoints();
+    test_read_watchpoints();
+    test_reverse();
+
+    printf("debug_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "disassembler.h"
+#include "log.h"
+
+#define TEST_AREA "disassembler"
+#include "test.h"
+
+/*
+ * Disassembler output: it reassembles to the same bytes, and the parallel
+ * path (-j) prints exactly what the single-threaded one does, including
+ * across ranges that start in the middle of an instruction.
+ */
+
+// One instruction of every operand format
+static const char program[] =
+    ".org 0x2001\n"
+    "start:\n"
+    "    LOAD_IMM R1, #5\n"
+    "    LOAD_IMM16 P1, start\n"
+    "    LOAD_MEM R1, [P1+]\n"
+    "    STORE R1, [P2]\n"
+    "    LOAD_MEM R2, 0x2100\n"
+    "    STORE R2, 0x2000\n"
+    "    ADD R0, R1\n"
+    "    DIV R0, R1\n"
+    "    ADD16 P0, P1\n"
+    "    CMP R0, R1\n"
+    "    JNZ start\n"
+    "    CALL start\n"
+    "    RET\n"
+    "    RDINS P0, #1\n"
+    "    MAP R1, R2, R3\n"
+    "    TIMER R0, R1\n"
+    "    EI\n"
+    "    HALT\n";
+
+static bool assemble_text(const char *source, size_t len, Image *image)
+{
+    char error[256];
+    FILE *in = fmemopen((void *)source, len, "r");
+
+    image_init(image);
+    if (!in || assemble_source(in, image, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "disassembler_test: cannot assemble: %s\n", error);
+        if (in)
+            fclose(in);
+        return false;
+    }
+    fclose(in);
+    return true;
+}
+
+static void test_round_trip(void)
+{
+    static Image image, again;
+    static uint8_t memory[RAM_SIZE];
+    static char text[1 << 14];
+    static char source[1 << 14];
+
+    if (!assemble_text(program, sizeof(program) - 1, &image))
+    {
+        failures++;
+        return;
+    }
+    memcpy(memory + image.org, image.bytes, image.size);
+
+    size_t n = disassemble_to_buffer(memory, image.org, (uint16_t)(image.org + image.size - 1),
+                                     text, sizeof(text) - 1);
+    text[n] = '\0';
+
+    // "0x2001: LOAD_IMM R1, #5" -> "LOAD_IMM R1, #5"
+    size_t len = (size_t)snprintf(source, sizeof(source), ".org 0x%04X\n", image.org);
+    for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        char *colon = strchr(line, ':');
+        len += (size_t)snprintf(source + len, sizeof(source) - len, "%s\n", colon ? colon + 2 : line);
+    }
+
+    check(assemble_text(source, len, &again), "disassembly assembles");
+    check(again.size == image.size && memcmp(again.bytes, image.bytes, image.size) == 0,
+          "disassembly reassembles to the same bytes");
+
+    // A buffer too small for everything holds whole lines only
+    n = disassemble_to_buffer(memory, image.org, (uint16_t)(image.org + image.size - 1), text, 40);
+    check(n > 0 && n <= 40 && text[n - 1] == '\n', "short buffer ends at a whole line");
+}
+
+// Read back everything written to f
+static char *contents(FILE *f, long *len)
+{
+    fflush(f);
+    *len = ftell(f);
+    char *buf = malloc((size_t)*len + 1);
+    rewind(f);
+    if (fread(buf, 1, (size_t)*len, f) != (size_t)*len)
+        *len = -1;
+    return buf;
+}
+
+static void test_parallel_matches_serial(void)
+{
+    static uint8_t memory[RAM_SIZE];
+    static const uint16_t ranges[][2] = { { 0x0000, 0xFFFF }, { 0x2001, 0x2FFF }, { 0x1234, 0x1240 } };
+    static const int threads[] = { 2, 3, 4, 8 };
+
+    // Mostly defined opcodes, so worker boundaries land mid-instruction
+    srand(1);
+    for (uint32_t i = 0; i < RAM_SIZE; i++)
+        memory[i] = (uint8_t)(rand() % 4 ? rand() % 29 : rand());
+
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        FILE *serial = tmpfile();
+        long serial_len;
+        disassemble_to_file(memory, ranges[r][0], ranges[r][1], serial);
+        char *expected = contents(serial, &serial_len);
+
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        {
+            FILE *parallel = tmpfile();
+            long parallel_len;
+            char what[80];
+
+            disassemble_parallel(memory, ranges[r][0], ranges[r][1], parallel, threads[t]);
+            char *got = contents(parallel, &parallel_len);
+            snprintf(what, sizeof(what), "-j %d on 0x%04X-0x%04X matches -j 1",
+                     threads[t], ranges[r][0], ranges[r][1]);
+            check(serial_len > 0 && parallel_len == serial_len &&
+                  memcmp(got, expected, (size_t)serial_len) == 0, what);
+            free(got);
+            fclose(parallel);
+        }
+        free(expected);
+        fclose(serial);
+    }
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    test_round_trip();
+    test_parallel_matches_serial();
+
+    printf("disassembler_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+; expect: 7
+;
+; The verifier proves R1 = 5 at the DIV from the block's leader. A RET to
+; an overwritten return address enters the block at mid with R1 = 0: every
+; engine must stop with a divide-by-zero fault rather than divide.
+.org 0x2001
+start:
+    LOAD_IMM R0, #7
+    STORE R0, 0x2000
+    LOAD_IMM R1, #0
+    CALL patch
+    LOAD_IMM R1, #5
+mid:
+    DIV R0, R1
+    STORE R0, 0x2000
+    HALT
+patch:
+    LOAD_IMM16 P1, mid
+    STORE R2, 0xFFFE
+    STORE R3, 0xFFFF
+    RET
@@ -0,0 +1,17 @@
+; expect: 10
+;
+; A DIV by a constant the verifier proves non-zero, run often enough to be
+; decoded with the unchecked handler and memoized.
+.org 0x2001
+start:
+    LOAD_IMM R0, #0
+    LOAD_IMM R3, #1
+    LOAD_IMM R4, #200
+loop:
+    LOAD_IMM R1, #100
+    LOAD_IMM R2, #10
+    DIV R1, R2
+    SUB R4, R3
+    JNZ loop
+    STORE R1, 0x2000
+    HALT
@@ -0,0 +1,134 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cpu.h"
+#include "fuzz.h"
+#include "log.h"
+
+#define TEST_AREA "fuzz"
+#include "test.h"
+
+/*
+ * --fuzz on a small parser: coverage has to lead the fuzzer through a
+ * three-byte magic to a division by zero, which is saved once under
+ * crashes/ with the input that reached it. An input starting with 'T'
+ * spins and must be counted as a timeout, not a crash.
+ */
+
+static const char program[] =
+    ".org 0x2001\n"
+    "    LOAD_MEM R1, 0x3000\n"
+    "    LOAD_IMM R2, #0x54\n"     // 'T'
+    "    CMP R1, R2\n"
+    "    JZ spin\n"
+    "    LOAD_IMM R2, #0x46\n"     // 'F'
+    "    CMP R1, R2\n"
+    "    JNZ done\n"
+    "    LOAD_MEM R1, 0x3001\n"
+    "    LOAD_IMM R2, #0x55\n"     // 'U'
+    "    CMP R1, R2\n"
+    "    JNZ done\n"
+    "    LOAD_MEM R1, 0x3002\n"
+    "    LOAD_IMM R2, #0x5A\n"     // 'Z'
+    "    CMP R1, R2\n"
+    "    JNZ done\n"
+    "    LOAD_IMM R3, #0\n"
+    "crash:\n"
+    "    DIV R1, R3\n"
+    "done:\n"
+    "    HALT\n"
+    "spin:\n"
+    "    JMP spin\n";
+
+static uint32_t count_files(const char *path, char *first, size_t first_size)
+{
+    DIR *d = opendir(path);
+    struct dirent *e;
+    uint32_t n = 0;
+
+    while (d && (e = readdir(d)))
+    {
+        if (e->d_name[0] == '.')
+            continue;
+        if (n++ == 0 && first)
+            snprintf(first, first_size, "%s", e->d_name);
+    }
+    if (d)
+        closedir(d);
+    return n;
+}
+
+int main(void)
+{
+    static Image image;
+    char error[256], path[128], name[64] = "";
+    Cpu cpu;
+    Ram ram;
+
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+    log_set_enabled(LOG_ERROR, false);
+
+    FILE *in = fmemopen((void *)program, sizeof(program) - 1, "r");
+    image_init(&image);
+    if (!in || assemble_source(in, &image, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "fuzz_test: cannot assemble: %s\n", error);
+        return 1;
+    }
+    fclose(in);
+
+    char dir[] = "/tmp/cpu-emulator-fuzz-test.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    cpu_init(&cpu, true);
+    ram_init(&ram);
+    image_load(&image, &ram, true);
+    cpu.PC = image.org;
+    cpu.running = true;
+
+    FuzzConfig config = { .dir = dir, .max_steps = 1000, .max_execs = 300000, .seed = 1 };
+    FuzzStats stats;
+    check(fuzz_parse_input("0x3000:4", &config) && config.input_addr == 0x3000 && config.input_max == 4,
+          "parse the input region");
+    check(!fuzz_parse_input("0x3000:0", &config), "empty input region refused");
+    config.input_max = 4;
+
+    check(fuzz_run(&config, &cpu, &ram, NULL, &stats), "fuzz_run");
+    check(stats.execs == config.max_execs, "stops after max_execs");
+    check(stats.unique_crashes == 1 && stats.crashes > 0, "the division by zero is found");
+    check(stats.timeouts > 0, "spinning inputs are timeouts");
+    check(stats.corpus >= 3, "each magic byte short of the crash adds to the corpus");
+
+    snprintf(path, sizeof(path), "%s/crashes", dir);
+    check(count_files(path, name, sizeof(name)) == 1 && strncmp(name, "div_zero-", 9) == 0,
+          "one crash file, named after the fault");
+
+    snprintf(path, sizeof(path), "%s/crashes/%s", dir, name);
+    FILE *crash = fopen(path, "rb");
+    char input[8] = "";
+    size_t n = crash ? fread(input, 1, sizeof(input), crash) : 0;
+    if (crash)
+        fclose(crash);
+    check(n >= 3 && memcmp(input, "FUZ", 3) == 0, "the crash file holds the magic");
+
+    snprintf(path, sizeof(path), "%s/queue", dir);
+    // All but the zero-byte seed
+    check(count_files(path, NULL, 0) == stats.corpus - 1, "corpus saved to queue/");
+
+    ram_free(&ram);
+    snprintf(path, sizeof(path), "rm -rf %s", dir);
+    if (system(path) != 0)
+        failures++;
+
+    printf("fuzz_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "assembler.h"
+#include "image_cache.h"
+#include "log.h"
+
+#define TEST_AREA "image"
+#include "test.h"
+
+/*
+ * Images: a segment filling all 64 KB survives assembly, the image cache
+ * and loading; code running past 0xFFFF is an assembly error; and
+ * cpu-emulator writes out.bin on an image cache hit too.
+ */
+
+static char dir[] = "/tmp/cpu-emulator-image-test.XXXXXX";
+
+static int assemble_string(const char *source, size_t len, Image *image, char *error, size_t error_size)
+{
+    FILE *in = fmemopen((void *)source, len, "r");
+    if (!in)
+        return -1;
+
+    image_init(image);
+    int size = assemble_source(in, image, error, error_size);
+    fclose(in);
+    return size;
+}
+
+static void test_full_segment(void)
+{
+    static Image image, cached;
+    static char source[16 + RAM_SIZE * 5];
+    char error[256];
+    size_t len = (size_t)sprintf(source, ".org 0x0000\n");
+
+    for (uint32_t i = 0; i < RAM_SIZE; i++)
+        len += (size_t)sprintf(source + len, "HALT\n");
+
+    check(assemble_string(source, len, &image, error, sizeof(error)) == (int)RAM_SIZE,
+          "assemble 64 KB");
+    check(image.segment_count == 1 && image.segments[0].length == RAM_SIZE,
+          "one segment of 64 KB");
+
+    char cache[64];
+    snprintf(cache, sizeof(cache), "%s/cache", dir);
+    check(image_cache_store(cache, "full", &image) && image_cache_lookup(cache, "full", &cached) &&
+          cached.segments[0].length == RAM_SIZE && memcmp(cached.bytes, image.bytes, RAM_SIZE) == 0,
+          "64 KB segment through the image cache");
+
+    Ram ram;
+    ram_init(&ram);
+    check(image_load(&cached, &ram, true) && ram_peek(&ram, 0x0000) == 0xFF &&
+          ram_peek(&ram, 0xFFFF) == 0xFF, "load 64 KB");
+    ram_free(&ram);
+
+    static const char past_end[] = ".org 0xFFFF\nHALT\nHALT\n";
+    check(assemble_string(past_end, sizeof(past_end) - 1, &image, error, sizeof(error)) < 0 &&
+          strstr(error, "past the end"), "code past 0xFFFF is an error");
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static void test_out_bin_on_cache_hit(void)
+{
+    char cwd[4096], command[8400], out_bin[128];
+
+    if (!getcwd(cwd, sizeof(cwd)))
+        return;
+
+    snprintf(out_bin, sizeof(out_bin), "%s/out.bin", dir);
+    snprintf(command, sizeof(command),
+             "cd %s && %s/cpu-emulator -q --cache-dir cache %s/tests/add.asm > /dev/null 2>&1",
+             dir, cwd, cwd);
+
+    // First run assembles and stores, second hits the cache
+    check(system(command) == 0 && file_size(out_bin) > 0, "out.bin after assembling");
+    long assembled = file_size(out_bin);
+    unlink(out_bin);
+    check(system(command) == 0 && file_size(out_bin) == assembled, "out.bin after a cache hit");
+    unlink(out_bin);
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_full_segment();
+    test_out_bin_on_cache_hit();
+
+    char command[128];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+
+    printf("image_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
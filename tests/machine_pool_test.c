@@ -0,0 +1,224 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "machine_pool.h"
+
+#define TEST_AREA "machine_pool"
+#include "test.h"
+
+/*
+ * Machine pool: every machine can be acquired once, a released machine
+ * comes back zeroed and reset, threads acquiring and releasing each
+ * other's machines never hold the same one twice, and threads that exit
+ * leave neither their machines nor their slots behind.
+ */
+
+#define CAPACITY 512
+#define THREADS 8
+#define ROUNDS 20000
+#define HELD_MAX 64
+#define SHORT_LIVED 200         // threads started one after another
+#define SHORT_LIVED_HOLD 20
+
+static MachinePool *pool;
+
+// True if m is as a fresh acquire must leave it
+static bool is_clean(PoolMachine *m)
+{
+    for (uint32_t a = 0; a < RAM_SIZE; a += 97)
+        if (ram_peek(&m->ram, (uint16_t)a) != 0)
+            return false;
+    if (ram_peek(&m->ram, 0xFFFF) != 0)
+        return false;
+
+    for (int r = 0; r < REG_COUNT; r++)
+        if (m->cpu.R[r] != 0)
+            return false;
+    return m->cpu.PC == 0 && !m->cpu.privileged && m->cpu.fault == CPU_FAULT_NONE &&
+           !m->ram.mmu && !m->ram.watch_pages && !m->ram.access_log;
+}
+
+// Leave traces a reset must remove
+static void dirty(PoolMachine *m, uint8_t tag)
+{
+    ram_write(&m->ram, 0x0000, tag, true);
+    ram_write(&m->ram, 0x2000 + tag, tag, true);
+    ram_write(&m->ram, 0xFFFF, tag, true);
+    m->cpu.R[3] = tag;
+    m->cpu.PC = 0x2001;
+    m->cpu.privileged = true;
+}
+
+static void test_single_thread(void)
+{
+    MachinePool *p = machine_pool_create(64);
+    PoolMachine *all[65];
+    static bool seen[64];
+    uint32_t got = 0;
+
+    check(p != NULL, "create");
+    if (!p)
+        return;
+
+    while (got < 65 && (all[got] = machine_pool_acquire(p)))
+        got++;
+    check(got == 64, "acquire exactly the capacity");
+
+    bool distinct = true;
+    for (uint32_t i = 0; i < got; i++)
+    {
+        distinct &= all[i]->index < 64 && !seen[all[i]->index];
+        seen[all[i]->index] = true;
+        distinct &= is_clean(all[i]);
+        dirty(all[i], (uint8_t)i);
+    }
+    check(distinct, "distinct, clean machines");
+
+    for (uint32_t i = 0; i < got; i++)
+        machine_pool_release(p, all[i]);
+
+    bool clean = true;
+    for (uint32_t i = 0; i < got; i++)
+    {
+        all[i] = machine_pool_acquire(p);
+        clean &= all[i] && is_clean(all[i]);
+    }
+    check(clean, "released machines come back zeroed and reset");
+
+    machine_pool_destroy(p);
+}
+
+// Machines acquired by any thread, released by whichever pops them
+static PoolMachine *held[HELD_MAX];
+static uint32_t held_count;
+static pthread_mutex_t held_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t owned[CAPACITY];
+static uint32_t bad_acquires, dirty_acquires;
+
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        PoolMachine *m = NULL;
+
+        if (rand_r(&seed) & 1)
+        {
+            m = machine_pool_acquire(pool);
+            if (!m || __atomic_exchange_n(&owned[m->index], 1, __ATOMIC_ACQ_REL))
+            {
+                __atomic_fetch_add(&bad_acquires, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (!is_clean(m))
+                __atomic_fetch_add(&dirty_acquires, 1, __ATOMIC_RELAXED);
+            dirty(m, (uint8_t)seed);
+
+            pthread_mutex_lock(&held_lock);
+            if (held_count < HELD_MAX)
+            {
+                held[held_count++] = m;
+                m = NULL;
+            }
+            pthread_mutex_unlock(&held_lock);
+        }
+        else
+        {
+            pthread_mutex_lock(&held_lock);
+            if (held_count)
+                m = held[--held_count];
+            pthread_mutex_unlock(&held_lock);
+        }
+
+        if (m)
+        {
+            __atomic_store_n(&owned[m->index], 0, __ATOMIC_RELEASE);
+            machine_pool_release(pool, m);
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[THREADS];
+
+    pool = machine_pool_create(CAPACITY);
+    check(pool != NULL, "create a shared pool");
+    if (!pool)
+        return;
+
+    for (uintptr_t t = 0; t < THREADS; t++)
+        pthread_create(&threads[t], NULL, worker, (void *)(t + 1));
+    for (int t = 0; t < THREADS; t++)
+        pthread_join(threads[t], NULL);
+
+    check(bad_acquires == 0, "no failed or duplicate acquires across threads");
+    check(dirty_acquires == 0, "machines released by another thread come back clean");
+
+    while (held_count)
+        machine_pool_release(pool, held[--held_count]);
+    machine_pool_destroy(pool);
+}
+
+// Acquire and release a few machines, leaving some cached on exit
+static void *short_lived(void *arg)
+{
+    MachinePool *p = arg;
+    PoolMachine *got[SHORT_LIVED_HOLD];
+    uintptr_t acquired = 0;
+
+    while (acquired < SHORT_LIVED_HOLD && (got[acquired] = machine_pool_acquire(p)))
+        acquired++;
+    for (uintptr_t i = 0; i < acquired; i++)
+        machine_pool_release(p, got[i]);
+    return (void *)acquired;
+}
+
+static void test_thread_exit(void)
+{
+    MachinePool *p = machine_pool_create(64);
+    bool all_acquired = true;
+
+    check(p != NULL, "create a pool for short-lived threads");
+    if (!p)
+        return;
+
+    // More threads than slots, each gone before the next starts
+    for (int t = 0; t < SHORT_LIVED; t++)
+    {
+        pthread_t thread;
+        void *acquired = NULL;
+
+        pthread_create(&thread, NULL, short_lived, p);
+        pthread_join(thread, &acquired);
+        all_acquired &= (uintptr_t)acquired == SHORT_LIVED_HOLD;
+    }
+    check(all_acquired, "every short-lived thread gets its machines");
+
+    PoolMachine *all[64];
+    uint32_t got = 0;
+    while (got < 64 && (all[got] = machine_pool_acquire(p)))
+        got++;
+    check(got == 64, "exited threads leave no machines cached");
+
+    machine_pool_destroy(p);
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    test_single_thread();
+    test_threads();
+    test_thread_exit();
+
+    printf("machine_pool_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
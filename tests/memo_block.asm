@@ -0,0 +1,39 @@
+; expect: 119
+;
+; A pure block (square of [0x2100] + R2, stored to 0x2101) run 255 times
+; with R2 alternating 0 and 1, so memoized runs replay it. Half way
+; through, the loaded byte changes: a replay keyed on the old byte would
+; give the wrong sum.
+.org 0x2001
+    LOAD_IMM R0, #0
+    LOAD_IMM R2, #0
+    LOAD_IMM R5, #1
+    LOAD_IMM R6, #128
+    LOAD_IMM R7, #255
+    LOAD_IMM R3, #2
+    STORE    R3, 0x2100
+loop:
+    LOAD_MEM R1, 0x2100
+    ADD      R1, R2
+    MLP      R1, R1
+    STORE    R1, 0x2101
+    JMP      sum
+sum:
+    ADD      R0, R1
+    SUB      R7, R5
+    JZ       done
+    CMP      R7, R6
+    JZ       poke
+toggle:
+    LOAD_IMM R3, #1
+    SUB      R3, R2
+    LOAD_IMM R2, #0
+    ADD      R2, R3
+    JMP      loop
+poke:
+    LOAD_IMM R3, #5
+    STORE    R3, 0x2100
+    JMP      toggle
+done:
+    STORE    R0, 0x2000
+    HALT
@@ -0,0 +1,21 @@
+; expect: 42
+; options: --mmu 1024
+;
+; Maps virtual page 0x90 to two frames in turn: the byte stored through
+; the first mapping is read back once it is restored.
+.org 0x2001
+    LOAD_IMM R0, #0x90
+    LOAD_IMM R1, #0x01
+    LOAD_IMM R2, #0x00
+    MAP      R0, R1, R2
+    LOAD_IMM R3, #42
+    STORE    R3, 0x9010
+    LOAD_IMM R1, #0x02
+    MAP      R0, R1, R2
+    LOAD_MEM R4, 0x9010
+    LOAD_IMM R1, #0x01
+    MAP      R0, R1, R2
+    LOAD_MEM R5, 0x9010
+    STORE    R5, 0x2000
+    TLBFLUSH
+    HALT
@@ -0,0 +1,27 @@
+; expect: 88
+;
+; Fills a 200-byte table through a post-incremented pointer pair, then
+; sums it (200 * 3 mod 256).
+; P0=R0:R1 P1=R2:R3 P2=R4:R5 P3=R6:R7
+.org 0x2001
+start:
+    LOAD_IMM16 P1, table
+    LOAD_IMM16 P2, #200
+    LOAD_IMM16 P3, #1
+    LOAD_IMM R0, #0
+    LOAD_IMM R1, #3
+fill:
+    STORE R1, [P1+]
+    SUB16 P2, P3
+    JNZ fill
+    LOAD_IMM16 P1, table
+    LOAD_IMM16 P2, #200
+loop:
+    LOAD_MEM R1, [P1+]
+    ADD R0, R1
+    SUB16 P2, P3
+    JNZ loop
+    ADD16 P1, P3
+    STORE R0, 0x2000
+    HALT
+table:
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "ram.h"
+
+#define TEST_AREA "ram"
+#include "test.h"
+
+/*
+ * Sparse and copy-on-write Ram: unwritten pages read as zero and own no
+ * storage, the first write copies just its page, and a Ram made from a
+ * template never changes the template.
+ */
+
+static uint8_t read_byte(Ram *ram, uint32_t addr)
+{
+    uint8_t value = 0xEE;
+    ram_read(ram, addr, &value, true);
+    return value;
+}
+
+static void test_sparse(void)
+{
+    Ram ram;
+
+    check(ram_init_sparse(&ram), "ram_init_sparse");
+    check(ram_resident_bytes(&ram) == 0, "fresh sparse Ram owns no pages");
+    check(read_byte(&ram, 0x0000) == 0 && read_byte(&ram, 0xFFFF) == 0, "unwritten pages read zero");
+    check(!ram_store_fast(&ram, 0x3000, 1), "fast store refused on a shared page");
+
+    check(ram_write(&ram, 0x3001, 0x42, true), "write to a shared page");
+    check(ram_resident_bytes(&ram) == RAM_PAGE_SIZE, "first write copies one page");
+    check(read_byte(&ram, 0x3001) == 0x42 && read_byte(&ram, 0x3000) == 0,
+          "written page keeps the rest zero");
+    check(ram_store_fast(&ram, 0x3FFF, 7) && read_byte(&ram, 0x3FFF) == 7,
+          "fast store on an owned page");
+
+    // The zero page itself is never written
+    Ram other;
+    ram_init_sparse(&other);
+    check(read_byte(&other, 0x3001) == 0, "another sparse Ram still reads zero");
+
+    ram_write(&ram, 0x3002, 1, true);
+    ram_write(&ram, 0xF000, 1, true);
+    check(ram_resident_bytes(&ram) == 2 * RAM_PAGE_SIZE, "one copy per written page");
+
+    ram_free(&other);
+    ram_free(&ram);
+}
+
+static void test_template(void)
+{
+    Ram template, ram;
+
+    ram_init(&template);
+    ram_write(&template, 0x2000, 5, true);
+    ram_write(&template, 0x4000, 6, true);
+
+    check(ram_init_from(&ram, &template), "ram_init_from");
+    check(ram_resident_bytes(&ram) == 0 && read_byte(&ram, 0x2000) == 5,
+          "copy-on-write view shares the template's pages");
+
+    ram_write(&ram, 0x2000, 9, true);
+    check(read_byte(&ram, 0x2000) == 9 && read_byte(&template, 0x2000) == 5,
+          "write goes to the copy, not the template");
+    check(read_byte(&ram, 0x2001) == read_byte(&template, 0x2001) && read_byte(&ram, 0x4000) == 6,
+          "copied page starts as the template's");
+
+    ram_reset(&ram, &template);
+    check(read_byte(&ram, 0x2000) == 5 && ram_resident_bytes(&ram) == RAM_PAGE_SIZE,
+          "reset restores owned pages and keeps them");
+
+    ram_free(&ram);
+    ram_free(&template);
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    test_sparse();
+    test_template();
+
+    printf("ram_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# Run every tests/*.asm on each engine and compare. Header comments in a
+# program say what it must end with:
+#
+#   ; expect: <n>          byte at 0x2000 (the "Result:" line)
+#   ; options: <options>   extra cpu-emulator options, e.g. --mmu 1024
+#   ; engines: interp      only the interpreter, for features --fast hands back
+#
+# Each engine must exit 0, print the expected result and reach the same
+# state digest (registers, flags, fault and all of RAM) as the interpreter.
+#
+# usage: tests/run.sh [cpu-emulator] [program.asm...]
+
+EMU=$(cd "$(dirname "${1:-./cpu-emulator}")" && pwd)/$(basename "${1:-./cpu-emulator}")
+[ $# -gt 0 ] && shift
+DIR=$(cd "$(dirname "$0")" && pwd)
+[ $# -eq 0 ] && set -- "$DIR"/*.asm
+
+# Runs write out.bin into the working directory
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+failed=0
+count=0
+
+header()
+{
+    sed -n "s/^; $1: *//p" "$2" | head -n 1
+}
+
+for prog in "$@"; do
+    name=$(basename "$prog" .asm)
+    expect=$(header expect "$prog")
+    options=$(header options "$prog")
+    engines=$(header engines "$prog")
+    digest=
+
+    if [ -z "$expect" ]; then
+        echo "FAIL $name: no '; expect:' line"
+        failed=$((failed + 1))
+        continue
+    fi
+
+    if [ "$engines" = interp ]; then
+        set -- ""
+    else
+        set -- "" "--no-verify" "--fast" "--fast --no-memo" "--fast --no-verify"
+    fi
+
+    for engine in "$@"; do
+        # shellcheck disable=SC2086
+        out=$("$EMU" --no-cache $options $engine "$prog" 2>&1)
+        status=$?
+        result=$(printf '%s\n' "$out" | sed -n 's/.*Result: \([0-9]*\).*/\1/p')
+        state=$(printf '%s\n' "$out" | sed -n 's/.*State digest: \([0-9a-f]*\).*/\1/p')
+        label="$name${engine:+ ($engine)}"
+
+        count=$((count + 1))
+        if [ $status -ne 0 ]; then
+            echo "FAIL $label: exit status $status"
+        elif [ "$result" != "$expect" ]; then
+            echo "FAIL $label: result '$result', expected $expect"
+        elif [ -n "$digest" ] && [ "$state" != "$digest" ]; then
+            echo "FAIL $label: state digest $state, interpreter reached $digest"
+        else
+            [ -z "$digest" ] && digest=$state
+            continue
+        fi
+        failed=$((failed + 1))
+    done
+done
+
+echo "$count program runs, $failed failed"
+[ $failed -eq 0 ]
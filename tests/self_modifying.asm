@@ -0,0 +1,16 @@
+; expect: 7
+;
+; Stores into the immediate of the instruction at patch, which already
+; ran once: every later pass must load the new value.
+.org 0x2001
+    LOAD_IMM R1, #7
+    LOAD_IMM R2, #1
+    LOAD_IMM R3, #3
+again:
+    STORE R1, 0x2010
+patch:
+    LOAD_IMM R0, #5
+    STORE R0, 0x2000
+    SUB R3, R2
+    JNZ again
+    HALT
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "shm_state.h"
+#include "sweep.h"
+
+#define TEST_AREA "shm"
+#include "test.h"
+
+/*
+ * --shm: refused with --sweep, whose runs never touch the shared CPU or
+ * RAM, and cpu-observe says so instead of waiting when nothing has been
+ * published.
+ */
+
+int main(void)
+{
+    char name[64], command[512], line[256];
+    static ShmState shm;
+
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+
+    snprintf(name, sizeof(name), "/cpu-emulator-shm-test-%ld", (long)getpid());
+
+    // A valid sweep of one record, which runs fine without --shm
+    char dir[] = "/tmp/cpu-emulator-shm-test.XXXXXX";
+    char input[64];
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(input, sizeof(input), "%s/in.bin", dir);
+
+    SweepHeader header = { .format = SWEEP_FORMAT, .record_size = SWEEP_REG_BYTES };
+    uint8_t regs[SWEEP_REG_BYTES] = { 0 };
+    memcpy(header.magic, SWEEP_MAGIC, 4);
+    FILE *in = fopen(input, "wb");
+    if (!in || fwrite(&header, sizeof(header), 1, in) != 1 || fwrite(regs, sizeof(regs), 1, in) != 1)
+    {
+        fprintf(stderr, "shm_test: cannot write %s\n", input);
+        return 1;
+    }
+    fclose(in);
+
+    const char *sweep = "./cpu-emulator -q --no-cache --sweep %s --sweep-out %s/out.bin %s "
+                        "tests/add.asm > /dev/null 2>&1";
+    snprintf(command, sizeof(command), sweep, input, dir, "");
+    check(system(command) == 0, "sweep without --shm");
+
+    char shm_option[80];
+    snprintf(shm_option, sizeof(shm_option), "--shm %s", name);
+    snprintf(command, sizeof(command), sweep, input, dir, shm_option);
+    check(system(command) != 0, "--shm with --sweep is refused");
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+
+    // An object nothing has published into yet
+    if (!shm_state_open(&shm, name))
+    {
+        fprintf(stderr, "shm_test: cannot create %s\n", name);
+        return 1;
+    }
+
+    snprintf(command, sizeof(command), "./cpu-observe -n 1 %s", name);
+    FILE *out = popen(command, "r");
+    bool reported = false;
+    while (out && fgets(line, sizeof(line), out))
+        reported |= strstr(line, "No CPU state published") != NULL;
+    check(out && pclose(out) == 0 && reported, "cpu-observe reports an unpublished CPU");
+
+    shm_state_close(&shm);
+
+    printf("shm_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
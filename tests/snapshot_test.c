@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cpu_exec.h"
+#include "log.h"
+#include "sched.h"
+#include "snapshot.h"
+#include "state_hash.h"
+#include "timer.h"
+
+#define TEST_AREA "snapshot"
+#include "test.h"
+
+/*
+ * Snapshot store: every page codec round-trips and rejects corrupt input,
+ * identical pages are stored once, pages with the same hash but different
+ * contents are kept apart, and a store reopened from disk
+ * restores each snapshot to the exact machine state it was taken from.
+ * ./cpu-emulator --resume keeps the snapshot's privilege mode; it is run
+ * from the repository root.
+ */
+
+#define SNAPSHOTS 200
+
+static void round_trip(const uint8_t *page, SnapshotCodec expected, const char *what)
+{
+    static uint8_t encoded[RAM_PAGE_SIZE], decoded[RAM_PAGE_SIZE];
+    uint16_t length;
+
+    SnapshotCodec codec = snapshot_encode_page(page, encoded, &length);
+    check(codec == expected, what);
+    check(snapshot_decode_page(codec, encoded, length, decoded) &&
+          memcmp(decoded, page, RAM_PAGE_SIZE) == 0, what);
+    if (codec != SNAPSHOT_CODEC_ZERO && codec != SNAPSHOT_CODEC_RAW)
+        check(length < RAM_PAGE_SIZE &&
+              !snapshot_decode_page(codec, encoded, (uint16_t)(length - 1), decoded),
+              "truncated encoding refused");
+}
+
+static void test_codecs(void)
+{
+    static uint8_t page[RAM_PAGE_SIZE], garbage[RAM_PAGE_SIZE];
+    static uint8_t out[RAM_PAGE_SIZE + 1024];   // guard bytes after the page
+
+    memset(page, 0, sizeof(page));
+    round_trip(page, SNAPSHOT_CODEC_ZERO, "zero page");
+
+    for (uint32_t i = 0; i < RAM_PAGE_SIZE; i++)
+        page[i] = (uint8_t)(i / 100);
+    round_trip(page, SNAPSHOT_CODEC_RUNS, "long runs");
+
+    srand(7);
+    for (uint32_t i = 0; i < 64; i++)
+        page[i] = (uint8_t)rand();
+    for (uint32_t i = 64; i < RAM_PAGE_SIZE; i++)
+        page[i] = page[i % 64];
+    round_trip(page, SNAPSHOT_CODEC_LZ, "repeated pattern");
+
+    for (uint32_t i = 0; i < RAM_PAGE_SIZE; i++)
+        page[i] = (uint8_t)rand();
+    round_trip(page, SNAPSHOT_CODEC_RAW, "random bytes");
+
+    // Corrupt input fails or decodes inside the page, never past it
+    memset(out + RAM_PAGE_SIZE, 0xA5, sizeof(out) - RAM_PAGE_SIZE);
+    for (int i = 0; i < 2000; i++)
+    {
+        for (uint32_t j = 0; j < 256; j++)
+            garbage[j] = (uint8_t)rand();
+        snapshot_decode_page(SNAPSHOT_CODEC_RUNS, garbage, 256, out);
+        snapshot_decode_page(SNAPSHOT_CODEC_LZ, garbage, 256, out);
+    }
+
+    // Maximal runs adding up to more than a page
+    for (uint32_t j = 0; j < 80; j += 2)
+    {
+        garbage[j] = 0xFF;
+        garbage[j + 1] = 0x11;
+    }
+    check(!snapshot_decode_page(SNAPSHOT_CODEC_RUNS, garbage, 80, out), "runs past the page refused");
+
+    bool guarded = true;
+    for (size_t j = RAM_PAGE_SIZE; j < sizeof(out); j++)
+        guarded &= out[j] == 0xA5;
+    check(guarded, "corrupt input never written past the page");
+}
+
+// Distinct states that share most pages: one counter byte and two registers
+static void make_state(uint32_t n, Cpu *cpu, Ram *ram)
+{
+    ram_write(ram, 0x3000, (uint8_t)n, true);
+    ram_write(ram, 0x7FFF, (uint8_t)(n / 10), true);
+    cpu->R[0] = (uint8_t)n;
+    cpu->PC = (uint16_t)(0x2001 + n);
+}
+
+static void test_store(void)
+{
+    static uint64_t digest[SNAPSHOTS + 1];
+    char dir[] = "/tmp/cpu-emulator-snapshot-test.XXXXXX";
+    SnapshotStats stats;
+    Cpu cpu;
+    Ram ram;
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+
+    cpu_init(&cpu, true);
+    ram_init(&ram);
+    for (uint32_t i = 0; i < RAM_SIZE; i += 3)
+        ram_write(&ram, i, (uint8_t)(i >> 4), true);
+
+    SnapshotStore *store = snapshot_store_open(dir);
+    check(store != NULL, "create a store");
+    if (!store)
+        return;
+
+    bool numbered = true;
+    for (uint32_t n = 0; n < SNAPSHOTS; n++)
+    {
+        make_state(n, &cpu, &ram);
+        digest[n] = state_hash_machine(&cpu, &ram);
+        numbered &= snapshot_store_add(store, &cpu, &ram, false) == (int64_t)n;
+    }
+    check(numbered, "snapshots numbered from 0");
+
+    // 16 pages of the first state, then a new 0x3000 page per state and a
+    // new 0x7000 page every tenth
+    snapshot_store_stats(store, &stats);
+    check(stats.snapshots == SNAPSHOTS && stats.pages == 16 + (SNAPSHOTS - 1) + (SNAPSHOTS / 10 - 1),
+          "identical pages stored once");
+    check(snapshot_store_close(store), "close");
+
+    store = snapshot_store_open(dir);
+    check(store && snapshot_store_count(store) == SNAPSHOTS, "reopen finds every snapshot");
+    if (!store)
+        return;
+
+    Cpu restored;
+    Ram target;
+    cpu_init(&restored, true);
+    ram_init(&target);
+    bool same = true;
+    for (uint32_t k = 0; k < SNAPSHOTS; k++)
+    {
+        uint32_t n = (k * 37) % SNAPSHOTS;   // out of order
+        same &= snapshot_store_restore(store, n, &restored, &target) &&
+                state_hash_machine(&restored, &target) == digest[n];
+    }
+    check(same, "restore reaches each recorded state");
+    check(!snapshot_store_restore(store, SNAPSHOTS, &restored, &target), "unknown id refused");
+
+    // New snapshots go to a new segment after the ones found
+    make_state(SNAPSHOTS, &cpu, &ram);
+    digest[SNAPSHOTS] = state_hash_machine(&cpu, &ram);
+    check(snapshot_store_add(store, &cpu, &ram, false) == SNAPSHOTS, "add after reopening");
+    check(snapshot_store_close(store), "close again");
+
+    store = snapshot_store_open(dir);
+    snapshot_store_stats(store, &stats);
+    check(store && stats.segments == 2 && snapshot_store_count(store) == SNAPSHOTS + 1 &&
+          snapshot_store_restore(store, SNAPSHOTS, &restored, &target) &&
+          state_hash_machine(&restored, &target) == digest[SNAPSHOTS] &&
+          snapshot_store_restore(store, 0, &restored, &target) &&
+          state_hash_machine(&restored, &target) == digest[0],
+          "both segments readable");
+    snapshot_store_close(store);
+
+    ram_free(&target);
+    ram_free(&ram);
+
+    char command[96];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+}
+
+static void fill_page(Ram *ram, uint32_t page, uint8_t seed)
+{
+    for (uint32_t i = 0; i < RAM_PAGE_SIZE; i++)
+        ram_write(ram, page * RAM_PAGE_SIZE + i, (uint8_t)(seed + i * 7), true);
+}
+
+static bool same_ram(Ram *a, Ram *b)
+{
+    for (uint32_t i = 0; i < RAM_SIZE; i++)
+    {
+        if (ram_peek(a, (uint16_t)i) != ram_peek(b, (uint16_t)i))
+            return false;
+    }
+    return true;
+}
+
+// Rewrite a stored page's hash to another page's, as a 64-bit collision would
+static bool forge_hash(const char *dir, uint64_t from, uint64_t to)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/seg-000000", dir);
+
+    FILE *f = fopen(path, "r+b");
+    static uint8_t data[1 << 20];
+    size_t n = f ? fread(data, 1, sizeof(data), f) : 0;
+    bool found = false;
+
+    for (size_t i = 0; i + sizeof(from) <= n && !found; i += 8)
+    {
+        if (memcmp(data + i, &from, sizeof(from)) == 0)
+        {
+            found = fseek(f, (long)i, SEEK_SET) == 0 && fwrite(&to, sizeof(to), 1, f) == 1;
+        }
+    }
+    if (f)
+        found &= fclose(f) == 0;
+    return found;
+}
+
+// Pages that share a hash are still told apart by their contents
+static void test_collision(void)
+{
+    char dir[] = "/tmp/cpu-emulator-snapshot-test.XXXXXX";
+    Cpu cpu;
+    Ram x, y, target;
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+
+    cpu_init(&cpu, true);
+    ram_init(&x);
+    ram_init(&y);
+    ram_init(&target);
+    fill_page(&x, 3, 1);
+    fill_page(&y, 3, 2);
+
+    SnapshotStore *store = snapshot_store_open(dir);
+    check(store && snapshot_store_add(store, &cpu, &x, false) == 0 && snapshot_store_close(store),
+          "store the first page");
+    check(forge_hash(dir, state_hash_page(&x, 3), state_hash_page(&y, 3)), "forge a colliding hash");
+
+    // The target holds the other page under the same hash: it must be replaced
+    store = snapshot_store_open(dir);
+    fill_page(&target, 3, 2);
+    check(store && snapshot_store_restore(store, 0, &cpu, &target) && same_ram(&target, &x),
+          "restore replaces a page with the same hash");
+
+    // Adding the other page must not reuse the stored one
+    ram_free(&target);
+    ram_init(&target);
+    check(store && snapshot_store_add(store, &cpu, &y, false) == 1 &&
+          snapshot_store_restore(store, 1, &cpu, &target) && same_ram(&target, &y),
+          "add stores a page with the same hash");
+    snapshot_store_close(store);
+
+    ram_free(&target);
+    ram_free(&y);
+    ram_free(&x);
+
+    char command[96];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+}
+
+// A user-mode store to privileged memory must fault after --resume too
+static void test_resume_mode(void)
+{
+    static const char program[] = ".org 0x2001\n"
+                                  "    LOAD_IMM R0, #1\n"
+                                  "    STORE R0, 0x1000\n"
+                                  "    HALT\n";
+    static const char *const engines[] = { "", "--fast", "--debug" };
+    static Image image;
+    static Scheduler sched;
+    static Timer timer;
+    char dir[] = "/tmp/cpu-emulator-snapshot-test.XXXXXX";
+    char source[64], command[512], error[256];
+    Cpu cpu;
+    Ram ram;
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+    snprintf(source, sizeof(source), "%s/prog.asm", dir);
+
+    FILE *f = fopen(source, "w");
+    bool written = f && fputs(program, f) >= 0;
+    if (f)
+        written &= fclose(f) == 0;
+    FILE *in = fmemopen((void *)program, sizeof(program) - 1, "r");
+    bool assembled = in && assemble_source(in, &image, error, sizeof(error)) >= 0;
+    if (in)
+        fclose(in);
+    check(written && assembled, "write the program");
+
+    cpu_init(&cpu, false);
+    ram_init(&ram);
+    image_load(&image, &ram, true);
+    cpu.PC = image.org;
+    cpu.running = true;
+
+    SnapshotStore *store = snapshot_store_open(dir);
+    check(store && snapshot_store_add(store, &cpu, &ram, false) == 0 && snapshot_store_close(store),
+          "store a user-mode state");
+
+    sched_init(&sched);
+    timer_init(&timer, &cpu, &sched);
+    cpu_run(&cpu, &ram, false);
+    check(cpu.fault == CPU_FAULT_MEMORY, "user-mode store faults");
+    uint64_t digest = state_hash_machine(&cpu, &ram);
+    ram_free(&ram);
+
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    {
+        char what[64];
+        snprintf(command, sizeof(command),
+                 "printf 'c\\nq\\n' | ./cpu-emulator -q --no-cache %s --resume %s:0 "
+                 "--expect-digest %016llx %s > /dev/null 2>&1",
+                 engines[i], dir, (unsigned long long)digest, source);
+        snprintf(what, sizeof(what), "resume %s stays in user mode", *engines[i] ? engines[i] : "interpreted");
+        check(system(command) == 0, what);
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+    log_set_enabled(LOG_ERROR, false);
+    log_set_enabled(LOG_UNAUTHORIZED, false);
+
+    test_codecs();
+    test_store();
+    test_collision();
+    test_resume_mode();
+
+    printf("snapshot_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+; expect: 70
+; options: --sparse
+;
+; Stores on four pages of sparse RAM, calls through a stack on the last
+; page, then reads the stored bytes back: each store copies its page.
+.org 0x2001
+    LOAD_IMM R0, #10
+    LOAD_IMM R1, #20
+    STORE    R0, 0x3000
+    STORE    R1, 0x5FFF
+    STORE    R0, 0x8123
+    CALL     add
+    LOAD_MEM R2, 0x3000
+    LOAD_MEM R3, 0x5FFF
+    LOAD_MEM R4, 0x8123
+    LOAD_MEM R5, 0xA000
+    ADD      R2, R3
+    ADD      R2, R4
+    ADD      R2, R5
+    STORE    R2, 0x2000
+    HALT
+add:
+    ADD      R1, R0
+    STORE    R1, 0xA000
+    RET
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "state_hash.h"
+
+#define TEST_AREA "state_hash"
+#include "test.h"
+
+/*
+ * State digests and RAM diffs: the cached page hashes follow every way a
+ * page can change (ram_write, fast stores, direct writes, copy-on-write
+ * and reset), the machine digest ignores instret only, and
+ * state_diff_ram finds every differing byte.
+ */
+
+static void test_page_cache(void)
+{
+    Ram flat, sparse;
+
+    ram_init(&flat);
+    ram_init_sparse(&sparse);
+    uint64_t empty = state_hash_ram(&flat);
+    check(state_hash_ram(&sparse) == empty, "flat and sparse zero RAM hash alike");
+
+    ram_write(&flat, 0x3456, 7, true);
+    uint64_t written = state_hash_ram(&flat);
+    check(written != empty, "ram_write changes the hash");
+    ram_write(&sparse, 0x3456, 7, true);
+    check(state_hash_ram(&sparse) == written, "same bytes, same hash");
+    ram_write(&flat, 0x3456, 0, true);
+    check(state_hash_ram(&flat) == empty, "writing the byte back restores the hash");
+
+    check(ram_store_fast(&flat, 0x8000, 1), "fast store");
+    ram_fast_stores_done(&flat);
+    check(state_hash_ram(&flat) != empty, "fast stores are hashed once the engine stops");
+    ram_write(&flat, 0x8000, 0, true);
+
+    flat.memory_cells[0x9000] = 3;
+    ram_contents_changed(&flat);
+    check(state_hash_ram(&flat) != empty, "direct writes are hashed after ram_contents_changed");
+    flat.memory_cells[0x9000] = 0;
+    ram_contents_changed(&flat);
+
+    // Copy-on-write view: starts with the template's hashes, reset puts them back
+    Ram view;
+    ram_write(&flat, 0x2000, 9, true);
+    uint64_t template_hash = state_hash_ram(&flat);
+    ram_init_from(&view, &flat);
+    check(state_hash_ram(&view) == template_hash, "view hashes like its template");
+    ram_write(&view, 0x2001, 1, true);
+    check(state_hash_ram(&view) != template_hash && state_hash_ram(&flat) == template_hash,
+          "a write to the view changes only the view's hash");
+    ram_reset(&view, &flat);
+    check(state_hash_ram(&view) == template_hash, "reset restores the hash");
+
+    ram_free(&view);
+    ram_free(&sparse);
+    ram_free(&flat);
+}
+
+static void test_machine_digest(void)
+{
+    Cpu a, b;
+    Ram ram;
+
+    cpu_init(&a, true);
+    cpu_init(&b, true);
+    ram_init(&ram);
+
+    b.instret = 12345;
+    check(state_hash_machine(&a, &ram) == state_hash_machine(&b, &ram), "instret is left out");
+
+    b.R[7] = 1;
+    check(state_hash_machine(&a, &ram) != state_hash_machine(&b, &ram), "registers are covered");
+    b = a;
+    b.PC = 0x2001;
+    check(state_hash_machine(&a, &ram) != state_hash_machine(&b, &ram), "PC is covered");
+    b = a;
+    b.privileged = false;
+    check(state_hash_machine(&a, &ram) != state_hash_machine(&b, &ram), "privilege is covered");
+
+    uint64_t before = state_hash_machine(&a, &ram);
+    ram_write(&ram, 0xFFFF, 1, true);
+    check(state_hash_machine(&a, &ram) != before, "RAM is covered");
+
+    ram_free(&ram);
+}
+
+static void test_diff(void)
+{
+    Ram a, b, view;
+    StateDiff diffs[4];
+
+    ram_init(&a);
+    ram_init_sparse(&b);
+    check(state_diff_ram(&a, &b, diffs, 4) == 0, "zero RAMs do not differ");
+
+    // Unaligned, across pages, and at both ends
+    ram_write(&a, 0x0000, 1, true);
+    ram_write(&a, 0x1FFF, 2, true);
+    ram_write(&b, 0x7011, 3, true);
+    ram_write(&a, 0xFFFF, 4, true);
+    size_t n = state_diff_ram(&a, &b, diffs, 4);
+    check(n == 4 && diffs[0].addr == 0x0000 && diffs[1].addr == 0x1FFF && diffs[2].addr == 0x7011 &&
+          diffs[3].addr == 0xFFFF, "every differing byte, in address order");
+    check(diffs[2].a == 0 && diffs[2].b == 3 && diffs[3].a == 4 && diffs[3].b == 0,
+          "values from both sides");
+    check(state_diff_ram(&a, &b, diffs, 2) == 4, "count beyond max");
+
+    ram_init_from(&view, &a);
+    ram_write(&view, 0x5555, 5, true);
+    n = state_diff_ram(&a, &view, diffs, 4);
+    check(n == 1 && diffs[0].addr == 0x5555, "view against its template");
+
+    ram_free(&view);
+    ram_free(&b);
+    ram_free(&a);
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    test_page_cache();
+    test_machine_digest();
+    test_diff();
+
+    printf("state_hash_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cpu_exec.h"
+#include "log.h"
+#include "sched.h"
+#include "snapshot.h"
+#include "state_hash.h"
+#include "sweep.h"
+#include "timer.h"
+
+#define TEST_AREA "sweep"
+#include "test.h"
+
+/*
+ * --sweep end to end: per-record registers and RAM patches, a patch that
+ * lands on decoded code, or is decoded only during its run, and is gone
+ * again in the next record, halt, fault and --max-steps status, a patch
+ * into verified code, and runs stopped by --max-steps, which resume from
+ * their snapshot, patched code included. Runs ./cpu-emulator from the
+ * repository root.
+ */
+
+// R0 + R1 + [0x2100] + an immediate at 0x200D; spins if R4 equals that immediate
+static const char program[] =
+    ".org 0x2001\n"
+    "    LOAD_MEM R2, 0x2100\n"   // 0x2001
+    "    ADD R0, R1\n"            // 0x2005
+    "    ADD R0, R2\n"            // 0x2008
+    "    LOAD_IMM R3, #1\n"       // 0x200B, immediate at 0x200D
+    "    ADD R0, R3\n"
+    "    STORE R0, 0x2000\n"
+    "    CMP R4, R3\n"
+    "    JZ spin\n"
+    "    HALT\n"
+    "spin:\n"
+    "    JMP spin\n";
+
+#define CODE_PATCH 0x200D
+#define PATCHES 2
+#define RECORD_SIZE (SWEEP_REG_BYTES + PATCHES * SWEEP_PATCH_BYTES)
+
+typedef struct
+{
+    uint8_t r0, r1, r4;
+    uint8_t data;           // stored at 0x2100
+    uint16_t addr;          // second patch
+    uint8_t value;
+    uint8_t expected[4];    // R0, status, fault, 0x2000
+} Case;
+
+static const Case cases[] = {
+    { 1, 2, 0, 3, 0x2200, 0, { 7, SWEEP_STATUS_HALTED, CPU_FAULT_NONE, 7 } },
+    { 1, 2, 0, 3, CODE_PATCH, 10, { 16, SWEEP_STATUS_HALTED, CPU_FAULT_NONE, 16 } },
+    { 1, 2, 0, 3, 0x2200, 0, { 7, SWEEP_STATUS_HALTED, CPU_FAULT_NONE, 7 } },   // code is the template's again
+    { 1, 2, 1, 3, 0x2200, 0, { 7, SWEEP_STATUS_TIMEOUT, CPU_FAULT_NONE, 7 } },
+    { 1, 2, 11, 3, CODE_PATCH, 11, { 17, SWEEP_STATUS_TIMEOUT, CPU_FAULT_NONE, 17 } },
+    { 200, 100, 0, 0, 0x2200, 0, { 45, SWEEP_STATUS_HALTED, CPU_FAULT_NONE, 45 } },
+    { 5, 2, 0, 3, 0x2005, 0x80, { 5, SWEEP_STATUS_FAULT, CPU_FAULT_INVALID, 0 } },   // ADD made undefined
+};
+
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+static bool write_file(const char *path, const void *data, size_t len)
+{
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(data, 1, len, f) == len;
+    if (f)
+        fclose(f);
+    return ok;
+}
+
+static void put_patch(uint8_t *p, uint16_t addr, uint8_t value)
+{
+    p[0] = (uint8_t)(addr >> 8);
+    p[1] = (uint8_t)addr;
+    p[2] = value;
+}
+
+static void test_fields(void)
+{
+    static SweepConfig config;
+
+    check(sweep_parse_fields("R0,PC,status,fault,digest,0x2000:16", &config) &&
+          config.field_count == 6 && config.output_size == 1 + 2 + 1 + 1 + 8 + 16,
+          "parse a selection");
+    check(!sweep_parse_fields("R8", &config), "R8 is refused");
+    check(!sweep_parse_fields("0x2000:0", &config), "zero-length RAM field is refused");
+}
+
+static void test_sweep(void)
+{
+    char dir[] = "/tmp/cpu-emulator-sweep-test.XXXXXX";
+    char source[64], input[64], output[64], command[512];
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+    snprintf(source, sizeof(source), "%s/prog.asm", dir);
+    snprintf(input, sizeof(input), "%s/in.bin", dir);
+    snprintf(output, sizeof(output), "%s/out.bin", dir);
+
+    static uint8_t file[sizeof(SweepHeader) + CASES * RECORD_SIZE];
+    SweepHeader header = { .format = SWEEP_FORMAT, .patch_count = PATCHES, .record_size = RECORD_SIZE };
+    memcpy(header.magic, SWEEP_MAGIC, 4);
+    memcpy(file, &header, sizeof(header));
+
+    for (size_t i = 0; i < CASES; i++)
+    {
+        uint8_t *r = file + sizeof(header) + i * RECORD_SIZE;
+        r[0] = cases[i].r0;
+        r[1] = cases[i].r1;
+        r[4] = cases[i].r4;
+        put_patch(r + SWEEP_REG_BYTES, 0x2100, cases[i].data);
+        put_patch(r + SWEEP_REG_BYTES + SWEEP_PATCH_BYTES, cases[i].addr, cases[i].value);
+    }
+
+    check(write_file(source, program, sizeof(program) - 1) && write_file(input, file, sizeof(file)),
+          "write the sweep input");
+
+    snprintf(command, sizeof(command),
+             "./cpu-emulator -q --no-cache --sweep %s --sweep-out %s --select R0,status,fault,0x2000 "
+             "--max-steps 1000 %s > /dev/null 2>&1", input, output, source);
+    check(system(command) == 0, "sweep runs");
+
+    uint8_t results[CASES * 4 + 1];
+    FILE *f = fopen(output, "rb");
+    size_t n = f ? fread(results, 1, sizeof(results), f) : 0;
+    if (f)
+        fclose(f);
+    check(n == CASES * 4, "one output record per input record");
+
+    for (size_t i = 0; i < CASES && n == CASES * 4; i++)
+    {
+        char what[64];
+        snprintf(what, sizeof(what), "record %zu outputs", i);
+        check(memcmp(results + i * 4, cases[i].expected, 4) == 0, what);
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+}
+
+// A run stopped by max_steps is snapshotted as running: resuming it finishes the program
+static void test_resume_timed_out(void)
+{
+    static Image image;
+    static SweepConfig config;
+    char error[256];
+    FILE *in = fmemopen((void *)program, sizeof(program) - 1, "r");
+    bool assembled = in && assemble_source(in, &image, error, sizeof(error)) >= 0;
+
+    if (in)
+        fclose(in);
+    check(assembled, "assemble the program");
+    if (!assembled)
+        return;
+
+    Cpu cpu;
+    Ram ram;
+    SweepMachine m;
+    cpu_init(&cpu, true);
+    ram_init(&ram);
+    image_load(&image, &ram, true);
+    cpu.PC = image.org;
+    cpu.running = true;
+
+    sweep_parse_fields("R0,status", &config);
+    config.max_steps = 3;
+
+    uint8_t record[RECORD_SIZE] = { 1, 2 };
+    uint8_t out[2];
+    put_patch(record + SWEEP_REG_BYTES, 0x2100, 3);
+    put_patch(record + SWEEP_REG_BYTES + SWEEP_PATCH_BYTES, 0x2200, 0);
+
+    if (!sweep_machine_init(&m, &cpu, &ram))
+    {
+        check(false, "create a sweep machine");
+        ram_free(&ram);
+        return;
+    }
+    m.snapshots = snapshot_store_open(NULL);
+    check(m.snapshots && sweep_machine_run(&m, record, PATCHES, &config, out, NULL) &&
+          out[1] == SWEEP_STATUS_TIMEOUT, "run stops at max_steps");
+
+    static Scheduler sched;
+    static Timer timer;
+    Cpu resumed;
+    Ram target;
+    cpu_init(&resumed, false);
+    ram_init(&target);
+    sched_init(&sched);
+    timer_init(&timer, &resumed, &sched);
+
+    check(m.snapshots && snapshot_store_restore(m.snapshots, 0, &resumed, &target) && resumed.running,
+          "timed-out snapshot restores as running");
+    cpu_run(&resumed, &target, resumed.privileged);
+    check(resumed.fault == CPU_FAULT_NONE && resumed.R[0] == 7 && ram_peek(&target, 0x2000) == 7,
+          "resumed run finishes the program");
+
+    snapshot_store_close(m.snapshots);
+    sweep_machine_free(&m);
+    ram_free(&target);
+    ram_free(&ram);
+}
+
+// Sweeps run div_verified.asm on the verifier's unchecked DIV. A record that
+// patches the proven divisor to 0 must still fault instead of trapping, and
+// the next record must run the template's code again, verified or not.
+static void test_verified_sweep(void)
+{
+    static const char *const modes[] = { "", "--no-verify" };
+    char dir[] = "/tmp/cpu-emulator-sweep-test.XXXXXX";
+    char input[64], output[64], command[512];
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+    snprintf(input, sizeof(input), "%s/in.bin", dir);
+    snprintf(output, sizeof(output), "%s/out.bin", dir);
+
+    enum { RECORD = SWEEP_REG_BYTES + SWEEP_PATCH_BYTES };
+    uint8_t file[sizeof(SweepHeader) + 2 * RECORD] = { 0 };
+    SweepHeader header = { .format = SWEEP_FORMAT, .patch_count = 1, .record_size = RECORD };
+    memcpy(header.magic, SWEEP_MAGIC, 4);
+    memcpy(file, &header, sizeof(header));
+    put_patch(file + sizeof(header) + SWEEP_REG_BYTES, 0x200F, 0);             // LOAD_IMM R2, #0
+    put_patch(file + sizeof(header) + RECORD + SWEEP_REG_BYTES, 0x2100, 0);    // data, not code
+    check(write_file(input, file, sizeof(file)), "write the sweep input");
+
+    static const uint8_t expected[] = { SWEEP_STATUS_FAULT, CPU_FAULT_DIV_ZERO, 0,
+                                        SWEEP_STATUS_HALTED, CPU_FAULT_NONE, 10 };
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        uint8_t results[sizeof(expected) + 1];
+        char what[64];
+
+        snprintf(command, sizeof(command),
+                 "./cpu-emulator -q --no-cache %s --sweep %s --sweep-out %s --select status,fault,0x2000 "
+                 "tests/div_verified.asm > /dev/null 2>&1", modes[i], input, output);
+        snprintf(what, sizeof(what), "div_verified.asm sweep %s", *modes[i] ? modes[i] : "verified");
+        check(system(command) == 0, what);
+
+        FILE *f = fopen(output, "rb");
+        size_t n = f ? fread(results, 1, sizeof(results), f) : 0;
+        if (f)
+            fclose(f);
+        check(n == sizeof(expected) && memcmp(results, expected, n) == 0, what);
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+}
+
+// A patch turns div_verified.asm's constant divisor into 0; the resumed run
+// must take the checked DIV the verifier dropped for the image
+static void test_resume_patched_code(void)
+{
+    char dir[] = "/tmp/cpu-emulator-sweep-test.XXXXXX";
+    char input[64], states[64], command[512];
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+    snprintf(input, sizeof(input), "%s/in.bin", dir);
+    snprintf(states, sizeof(states), "%s/states", dir);
+
+    uint8_t file[sizeof(SweepHeader) + SWEEP_REG_BYTES + SWEEP_PATCH_BYTES] = { 0 };
+    SweepHeader header = { .format = SWEEP_FORMAT, .patch_count = 1,
+                           .record_size = SWEEP_REG_BYTES + SWEEP_PATCH_BYTES };
+    memcpy(header.magic, SWEEP_MAGIC, 4);
+    memcpy(file, &header, sizeof(header));
+    put_patch(file + sizeof(header) + SWEEP_REG_BYTES, 0x200F, 0);   // LOAD_IMM R2, #10
+
+    check(write_file(input, file, sizeof(file)), "write the sweep input");
+    snprintf(command, sizeof(command),
+             "./cpu-emulator -q --no-cache --sweep %s --sweep-out %s/out.bin --max-steps 3 "
+             "--snapshots %s tests/div_verified.asm > /dev/null 2>&1", input, dir, states);
+    check(system(command) == 0, "sweep with snapshots runs");
+
+    // The expected end state, from the interpreter
+    static Scheduler sched;
+    static Timer timer;
+    SnapshotStore *store = snapshot_store_open(states);
+    Cpu cpu;
+    Ram ram;
+    cpu_init(&cpu, false);
+    ram_init(&ram);
+    sched_init(&sched);
+    timer_init(&timer, &cpu, &sched);
+
+    bool restored = store && snapshot_store_restore(store, 0, &cpu, &ram);
+    check(restored, "restore the timed-out run");
+    snapshot_store_close(store);
+    if (restored)
+    {
+        cpu_run(&cpu, &ram, cpu.privileged);
+        check(cpu.fault == CPU_FAULT_DIV_ZERO, "patched divisor faults");
+
+        snprintf(command, sizeof(command),
+                 "./cpu-emulator -q --no-cache --fast --resume %s:0 --expect-digest %016llx "
+                 "tests/div_verified.asm > /dev/null 2>&1",
+                 states, (unsigned long long)state_hash_machine(&cpu, &ram));
+        check(system(command) == 0, "--fast --resume ends like the interpreter");
+    }
+    ram_free(&ram);
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0)
+        failures++;
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+    log_set_enabled(LOG_ERROR, false);
+
+    test_fields();
+    test_sweep();
+    test_verified_sweep();
+    test_resume_timed_out();
+    test_resume_patched_code();
+
+    printf("sweep_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Shared by the tests/<name>_test.c binaries. Define TEST_AREA (the
+ * <name>) before including: check() reports "FAIL <name>: <what>" and
+ * counts the failure, and main exits non-zero if any.
+ */
+
+#ifndef TEST_AREA
+#error "define TEST_AREA before including test.h"
+#endif
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL " TEST_AREA ": %s\n", what);
+        failures++;
+    }
+}
+
+#endif
@@ -0,0 +1,120 @@
+; expect: 12
+;
+; A timer interrupt every 10 cycles while straight-line code runs; the
+; handler at 0x3000 counts them in R7.
+.org 0x2001
+LOAD_IMM R0, #0x30
+LOAD_IMM R1, #0x00
+STORE R0, 0x0000
+STORE R1, 0x0001
+LOAD_IMM R6, #1
+LOAD_IMM R0, #0
+LOAD_IMM R1, #10
+TIMER R0, R1
+EI
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+ADD R5, R6
+STORE R7, 0x2000
+HALT
+.org 0x3000
+handler:
+ADD R7, R6
+IRET
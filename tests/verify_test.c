@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cpu.h"
+#include "cpu_exec.h"
+#include "cpu_fast.h"
+#include "log.h"
+#include "sched.h"
+#include "timer.h"
+#include "verify.h"
+
+#define TEST_AREA "verify"
+#include "test.h"
+
+/*
+ * Verifier decisions, and what the predecoded engine does with them:
+ * every program runs on cpu_run_fast with its verification attached and
+ * must stop exactly like the interpreter, faults included. An unchecked
+ * handler used where a check was still needed shows up as a missing
+ * fault (or a SIGFPE).
+ */
+
+#define RESULT 0x2000
+
+static Image image;
+static Verification verification;
+
+// Assemble and verify source entered in the given mode
+static bool verify_source(const char *source, bool privileged)
+{
+    char error[256];
+    FILE *in = fmemopen((void *)source, strlen(source), "r");
+
+    image_init(&image);
+    if (!in || assemble_source(in, &image, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "verify_test: cannot assemble: %s\n", error);
+        failures++;
+        if (in)
+            fclose(in);
+        return false;
+    }
+    fclose(in);
+
+    return verify_image(&verification, &image, privileged);
+}
+
+typedef struct
+{
+    uint8_t fault;
+    uint8_t result;       // byte at RESULT
+    uint8_t at_0x1000;    // a privileged byte user code must not change
+    uint64_t instret;
+} Outcome;
+
+static Outcome run(bool privileged, bool fast)
+{
+    static Scheduler sched;
+    static Timer timer;
+    Cpu cpu;
+    Ram ram;
+    Outcome o;
+
+    cpu_init(&cpu, privileged);
+    ram_init(&ram);
+    sched_init(&sched);
+    timer_init(&timer, &cpu, &sched);
+    image_load(&image, &ram, true);
+    cpu.PC = image.org;
+    cpu.running = true;
+
+    if (fast)
+    {
+        DecodeCache *dc = dcache_create();
+        dcache_attach_verification(dc, &verification);
+        cpu_run_fast(&cpu, &ram, privileged, dc);
+        dcache_destroy(dc);
+    }
+    else
+    {
+        cpu_run(&cpu, &ram, privileged);
+    }
+
+    o.fault = cpu.fault;
+    o.result = ram_peek(&ram, RESULT);
+    o.at_0x1000 = ram_peek(&ram, 0x1000);
+    o.instret = cpu.instret;
+    ram_free(&ram);
+    return o;
+}
+
+// Both engines stop with this fault and result
+static void check_runs(bool privileged, uint8_t fault, uint8_t result, const char *what)
+{
+    Outcome slow = run(privileged, false);
+    Outcome fast = run(privileged, true);
+    char label[160];
+
+    snprintf(label, sizeof(label), "%s: interpreter", what);
+    check(slow.fault == fault && slow.result == result, label);
+    snprintf(label, sizeof(label), "%s: predecoded engine matches the interpreter", what);
+    check(slow.fault == fast.fault && slow.result == fast.result &&
+          slow.at_0x1000 == fast.at_0x1000 && slow.instret == fast.instret, label);
+}
+
+// Address of the n-th instruction (0-based) of a single-segment image
+static uint16_t insn_addr(uint32_t n)
+{
+    uint16_t pc = image.org;
+
+    while (n--)
+        pc = (uint16_t)(pc + isa_table[image.bytes[pc - image.segments[0].addr]].size);
+    return pc;
+}
+
+static void test_constant_divisor(void)
+{
+    bool ok = verify_source(".org 0x2001\n"
+                            "    LOAD_IMM R1, #5\n"
+                            "    LOAD_IMM R0, #20\n"
+                            "    DIV R0, R1\n"
+                            "    STORE R0, 0x2000\n"
+                            "    HALT\n", true);
+    uint8_t leader = verification.flags[image.org];
+    uint8_t div = verification.flags[insn_addr(2)];
+
+    check(ok && verification.failed_blocks == 0, "constant divisor: passes");
+    check((leader & (VERIFY_OK | VERIFY_LEADER | VERIFY_KERNEL_ONLY)) ==
+          (VERIFY_OK | VERIFY_LEADER | VERIFY_KERNEL_ONLY), "constant divisor: leader flags");
+    check((div & VERIFY_DIVISOR_NONZERO) && !(div & VERIFY_LEADER),
+          "constant divisor: DIV drops the zero test");
+    check_runs(true, CPU_FAULT_NONE, 4, "constant divisor");
+}
+
+static void test_unknown_divisor(void)
+{
+    bool ok = verify_source(".org 0x2001\n"
+                            "    LOAD_IMM R0, #20\n"
+                            "    LOAD_MEM R1, 0x2100\n"
+                            "    DIV R0, R1\n"
+                            "    STORE R0, 0x2000\n"
+                            "    HALT\n", true);
+    uint8_t div = verification.flags[insn_addr(2)];
+
+    check(ok && (div & VERIFY_OK) && !(div & VERIFY_DIVISOR_NONZERO),
+          "divisor from memory: passes, keeps the zero test");
+    check_runs(true, CPU_FAULT_DIV_ZERO, 0, "divisor from memory");
+}
+
+static void test_zero_divisor(void)
+{
+    bool ok = verify_source(".org 0x2001\n"
+                            "    LOAD_IMM R1, #0\n"
+                            "    DIV R0, R1\n"
+                            "    HALT\n", true);
+
+    check(!ok && verification.failed_blocks == 1 && !(verification.flags[insn_addr(1)] & VERIFY_OK),
+          "constant zero divisor: block fails");
+    check_runs(true, CPU_FAULT_DIV_ZERO, 0, "constant zero divisor");
+}
+
+static void test_interrupts_drop_register_facts(void)
+{
+    bool ok = verify_source(".org 0x2001\n"
+                            "    EI\n"
+                            "    LOAD_IMM R1, #5\n"
+                            "    LOAD_IMM R0, #20\n"
+                            "    DIV R0, R1\n"
+                            "    STORE R0, 0x2000\n"
+                            "    HALT\n", true);
+    uint8_t div = verification.flags[insn_addr(3)];
+
+    check(ok && (div & VERIFY_OK) && !(div & VERIFY_DIVISOR_NONZERO),
+          "EI: no register facts");
+    check_runs(true, CPU_FAULT_NONE, 4, "EI");
+}
+
+static void test_privileged_store(void)
+{
+    static const char source[] = ".org 0x2001\n"
+                                 "    LOAD_IMM R0, #1\n"
+                                 "    STORE R0, 0x1000\n"
+                                 "    STORE R0, 0x2000\n"
+                                 "    HALT\n";
+
+    check(verify_source(source, true) && (verification.flags[insn_addr(1)] & VERIFY_OK),
+          "kernel store to privileged memory: passes");
+    check_runs(true, CPU_FAULT_NONE, 1, "kernel store to privileged memory");
+
+    check(!verify_source(source, false) && !(verification.flags[insn_addr(1)] & VERIFY_OK) &&
+          !(verification.flags[image.org] & VERIFY_KERNEL_ONLY),
+          "user store to privileged memory: block fails");
+    check_runs(false, CPU_FAULT_MEMORY, 0, "user store to privileged memory");
+}
+
+static void test_runtime_handler(void)
+{
+    // The vector is stored at run time: the walk never sees the handler
+    bool ok = verify_source(".org 0x2001\n"
+                            "    LOAD_IMM R0, #0x30\n"
+                            "    LOAD_IMM R1, #0x00\n"
+                            "    STORE R0, 0x0000\n"
+                            "    STORE R1, 0x0001\n"
+                            "    LOAD_IMM R6, #1\n"
+                            "    LOAD_IMM R0, #0\n"
+                            "    LOAD_IMM R1, #3\n"
+                            "    TIMER R0, R1\n"
+                            "    EI\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    ADD R5, R6\n"
+                            "    STORE R7, 0x2000\n"
+                            "    HALT\n"
+                            ".org 0x3000\n"
+                            "    LOAD_IMM R2, #0\n"
+                            "    DIV R6, R2\n"
+                            "    IRET\n", true);
+
+    check(ok && !(verification.flags[0x3000] & VERIFY_REACHED),
+          "handler installed at run time: not reached");
+    check_runs(true, CPU_FAULT_DIV_ZERO, 0, "handler installed at run time");
+}
+
+static void test_jump_outside_image(void)
+{
+    bool ok = verify_source(".org 0x2001\n"
+                            "    JMP 0x2800\n", true);
+
+    check(!ok && !(verification.flags[0x2800] & VERIFY_OK), "jump outside the image: fails");
+    check_runs(true, CPU_FAULT_INVALID, 0, "jump outside the image");
+}
+
+int main(void)
+{
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+    log_set_enabled(LOG_WARN, false);
+    log_set_enabled(LOG_ERROR, false);
+    log_set_enabled(LOG_UNAUTHORIZED, false);
+
+    test_constant_divisor();
+    test_unknown_divisor();
+    test_zero_divisor();
+    test_interrupts_drop_register_facts();
+    test_privileged_store();
+    test_runtime_handler();
+    test_jump_outside_image();
+
+    printf("verify_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "assembler.h"
+#include "cpu.h"
+#include "cpu_fast.h"
+#include "log.h"
+#include "sched.h"
+#include "timer.h"
+#include "watch.h"
+
+#define TEST_AREA "watch"
+#include "test.h"
+
+/*
+ * --watch reloads: an edit in place patches only its bytes, bytes the
+ * guest wrote survive edits elsewhere, PC follows its line when code
+ * moves, and a source that fails to assemble changes nothing. After each
+ * reload the program is run again on the predecoded engine, whose blocks
+ * from the previous run must not survive the patch.
+ */
+
+static char path[64];
+static time_t mtime = 1000000000;
+
+static const char original[] =
+    ".org 0x2001\n"
+    "    LOAD_IMM R0, #2\n"       // 0x2001, immediate at 0x2003
+    "    LOAD_IMM R1, #3\n"       // 0x2004, immediate at 0x2006
+    "    ADD R0, R1\n"            // 0x2007
+    "    STORE R0, 0x2000\n"
+    "    HALT\n";
+
+// Replace the source, with a new modification time even within one second
+static void edit(const char *source)
+{
+    FILE *f = fopen(path, "w");
+    if (!f || fputs(source, f) < 0)
+        failures++;
+    if (f)
+        fclose(f);
+
+    struct timespec times[2] = { { ++mtime, 0 }, { mtime, 0 } };
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+// Run from the entry point to HALT and return the result byte
+static uint8_t run(Cpu *cpu, Ram *ram, DecodeCache *dc)
+{
+    cpu->PC = 0x2001;
+    cpu->running = true;
+    cpu->fault = CPU_FAULT_NONE;
+    cpu_run_fast(cpu, ram, true, dc);
+    return ram_peek(ram, 0x2000);
+}
+
+int main(void)
+{
+    static Image image;
+    static Watch watch;
+    static Scheduler sched;
+    static Timer timer;
+    char error[256];
+    Cpu cpu;
+    Ram ram;
+
+    log_set_enabled(LOG_INFO, false);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+    log_set_enabled(LOG_ERROR, false);
+    log_set_enabled(LOG_WARN, false);
+
+    char dir[] = "/tmp/cpu-emulator-watch-test.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/prog.asm", dir);
+    edit(original);
+
+    FILE *in = fmemopen((void *)original, sizeof(original) - 1, "r");
+    image_init(&image);
+    if (!in || assemble_source(in, &image, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "watch_test: cannot assemble: %s\n", error);
+        return 1;
+    }
+    fclose(in);
+
+    cpu_init(&cpu, true);
+    ram_init(&ram);
+    sched_init(&sched);
+    timer_init(&timer, &cpu, &sched);
+    image_load(&image, &ram, true);
+    DecodeCache *dc = dcache_create();
+
+    check(watch_start(&watch, path, &cpu, &ram, dc), "watch_start");
+    check(run(&cpu, &ram, dc) == 5, "original program");
+    check(!watch_poll(&watch), "no reload without an edit");
+
+    // In place: one immediate changes
+    edit(".org 0x2001\n"
+         "    LOAD_IMM R0, #2\n"
+         "    LOAD_IMM R1, #9\n"
+         "    ADD R0, R1\n"
+         "    STORE R0, 0x2000\n"
+         "    HALT\n");
+    check(watch_poll(&watch) && watch.patched == 1 && ram_peek(&ram, 0x2006) == 9,
+          "edit in place patches one byte");
+    check(run(&cpu, &ram, dc) == 11, "patched code runs, not the decoded block");
+
+    // A byte the guest wrote survives an edit of another line
+    ram_write(&ram, 0x2003, 4, true);
+    edit(".org 0x2001\n"
+         "    LOAD_IMM R0, #2\n"
+         "    LOAD_IMM R1, #7\n"
+         "    ADD R0, R1\n"
+         "    STORE R0, 0x2000\n"
+         "    HALT\n");
+    check(watch_poll(&watch) && ram_peek(&ram, 0x2003) == 4 && ram_peek(&ram, 0x2006) == 7,
+          "guest-written byte kept");
+    check(run(&cpu, &ram, dc) == 11, "program after the second edit");
+
+    // Layout change: PC on the ADD follows it past the inserted lines
+    cpu.PC = 0x2007;
+    edit(".org 0x2001\n"
+         "    LOAD_IMM R0, #2\n"
+         "    LOAD_IMM R1, #7\n"
+         "    LOAD_IMM R2, #1\n"
+         "    ADD R0, R2\n"
+         "    ADD R0, R1\n"
+         "    STORE R0, 0x2000\n"
+         "    HALT\n");
+    check(watch_poll(&watch) && cpu.PC == 0x200D, "PC follows its line when code moves");
+    check(run(&cpu, &ram, dc) == 12, "program after inserting lines");
+
+    // A broken edit keeps the running code
+    uint8_t before[0x40];
+    for (uint16_t i = 0; i < sizeof(before); i++)
+        before[i] = ram_peek(&ram, (uint16_t)(0x2000 + i));
+    edit(".org 0x2001\n"
+         "    LOAD_IMM R0, #2\n"
+         "    BOGUS R0\n");
+    bool same = !watch_poll(&watch);
+    for (uint16_t i = 0; i < sizeof(before); i++)
+        same &= before[i] == ram_peek(&ram, (uint16_t)(0x2000 + i));
+    check(same, "source that fails to assemble changes nothing");
+    check(run(&cpu, &ram, dc) == 12, "program after a broken edit");
+
+    watch_stop(&watch);
+    dcache_destroy(dc);
+    ram_free(&ram);
+    remove(path);
+    rmdir(dir);
+
+    printf("watch_test: %d failed\n", failures);
+    return failures ? 1 : 0;
+}
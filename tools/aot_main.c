@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aot.h"
+#include "cpu.h"
+#include "cpu_exec.h"
+#include "log.h"
+#include "ram.h"
+#include "sched.h"
+#include "state_hash.h"
+#include "timer.h"
+
+/*
+ * Driver linked into every program built by cpu-aot. Runs the translated
+ * program like cpu-emulator runs the source; --check also runs the same
+ * image on the interpreter and compares the final Cpu and Ram state.
+ */
+
+typedef struct
+{
+    Cpu cpu;
+    Ram ram;
+    Scheduler sched;
+    Timer timer;
+} Machine;
+
+static long long time_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-q] [--check]\n", prog);
+    printf("  -q        quiet: only warnings and errors\n");
+    printf("  --check   also run on the interpreter and compare the final state\n");
+}
+
+// Same start state as cpu-emulator's main
+static bool machine_init(Machine *m, const Image *image)
+{
+    cpu_init(&m->cpu, false);
+    if (!ram_init(&m->ram) || !image_load(image, &m->ram, false))
+        return false;
+
+    sched_init(&m->sched);
+    timer_init(&m->timer, &m->cpu, &m->sched);
+    m->cpu.PC = image->org;
+    m->cpu.running = true;
+    return true;
+}
+
+static bool same_state(Machine *a, Machine *b)
+{
+    const Cpu *x = &a->cpu;
+    const Cpu *y = &b->cpu;
+    bool same = true;
+
+    if (x->PC != y->PC || x->SP != y->SP || x->running != y->running ||
+        x->privileged != y->privileged || x->fault != y->fault || x->instret != y->instret ||
+        x->cycles != y->cycles ||
+        cpu_flag_zero(x) != cpu_flag_zero(y) || cpu_flag_carry(x) != cpu_flag_carry(y) ||
+        memcmp(x->R, y->R, REG_COUNT) != 0)
+    {
+        log_write(LOG_ERROR, "Check: CPU differs (PC 0x%04X/0x%04X, instret %llu/%llu)",
+                  x->PC, y->PC, (unsigned long long)x->instret, (unsigned long long)y->instret);
+        same = false;
+    }
+
+    StateDiff diff[8];
+    size_t count = state_diff_ram(&a->ram, &b->ram, diff, 8);
+
+    for (size_t i = 0; i < count && i < 8; i++)
+        log_write(LOG_ERROR, "Check: RAM differs at 0x%04X (0x%02X/0x%02X)", diff[i].addr, diff[i].a, diff[i].b);
+    if (count > 8)
+        log_write(LOG_ERROR, "Check: %zu more RAM byte(s) differ", count - 8);
+
+    return same && count == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bool check = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--check") == 0)
+        {
+            check = true;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            log_set_enabled(LOG_INFO, false);
+            log_set_enabled(LOG_DEBUG, false);
+            log_set_enabled(LOG_TRACE, false);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    static Image image;
+    static Machine native;
+    static AotCtx ctx;
+
+    aot_image(&aot_program, &image);
+    if (!machine_init(&native, &image))
+        return 1;
+    aot_init(&ctx, &aot_program);
+
+    long long start = time_now_ms();
+    aot_run(&native.cpu, &native.ram, true, &ctx);
+    long long end = time_now_ms();
+
+    uint8_t result = 0;
+    ram_read(&native.ram, 0x2000, &result, false);
+
+    log_write(LOG_INFO, "Result: %u", result);
+    cpu_print(&native.cpu);
+    log_write(LOG_INFO, "Elapsed time: %lld ms (%.3f s)", end - start, (end - start) / 1000.0);
+
+    int status = 0;
+
+    if (check)
+    {
+        static Machine reference;
+
+        // The interpreter logs every instruction; keep the comparison readable
+        bool show_debug = log_is_enabled(LOG_DEBUG);
+        bool show_trace = log_is_enabled(LOG_TRACE);
+        log_set_enabled(LOG_DEBUG, false);
+        log_set_enabled(LOG_TRACE, false);
+
+        if (!machine_init(&reference, &image))
+            return 1;
+        cpu_run(&reference.cpu, &reference.ram, true);
+
+        log_set_enabled(LOG_DEBUG, show_debug);
+        log_set_enabled(LOG_TRACE, show_trace);
+
+        if (same_state(&native, &reference))
+        {
+            log_write(LOG_INFO, "Check: final state matches the interpreter (%llu instructions)",
+                      (unsigned long long)reference.cpu.instret);
+        }
+        else
+        {
+            status = 1;
+        }
+
+        ram_free(&reference.ram);
+    }
+
+    ram_free(&native.ram);
+    return status;
+}
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "cpu.h"
+#include "image.h"
+#include "isa.h"
+#include "log.h"
+#include "verify.h"
+
+/*
+ * Ahead-of-time translator: assembles a program and writes it out as C
+ * for the runtime in aot.h. Build the result with the emulator objects and
+ * tools/aot_main.c (make <program>.native does all of it).
+ */
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s <asm_file> [-o <out.c>]\n", prog);
+}
+
+static const char *flags_op(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case OP_ADD:
+        return "FLAGS_ADD";
+    case OP_SUB:
+    case OP_CMP:
+        return "FLAGS_SUB";
+    case OP_MLP:
+        return "FLAGS_MLP";
+    default:
+        return "FLAGS_DIV";
+    }
+}
+
+static const char *alu_op(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case OP_ADD:
+        return "+=";
+    case OP_SUB:
+        return "-=";
+    case OP_MLP:
+        return "*=";
+    default:
+        return "/=";
+    }
+}
+
+static uint8_t code[RAM_SIZE];      // image bytes at their load addresses
+static uint8_t loaded[RAM_SIZE];    // 1 where code holds an image byte
+
+// Reachable, defined and entirely from the image
+static bool translated(const Verification *v, uint32_t pc)
+{
+    const IsaInstr *ins = &isa_table[code[pc]];
+
+    if (!(v->flags[pc] & VERIFY_REACHED) || ins->format == FMT_INVALID || pc + ins->size > RAM_SIZE)
+        return false;
+
+    for (uint32_t a = pc; a < pc + ins->size; a++)
+    {
+        if (!loaded[a])
+            return false;
+    }
+
+    return true;
+}
+
+// Branch to target: goto if it is translated, else leave translated code
+static void emit_jump(FILE *out, const Verification *v, uint16_t target)
+{
+    if (translated(v, target))
+        fprintf(out, "goto L_%04X;", target);
+    else
+        fprintf(out, "AOT_EXIT(0x%04X);", target);
+}
+
+// C for one instruction; returns false if control never falls through
+static bool emit_insn(FILE *out, const Verification *v, uint16_t pc)
+{
+    uint8_t opcode = code[pc];
+    const IsaInstr *ins = &isa_table[opcode];
+    uint16_t next = (uint16_t)(pc + ins->size);
+    uint8_t o1 = ins->size > 1 ? code[pc + 1] : 0;
+    uint8_t o2 = ins->size > 2 ? code[pc + 2] : 0;
+    uint8_t o3 = ins->size > 3 ? code[pc + 3] : 0;
+    uint16_t addr = (o2 << 8) | o3;
+    uint16_t target = (o1 << 8) | o2;
+    uint8_t pair = o2 & ISA_IND_PAIR_MASK;
+    bool regs_ok = true;
+
+    switch (ins->format)
+    {
+    case FMT_REG_IMM:
+    case FMT_REG_ADDR:
+        regs_ok = o1 < REG_COUNT;
+        break;
+    case FMT_REG_REG:
+        regs_ok = o1 < REG_COUNT && o2 < REG_COUNT;
+        break;
+    case FMT_PAIR_IMM:
+        regs_ok = o1 < PAIR_COUNT;
+        break;
+    case FMT_PAIR_PAIR:
+        regs_ok = o1 < PAIR_COUNT && o2 < PAIR_COUNT;
+        break;
+    case FMT_REG_IND:
+        regs_ok = o1 < REG_COUNT && pair < PAIR_COUNT;
+        break;
+    case FMT_PAIR_WORD:
+        regs_ok = o1 < PAIR_COUNT && o2 < ISA_COUNTER_WORDS;
+        break;
+    default:
+        break;
+    }
+
+    fprintf(out, "L_%04X: /* %s */\n", pc, ins->mnemonic);
+    fprintf(out, "    AOT_BEGIN(0x%04X, %u)\n", pc, ins->cycles);
+
+    if (!regs_ok)
+    {
+        fprintf(out, "    AOT_INTERP(0x%04X);\n", pc);
+        return false;
+    }
+
+    switch (opcode)
+    {
+    case OP_LOAD_IMM:
+        fprintf(out, "    cpu->R[%u] = 0x%02X;\n", o1, o2);
+        return true;
+
+    case OP_DIV:
+        fprintf(out, "    if (cpu->R[%u] == 0)\n        AOT_INTERP(0x%04X);\n", o2, pc);
+        /* fall through */
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MLP:
+        fprintf(out, "    cpu_record_flags(cpu, %s, cpu->R[%u], cpu->R[%u]);\n", flags_op(opcode), o1, o2);
+        fprintf(out, "    cpu->R[%u] %s cpu->R[%u];\n", o1, alu_op(opcode), o2);
+        return true;
+
+    case OP_CMP:
+        fprintf(out, "    cpu_record_flags(cpu, FLAGS_SUB, cpu->R[%u], cpu->R[%u]);\n", o1, o2);
+        return true;
+
+    case OP_LOAD_MEM:
+        if (addr <= RAM_PRIVILEGED_MODE_END)
+            fprintf(out, "    if (!cpu->privileged)\n        AOT_INTERP(0x%04X);\n", pc);
+        fprintf(out, "    cpu->R[%u] = ram_load_fast(ram, 0x%04X);\n", o1, addr);
+        return true;
+
+    case OP_STORE:
+        if (addr <= RAM_PRIVILEGED_MODE_END)
+            fprintf(out, "    if (!cpu->privileged)\n        AOT_INTERP(0x%04X);\n", pc);
+        fprintf(out, "    AOT_STORE(0x%04X, 0x%04X, 0x%04X, cpu->R[%u]);\n", pc, next, addr, o1);
+        return true;
+
+    case OP_LOAD_IMM16:
+        fprintf(out, "    cpu_set_pair(cpu, %u, 0x%04X);\n", o1, addr);
+        return true;
+
+    case OP_ADD16:
+    case OP_SUB16:
+        fprintf(out, "    {\n");
+        fprintf(out, "        uint16_t a_ = cpu_pair(cpu, %u), b_ = cpu_pair(cpu, %u);\n", o1, o2);
+        fprintf(out, "        cpu_record_flags(cpu, %s, a_, b_);\n",
+                opcode == OP_ADD16 ? "FLAGS_ADD16" : "FLAGS_SUB16");
+        fprintf(out, "        cpu_set_pair(cpu, %u, a_ %c b_);\n", o1, opcode == OP_ADD16 ? '+' : '-');
+        fprintf(out, "    }\n");
+        return true;
+
+    case OP_LOAD_IND:
+    case OP_STORE_IND:
+        fprintf(out, "    {\n");
+        fprintf(out, "        uint16_t a_ = cpu_pair(cpu, %u);\n", pair);
+        fprintf(out, "        if (aot_user_blocked(cpu, a_))\n            AOT_INTERP(0x%04X);\n", pc);
+        if (opcode == OP_LOAD_IND)
+        {
+            fprintf(out, "        cpu->R[%u] = ram_load_fast(ram, a_);\n", o1);
+            if (o2 & ISA_IND_POST_INC)
+                fprintf(out, "        cpu_set_pair(cpu, %u, a_ + 1);\n", pair);
+        }
+        else
+        {
+            fprintf(out, "        int w_ = aot_store(ram, ctx, a_, cpu->R[%u]);\n", o1);
+            fprintf(out, "        if (w_ == AOT_WRITE_FAULT)\n            AOT_INTERP(0x%04X);\n", pc);
+            if (o2 & ISA_IND_POST_INC)
+                fprintf(out, "        cpu_set_pair(cpu, %u, a_ + 1);\n", pair);
+            fprintf(out, "        if (w_ == AOT_WRITE_CODE)\n            AOT_EXIT(0x%04X);\n", next);
+        }
+        fprintf(out, "    }\n");
+        return true;
+
+    case OP_JMP:
+        fprintf(out, "    ");
+        emit_jump(out, v, target);
+        fprintf(out, "\n");
+        return false;
+
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JC:
+        fprintf(out, "    if (%scpu_flag_%s(cpu))\n        ",
+                opcode == OP_JNZ ? "!" : "", opcode == OP_JC ? "carry" : "zero");
+        emit_jump(out, v, target);
+        fprintf(out, "\n");
+        return true;
+
+    case OP_CALL:
+        fprintf(out, "    if (!aot_call(cpu, ram, ctx, 0x%04X, 0x%04X, 0x%04X))\n        goto dispatch;\n    ",
+                pc, next, target);
+        emit_jump(out, v, target);
+        fprintf(out, "\n");
+        return false;
+
+    case OP_RET:
+        fprintf(out, "    aot_ret(cpu, ram, 0x%04X);\n    goto dispatch;\n", pc);
+        return false;
+
+    case OP_HALT:
+        fprintf(out, "    aot_halt(cpu, 0x%04X);\n    return;\n", next);
+        return false;
+
+    default:
+        // System instructions
+        fprintf(out, "    AOT_INTERP(0x%04X);\n", pc);
+        return false;
+    }
+}
+
+// C string literal for s
+static void emit_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static bool translate(FILE *out, const char *source, const Image *image, const Verification *v)
+{
+    for (uint16_t i = 0; i < image->segment_count; i++)
+    {
+        const ImageSegment *seg = &image->segments[i];
+
+        memcpy(code + seg->addr, image->bytes + seg->offset, seg->length);
+        memset(loaded + seg->addr, 1, seg->length);
+    }
+
+    fprintf(out, "/* Generated by cpu-aot, do not edit */\n\n");
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    fprintf(out, "static const uint8_t image_bytes[%u] =\n{", image->size ? image->size : 1);
+    for (uint32_t i = 0; i < image->size; i++)
+        fprintf(out, "%s0x%02X,", i % 12 ? " " : "\n    ", image->bytes[i]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const ImageSegment segments[%u] =\n{\n",
+            image->segment_count ? image->segment_count : 1);
+    for (uint16_t i = 0; i < image->segment_count; i++)
+    {
+        const ImageSegment *seg = &image->segments[i];
+        fprintf(out, "    { 0x%04X, %u, %u },\n", seg->addr, seg->length, seg->offset);
+    }
+    fprintf(out, "};\n\n");
+
+    // Translated: every reachable instruction whose bytes come from the image
+    uint32_t count = 0;
+
+    fprintf(out, "static const AotInsn insns[] =\n{\n");
+    for (uint32_t pc = 0; pc < RAM_SIZE; pc++)
+    {
+        if (!translated(v, pc))
+            continue;
+        fprintf(out, "    { 0x%04X, %u },\n", pc, isa_table[code[pc]].size);
+        count++;
+    }
+    fprintf(out, "    { 0, 0 }\n};\n\n");
+
+    fprintf(out, "static void run(Cpu *cpu, Ram *ram, AotCtx *ctx)\n{\n");
+    fprintf(out, "    (void)ram;\n    (void)ctx;\n\ndispatch: __attribute__((unused));\n");
+    fprintf(out, "    if (!cpu->running || !aot_live(ctx, cpu->PC))\n        return;\n\n");
+    fprintf(out, "    switch (cpu->PC)\n    {\n");
+    for (uint32_t pc = 0; pc < RAM_SIZE; pc++)
+    {
+        if (translated(v, pc))
+            fprintf(out, "    case 0x%04X: goto L_%04X;\n", pc, pc);
+    }
+    fprintf(out, "    default: return;\n    }\n\n");
+
+    bool falls = false;
+    uint32_t fall_to = 0;
+
+    for (uint32_t pc = 0; pc < RAM_SIZE; pc++)
+    {
+        if (!translated(v, pc))
+            continue;
+
+        // The previous instruction continues somewhere other than here
+        if (falls && fall_to != pc)
+        {
+            fprintf(out, "    ");
+            if (fall_to < RAM_SIZE)
+                emit_jump(out, v, (uint16_t)fall_to);
+            else
+                fprintf(out, "AOT_EXIT(0x0000);");
+            fprintf(out, "\n");
+        }
+
+        falls = emit_insn(out, v, (uint16_t)pc);
+        fall_to = pc + isa_table[code[pc]].size;
+    }
+
+    if (falls)
+    {
+        fprintf(out, "    ");
+        if (fall_to < RAM_SIZE)
+            emit_jump(out, v, (uint16_t)fall_to);
+        else
+            fprintf(out, "AOT_EXIT(0x0000);");
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "const AotProgram aot_program =\n{\n    ");
+    emit_string(out, source);
+    fprintf(out, ", 0x%04X, %u, segments, image_bytes, %u, insns, %u, run\n",
+            image->org, image->segment_count, image->size, count);
+    fprintf(out, "};\n");
+
+    log_write(LOG_INFO, "Translated %u instruction(s) from %s", count, source);
+    return ferror(out) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *asm_path = NULL;
+    const char *out_path = "out.aot.c";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (argv[i][0] != '-' && asm_path == NULL)
+            asm_path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (asm_path == NULL)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(asm_path, "r");
+    if (!in)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", asm_path);
+        return 1;
+    }
+
+    static Image image;
+    assemble_image(in, &image);
+    fclose(in);
+
+    // The walk also reports what would fault; the translation keeps those checks
+    static Verification v;
+    verify_image(&v, &image, true);
+
+    FILE *out = fopen(out_path, "w");
+    if (!out)
+    {
+        log_write(LOG_ERROR, "Error while opening %s", out_path);
+        return 1;
+    }
+
+    bool ok = translate(out, asm_path, &image, &v);
+    if (fclose(out) != 0 || !ok)
+    {
+        log_write(LOG_ERROR, "Error while writing %s", out_path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,783 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "assembler.h"
+#include "code_share.h"
+#include "cpu.h"
+#include "cpu_fast.h"
+#include "daemon.h"
+#include "image.h"
+#include "image_cache.h"
+#include "log.h"
+#include "machine_pool.h"
+#include "ram.h"
+#include "sched.h"
+#include "sweep.h"
+#include "timer.h"
+#include "verify.h"
+
+/*
+ * Emulator daemon: keeps assembled images, their loaded start state and
+ * each worker's decode cache warm between requests, so a run costs the
+ * run itself rather than process start, assembly and loading. The workers'
+ * decode caches share their blocks through one CodeShare, so a worker
+ * binding an image another worker has run adopts its decoded code.
+ * Protocol in include/daemon.h.
+ */
+
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define MAX_IMAGES 256
+#define MAX_CONNECTIONS 1024
+#define REQUEST_TIMEOUT_S 5      // for the rest of a request once its first byte arrived
+
+// An image ready to run: never freed once in the table
+typedef struct
+{
+    char key[IMAGE_CACHE_KEY_LEN + 1];
+    Image image;
+    PoolMachine *machine;         // start state (PC at org) and loaded RAM: the
+                                  // template for the workers' views
+    Verification verification;
+    bool verified;
+    bool transient;               // table was full: freed after its run
+} WarmImage;
+
+typedef struct
+{
+    pthread_t thread;
+    WarmImage *bound;             // image the machine was built for
+    SweepMachine machine;
+    uint8_t *buf;                 // request body, then outputs
+    size_t buf_cap;
+} Worker;
+
+static struct
+{
+    pthread_rwlock_t lock;
+    WarmImage *entries[MAX_IMAGES];
+    uint32_t count;
+} warm = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+// The assembler keeps global state; also serializes building WarmImages
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Templates for warm images, and one transient image per worker
+static MachinePool *templates;
+
+// Decoded blocks shared by every worker, NULL with --no-share
+static CodeShare *share;
+
+// Connections with a request waiting for a worker
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int fds[MAX_CONNECTIONS];
+    uint32_t head;
+    uint32_t count;
+} queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+
+// Connections a worker has answered, to be watched again by the main thread
+static struct
+{
+    pthread_mutex_t lock;
+    int fds[MAX_CONNECTIONS];
+    uint32_t count;
+    int wake[2];                  // pipe: a byte per returned connection
+} idle = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Accepted and not yet closed
+static uint32_t connections;
+
+static const char *cache_dir = IMAGE_CACHE_DEFAULT_DIR;
+static bool use_verify = true;
+static volatile sig_atomic_t stop;
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  -s <path>          socket path (default %s)\n", DAEMON_DEFAULT_SOCKET);
+    printf("  -j <n>             worker threads (default %d)\n", DEFAULT_WORKERS);
+    printf("  --cache-dir <dir>  assembled image cache (default %s)\n", IMAGE_CACHE_DEFAULT_DIR);
+    printf("  --no-cache         never read or write the image cache\n");
+    printf("  --no-verify        skip the load-time verifier\n");
+    printf("  --no-share         decode code separately in every worker\n");
+    printf("  -v                 log every run (INFO)\n");
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* ================= I/O ================= */
+
+static bool read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+static bool reserve(Worker *w, size_t len)
+{
+    if (len <= w->buf_cap)
+        return true;
+
+    uint8_t *buf = realloc(w->buf, len);
+    if (!buf)
+        return false;
+
+    w->buf = buf;
+    w->buf_cap = len;
+    return true;
+}
+
+// Header and payload in one write
+static bool respond(Worker *w, int fd, uint8_t status, const WarmImage *image, uint64_t instret,
+                    const void *payload, uint32_t length)
+{
+    DaemonResponse rsp;
+
+    memset(&rsp, 0, sizeof(rsp));
+    memcpy(rsp.magic, DAEMON_RESPONSE_MAGIC, 4);
+    rsp.version = DAEMON_VERSION;
+    rsp.status = status;
+    rsp.length = length;
+    rsp.instret = instret;
+    if (image)
+        memcpy(rsp.key, image->key, IMAGE_CACHE_KEY_LEN);
+
+    // payload may already sit in buf, just after the header
+    if (!reserve(w, sizeof(rsp) + length))
+        return false;
+    if (payload != w->buf + sizeof(rsp))
+        memmove(w->buf + sizeof(rsp), payload, length);
+    memcpy(w->buf, &rsp, sizeof(rsp));
+
+    return write_full(fd, w->buf, sizeof(rsp) + length);
+}
+
+static bool respond_error(Worker *w, int fd, uint8_t status, const char *msg)
+{
+    char copy[256];
+
+    // msg may point into buf
+    snprintf(copy, sizeof(copy), "%s", msg);
+    return respond(w, fd, status, NULL, 0, copy, (uint32_t)strlen(copy));
+}
+
+/* ================= warm images ================= */
+
+static WarmImage *find_image(const char *key)
+{
+    WarmImage *found = NULL;
+
+    pthread_rwlock_rdlock(&warm.lock);
+    for (uint32_t i = 0; i < warm.count && !found; i++)
+    {
+        if (memcmp(warm.entries[i]->key, key, IMAGE_CACHE_KEY_LEN) == 0)
+            found = warm.entries[i];
+    }
+    pthread_rwlock_unlock(&warm.lock);
+
+    return found;
+}
+
+// Same start state as cpu-emulator's main
+static bool prepare_image(WarmImage *e)
+{
+    e->machine = machine_pool_acquire(templates);
+    if (!e->machine)
+        return false;
+    if (!image_load(&e->image, &e->machine->ram, false))
+    {
+        machine_pool_release(templates, e->machine);
+        return false;
+    }
+
+    e->machine->cpu.PC = e->image.org;
+    e->machine->cpu.running = true;
+
+    if (use_verify)
+    {
+        verify_image(&e->verification, &e->image, true);
+        e->verified = true;
+    }
+
+    return true;
+}
+
+static void publish_image(WarmImage *e)
+{
+    pthread_rwlock_wrlock(&warm.lock);
+    if (warm.count < MAX_IMAGES)
+        warm.entries[warm.count++] = e;
+    else
+        e->transient = true;
+    pthread_rwlock_unlock(&warm.lock);
+
+    log_write(LOG_INFO, "Image %s ready (%u bytes at 0x%04X)%s", e->key, e->image.size,
+              e->image.org, e->transient ? ", table full: not kept" : "");
+}
+
+/*
+ * The image for key: from the table, the disk cache or, given source, the
+ * assembler. NULL with status and error set when there is none.
+ */
+static WarmImage *get_image(const char *key, const uint8_t *source, uint32_t source_len,
+                            uint8_t *status, char *error, size_t error_size)
+{
+    WarmImage *e = find_image(key);
+    if (e)
+        return e;
+
+    pthread_mutex_lock(&build_lock);
+
+    // Another worker may have built it while this one waited
+    e = find_image(key);
+    if (e)
+    {
+        pthread_mutex_unlock(&build_lock);
+        return e;
+    }
+
+    e = calloc(1, sizeof(WarmImage));
+    if (!e)
+    {
+        pthread_mutex_unlock(&build_lock);
+        *status = DAEMON_ERROR;
+        snprintf(error, error_size, "out of memory");
+        return NULL;
+    }
+    memcpy(e->key, key, IMAGE_CACHE_KEY_LEN);
+
+    bool found = cache_dir && image_cache_lookup(cache_dir, key, &e->image);
+
+    if (!found && source)
+    {
+        FILE *in = fmemopen((void *)source, source_len ? source_len : 1, "r");
+
+        found = in && assemble_source(in, &e->image, error, error_size) >= 0;
+        if (in)
+            fclose(in);
+        else
+            snprintf(error, error_size, "cannot read the source");
+
+        if (found && cache_dir)
+            image_cache_store(cache_dir, key, &e->image);
+        *status = DAEMON_ERROR;
+    }
+    else if (!found)
+    {
+        snprintf(error, error_size, "unknown image, send the source");
+        *status = DAEMON_NO_IMAGE;
+    }
+
+    if (found && !prepare_image(e))
+    {
+        snprintf(error, error_size, "cannot load the image");
+        *status = DAEMON_ERROR;
+        found = false;
+    }
+
+    if (found)
+        publish_image(e);
+    pthread_mutex_unlock(&build_lock);
+
+    if (!found)
+    {
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+static void free_image(WarmImage *e)
+{
+    machine_pool_release(templates, e->machine);
+    free(e);
+}
+
+/* ================= workers ================= */
+
+static void unbind_image(Worker *w)
+{
+    if (!w->bound)
+        return;
+
+    sweep_machine_free(&w->machine);
+    if (w->bound->transient)
+        free_image(w->bound);
+    w->bound = NULL;
+}
+
+static bool bind_image(Worker *w, WarmImage *e)
+{
+    if (w->bound == e)
+        return true;
+
+    unbind_image(w);
+    if (!sweep_machine_init(&w->machine, &e->machine->cpu, &e->machine->ram))
+        return false;
+    if (share)
+        dcache_attach_share(w->machine.dc, share);
+    if (e->verified)
+        dcache_attach_verification(w->machine.dc, &e->verification);
+
+    w->bound = e;
+    return true;
+}
+
+static bool valid_key(const char *key)
+{
+    for (int i = 0; i < IMAGE_CACHE_KEY_LEN; i++)
+    {
+        if (!isxdigit((unsigned char)key[i]))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Answer one request. Returns false when the connection should be closed:
+ * I/O errors and requests that cannot be framed.
+ */
+static bool handle_request(Worker *w, int fd, const DaemonRequest *req)
+{
+    if (memcmp(req->magic, DAEMON_REQUEST_MAGIC, 4) != 0 || req->version != DAEMON_VERSION ||
+        req->kind > DAEMON_RUN_IMAGE || req->source_len > DAEMON_MAX_SOURCE ||
+        req->select_len > DAEMON_MAX_SELECT || req->patch_count > DAEMON_MAX_PATCHES ||
+        (req->kind == DAEMON_RUN_IMAGE && req->source_len))
+    {
+        respond_error(w, fd, DAEMON_ERROR, "malformed request");
+        return false;
+    }
+
+    // Body layout in buf: select (NUL-terminated), registers and patches, source
+    size_t record_size = SWEEP_REG_BYTES + (size_t)req->patch_count * SWEEP_PATCH_BYTES;
+    size_t select_at = 0;
+    size_t record_at = req->select_len + 1;
+    size_t source_at = record_at + record_size;
+
+    if (!reserve(w, source_at + req->source_len))
+        return false;
+
+    uint8_t *source = w->buf + source_at;
+    uint8_t *record = w->buf + record_at;
+    char *select = (char *)w->buf + select_at;
+
+    if (!read_full(fd, source, req->source_len) ||
+        !read_full(fd, select, req->select_len) ||
+        !read_full(fd, record + SWEEP_REG_BYTES, record_size - SWEEP_REG_BYTES))
+        return false;
+
+    select[req->select_len] = '\0';
+    memcpy(record, req->regs, SWEEP_REG_BYTES);
+
+    char key[IMAGE_CACHE_KEY_LEN + 1];
+    char error[256];
+    uint8_t status = DAEMON_ERROR;
+
+    if (req->kind == DAEMON_RUN_SOURCE)
+    {
+        image_cache_key(source, req->source_len, key);
+    }
+    else
+    {
+        if (!valid_key(req->key))
+            return respond_error(w, fd, DAEMON_ERROR, "invalid image key");
+        memcpy(key, req->key, IMAGE_CACHE_KEY_LEN);
+        key[IMAGE_CACHE_KEY_LEN] = '\0';
+    }
+
+    SweepConfig config;
+
+    config.max_steps = req->max_steps ? req->max_steps : SWEEP_DEFAULT_MAX_STEPS;
+    if (!sweep_parse_fields(req->select_len ? select : SWEEP_DEFAULT_SELECT, &config))
+        return respond_error(w, fd, DAEMON_ERROR, "invalid output selection");
+
+    WarmImage *e = get_image(key, req->kind == DAEMON_RUN_SOURCE ? source : NULL,
+                             req->source_len, &status, error, sizeof(error));
+    if (!e)
+        return respond_error(w, fd, status, error);
+
+    if (!bind_image(w, e))
+    {
+        if (e->transient)
+            free_image(e);
+        return respond_error(w, fd, DAEMON_ERROR, "out of memory");
+    }
+
+    // Outputs go right after the response header; the record moves ahead of them
+    size_t out_at = sizeof(DaemonResponse);
+    size_t moved_at = out_at + config.output_size;
+
+    if (!reserve(w, moved_at + record_size))
+        return false;
+    memmove(w->buf + moved_at, w->buf + record_at, record_size);
+
+    SweepRunStats stats;
+    bool ran = sweep_machine_run(&w->machine, w->buf + moved_at, req->patch_count, &config,
+                                 w->buf + out_at, &stats);
+
+    if (!ran)
+    {
+        // A patch may have been stored before the failing one
+        unbind_image(w);
+        return respond_error(w, fd, DAEMON_ERROR, "patch could not be stored");
+    }
+
+    log_write(LOG_INFO, "Ran %.12s: %llu instructions%s", e->key,
+              (unsigned long long)stats.instret, stats.timed_out ? ", timed out" : "");
+
+    bool ok = respond(w, fd, stats.timed_out ? DAEMON_TIMEOUT : DAEMON_OK, e, stats.instret,
+                      w->buf + out_at, config.output_size);
+
+    if (e->transient)
+        unbind_image(w);
+    return ok;
+}
+
+static int next_connection(void)
+{
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0)
+        pthread_cond_wait(&queue.ready, &queue.lock);
+
+    int fd = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % MAX_CONNECTIONS;
+    queue.count--;
+    pthread_mutex_unlock(&queue.lock);
+
+    return fd;
+}
+
+// Never full: a connection is in at most one place
+static void queue_connection(int fd)
+{
+    pthread_mutex_lock(&queue.lock);
+    queue.fds[(queue.head + queue.count) % MAX_CONNECTIONS] = fd;
+    queue.count++;
+    pthread_cond_signal(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+// Hand an answered connection back to the main thread's poll set
+static void return_connection(int fd)
+{
+    pthread_mutex_lock(&idle.lock);
+    idle.fds[idle.count++] = fd;
+    pthread_mutex_unlock(&idle.lock);
+
+    char byte = 0;
+    while (write(idle.wake[1], &byte, 1) < 0 && errno == EINTR)
+    {
+    }
+}
+
+/*
+ * Each worker answers one request per dispatch, then returns the
+ * connection to the main thread, which waits for its next request with
+ * poll. Idle clients therefore hold no worker.
+ */
+static void *worker_main(void *arg)
+{
+    Worker *w = arg;
+
+    for (;;)
+    {
+        int fd = next_connection();
+        DaemonRequest req;
+
+        if (read_full(fd, &req, sizeof(req)) && handle_request(w, fd, &req))
+        {
+            return_connection(fd);
+        }
+        else
+        {
+            close(fd);
+            __atomic_fetch_sub(&connections, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/* ================= entry ================= */
+
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        log_write(LOG_ERROR, "Socket path too long: %s", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        log_write(LOG_ERROR, "Error while creating the socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // A socket file left by a daemon that did not exit cleanly
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        log_write(LOG_ERROR, "Error while binding %s", path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = DAEMON_DEFAULT_SOCKET;
+    int workers = DEFAULT_WORKERS;
+    bool verbose = false;
+    bool use_share = true;
+
+    const char *env_cache = getenv("CPU_EMULATOR_CACHE");
+    if (env_cache)
+        cache_dir = env_cache;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            workers = atoi(argv[++i]);
+            if (workers < 1 || workers > MAX_WORKERS)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc)
+        {
+            cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0)
+        {
+            cache_dir = NULL;
+        }
+        else if (strcmp(argv[i], "--no-verify") == 0)
+        {
+            use_verify = false;
+        }
+        else if (strcmp(argv[i], "--no-share") == 0)
+        {
+            use_share = false;
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int listen_fd = open_socket(socket_path);
+    if (listen_fd < 0)
+        return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;   // no SA_RESTART: accept returns EINTR
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Workers inherit a mask without SIGINT/SIGTERM so the signal interrupts accept
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    // Room for every warm image, a transient one per worker and the per-thread caches
+    templates = machine_pool_create(MAX_IMAGES + (uint32_t)workers * (1 + 2 * MACHINE_POOL_BATCH));
+    if (!templates)
+    {
+        unlink(socket_path);
+        return 1;
+    }
+
+    if (use_share && !(share = code_share_create(CODE_SHARE_DEFAULT_SIZE)))
+    {
+        log_write(LOG_ERROR, "Out of memory allocating the shared code cache");
+        unlink(socket_path);
+        return 1;
+    }
+
+    // Non-blocking so draining and signalling never stall either side
+    if (pipe(idle.wake) != 0 || fcntl(idle.wake[0], F_SETFL, O_NONBLOCK) != 0 ||
+        fcntl(idle.wake[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        log_write(LOG_ERROR, "Error while creating the wake-up pipe");
+        unlink(socket_path);
+        return 1;
+    }
+
+    static Worker pool[MAX_WORKERS];
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&pool[i].thread, NULL, worker_main, &pool[i]) != 0)
+        {
+            log_write(LOG_ERROR, "Error while starting worker %d", i);
+            unlink(socket_path);
+            return 1;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    log_write(LOG_INFO, "Listening on %s with %d workers", socket_path, workers);
+
+    // The engines log every run; keep only warnings and errors unless asked
+    log_set_enabled(LOG_INFO, verbose);
+    log_set_enabled(LOG_DEBUG, false);
+    log_set_enabled(LOG_TRACE, false);
+
+    // Watched connections: the listening socket, the wake pipe, then idle clients
+    static struct pollfd watched[2 + MAX_CONNECTIONS];
+    nfds_t n = 2;
+
+    watched[0].fd = listen_fd;
+    watched[0].events = POLLIN;
+    watched[1].fd = idle.wake[0];
+    watched[1].events = POLLIN;
+
+    while (!stop)
+    {
+        if (poll(watched, n, -1) < 0)
+            continue;
+
+        // A request, or a hang-up, makes a connection ready for a worker
+        for (nfds_t i = 2; i < n;)
+        {
+            if (watched[i].revents)
+            {
+                queue_connection(watched[i].fd);
+                watched[i] = watched[--n];
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        if (watched[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(idle.wake[0], drain, sizeof(drain)) > 0)
+            {
+            }
+
+            pthread_mutex_lock(&idle.lock);
+            for (uint32_t i = 0; i < idle.count; i++)
+            {
+                watched[n].fd = idle.fds[i];
+                watched[n].events = POLLIN;
+                watched[n++].revents = 0;
+            }
+            idle.count = 0;
+            pthread_mutex_unlock(&idle.lock);
+        }
+
+        if (watched[0].revents & POLLIN)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+
+            if (__atomic_load_n(&connections, __ATOMIC_RELAXED) >= MAX_CONNECTIONS)
+            {
+                log_write(LOG_WARN, "Too many connections, closing one");
+                close(fd);
+                continue;
+            }
+
+            // A client may not hold a worker by stopping half-way through a request
+            struct timeval timeout = { REQUEST_TIMEOUT_S, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            __atomic_fetch_add(&connections, 1, __ATOMIC_RELAXED);
+            watched[n].fd = fd;
+            watched[n].events = POLLIN;
+            watched[n++].revents = 0;
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    log_set_enabled(LOG_INFO, true);
+    log_write(LOG_INFO, "Stopped, %u image(s) were warm", warm.count);
+
+    if (share)
+    {
+        CodeShareStats st;
+        code_share_stats(share, &st);
+        log_write(LOG_INFO, "Shared code: %llu blocks in %zu KB, %llu of %llu lookups hit",
+                  (unsigned long long)st.blocks, st.bytes >> 10,
+                  (unsigned long long)st.hits, (unsigned long long)st.lookups);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_state.h"
+
+/*
+ * Live view of an emulator started with --shm: registers from the header
+ * (seqlock-consistent) and a hex dump of a memory window, read straight
+ * from the shared mapping.
+ */
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options] </name | /proc/<pid>/fd/<fd>>\n", prog);
+    printf("  -a <addr>   first address to dump (default 0x2000)\n");
+    printf("  -l <len>    bytes to dump (default 128)\n");
+    printf("  -i <ms>     refresh interval (default 200)\n");
+    printf("  -n <count>  stop after <count> samples (default: until the CPU stops)\n");
+}
+
+static const ShmStateHeader *map_state(const char *path)
+{
+    // A bare "/name" is a POSIX shared-memory object, anything deeper a file
+    int fd = strchr(path + 1, '/') ? open(path, O_RDONLY) : shm_open(path, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SHM_STATE_SIZE)
+    {
+        fprintf(stderr, "%s is not emulator state\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, SHM_STATE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "cannot map %s\n", path);
+        return NULL;
+    }
+
+    const ShmStateHeader *h = map;
+    if (memcmp(h->magic, SHM_STATE_MAGIC, 4) != 0 || h->version != SHM_STATE_VERSION)
+    {
+        fprintf(stderr, "%s: unsupported layout\n", path);
+        munmap(map, SHM_STATE_SIZE);
+        return NULL;
+    }
+
+    return h;
+}
+
+// Seqlock read side
+static void snapshot(const ShmStateHeader *h, ShmStateHeader *out)
+{
+    for (;;)
+    {
+        uint64_t seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(out, h, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+static void show(const ShmStateHeader *s, const uint8_t *memory, uint32_t addr, uint32_t len)
+{
+    printf("instret %llu  PC 0x%04X  SP 0x%04X  %s %s  Z=%u C=%u  IE=%u IRQ=0x%02X\n",
+           (unsigned long long)s->instret, s->pc, s->sp,
+           s->running ? "running" : "stopped",
+           s->privileged ? "kernel" : "user",
+           s->flag_zero, s->flag_carry, s->irq_enabled, s->irq_pending);
+
+    for (int i = 0; i < REG_COUNT; i++)
+        printf("R%d=0x%02X%s", i, s->regs[i], i == REG_COUNT - 1 ? "\n\n" : "  ");
+
+    for (uint32_t row = addr; row < addr + len; row += 16)
+    {
+        printf("0x%04X:", row);
+        for (uint32_t a = row; a < row + 16 && a < addr + len; a++)
+            printf(" %02X", memory[a]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t addr = 0x2000;
+    uint32_t len = 128;
+    long interval_ms = 200;
+    long samples = -1;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            addr = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            len = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval_ms = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            samples = strtol(argv[++i], NULL, 0);
+        else if (argv[i][0] == '/' && path == NULL)
+            path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (path == NULL || addr >= RAM_SIZE)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (addr + len > RAM_SIZE)
+        len = RAM_SIZE - addr;
+
+    const ShmStateHeader *h = map_state(path);
+    if (!h)
+        return 1;
+
+    const uint8_t *memory = (const uint8_t *)h + h->memory_offset;
+    bool tty = isatty(STDOUT_FILENO);
+    struct timespec pause = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+
+    for (long n = 0; samples < 0 || n < samples; n++)
+    {
+        ShmStateHeader s;
+        snapshot(h, &s);
+
+        if (tty)
+            printf("\x1b[H\x1b[2J");
+        if (s.seq == 0)
+            printf("No CPU state published yet\n");
+        else
+            show(&s, memory, addr, len);
+        fflush(stdout);
+
+        if (!s.running && s.seq)
+            break;
+        nanosleep(&pause, NULL);
+    }
+
+    munmap((void *)h, SHM_STATE_SIZE);
+    return 0;
+}